@@ -0,0 +1,181 @@
+package HRCEvt0;
+use strict;
+use warnings;
+
+=head1 NAME
+
+HRCEvt0 - HRC level 0 corrections on piddles, through libhrc_evt0
+
+=head1 SYNOPSIS
+
+  use PDL;
+  use HRCEvt0 qw( correct_taps fix_amp_sf ampsf_profile );
+
+  # $amp_sf is a byte piddle, $au1 ... $av3 short piddles
+  fix_amp_sf($amp_sf, $pha, $au1, $au2, $au3, $av1, $av2, $av3,
+	     ampsf_profile($detnam, $date_obs));
+  correct_taps($amp_sf, $au1, $au2, $au3, $av1, $av2, $av3);
+
+=head1 DESCRIPTION
+
+The AMP_SF reassignment of fix_amp_sf_4 and the ringing correction of
+hrc_evt0_correct, applied in place to piddles already in memory (see
+hrc_evt0.h). The piddles' data is handed to the library as it is, not
+copied, so AMP_SF, PHA and VETOSTT must be byte piddles and the taps
+short piddles, all of the same length. Pass whole piddles: a slice is
+made physical and corrected on its own copy.
+
+The library is loaded from $HRC_EVT0_LIB, or else libhrc_evt0.so next
+to this module or on the normal search path.
+
+=head1 FUNCTIONS
+
+=over 4
+
+=item correct_taps($amp_sf, $au1, $au2, $au3, $av1, $av2, $av3, [\%params], [$vstat], [$isa])
+
+Correct $au3 and $av3. %params has the coefficients a b c d e f g o
+of each axis as C<u> and C<v> array refs, and C<use_width>; it
+defaults to tap_defaults(). $vstat is only needed with use_width.
+$isa caps the instruction set: 0 scalar, 1 AVX2, 2 (the default)
+AVX-512.
+
+=item fix_amp_sf($amp_sf, $pha, $au1, $au2, $au3, $av1, $av2, $av3, [\%params], [$isa])
+
+Reassign $amp_sf. %params has the keys gain, thresh1, thresh2,
+thresh3, pha_1to2, pha_2to3, width1 and width2, and defaults to
+ampsf_defaults().
+
+=item tap_defaults(), ampsf_defaults()
+
+The correction.h coefficients, and the fix_amp_sf_4 -d parameters.
+
+=item ampsf_profile($detnam, $date_obs)
+
+The parameters fix_amp_sf_4 picks for an EVENTS header, or undef if
+there are none.
+
+=back
+
+=head1 SEE ALSO
+
+hrc_evt0.h, hrc_evt0.py, FFI::Platypus.
+
+=cut
+
+use Carp;
+use File::Basename qw( dirname );
+use PDL;
+use FFI::Platypus 1.00;
+use FFI::Platypus::Buffer qw( scalar_to_buffer );
+
+use base 'Exporter';
+our @EXPORT_OK = qw( correct_taps fix_amp_sf tap_defaults ampsf_defaults
+		     ampsf_profile );
+
+# the C structures, padded as the compiler lays them out
+my $TAP_PACK = 'd8 d8 i x4';
+my $AMPSF_PACK = 'd i3 x4 d4';
+my @AMPSF_KEYS = qw( gain thresh1 thresh2 thresh3 pha_1to2 pha_2to3
+		     width1 width2 );
+
+my $ffi = FFI::Platypus->new( api => 1 );
+$ffi->lib( _find_lib() );
+
+$ffi->attach( [ hrc_evt0_tap_defaults => '_tap_defaults' ] =>
+	      [ 'opaque' ] => 'void' );
+$ffi->attach( [ hrc_evt0_ampsf_defaults => '_ampsf_defaults' ] =>
+	      [ 'opaque' ] => 'void' );
+$ffi->attach( [ hrc_evt0_ampsf_profile => '_ampsf_profile' ] =>
+	      [ 'string', 'string', 'opaque' ] => 'int' );
+$ffi->attach( [ hrc_evt0_correct_taps => '_correct_taps' ] =>
+	      [ 'long', ('opaque') x 9, 'int' ] => 'void' );
+$ffi->attach( [ hrc_evt0_fix_amp_sf => '_fix_amp_sf' ] =>
+	      [ 'long', ('opaque') x 9, 'int' ] => 'void' );
+
+sub _find_lib {
+  return $ENV{HRC_EVT0_LIB} if $ENV{HRC_EVT0_LIB};
+  my $here = dirname(__FILE__) . '/libhrc_evt0.so';
+  return -f $here ? $here : 'libhrc_evt0.so';
+}
+
+# the address of a packed structure in a scalar
+sub _ptr { my ($ptr) = scalar_to_buffer($_[0]); return $ptr }
+
+# the address of a piddle's data, checking its type and length
+sub _data {
+  my ($p, $type, $n, $name) = @_;
+  return undef unless defined $p;
+  UNIVERSAL::isa($p, 'PDL') or croak "$name is not a piddle";
+  $p->get_datatype == $type->enum or
+    croak "$name is " . $p->type . ", not $type";
+  $p->nelem == $n or croak "$name has " . $p->nelem . " elements, not $n";
+  $p->make_physical;
+  my ($ptr) = scalar_to_buffer(${$p->get_dataref});
+  return $ptr;
+}
+
+sub _pack_taps {
+  my $p = shift;
+  @{$p->{u}} == 8 && @{$p->{v}} == 8 or croak "want 8 coefficients per axis";
+  return pack $TAP_PACK, @{$p->{u}}, @{$p->{v}}, $p->{use_width} ? 1 : 0;
+}
+
+sub _unpack_ampsf {
+  my %p;
+  @p{@AMPSF_KEYS} = unpack $AMPSF_PACK, $_[0];
+  return \%p;
+}
+
+sub tap_defaults {
+  my $buf = "\0" x length pack $TAP_PACK;
+  _tap_defaults(_ptr($buf));
+  my @x = unpack $TAP_PACK, $buf;
+  return { u => [ @x[0..7] ], v => [ @x[8..15] ], use_width => $x[16] };
+}
+
+sub ampsf_defaults {
+  my $buf = "\0" x length pack $AMPSF_PACK;
+  _ampsf_defaults(_ptr($buf));
+  return _unpack_ampsf($buf);
+}
+
+sub ampsf_profile {
+  my ($detnam, $date_obs) = @_;
+  my $buf = "\0" x length pack $AMPSF_PACK;
+  _ampsf_profile($detnam, $date_obs, _ptr($buf)) and return undef;
+  return _unpack_ampsf($buf);
+}
+
+sub correct_taps {
+  my ($amp_sf, $au1, $au2, $au3, $av1, $av2, $av3, $params, $vstat, $isa)
+    = @_;
+  $params ||= tap_defaults();
+  $params->{use_width} && !defined $vstat and croak "use_width needs vstat";
+  my $n = $amp_sf->nelem;
+  my $p = _pack_taps($params);
+  _correct_taps($n, _data($amp_sf, byte, $n, 'amp_sf'),
+		_data($vstat, byte, $n, 'vstat'),
+		_data($au1, short, $n, 'au1'), _data($au2, short, $n, 'au2'),
+		_data($au3, short, $n, 'au3'), _data($av1, short, $n, 'av1'),
+		_data($av2, short, $n, 'av2'), _data($av3, short, $n, 'av3'),
+		_ptr($p), defined $isa ? $isa : 2);
+  $_->upd_data for $au3, $av3;
+}
+
+sub fix_amp_sf {
+  my ($amp_sf, $pha, $au1, $au2, $au3, $av1, $av2, $av3, $params, $isa)
+    = @_;
+  $params ||= ampsf_defaults();
+  my $n = $amp_sf->nelem;
+  my $p = pack $AMPSF_PACK, @{$params}{@AMPSF_KEYS};
+  _fix_amp_sf($n, _data($amp_sf, byte, $n, 'amp_sf'),
+	      _data($pha, byte, $n, 'pha'),
+	      _data($au1, short, $n, 'au1'), _data($au2, short, $n, 'au2'),
+	      _data($au3, short, $n, 'au3'), _data($av1, short, $n, 'av1'),
+	      _data($av2, short, $n, 'av2'), _data($av3, short, $n, 'av3'),
+	      _ptr($p), defined $isa ? $isa : 2);
+  $amp_sf->upd_data;
+}
+
+1;
@@ -0,0 +1,105 @@
+package SpecExtract;
+use strict;
+use warnings;
+
+=head1 NAME
+
+SpecExtract - run spec_extract for the grating extraction drivers
+
+=head1 SYNOPSIS
+
+  use FindBin;
+  use lib $FindBin::Bin;
+  use SpecExtract qw( spec_extract );
+
+  my $ext = spec_extract(\%opts, $xquantum, $yquantum, $xspan,
+			 $evtfile, '-L', $linear_args);
+
+=head1 DESCRIPTION
+
+extract_linear and prextract_parabola differ only in the shape of the
+extraction region; both hand the event loop to spec_extract, found
+with tool_path() (see ToolPath.pm), and read back what it wrote.
+
+=head1 FUNCTIONS
+
+=over 4
+
+=item spec_extract(\%opts, $xquantum, $yquantum, $xspan, $evtfile, @args)
+
+Run spec_extract on $evtfile with the options common to all the
+extractions, taken from %opts (extname, xcol, ycol, xcen, ycen,
+chip3off, angle, bg1off, bg1width, bg2off, bg2width, binsize and
+threads), and the region options in @args. Returns a hash ref of what
+it found: the extents of the regions under C<region>, the spectral
+range, the spectra (piddles keyed by column name), and the bg, data
+and all images under C<image>, each a 512x512 float piddle followed
+by its range. Dies if spec_extract fails.
+
+=back
+
+=cut
+
+use PDL;
+use File::Temp qw( tempfile );
+use ToolPath qw( tool_path );
+
+use base 'Exporter';
+our @EXPORT_OK = qw( spec_extract );
+
+sub spec_extract {
+  my ($opts, $xquantum, $yquantum, $xspan, $evtfile, @args) = @_;
+
+  my (undef, $rdbfile) = tempfile('extractXXXXX', TMPDIR => 1, UNLINK => 1);
+  my (undef, $imgfile) = tempfile('extractXXXXX', TMPDIR => 1, UNLINK => 1);
+  my $npix = 512;
+  my @cmd = (tool_path('spec_extract', 'SPEC_EXTRACT'),
+	     '-e', $opts->{extname}, '-x', $opts->{xcol}, '-y', $opts->{ycol},
+	     '-c', "$opts->{xcen},$opts->{ycen}", '-q', "$xquantum,$yquantum",
+	     '-3', $opts->{chip3off}, '-a', $opts->{angle},
+	     '-B', join(',', @{$opts}{qw( bg1off bg1width bg2off bg2width )}),
+	     '-s', $opts->{binsize}, '-w', $xspan, '-n', $npix,
+	     '-j', $opts->{threads}, '-o', $rdbfile, '-i', $imgfile,
+	     @args, $evtfile);
+  system(@cmd) == 0
+    or die "$0: spec_extract failed on '$evtfile'\n";
+
+  my (%ext, @names, %cols);
+  open(my $fh, '<', $rdbfile) or die "$0: could not read '$rdbfile': $!\n";
+  while (<$fh>) {
+    chomp;
+    if (/^#\s*(\w+):\s*(.*)/) {
+      my ($key, @v) = ($1, split(' ', $2));
+      if ($key eq 'region' or $key eq 'image') {
+	my $name = shift @v;
+	$ext{$key}{$name} = \@v;
+      }
+      else {
+	$ext{$key} = $v[0];
+      }
+      next;
+    }
+    next if /^#/;
+    @names = split(/\t/), next unless @names;
+    next if /^[N\t]+$/;
+    my @v = split /\t/;
+    push @{$cols{$names[$_]}}, $v[$_] for 0..$#names;
+  }
+  close $fh;
+  $ext{$_} = pdl($cols{$_}) for @names;
+
+  open($fh, '<', $imgfile) or die "$0: could not read '$imgfile': $!\n";
+  binmode $fh;
+  for my $name (qw( bg data all )) {
+    my $image = zeroes(float, $npix, $npix);
+    read($fh, ${$image->get_dataref}, 4*$npix*$npix) == 4*$npix*$npix
+      or die "$0: short image file '$imgfile'\n";
+    $image->upd_data;
+    $ext{image}{$name} = [ $image, @{$ext{image}{$name}} ];
+  }
+  close $fh;
+
+  return \%ext;
+}
+
+1;
@@ -0,0 +1,48 @@
+package ToolPath;
+use strict;
+use warnings;
+
+=head1 NAME
+
+ToolPath - where the Perl drivers find their compiled helpers
+
+=head1 SYNOPSIS
+
+  use FindBin;
+  use lib $FindBin::Bin;
+  use ToolPath qw( tool_path );
+
+  system(tool_path('gti_split', 'GTI_SPLIT'), @args);
+
+=head1 DESCRIPTION
+
+The drivers (time_split, dither_split, lcurve, extract_linear and so
+on) hand their event loops to small C programs built from this
+directory. tool_path() says which one to run.
+
+=head1 FUNCTIONS
+
+=over 4
+
+=item tool_path($name, $env)
+
+$ENV{$env} if it is set, else $name next to the running script if it
+is executable there, else plain $name, to be looked up on the PATH.
+
+=back
+
+=cut
+
+use File::Basename qw( dirname );
+
+use base 'Exporter';
+our @EXPORT_OK = qw( tool_path );
+
+sub tool_path {
+  my ($name, $env) = @_;
+  return $ENV{$env} if $ENV{$env};
+  my $here = dirname($0) . '/' . $name;
+  return -x $here ? $here : $name;
+}
+
+1;
@@ -0,0 +1,492 @@
+/*
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+            dither_quad
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+
+The quadrant split behind dither_split. The aspect offsets are split
+into four quadrants about a centre point, each quadrant again into
+four, and so on for the given number of levels. The times of each of
+the 4^levels leaves become its good time intervals, broken wherever
+two successive times are more than ten times the median time step
+apart. The output is a GTI file for gti_split,
+
+	outbase_NN.fits start stop
+
+with NN the leaf number from 1; leaves with fewer than two times are
+left out. The quadrants of a split are, in order, x < xc & y > yc,
+x > xc & y > yc, x < xc & y < yc and x > xc & y < yc, so offsets on
+either centre line are dropped. The centre is the middle of the
+range of the offsets, or with -M their median.
+
+The offsets are read once into one array and each level partitions
+its part of it in place, with the median found by quickselect, so no
+level copies anything. The leaves are sorted back into time order
+before their GTIs are made. Subtrees are split in parallel.
+
+Build:
+	cc -O2 -pthread -o dither_quad dither_quad.c -lcfitsio -lm
+
+*/
+
+/*** include files ***/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+
+#include "fitsio.h"
+
+#include "correction.h"
+
+typedef struct
+{
+  double t, x, y;
+} dq_point;
+
+/* the GTIs of one leaf */
+typedef struct
+{
+  long n;
+  double *start, *stop;
+} dq_leaf;
+
+typedef struct
+{
+  int median;			/* centre on the median, not mid-range */
+  double threshold;		/* time gap that breaks a GTI */
+  dq_leaf *leaves;
+} dq_split;
+
+/* one subtree, for a thread */
+typedef struct
+{
+  dq_split *ds;
+  dq_point *p;
+  long n, leaf;
+  int level, threads;
+} dq_node;
+
+static char *progname;
+
+void printerror(int status)
+{
+  /*****************************************************/
+  /* Print out cfitsio error messages and exit program */
+  /*****************************************************/
+
+  if (status)
+    fprintf(stderr, "\n*** Error occurred during program execution ***\n");
+  fits_report_error(stderr, status);
+  exit( status );
+}
+
+int print_usage(void)
+{
+  fprintf(stderr, "\nUsage:\n\t%s [options] <ASPOFF>\n", progname);
+  fprintf(stderr,"\n\tn[2]:\tlevels of quadrant splits\n");
+  fprintf(stderr,"\tM:\tsplit at the median offsets, not mid-range\n");
+  fprintf(stderr,"\tU:\tdo not unroll the offsets by ROLL_NOM + roll_offsets\n");
+  fprintf(stderr,"\tb[dither_split]:\tbase name of the output files\n");
+  fprintf(stderr,"\tj[online CPUs]:\tthreads\n");
+  fprintf(stderr,"\to[stdout]:\toutput GTI file\n");
+  fprintf(stderr,"\th or ?:\tprint usage\n");
+  return 0;
+}
+
+static inline double coord(const dq_point *p, int axis)
+{
+  return axis ? p->y : p->x;
+}
+
+static inline void swap_point(dq_point *a, dq_point *b)
+{
+  dq_point tmp = *a;
+
+  *a = *b;
+  *b = tmp;
+}
+
+/*
+  Put the point with the kth smallest coordinate at p[k], the smaller
+  before it and the larger after, as std::nth_element.
+*/
+static void nth_point(dq_point *p, long n, long k, int axis)
+{
+  long lo = 0, hi = n - 1, i, j, mid;
+  double a, b, c, v;
+
+  while ( hi > lo )
+    {
+      /* median of three */
+      mid = lo + (hi - lo)/2;
+      a = coord(p + lo, axis);
+      b = coord(p + mid, axis);
+      c = coord(p + hi, axis);
+      v = a < b ? (b < c ? b : (a < c ? c : a)) : (a < c ? a : (b < c ? c : b));
+
+      for ( i = lo, j = hi; i <= j; )
+	{
+	  while ( coord(p + i, axis) < v )
+	    i++;
+	  while ( coord(p + j, axis) > v )
+	    j--;
+	  if ( i <= j )
+	    swap_point(p + i++, p + j--);
+	}
+      if ( k <= j )
+	hi = j;
+      else if ( k >= i )
+	lo = i;
+      else
+	return;
+    }
+}
+
+/* the median, averaging the middle two of an even number */
+static double median_coord(dq_point *p, long n, int axis)
+{
+  long k = n/2, i;
+  double m, below;
+
+  nth_point(p, n, k, axis);
+  m = coord(p + k, axis);
+  if ( n % 2 )
+    return m;
+  for ( i = 1, below = coord(p, axis); i < k; i++ )
+    if ( coord(p + i, axis) > below )
+      below = coord(p + i, axis);
+  return (m + below)/2;
+}
+
+static double midrange_coord(const dq_point *p, long n, int axis)
+{
+  double lo = coord(p, axis), hi = lo, v;
+  long i;
+
+  for ( i = 1; i < n; i++ )
+    {
+      v = coord(p + i, axis);
+      if ( v < lo )
+	lo = v;
+      if ( v > hi )
+	hi = v;
+    }
+  return (hi + lo)/2;
+}
+
+/*
+  Partition p in place into those below mid (above, if above_first)
+  then the others, with any on mid moved to the end. Returns the
+  size of the first part; *nsecond gets that of the second.
+*/
+static long partition3(dq_point *p, long n, int axis, double mid,
+		       int above_first, long *nsecond)
+{
+  long lo = 0, i = 0, hi = n;
+  double v;
+
+  while ( i < hi )
+    {
+      v = coord(p + i, axis);
+      if ( v == mid || v != v )
+	swap_point(p + i, p + --hi);
+      else if ( (v > mid) == (above_first != 0) )
+	swap_point(p + lo++, p + i++);
+      else
+	i++;
+    }
+  *nsecond = hi - lo;
+  return lo;
+}
+
+static int cmp_time(const void *a, const void *b)
+{
+  double x = ((const dq_point *)a)->t, y = ((const dq_point *)b)->t;
+
+  return x < y ? -1 : x > y;
+}
+
+/* the GTIs of a leaf: its times, broken at gaps over the threshold */
+static void make_leaf(dq_split *ds, dq_point *p, long n, long leaf)
+{
+  dq_leaf *l = ds->leaves + leaf;
+  long i, ngap;
+
+  if ( n < 2 )
+    return;
+  qsort(p, n, sizeof(dq_point), cmp_time);
+  for ( i = 1, ngap = 0; i < n; i++ )
+    ngap += p[i].t - p[i-1].t > ds->threshold;
+
+  l->start = CALLOC(ngap + 1, double);
+  l->stop = CALLOC(ngap + 1, double);
+  if ( !l->start || !l->stop )
+    {
+      fprintf(stderr, "%s: out of memory\n", progname);
+      exit(1);
+    }
+  l->start[0] = p[0].t;
+  for ( i = 1, l->n = 0; i < n; i++ )
+    if ( p[i].t - p[i-1].t > ds->threshold )
+      {
+	l->stop[l->n++] = p[i-1].t;
+	l->start[l->n] = p[i].t;
+      }
+  l->stop[l->n++] = p[n-1].t;
+}
+
+static void *split_thread(void *arg);
+
+static void split_node(dq_node *node)
+{
+  dq_node child[4];
+  pthread_t tid[4];
+  int started[4] = { 0, 0, 0, 0 };
+  long off[4], cnt[4], ntop, nbot;
+  double xc, yc;
+  int q;
+
+  if ( !node->level )
+    {
+      make_leaf(node->ds, node->p, node->n, node->leaf);
+      return;
+    }
+  if ( !node->n )
+    return;
+
+  if ( node->ds->median )
+    {
+      xc = median_coord(node->p, node->n, 0);
+      yc = median_coord(node->p, node->n, 1);
+    }
+  else
+    {
+      xc = midrange_coord(node->p, node->n, 0);
+      yc = midrange_coord(node->p, node->n, 1);
+    }
+
+  /* top then bottom, each split left then right */
+  ntop = partition3(node->p, node->n, 1, yc, 1, &nbot);
+  off[0] = 0;
+  cnt[0] = partition3(node->p, ntop, 0, xc, 0, &cnt[1]);
+  off[1] = cnt[0];
+  off[2] = ntop;
+  cnt[2] = partition3(node->p + ntop, nbot, 0, xc, 0, &cnt[3]);
+  off[3] = ntop + cnt[2];
+
+  for ( q = 0; q < 4; q++ )
+    {
+      child[q].ds = node->ds;
+      child[q].p = node->p + off[q];
+      child[q].n = cnt[q];
+      child[q].leaf = 4*node->leaf + q;
+      child[q].level = node->level - 1;
+      child[q].threads = node->threads/4 + (q < node->threads % 4);
+    }
+
+  /*
+    The threads are shared out among the subtrees, the first one's
+    share including this thread. Any other subtree with a share gets a
+    thread of its own; the rest wait for this one, on a single thread.
+  */
+  for ( q = 1; q < 4; q++ )
+    if ( child[q].threads > 0 )
+      started[q] = pthread_create(&tid[q], 0, split_thread, &child[q]) == 0;
+  for ( q = 1; q < 4; q++ )
+    if ( !started[q] )
+      child[q].threads = 1;
+  for ( q = 0; q < 4; q++ )
+    if ( !started[q] )
+      split_node(&child[q]);
+  for ( q = 1; q < 4; q++ )
+    if ( started[q] )
+      pthread_join(tid[q], 0);
+}
+
+static void *split_thread(void *arg)
+{
+  split_node((dq_node *)arg);
+  return 0;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+  double x = *(const double *)a, y = *(const double *)b;
+
+  return x < y ? -1 : x > y;
+}
+
+/* ten times the median step between successive times */
+static double gap_threshold(const dq_point *p, long n)
+{
+  double *d, med;
+  long i;
+
+  if ( n < 2 )
+    return 0.0;
+  if ( !(d = CALLOC(n - 1, double)) )
+    return 0.0;
+  for ( i = 1; i < n; i++ )
+    d[i-1] = p[i].t - p[i-1].t;
+  qsort(d, n - 1, sizeof(double), cmp_double);
+  med = (n - 1) % 2 ? d[(n-1)/2] : (d[(n-1)/2 - 1] + d[(n-1)/2])/2;
+  free(d);
+  return 10*med;
+}
+
+/* time and offsets of the ASPOFF table, unrolled unless told not to */
+static long read_offsets(const char *filename, int unroll, dq_point **pts)
+{
+  fitsfile *fptr;
+  dq_point *p;
+  double *t = 0, *x = 0, *y = 0, *roll = 0, roll_nom, a, xr;
+  long nrows = 0, i;
+  int tcol, xcol, ycol, rcol, anynul, status = 0;
+  char key[FLEN_VALUE];
+
+  if ( fits_open_file(&fptr, filename, READONLY, &status)
+       || fits_movnam_hdu(fptr, BINARY_TBL, "aspoff", 0, &status)
+       || fits_read_key(fptr, TDOUBLE, "ROLL_NOM", &roll_nom, NULL, &status)
+       || fits_read_key(fptr, TSTRING, "RA_TARG", key, NULL, &status)
+       || fits_read_key(fptr, TSTRING, "DEC_TARG", key, NULL, &status)
+       || fits_get_num_rows(fptr, &nrows, &status)
+       || fits_get_colnum(fptr, CASEINSEN, "time", &tcol, &status)
+       || fits_get_colnum(fptr, CASEINSEN, "x_offsets", &xcol, &status)
+       || fits_get_colnum(fptr, CASEINSEN, "y_offsets", &ycol, &status)
+       || fits_get_colnum(fptr, CASEINSEN, "roll_offsets", &rcol, &status) )
+    printerror(status);
+
+  p = CALLOC(nrows + 1, dq_point);
+  t = CALLOC(nrows + 1, double);
+  x = CALLOC(nrows + 1, double);
+  y = CALLOC(nrows + 1, double);
+  roll = CALLOC(nrows + 1, double);
+  if ( !p || !t || !x || !y || !roll )
+    {
+      fprintf(stderr, "%s: out of memory for %ld offsets\n", progname, nrows);
+      exit(1);
+    }
+  if ( fits_read_col(fptr, TDOUBLE, tcol, 1, 1, nrows, NULL, t, &anynul,
+		     &status)
+       || fits_read_col(fptr, TDOUBLE, xcol, 1, 1, nrows, NULL, x, &anynul,
+			&status)
+       || fits_read_col(fptr, TDOUBLE, ycol, 1, 1, nrows, NULL, y, &anynul,
+			&status)
+       || fits_read_col(fptr, TDOUBLE, rcol, 1, 1, nrows, NULL, roll, &anynul,
+			&status)
+       || fits_close_file(fptr, &status) )
+    printerror(status);
+
+  for ( i = 0; i < nrows; i++ )
+    {
+      p[i].t = t[i];
+      p[i].x = x[i];
+      p[i].y = y[i];
+      if ( unroll )
+	{
+	  a = -(roll_nom + roll[i])*M_PI/180.0;
+	  xr = x[i]*cos(a) + y[i]*sin(a);
+	  p[i].y = y[i]*cos(a) - x[i]*sin(a);
+	  p[i].x = xr;
+	}
+    }
+  free(t);
+  free(x);
+  free(y);
+  free(roll);
+  *pts = p;
+  return nrows;
+}
+
+int main(int argc, char *argv[])
+{
+  dq_split ds;
+  dq_node root;
+  dq_point *pts;
+  FILE *out = stdout;
+  char *outbase = "dither_split", *outfile = 0, *p;
+  long npts, nleaves, i, j;
+  int c, levels = 2, unroll = 1, threads = 0;
+
+  progname = argv[0];
+  if ( (p = strrchr(progname, '/')) )
+    progname = p + 1;
+
+  memset(&ds, 0, sizeof(ds));
+
+  while ((c = getopt(argc, argv, "n:MUb:j:o:h?")) != -1)
+    {
+      switch (c)
+	{
+	case 'n':
+	  levels = atoi(optarg);
+	  break;
+	case 'M':
+	  ds.median = 1;
+	  break;
+	case 'U':
+	  unroll = 0;
+	  break;
+	case 'b':
+	  outbase = optarg;
+	  break;
+	case 'j':
+	  threads = atoi(optarg);
+	  break;
+	case 'o':
+	  outfile = optarg;
+	  break;
+	case 'h':
+	case '?':
+	default:
+	  print_usage();
+	  exit(1);
+	}
+    }
+  if ( argc - optind != 1 || levels < 1 || levels > 12 )
+    {
+      print_usage();
+      exit(1);
+    }
+  if ( threads < 1 )
+    threads = sysconf(_SC_NPROCESSORS_ONLN);
+  if ( threads < 1 )
+    threads = 1;
+
+  npts = read_offsets(argv[optind], unroll, &pts);
+  ds.threshold = gap_threshold(pts, npts);
+
+  nleaves = 1L << 2*levels;
+  if ( !(ds.leaves = CALLOC(nleaves, dq_leaf)) )
+    {
+      fprintf(stderr, "%s: out of memory for %ld leaves\n", progname, nleaves);
+      exit(1);
+    }
+
+  root.ds = &ds;
+  root.p = pts;
+  root.n = npts;
+  root.leaf = 0;
+  root.level = levels;
+  root.threads = threads;
+  split_node(&root);
+
+  if ( outfile && !(out = fopen(outfile, "w")) )
+    {
+      perror(outfile);
+      exit(1);
+    }
+  for ( i = 0; i < nleaves; i++ )
+    for ( j = 0; j < ds.leaves[i].n; j++ )
+      fprintf(out, "%s_%.2ld.fits %.17g %.17g\n", outbase, i + 1,
+	      ds.leaves[i].start[j], ds.leaves[i].stop[j]);
+  if ( out != stdout && fclose(out) )
+    {
+      perror(outfile);
+      exit(1);
+    }
+  return 0;
+}
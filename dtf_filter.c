@@ -0,0 +1,669 @@
+/*
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+            dtf_filter
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+
+Filters the reprocessed HRC event list of each ObsID directory to the
+times the deadtime factor is above a threshold, and updates its
+exposure; this is the work of deadtime_filter.pl. For each directory
+it
+
+	reads the DTF series of primary/hrc*dtf1.fits*,
+	takes the GTIs where DTF > threshold (as dmgti userlimit="dtf>0.98"),
+	ANDs them with the GTI extension of the *evt2.fits in tg_repro,
+	copies the event list to tg_repro/<outfile> in one pass, keeping
+	  the events in those GTIs and replacing the GTI extension; the
+	  other HDUs, REGION among them, are copied as they are,
+	and sets ONTIME, DTCOR, LIVETIME and EXPOSURE in its EVENTS header.
+
+A DTF sample good from its TIME to the next sample's is good time.
+DTCOR is the mean DTF of the samples in the GTIs, weighted by
+1/DTF_ERR^2 (the average hrc_dtfstats reports); samples with no error
+count with the weight of the others' mean. LIVETIME and EXPOSURE are
+ONTIME*DTCOR.
+
+The directories are handed out to threads, -j of them, which needs
+cfitsio built with --enable-reentrant; otherwise one is used.
+
+Build:
+	cc -O2 -pthread -o dtf_filter dtf_filter.c evt0_map.c evt_gti.c \
+		-lcfitsio -lm
+
+*/
+
+/*** include files ***/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <getopt.h>
+#include <glob.h>
+#include <pthread.h>
+
+#include "fitsio.h"
+
+#include "evt0_map.h"
+#include "evt_gti.h"
+
+/* what to do with every directory */
+typedef struct
+{
+  double thresh;
+  const char *outname;		/* in tg_repro */
+  const char *gtiname;		/* in primary, or none */
+  const char *history;
+  long chunk;
+  int verb;
+} dtf_params;
+
+/* the directories still to do, shared by the threads */
+typedef struct
+{
+  char **dirs;
+  int ndirs, next, nfail;
+  const dtf_params *p;
+  pthread_mutex_t lock;
+} dtf_queue;
+
+static char *progname;
+static char DATE[FLEN_VALUE];
+
+void printerror(int status)
+{
+  /*****************************************************/
+  /* Print out cfitsio error messages and exit program */
+  /*****************************************************/
+
+  if (status)
+    fprintf(stderr, "\n*** Error occurred during program execution ***\n");
+  fits_report_error(stderr, status);
+  exit( status );
+}
+
+int print_usage(void)
+{
+  fprintf(stderr, "\nUsage:\n\t%s [options] [<OBSID_DIR> ...]\n", progname);
+  fprintf(stderr,"\n\tl:\tfile listing ObsID directories, one per line\n");
+  fprintf(stderr,"\tt[0.98]:\tkeep times with DTF > t\n");
+  fprintf(stderr,"\to[evt2_098.fits]:\toutput event list, in tg_repro\n");
+  fprintf(stderr,"\tg:\talso write the DTF GTIs to this file, in primary\n");
+  fprintf(stderr,"\tj[1]:\tObsIDs processed at once\n");
+  fprintf(stderr,"\tm[65536]:\trows read at a time\n");
+  fprintf(stderr,"\tH[command line]:\tHISTORY record for the EVENTS header\n");
+  fprintf(stderr,"\tv[0]:\tverbosity of diagnostic output\n");
+  fprintf(stderr,"\th or ?:\tprint usage\n");
+  return 0;
+}
+
+/* the one file matching dir/pattern */
+static int find_file(const char *dir, const char *pattern, char *name,
+		     size_t len)
+{
+  char pat[FLEN_FILENAME];
+  glob_t g;
+  int n;
+
+  snprintf(pat, sizeof(pat), "%s/%s", dir, pattern);
+  if ( glob(pat, 0, NULL, &g) || g.gl_pathc == 0 )
+    {
+      fprintf(stderr, "%s: no %s\n", progname, pat);
+      globfree(&g);
+      return -1;
+    }
+  if ( g.gl_pathc > 1 )
+    fprintf(stderr, "%s: %d files match %s; using %s\n", progname,
+	    (int)g.gl_pathc, pat, g.gl_pathv[0]);
+  n = snprintf(name, len, "%s", g.gl_pathv[0]);
+  globfree(&g);
+  return (size_t)n < len ? 0 : -1;
+}
+
+/* the TIME, DTF and DTF_ERR columns of the dtf extension of filename */
+static int read_dtf(const char *filename, double **t, double **dtf,
+		    double **err, long *n, int *status)
+{
+  fitsfile *fptr;
+  int tcol, dcol, ecol, anynul, st = 0;
+
+  *t = *dtf = *err = 0;
+  if ( fits_open_file(&fptr, filename, READONLY, status) )
+    return *status;
+  if ( fits_movnam_hdu(fptr, BINARY_TBL, "dtf", 0, status)
+       || fits_get_num_rows(fptr, n, status)
+       || fits_get_colnum(fptr, CASEINSEN, "time", &tcol, status)
+       || fits_get_colnum(fptr, CASEINSEN, "dtf", &dcol, status)
+       || fits_get_colnum(fptr, CASEINSEN, "dtf_err", &ecol, status) )
+    {
+      fits_close_file(fptr, &st);
+      return *status;
+    }
+
+  *t = CALLOC(*n + 1, double);
+  *dtf = CALLOC(*n + 1, double);
+  *err = CALLOC(*n + 1, double);
+  if ( !*t || !*dtf || !*err )
+    *status = MEMORY_ALLOCATION;
+  fits_read_col(fptr, TDOUBLE, tcol, 1, 1, *n, NULL, *t, &anynul, status);
+  fits_read_col(fptr, TDOUBLE, dcol, 1, 1, *n, NULL, *dtf, &anynul, status);
+  fits_read_col(fptr, TDOUBLE, ecol, 1, 1, *n, NULL, *err, &anynul, status);
+  fits_close_file(fptr, &st);
+  if ( !*status )
+    *status = st;
+  return *status;
+}
+
+/*
+  The times the DTF is above thresh. Sample i holds from t[i] to
+  t[i+1]; the last one for as long as the one before it.
+*/
+static long dtf_gti(const double *t, const double *dtf, long n,
+		    double thresh, evt_interval **gti)
+{
+  double stop;
+  long i, m = 0;
+
+  if ( !(*gti = CALLOC(n + 1, evt_interval)) )
+    return -1;
+  for ( i = 0; i < n; i++ )
+    {
+      if ( !(dtf[i] > thresh) )
+	continue;
+      stop = i + 1 < n ? t[i+1] : (n > 1 ? 2*t[i] - t[i-1] : t[i]);
+      if ( m && t[i] <= (*gti)[m-1].stop )
+	{
+	  if ( stop > (*gti)[m-1].stop )
+	    (*gti)[m-1].stop = stop;
+	  continue;
+	}
+      (*gti)[m].start = t[i];
+      (*gti)[m++].stop = stop;
+    }
+  return m;
+}
+
+/* the intervals in both of the sorted, disjoint lists a and b */
+static long and_gti(const evt_interval *a, long na, const evt_interval *b,
+		    long nb, evt_interval **out)
+{
+  double s, e;
+  long i = 0, j = 0, m = 0;
+
+  if ( !(*out = CALLOC(na + nb + 1, evt_interval)) )
+    return -1;
+  while ( i < na && j < nb )
+    {
+      s = a[i].start > b[j].start ? a[i].start : b[j].start;
+      e = a[i].stop < b[j].stop ? a[i].stop : b[j].stop;
+      if ( e > s )
+	{
+	  (*out)[m].start = s;
+	  (*out)[m++].stop = e;
+	}
+      if ( a[i].stop < b[j].stop )
+	i++;
+      else
+	j++;
+    }
+  return m;
+}
+
+/*
+  DTCOR over the GTIs: the mean DTF of the samples in them, weighted
+  by 1/DTF_ERR^2. Returns 0 if there are none.
+*/
+static double gti_dtcor(const double *t, const double *dtf, const double *err,
+			long n, const evt_interval *gti, long ngti)
+{
+  double sw = 0.0, swd = 0.0, w, wmean;
+  long i, cur = 0, nw = 0, nzero = 0;
+  double szero = 0.0;
+
+  for ( i = 0; i < n; i++ )
+    {
+      /* a sample at the end of an interval is for the time after it */
+      if ( !evt_gti_in(gti, ngti, t[i], &cur) || t[i] >= gti[cur].stop )
+	continue;
+      if ( err[i] > 0 )
+	{
+	  w = 1.0/(err[i]*err[i]);
+	  sw += w;
+	  swd += w*dtf[i];
+	  nw++;
+	}
+      else
+	{
+	  szero += dtf[i];
+	  nzero++;
+	}
+    }
+  wmean = nw ? sw/nw : 1.0;
+  sw += wmean*nzero;
+  swd += wmean*szero;
+  return sw > 0 ? swd/sw : 0.0;
+}
+
+/*
+  Copy the events in the GTIs from the current HDU of in to the last
+  HDU of out, whose header is written. Returns the rows copied.
+*/
+static long copy_events(fitsfile *in, fitsfile *out, const evt_interval *gti,
+			long ngti, long chunk, int *status)
+{
+  unsigned char *rows, *dst;
+  double *t;
+  long rowlen, nrows, row, n, j, cur = 0, nbuf, nout = 0;
+  int tcol, anynul;
+
+  if ( fits_read_key(in, TLONG, "NAXIS1", &rowlen, NULL, status)
+       || fits_get_num_rows(in, &nrows, status)
+       || fits_get_colnum(in, CASEINSEN, "time", &tcol, status) )
+    return -1;
+  if ( chunk < 1 )
+    chunk = 1;
+  rows = CALLOC(chunk*rowlen + 1, unsigned char);
+  t = CALLOC(chunk, double);
+  if ( !rows || !t )
+    {
+      *status = MEMORY_ALLOCATION;
+      return -1;
+    }
+
+  for ( row = 1; row <= nrows && !*status; row += n )
+    {
+      n = nrows - row + 1 < chunk ? nrows - row + 1 : chunk;
+      if ( fits_read_col(in, TDOUBLE, tcol, row, 1, n, NULL, t, &anynul,
+			 status)
+	   || fits_read_tblbytes(in, row, 1, (LONGLONG)n*rowlen, rows,
+				 status) )
+	break;
+
+      /* pack the rows kept to the front of the buffer */
+      for ( j = 0, nbuf = 0, dst = rows; j < n; j++ )
+	if ( evt_gti_in(gti, ngti, t[j], &cur) )
+	  {
+	    if ( j != nbuf )
+	      memcpy(dst, rows + j*rowlen, rowlen);
+	    dst += rowlen;
+	    nbuf++;
+	  }
+      if ( nbuf )
+	fits_write_tblbytes(out, nout + 1, 1, (LONGLONG)nbuf*rowlen, rows,
+			    status);
+      nout += nbuf;
+    }
+  free(rows);
+  free(t);
+  return *status ? -1 : nout;
+}
+
+/* write gti as the last HDU of out, with the header of the current one of in */
+static int write_gti_hdu(fitsfile *in, fitsfile *out, const evt_interval *gti,
+			 long ngti, int *status)
+{
+  double *v;
+  long i;
+  int scol, ecol;
+
+  if ( !(v = CALLOC(2*ngti + 2, double)) )
+    return *status = MEMORY_ALLOCATION;
+  for ( i = 0; i < ngti; i++ )
+    {
+      v[i] = gti[i].start;
+      v[ngti + i] = gti[i].stop;
+    }
+  fits_get_colnum(in, CASEINSEN, "start", &scol, status);
+  fits_get_colnum(in, CASEINSEN, "stop", &ecol, status);
+  fits_copy_header(in, out, status);
+  fits_modify_key_lng(out, "NAXIS2", 0, "&", status);
+  fits_set_hdustruc(out, status);
+  if ( ngti )
+    {
+      fits_write_col(out, TDOUBLE, scol, 1, 1, ngti, v, status);
+      fits_write_col(out, TDOUBLE, ecol, 1, 1, ngti, v + ngti, status);
+    }
+  free(v);
+  return *status;
+}
+
+/* write the DTF GTIs as a file of their own, as dmgti would */
+static int write_gti_file(const char *filename, const evt_interval *gti,
+			  long ngti, double thresh, int *status)
+{
+  char *ttype[] = { "START", "STOP" }, *tform[] = { "1D", "1D" };
+  char *tunit[] = { "s", "s" }, name[FLEN_FILENAME + 1];
+  char limit[FLEN_VALUE];
+  fitsfile *fptr;
+  long i;
+
+  snprintf(name, sizeof(name), "!%s", filename);
+  snprintf(limit, sizeof(limit), "dtf>%g", thresh);
+  if ( fits_create_file(&fptr, name, status)
+       || fits_create_tbl(fptr, BINARY_TBL, 0, 2, ttype, tform, tunit,
+			  "GTI", status) )
+    return *status;
+  fits_update_key(fptr, TSTRING, "USERLIM", limit, "DTF limit", status);
+  for ( i = 0; i < ngti && !*status; i++ )
+    {
+      fits_write_col(fptr, TDOUBLE, 1, i + 1, 1, 1, (double *)&gti[i].start,
+		     status);
+      fits_write_col(fptr, TDOUBLE, 2, i + 1, 1, 1, (double *)&gti[i].stop,
+		     status);
+    }
+  evt0_stamp_hdu(fptr, progname, DATE, status);
+  fits_close_file(fptr, status);
+  return *status;
+}
+
+/* filter the event list of one ObsID directory */
+static int filter_obsid(const char *dir, const dtf_params *p)
+{
+  char dtfname[FLEN_FILENAME], evtname[FLEN_FILENAME];
+  char outname[FLEN_FILENAME + 1];
+  fitsfile *in = 0, *out;
+  evt_interval *dgti = 0, *egti = 0, *gti = 0;
+  double *t = 0, *dtf = 0, *err = 0, ontime = 0.0, livetime, dtcor;
+  double olddtcor = 0.0;
+  long n, ndgti, negti = -1, ngti, nout = -1, i;
+  int nhdus, hdu, evthdu = 0, gtihdu = 0, hdutype, status = 0, ret = -1;
+
+  if ( find_file(dir, "primary/hrc*dtf1.fits*", dtfname, sizeof(dtfname))
+       || find_file(dir, "tg_repro/*evt2.fits", evtname, sizeof(evtname)) )
+    goto done;
+  snprintf(outname, sizeof(outname), "!%s/tg_repro/%s", dir, p->outname);
+
+  if ( read_dtf(dtfname, &t, &dtf, &err, &n, &status) )
+    {
+      fprintf(stderr, "%s: %s:\n", progname, dtfname);
+      fits_report_error(stderr, status);
+      goto done;
+    }
+  if ( (ndgti = dtf_gti(t, dtf, n, p->thresh, &dgti)) < 0 )
+    goto done;
+  if ( p->gtiname )
+    {
+      char gtiname[FLEN_FILENAME];
+
+      snprintf(gtiname, sizeof(gtiname), "%s/primary/%s", dir, p->gtiname);
+      if ( write_gti_file(gtiname, dgti, ndgti, p->thresh, &status) )
+	{
+	  fprintf(stderr, "%s: %s:\n", progname, gtiname);
+	  fits_report_error(stderr, status);
+	  goto done;
+	}
+    }
+
+  /* find the events and their GTIs */
+  if ( fits_open_file(&in, evtname, READONLY, &status)
+       || fits_get_num_hdus(in, &nhdus, &status)
+       || fits_movnam_hdu(in, BINARY_TBL, "events", 0, &status) )
+    {
+      fprintf(stderr, "%s: %s:\n", progname, evtname);
+      fits_report_error(stderr, status);
+      goto done;
+    }
+  fits_get_hdu_num(in, &evthdu);
+  fits_write_errmark();
+  if ( fits_read_key(in, TDOUBLE, "DTCOR", &olddtcor, NULL, &status) )
+    status = 0;
+  if ( fits_movnam_hdu(in, BINARY_TBL, "gti", 0, &status) == 0 )
+    {
+      fits_get_hdu_num(in, &gtihdu);
+      negti = evt_gti_read_hdu(in, &egti, &status);
+    }
+  else
+    status = 0;
+  fits_clear_errmark();
+  if ( status )
+    {
+      fprintf(stderr, "%s: %s:\n", progname, evtname);
+      fits_report_error(stderr, status);
+      goto done;
+    }
+
+  if ( negti >= 0 )
+    ngti = and_gti(dgti, ndgti, egti, negti, &gti);
+  else
+    {
+      gti = dgti;
+      ngti = ndgti;
+      dgti = 0;
+    }
+  if ( ngti < 0 )
+    goto done;
+  for ( i = 0; i < ngti; i++ )
+    ontime += gti[i].stop - gti[i].start;
+  dtcor = gti_dtcor(t, dtf, err, n, gti, ngti);
+  livetime = ontime*dtcor;
+
+  /* copy every HDU, filtering the events and replacing the GTIs */
+  fits_create_file(&out, outname, &status);
+  for ( hdu = 1; hdu <= nhdus && !status; hdu++ )
+    {
+      fits_movabs_hdu(in, hdu, &hdutype, &status);
+      if ( hdu == evthdu )
+	{
+	  fits_copy_header(in, out, &status);
+	  fits_modify_key_lng(out, "NAXIS2", 0, "&", &status);
+	  fits_set_hdustruc(out, &status);
+	  fits_write_history(out, p->history, &status);
+	  nout = copy_events(in, out, gti, ngti, p->chunk, &status);
+	  fits_update_key(out, TDOUBLE, "ONTIME", &ontime, NULL, &status);
+	  fits_update_key(out, TDOUBLE, "DTCOR", &dtcor, NULL, &status);
+	  fits_update_key(out, TDOUBLE, "LIVETIME", &livetime, NULL, &status);
+	  fits_update_key(out, TDOUBLE, "EXPOSURE", &livetime, NULL, &status);
+	}
+      else if ( hdu == gtihdu )
+	write_gti_hdu(in, out, gti, ngti, &status);
+      else
+	fits_copy_hdu(in, out, 0, &status);
+      evt0_stamp_hdu(out, progname, DATE, &status);
+    }
+  fits_close_file(out, &status);
+  if ( status )
+    {
+      fprintf(stderr, "%s: %s:\n", progname, outname + 1);
+      fits_report_error(stderr, status);
+    }
+  else
+    {
+      printf("%s\t%g\t%g\n", dir, olddtcor, dtcor);
+      if ( p->verb )
+	fprintf(stderr, "%s: %s: %ld events in %ld GTIs, ONTIME %.3f\n",
+		progname, outname + 1, nout, ngti, ontime);
+      ret = 0;
+    }
+
+ done:
+  if ( in )
+    {
+      status = 0;
+      fits_close_file(in, &status);
+    }
+  free(t);
+  free(dtf);
+  free(err);
+  free(dgti);
+  free(egti);
+  free(gti);
+  return ret;
+}
+
+static void *worker(void *arg)
+{
+  dtf_queue *q = arg;
+  int i, bad;
+
+  for ( ;; )
+    {
+      pthread_mutex_lock(&q->lock);
+      i = q->next++;
+      pthread_mutex_unlock(&q->lock);
+      if ( i >= q->ndirs )
+	break;
+      bad = filter_obsid(q->dirs[i], q->p) != 0;
+      pthread_mutex_lock(&q->lock);
+      q->nfail += bad;
+      pthread_mutex_unlock(&q->lock);
+    }
+  return 0;
+}
+
+/* the first word of every line of a list of directories */
+static int read_list(const char *filename, char ***dirs, int *ndirs)
+{
+  char line[FLEN_FILENAME], word[FLEN_FILENAME];
+  FILE *fp;
+  char **more;
+  int max = *ndirs;
+
+  if ( !(fp = fopen(filename, "r")) )
+    {
+      perror(filename);
+      return -1;
+    }
+  while ( fgets(line, sizeof(line), fp) )
+    {
+      if ( sscanf(line, "%1024s", word) != 1 || *word == '#' )
+	continue;
+      if ( *ndirs >= max )
+	{
+	  max = max ? 2*max : 64;
+	  if ( !(more = realloc(*dirs, max*sizeof(char *))) )
+	    {
+	      fclose(fp);
+	      return -1;
+	    }
+	  *dirs = more;
+	}
+      if ( !((*dirs)[(*ndirs)++] = strdup(word)) )
+	{
+	  fclose(fp);
+	  return -1;
+	}
+    }
+  fclose(fp);
+  return 0;
+}
+
+int main(int argc, char *argv[])
+{
+  dtf_params par;
+  dtf_queue q;
+  pthread_t *tid;
+  char *listfile = 0, *history = 0, *p;
+  char **dirs = 0;
+  long len;
+  int ndirs = 0, nthreads = 1, c, i, timeref, status = 0;
+
+  progname = argv[0];
+  if ( (p = strrchr(progname, '/')) )
+    progname = p + 1;
+
+  memset(&par, 0, sizeof(par));
+  par.thresh = 0.98;
+  par.outname = "evt2_098.fits";
+  par.chunk = 65536;
+
+  while ((c = getopt(argc, argv, "l:t:o:g:j:m:H:v:h?")) != -1)
+    {
+      switch (c)
+	{
+	case 'l':
+	  listfile = optarg;
+	  break;
+	case 't':
+	  par.thresh = atof(optarg);
+	  break;
+	case 'o':
+	  par.outname = optarg;
+	  break;
+	case 'g':
+	  par.gtiname = optarg;
+	  break;
+	case 'j':
+	  nthreads = atoi(optarg);
+	  break;
+	case 'm':
+	  par.chunk = atol(optarg);
+	  break;
+	case 'H':
+	  history = optarg;
+	  break;
+	case 'v':
+	  par.verb = atoi(optarg);
+	  break;
+	case 'h':
+	case '?':
+	default:
+	  print_usage();
+	  exit(1);
+	}
+    }
+
+  if ( listfile && read_list(listfile, &dirs, &ndirs) )
+    exit(1);
+  for ( i = optind; i < argc; i++ )
+    {
+      if ( !(dirs = realloc(dirs, (ndirs + 1)*sizeof(char *))) )
+	exit(1);
+      dirs[ndirs++] = argv[i];
+    }
+  if ( ndirs == 0 )
+    {
+      print_usage();
+      exit(1);
+    }
+
+  /* the command line, for the HISTORY record */
+  if ( !history )
+    {
+      for ( i = 0, len = 1; i < argc; i++ )
+	len += strlen(argv[i]) + 1;
+      if ( !(history = CALLOC(len, char)) )
+	exit(1);
+      strcpy(history, progname);
+      for ( i = 1; i < argc; i++ )
+	strcat(strcat(history, " "), argv[i]);
+    }
+  par.history = history;
+  fits_get_system_time(DATE, &timeref, &status);
+
+  if ( nthreads > ndirs )
+    nthreads = ndirs;
+  if ( nthreads > 1 && !fits_is_reentrant() )
+    {
+      fprintf(stderr, "%s: cfitsio is not thread safe, using one thread\n",
+	      progname);
+      nthreads = 1;
+    }
+  if ( nthreads < 1 )
+    nthreads = 1;
+
+  q.dirs = dirs;
+  q.ndirs = ndirs;
+  q.next = q.nfail = 0;
+  q.p = &par;
+  pthread_mutex_init(&q.lock, 0);
+
+  if ( nthreads == 1 )
+    worker(&q);
+  else
+    {
+      if ( !(tid = CALLOC(nthreads, pthread_t)) )
+	exit(1);
+      for ( i = 0; i < nthreads; i++ )
+	if ( pthread_create(tid + i, 0, worker, &q) )
+	  {
+	    fprintf(stderr, "%s: could not start a thread\n", progname);
+	    exit(1);
+	  }
+      for ( i = 0; i < nthreads; i++ )
+	pthread_join(tid[i], 0);
+      free(tid);
+    }
+
+  if ( q.nfail )
+    fprintf(stderr, "%s: %d of %d ObsIDs failed\n", progname, q.nfail,
+	    ndirs);
+  return q.nfail ? 1 : 0;
+}
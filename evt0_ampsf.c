@@ -0,0 +1,304 @@
+/*
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+            evt0_ampsf.c
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+
+Table driven AMP_SF reassignment, with the same result as fix_amp_sf()
+in evt0_kernels.c. Which of the five PHA ranges of fix_amp_sf() an
+event falls in depends only on its PHA, an unsigned char, so the
+ranges are tabulated once per parameter set in a 256 entry class
+table. Events outside the two switch bands get their AMP_SF straight
+from the table with no branch. Those inside are compacted, as in
+evt0_simd.c, and resolved from the sum of their six taps a vector at
+a time.
+
+The bands are a few PHA channels wide and hold a few percent of the
+events, so four doubles per vector is plenty; the gather of the taps
+costs more than the arithmetic.
+
+The parameters depend on the detector and on whether the observation
+predates the range switch level change of 1999-12-06; ampsf_profile()
+has the values fix_amp_sf_4.pl used to pass.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <math.h>
+
+#include "evt0_kernels.h"
+
+/* band events resolved at a time; a multiple of the vector length */
+#define AMPSF_CHUNK 512
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86_SIMD 1
+#endif
+
+/* the range switch level changed on this date, as yyyymmdd */
+#define RANGE_SWITCH_DATE 19991206
+
+typedef struct
+{
+  const char *detnam;		/* found anywhere in DETNAM */
+  int before;			/* 1: observed before RANGE_SWITCH_DATE */
+  ampsf_params p;
+} ampsf_prof;
+
+static const ampsf_prof profiles[] =
+  {
+    { "HRC-I", 1, { GAIN, THRESH1, THRESH2, THRESH3, 50.5, 99.0,
+		    WIDTH1, WIDTH2 } },
+    { "HRC-I", 0, { GAIN, THRESH1, THRESH2, THRESH3, 64.5, 126.5,
+		    WIDTH1, WIDTH2 } },
+    { "HRC-S", 1, { 52.9, 250, 250, 250, 51.0, 99.5, 5.0, 5.0 } },
+    { "HRC-S", 0, { 52.9, 250, 250, 250, 70.5, 137.5, 5.0, 5.0 } },
+  };
+
+/* switch band events gathered from a block */
+typedef struct
+{
+  long n;
+  long idx[AMPSF_CHUNK];
+  double pha[AMPSF_CHUNK];
+  double sum[AMPSF_CHUNK];	/* sum of the taps; the new AMP_SF after */
+  double hi[AMPSF_CHUNK];	/* 1 in the 2 to 3 band, 0 in the 1 to 2 */
+} ampsf_work;
+
+/*
+  Tabulate the PHA ranges of fix_amp_sf() for parameters p, with the
+  same comparisons.
+*/
+void ampsf_lut_init(ampsf_lut *lut, const ampsf_params *p)
+{
+  int v;
+
+  lut->p = *p;
+  for ( v = 0; v < 256; v++ )
+    {
+      if( v < (p->pha_1to2 - p->width1))
+	lut->cls[v] = 1;
+      else if( v < (p->pha_1to2 + p->width1))
+	lut->cls[v] = AMPSF_BAND12;
+      else if( v < (p->pha_2to3 - p->width2))
+	lut->cls[v] = 2;
+      else if( v < (p->pha_2to3 + p->width2))
+	lut->cls[v] = AMPSF_BAND23;
+      else
+	lut->cls[v] = 3;
+    }
+}
+
+/*
+  Set p from the built-in profile for detector detnam and observation
+  date date_obs (yyyy-mm-dd[Thh:mm:ss], or the old dd/mm/yy). Returns
+  -1 if there is none.
+*/
+int ampsf_profile(const char *detnam, const char *date_obs, ampsf_params *p)
+{
+  int y, m, d, before;
+  size_t i;
+
+  if ( sscanf(date_obs, "%4d-%2d-%2d", &y, &m, &d) != 3 )
+    {
+      if ( sscanf(date_obs, "%2d/%2d/%2d", &d, &m, &y) != 3 )
+	return -1;
+      y += 1900;
+    }
+  before = y*10000 + m*100 + d < RANGE_SWITCH_DATE;
+
+  for ( i = 0; i < sizeof(profiles)/sizeof(profiles[0]); i++ )
+    if ( strstr(detnam, profiles[i].detnam) && profiles[i].before == before )
+      {
+	*p = profiles[i].p;
+	return 0;
+      }
+  return -1;
+}
+
+/*
+  The parameters for a file whose EVENTS header has the given DETNAM,
+  DATE-OBS and AMPSFCOR values ("" where missing): its profile, or the
+  defaults with AMPSF_NOPROF. Returns 0, 1 if AMP_SF has been corrected
+  already (unless AMPSF_FORCE), or -1 if there is no profile for it.
+*/
+int ampsf_select(const char *detnam, const char *date_obs,
+		 const char *ampsfcor, int flags, ampsf_params *p)
+{
+  /* as tg_reprocess decides whether to run fix_amp_sf */
+  if ( !(flags & AMPSF_FORCE)
+       && (!strcmp(ampsfcor, "T") || !strcasecmp(ampsfcor, "true")) )
+    return 1;
+
+  ampsf_params_default(p);
+  if ( !(flags & AMPSF_NOPROF) && ampsf_profile(detnam, date_obs, p) )
+    return -1;
+  return 0;
+}
+
+/*
+  Set the parameter of fix_amp_sf_4's option letter key (one of
+  AMPSF_OPTS) from val; -1 if there is none.
+*/
+int ampsf_option(ampsf_params *p, int key, const char *val)
+{
+  switch ( key )
+    {
+    case 'g': p->gain = atof(val); break;
+    case 'a': p->thresh1 = atoi(val); break;
+    case 'b': p->thresh2 = atoi(val); break;
+    case 'c': p->thresh3 = atoi(val); break;
+    case 'p': p->pha_1to2 = atof(val); break;
+    case 'P': p->pha_2to3 = atof(val); break;
+    case 't': p->width1 = atof(val); break;
+    case 'T': p->width2 = atof(val); break;
+    default: return -1;
+    }
+  return 0;
+}
+
+/* the new AMP_SF of one band event, 0 to keep the telemetered one */
+static double ampsf_band(double pha, double sum, double hi,
+			 const ampsf_params *p)
+{
+  double sum_amps = sum*0.5/p->gain, da, db;
+  double r = 0.0;
+
+  if ( hi == 0.0 )
+    {
+      da = fabs(pha - sum_amps);
+      db = fabs(pha - 2.0*sum_amps);
+      if( (da <= db) && (da < p->thresh1) )
+	r = 1.0;
+      if( (db <= da) && (db < p->thresh2) )
+	r = 2.0;
+    }
+  else
+    {
+      da = fabs(pha - 2.0*sum_amps);
+      db = fabs(pha - 4.0*sum_amps);
+      if( (da <= db) && (da < p->thresh2) )
+	r = 2.0;
+      if( (db <= da) && (db < p->thresh3) )
+	r = 3.0;
+    }
+  return r;
+}
+
+static void ampsf_scalar(ampsf_work *w, const ampsf_params *p)
+{
+  long k;
+
+  for ( k = 0; k < w->n; k++ )
+    w->sum[k] = ampsf_band(w->pha[k], w->sum[k], w->hi[k], p);
+}
+
+#ifdef HAVE_X86_SIMD
+
+typedef double v4d __attribute__ ((vector_size (32)));
+typedef long long v4l __attribute__ ((vector_size (32)));
+
+#define VDUP(x) ((v4d){} + (x))
+
+/* of the loop's target, so that a, b and m are passed in registers */
+static inline __attribute__ ((always_inline, target ("avx2"))) v4d
+vsel4(v4l m, v4d a, v4d b)
+{
+  return (v4d)((m & (v4l)a) | (~m & (v4l)b));
+}
+
+/*
+  ampsf_band() four events at a time. The operations are those of the
+  scalar code in the same order, so the results are identical; the
+  multiplications by 1, 2 and 4 are exact, so even a contraction into
+  a fused multiply-add couldn't change them.
+*/
+__attribute__ ((target ("avx2")))
+static void ampsf_vec_avx2(ampsf_work *w, const ampsf_params *p)
+{
+  v4d pha, s, hi, ma, mb, ta, tb, va, vb, da, db, r;
+  v4l m23, ca, cb, absmask = (v4l){} + 0x7fffffffffffffffLL;
+  long k;
+
+  for ( k = 0; k < w->n; k += 4 )
+    {
+      memcpy(&pha, w->pha + k, sizeof(pha));
+      memcpy(&s, w->sum + k, sizeof(s));
+      memcpy(&hi, w->hi + k, sizeof(hi));
+
+      m23 = hi > VDUP(0.0);
+      ma = vsel4(m23, VDUP(2.0), VDUP(1.0));
+      mb = vsel4(m23, VDUP(4.0), VDUP(2.0));
+      ta = vsel4(m23, VDUP(p->thresh2), VDUP(p->thresh1));
+      tb = vsel4(m23, VDUP(p->thresh3), VDUP(p->thresh2));
+      va = vsel4(m23, VDUP(2.0), VDUP(1.0));
+      vb = vsel4(m23, VDUP(3.0), VDUP(2.0));
+
+      s = s*0.5/p->gain;
+      da = (v4d)((v4l)(pha - ma*s) & absmask);
+      db = (v4d)((v4l)(pha - mb*s) & absmask);
+      ca = (da <= db) & (da < ta);
+      cb = (db <= da) & (db < tb);
+      r = vsel4(cb, vb, vsel4(ca, va, VDUP(0.0)));
+      memcpy(w->sum + k, &r, sizeof(r));
+    }
+}
+
+#endif /* HAVE_X86_SIMD */
+
+/* resolve the gathered band events of blk and store their AMP_SF */
+static void ampsf_resolve(evt0_block *blk, const ampsf_lut *lut,
+			  ampsf_work *w, int isa)
+{
+  long k, j;
+
+  for ( k = 0; k < w->n; k++ )
+    {
+      j = w->idx[k];
+      w->pha[k] = blk->pha[j];
+      w->sum[k] = (double)(blk->au1[j] + blk->au2[j] + blk->au3[j]
+			   + blk->av1[j] + blk->av2[j] + blk->av3[j]);
+      w->hi[k] = lut->cls[blk->pha[j]] == AMPSF_BAND23;
+    }
+  /* pad the last vector with harmless values */
+  for ( j = k; j % 4; j++ )
+    w->pha[j] = w->sum[j] = w->hi[j] = 0.0;
+
+#ifdef HAVE_X86_SIMD
+  if ( isa != TAP_ISA_SCALAR )
+    ampsf_vec_avx2(w, &lut->p);
+  else
+#endif
+    ampsf_scalar(w, &lut->p);
+
+  for ( k = 0; k < w->n; k++ )
+    if ( w->sum[k] != 0.0 )
+      blk->amp_sf[w->idx[k]] = (unsigned char)w->sum[k];
+  w->n = 0;
+}
+
+/*
+  fix_amp_sf() through the class table lut. isa should come from
+  tap_isa_select(); the vector code needs AVX2.
+*/
+void fix_amp_sf_lut(evt0_block *blk, const ampsf_lut *lut, int isa)
+{
+  ampsf_work w;
+  unsigned char *amp_sf = blk->amp_sf, *pha = blk->pha, c;
+  long j;
+
+  w.n = 0;
+  for ( j = 0; j < blk->n; j++ )
+    {
+      c = lut->cls[pha[j]];
+      w.idx[w.n] = j;
+      w.n += c >> 2;		/* AMPSF_BAND12 and AMPSF_BAND23 only */
+      amp_sf[j] = c < AMPSF_BAND12 ? c : amp_sf[j];
+      if ( w.n == AMPSF_CHUNK )
+	ampsf_resolve(blk, lut, &w, isa);
+    }
+  if ( w.n > 0 )
+    ampsf_resolve(blk, lut, &w, isa);
+}
@@ -0,0 +1,523 @@
+/*
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+            evt0_batch.c
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+
+Batch mode for the evt0 tools, for reprocessing many observations in
+one process instead of starting a process per file. The files are
+listed in a manifest, one pair per line:
+
+	# comment
+	infile outfile [key=value ...]
+
+The key=value overrides use the tool's option letters (e.g. p=64.5
+for fix_amp_sf_4) and apply to that file only.
+
+Each output starts as a copy of its input (a clone, see evt0_patch.c,
+or the decompressed input if it is gzipped, see evt0_gz.c) and is then
+corrected in place through a writable mapping of its EVENTS table (see
+evt0_map.c).
+So several threads can work on different rows of one file with no
+cfitsio calls in between: one thread opens a file and splits its rows
+into ranges, and whichever thread finishes the last range brings the
+checksums up to date and closes it. Other HDUs are left as they are.
+
+Each thread keeps a deque of work. It takes the newest row range from
+its own deque, or else the oldest file, and when that is empty steals
+the oldest task from another's. Files are dealt out largest first, so the ranges of a big file spread
+over threads that have run out of work rather than leaving one thread
+to finish it alone.
+
+Opening and closing files in several threads needs cfitsio built with
+--enable-reentrant; otherwise one thread is used.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "evt0_batch.h"
+#include "evt0_gz.h"
+
+#define MAXTOK 66
+
+typedef struct
+{
+  evt0_job *job;
+  long row, n;			/* n == 0: open the file */
+} batch_task;
+
+typedef struct
+{
+  batch_task *t;
+  long head, tail, cap;
+  pthread_mutex_t lock;
+} task_deque;
+
+typedef struct
+{
+  evt0_batch *b;
+  task_deque *dq;
+  long outstanding;		/* tasks queued or running */
+  long pushes;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+} batch_state;
+
+typedef struct
+{
+  batch_state *bs;
+  int id;
+  evt0_block blk;
+} batch_worker;
+
+/*
+  Read a manifest. Returns 0 on success, or -1 after saying what is
+  wrong with it.
+*/
+int evt0_batch_read(const char *manifest, evt0_job **jobs, int *njobs)
+{
+  FILE *fp;
+  char line[4*FLEN_FILENAME], *tok[MAXTOK], *p;
+  evt0_job *j, *more;
+  int ntok, lineno = 0, cap = 0, i;
+
+  *jobs = 0;
+  *njobs = 0;
+  if ( !(fp = fopen(manifest, "r")) )
+    {
+      fprintf(stderr, "cannot open manifest %s\n", manifest);
+      return -1;
+    }
+
+  while ( fgets(line, sizeof(line), fp) )
+    {
+      lineno++;
+      if ( (p = strchr(line, '#')) )
+	*p = 0;
+      for ( ntok = 0, p = strtok(line, " \t\r\n"); p && ntok < MAXTOK;
+	    p = strtok(0, " \t\r\n") )
+	tok[ntok++] = p;
+      if ( ntok == 0 )
+	continue;
+      if ( ntok < 2 || p )
+	{
+	  fprintf(stderr, "%s:%d: expected infile outfile [key=value ...]\n",
+		  manifest, lineno);
+	  goto fail;
+	}
+      for ( i = 2; i < ntok; i++ )
+	if ( !strchr(tok[i], '=') )
+	  {
+	    fprintf(stderr, "%s:%d: override '%s' is not key=value\n",
+		    manifest, lineno, tok[i]);
+	    goto fail;
+	  }
+
+      if ( *njobs == cap )
+	{
+	  cap = cap ? 2*cap : 64;
+	  if ( !(more = realloc(*jobs, cap*sizeof(evt0_job))) )
+	    goto nomem;
+	  *jobs = more;
+	}
+      j = &(*jobs)[*njobs];
+      memset(j, 0, sizeof(*j));
+      (*njobs)++;
+      j->in = strdup(tok[0]);
+      j->out = strdup(tok[1]);
+      j->nover = ntok - 2;
+      j->over = CALLOC(j->nover + 1, char *);
+      if ( !j->in || !j->out || !j->over )
+	goto nomem;
+      for ( i = 0; i < j->nover; i++ )
+	if ( !(j->over[i] = strdup(tok[i+2])) )
+	  goto nomem;
+    }
+  fclose(fp);
+  return 0;
+
+ nomem:
+  fprintf(stderr, "%s: out of memory\n", manifest);
+ fail:
+  fclose(fp);
+  evt0_batch_free(*jobs, *njobs);
+  *jobs = 0;
+  *njobs = 0;
+  return -1;
+}
+
+/* frees the jobs, including each params with free() */
+void evt0_batch_free(evt0_job *jobs, int njobs)
+{
+  int i, k;
+
+  for ( i = 0; i < njobs; i++ )
+    {
+      free(jobs[i].in);
+      free(jobs[i].out);
+      for ( k = 0; jobs[i].over && k < jobs[i].nover; k++ )
+	free(jobs[i].over[k]);
+      free(jobs[i].over);
+      free(jobs[i].params);
+    }
+  free(jobs);
+}
+
+/* an output name without cfitsio's '!' for overwriting */
+static const char *bare(const char *name)
+{
+  return name + (*name == '!');
+}
+
+/* make job->out a copy of job->in, decompressing it if need be */
+static int batch_copy(evt0_job *job)
+{
+  char buf[1 << 16];
+  FILE *in;
+  size_t n;
+  int fd, bad = 0, flags = O_WRONLY | O_CREAT | O_EXCL;
+
+  if ( evt0_clone(job->in, job->out) == 0 )
+    return 0;
+
+  /* the other threads are busy with other files, so one inflating
+     thread, to overlap with writing the copy */
+  if ( evt0_gz_is(job->in) )
+    in = evt0_gz_open(job->in, 1);
+  else
+    in = fopen(job->in, "rb");
+  if ( !in )
+    return -1;
+  if ( *job->out == '!' )
+    flags = O_WRONLY | O_CREAT | O_TRUNC;
+  if ( (fd = open(bare(job->out), flags, 0666)) < 0 )
+    {
+      fclose(in);
+      return -1;
+    }
+  while ( (n = fread(buf, 1, sizeof(buf), in)) > 0 )
+    if ( write(fd, buf, n) != (ssize_t)n )
+      {
+	bad = 1;
+	break;
+      }
+  if ( ferror(in) )
+    bad = 1;
+  fclose(in);
+  if ( close(fd) || bad )
+    {
+      unlink(bare(job->out));
+      return -1;
+    }
+  return 0;
+}
+
+static void dq_push(batch_state *bs, int id, evt0_job *job, long row, long n)
+{
+  task_deque *d = &bs->dq[id];
+  batch_task *more;
+
+  pthread_mutex_lock(&d->lock);
+  if ( d->tail == d->cap )
+    {
+      d->cap = d->cap ? 2*d->cap : 64;
+      if ( !(more = realloc(d->t, d->cap*sizeof(batch_task))) )
+	{
+	  fprintf(stderr, "%s: out of memory\n", bs->b->progname);
+	  exit(1);
+	}
+      d->t = more;
+    }
+  d->t[d->tail].job = job;
+  d->t[d->tail].row = row;
+  d->t[d->tail].n = n;
+  d->tail++;
+  pthread_mutex_unlock(&d->lock);
+
+  pthread_mutex_lock(&bs->lock);
+  bs->outstanding++;
+  bs->pushes++;
+  pthread_cond_broadcast(&bs->cond);
+  pthread_mutex_unlock(&bs->lock);
+}
+
+/*
+  From our own deque, the newest row range, or else the oldest (i.e.
+  largest) file still to open; from another's, the oldest task.
+*/
+static int dq_take(task_deque *d, int own, batch_task *t)
+{
+  int ok = 0;
+
+  pthread_mutex_lock(&d->lock);
+  if ( d->head < d->tail )
+    {
+      *t = own && d->t[d->tail-1].n ? d->t[--d->tail] : d->t[d->head++];
+      if ( d->head == d->tail )
+	d->head = d->tail = 0;
+      ok = 1;
+    }
+  pthread_mutex_unlock(&d->lock);
+  return ok;
+}
+
+static void batch_fail(evt0_job *job, int status)
+{
+  int st = 0;
+
+  evt0_map_close(&job->map);
+  if ( job->fptr )
+    fits_close_file(job->fptr, &st);
+  job->fptr = 0;
+  unlink(bare(job->out));
+  job->status = status ? status : -1;
+}
+
+static void batch_close(batch_state *bs, evt0_job *job)
+{
+  int status = 0;
+
+  evt0_map_close(&job->map);
+  fits_write_date(job->fptr, &status);
+  evt0_patch_finish(&job->pt, &status);
+  fits_close_file(job->fptr, &status);
+  job->fptr = 0;
+  if ( status )
+    {
+      fprintf(stderr, "%s: %s:\n", bs->b->progname, job->out);
+      fits_report_error(stderr, status);
+      unlink(bare(job->out));
+      job->status = status;
+    }
+  else if ( bs->b->ztab && evt0_ztab_file(bare(job->out), 1) )
+    {
+      unlink(bare(job->out));
+      job->status = -1;
+    }
+  else if ( bs->b->verb > 0 )
+    fprintf(stderr, "%s: %s: %ld values changed in %ld runs\n",
+	    bs->b->progname, bare(job->out), job->pt.ncells, job->pt.nruns);
+}
+
+static void batch_open(batch_worker *w, evt0_job *job)
+{
+  batch_state *bs = w->bs;
+  evt0_batch *b = bs->b;
+  long row, nranges;
+  int k, status = 0;
+
+  job->fptr = 0;
+  job->map.map = 0;
+  if ( batch_copy(job) )
+    {
+      fprintf(stderr, "%s: cannot copy %s to %s\n", b->progname, job->in,
+	      bare(job->out));
+      job->status = -1;
+      return;
+    }
+  if ( fits_open_file(&job->fptr, bare(job->out), READWRITE, &status)
+       || fits_movnam_hdu(job->fptr, BINARY_TBL, "EVENTS", 0, &status) )
+    {
+      fprintf(stderr, "%s: %s:\n", b->progname, job->in);
+      fits_report_error(stderr, status);
+      batch_fail(job, status);
+      return;
+    }
+  if ( evt0_map_open(&job->map, job->fptr, bare(job->out),
+		     b->cols | EVT0_MAP_WRITE) )
+    {
+      fprintf(stderr, "%s: %s: cannot map the EVENTS table\n", b->progname,
+	      job->in);
+      batch_fail(job, 0);
+      return;
+    }
+  if ( (k = b->setup(b->ctx, job)) )
+    {
+      if ( k == -1 )
+	fprintf(stderr, "%s: %s: bad overrides\n", b->progname, job->in);
+      batch_fail(job, 0);
+      if ( k > 0 )
+	job->status = 0;
+      return;
+    }
+  evt0_patch_init(&job->pt, job->fptr, &job->map);
+  job->pt.wdata = (unsigned char *)job->map.data;
+
+  nranges = (job->map.nrows + b->range_rows - 1)/b->range_rows;
+  if ( nranges == 0 )
+    {
+      batch_close(bs, job);
+      return;
+    }
+  job->pending = nranges;
+
+  /* pushed last to first, so this thread goes through the file in order */
+  for ( row = 1 + (nranges - 1)*b->range_rows; row >= 1;
+	row -= b->range_rows )
+    dq_push(bs, w->id, job, row,
+	    row + b->range_rows - 1 <= job->map.nrows
+	    ? b->range_rows : 1 + job->map.nrows - row);
+}
+
+static void batch_range(batch_worker *w, evt0_job *job, long row, long n)
+{
+  evt0_batch *b = w->bs->b;
+  evt0_patch pt;
+  int last;
+
+  evt0_patch_init(&pt, job->fptr, &job->map);
+  pt.wdata = job->pt.wdata;
+  w->blk.n = n;
+  evt0_map_read(&job->map, &w->blk, row);
+  b->range(b->ctx, job, &w->blk, row, &pt);
+
+  pthread_mutex_lock(&job->lock);
+  evt0_patch_merge(&job->pt, &pt);
+  last = --job->pending == 0;
+  pthread_mutex_unlock(&job->lock);
+  if ( last )
+    batch_close(w->bs, job);
+}
+
+static void *batch_thread(void *arg)
+{
+  batch_worker *w = arg;
+  batch_state *bs = w->bs;
+  int nt = bs->b->nthreads, i, got, done;
+  batch_task t;
+  long seen;
+
+  for (;;)
+    {
+      pthread_mutex_lock(&bs->lock);
+      seen = bs->pushes;
+      pthread_mutex_unlock(&bs->lock);
+
+      got = dq_take(&bs->dq[w->id], 1, &t);
+      for ( i = 1; !got && i < nt; i++ )
+	got = dq_take(&bs->dq[(w->id + i) % nt], 0, &t);
+
+      if ( got )
+	{
+	  if ( t.n == 0 )
+	    batch_open(w, t.job);
+	  else
+	    batch_range(w, t.job, t.row, t.n);
+	  pthread_mutex_lock(&bs->lock);
+	  if ( --bs->outstanding == 0 )
+	    pthread_cond_broadcast(&bs->cond);
+	  pthread_mutex_unlock(&bs->lock);
+	  continue;
+	}
+
+      /* nothing to take; wait for more work or for the end */
+      pthread_mutex_lock(&bs->lock);
+      while ( bs->outstanding > 0 && bs->pushes == seen )
+	pthread_cond_wait(&bs->cond, &bs->lock);
+      done = bs->outstanding == 0;
+      pthread_mutex_unlock(&bs->lock);
+      if ( done )
+	break;
+    }
+  return 0;
+}
+
+static int by_size(const void *a, const void *b)
+{
+  const evt0_job *ja = *(evt0_job * const *)a, *jb = *(evt0_job * const *)b;
+
+  return ja->size < jb->size ? 1 : ja->size > jb->size ? -1 : 0;
+}
+
+/* Process all the jobs. Returns the number that failed. */
+int evt0_batch_run(evt0_batch *b, evt0_job *jobs, int njobs)
+{
+  batch_state bs;
+  batch_worker *w;
+  pthread_t *tid;
+  evt0_job **order;
+  struct stat st;
+  int i, nt, nfail = 0, *started;
+
+  if ( b->nthreads < 1 )
+    b->nthreads = 1;
+  if ( b->nthreads > 1 && !fits_is_reentrant() )
+    {
+      fprintf(stderr, "%s: cfitsio is not thread safe, using one thread\n",
+	      b->progname);
+      b->nthreads = 1;
+    }
+  nt = b->nthreads;
+
+  bs.b = b;
+  bs.outstanding = bs.pushes = 0;
+  bs.dq = CALLOC(nt, task_deque);
+  w = CALLOC(nt, batch_worker);
+  tid = CALLOC(nt, pthread_t);
+  started = CALLOC(nt, int);
+  order = CALLOC(njobs, evt0_job *);
+  if ( !bs.dq || !w || !tid || !started || !order )
+    {
+      fprintf(stderr, "%s: out of memory\n", b->progname);
+      exit(1);
+    }
+  pthread_mutex_init(&bs.lock, 0);
+  pthread_cond_init(&bs.cond, 0);
+
+  for ( i = 0; i < nt; i++ )
+    {
+      pthread_mutex_init(&bs.dq[i].lock, 0);
+      w[i].bs = &bs;
+      w[i].id = i;
+      if ( evt0_block_alloc(&w[i].blk, b->range_rows) )
+	{
+	  fprintf(stderr, "%s: could not allocate buffers\n", b->progname);
+	  exit(1);
+	}
+    }
+
+  /* largest first, round robin */
+  for ( i = 0; i < njobs; i++ )
+    {
+      jobs[i].size = stat(jobs[i].in, &st) ? 0 : st.st_size;
+      jobs[i].status = 0;
+      pthread_mutex_init(&jobs[i].lock, 0);
+      order[i] = &jobs[i];
+    }
+  qsort(order, njobs, sizeof(evt0_job *), by_size);
+  for ( i = 0; i < njobs; i++ )
+    dq_push(&bs, i % nt, order[i], 0, 0);
+
+  for ( i = 1; i < nt; i++ )
+    started[i] = pthread_create(&tid[i], 0, batch_thread, &w[i]) == 0;
+  batch_thread(&w[0]);
+  for ( i = 1; i < nt; i++ )
+    if ( started[i] )
+      pthread_join(tid[i], 0);
+
+  for ( i = 0; i < njobs; i++ )
+    {
+      if ( jobs[i].status )
+	nfail++;
+      pthread_mutex_destroy(&jobs[i].lock);
+    }
+  for ( i = 0; i < nt; i++ )
+    {
+      evt0_block_free(&w[i].blk);
+      free(bs.dq[i].t);
+      pthread_mutex_destroy(&bs.dq[i].lock);
+    }
+  pthread_mutex_destroy(&bs.lock);
+  pthread_cond_destroy(&bs.cond);
+  free(bs.dq);
+  free(w);
+  free(tid);
+  free(started);
+  free(order);
+  return nfail;
+}
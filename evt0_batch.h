@@ -0,0 +1,67 @@
+/*
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+            evt0_batch.h
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+
+Batch mode for the evt0 tools: many files from a manifest, split into
+row ranges and shared out to threads by work stealing. See
+evt0_batch.c.
+
+*/
+
+#ifndef EVT0_BATCH_H
+#define EVT0_BATCH_H
+
+#include <pthread.h>
+
+#include "fitsio.h"
+
+#include "evt0_map.h"
+#include "evt0_patch.h"
+
+typedef struct
+{
+  char *in, *out;
+  char **over;			/* per-file "key=value" overrides */
+  int nover;
+  void *params;			/* the tool's parameters for this file */
+
+  /* used by evt0_batch_run */
+  long long size;
+  fitsfile *fptr;
+  evt0_map map;
+  evt0_patch pt;
+  long pending;			/* row ranges not yet done */
+  int status;
+  pthread_mutex_t lock;
+} evt0_job;
+
+typedef struct
+{
+  int nthreads;
+  long range_rows;		/* rows per unit of work */
+  unsigned cols;		/* EVT0_* columns the tool reads */
+  int ztab;			/* tile-compress the outputs' EVENTS */
+  int verb;
+  const char *progname;
+
+  /*
+    setup turns the overrides of a job into its params, with the
+    EVENTS table of its output open in job->fptr. It returns 0, 1 to
+    leave the file alone (no output is made), -1 if the overrides are
+    bad, or another negative value after saying why it can't go on.
+    range corrects the rows in blk, which start at row, and stores
+    changes with evt0_patch_col(pt, ...); it runs concurrently, also
+    for ranges of the same file.
+  */
+  int (*setup)(void *ctx, evt0_job *job);
+  void (*range)(void *ctx, evt0_job *job, evt0_block *blk, long row,
+		evt0_patch *pt);
+  void *ctx;
+} evt0_batch;
+
+int evt0_batch_read(const char *manifest, evt0_job **jobs, int *njobs);
+int evt0_batch_run(evt0_batch *b, evt0_job *jobs, int njobs);
+void evt0_batch_free(evt0_job *jobs, int njobs);
+
+#endif
@@ -0,0 +1,454 @@
+/*
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+            evt0_gz.c
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+
+Reading gzipped evt0 files. cfitsio inflates a .gz input into memory
+on one thread before anything else can start, which takes longer than
+the correction itself. Here the file is decompressed on other threads
+while the caller reads it, through a stdio stream, as it would read a
+plain file (see evt0_stream.c).
+
+A BGZF file (bgzip, or pigz/gzip writing independent blocks with the
+BC extra field) is a series of gzip members of at most 64 kB each
+whose compressed and uncompressed sizes are in their headers. Groups
+of blocks are inflated by nthreads workers at once, into a ring of
+buffers that the reader drains in order. Any other gzip file,
+including concatenated members, can only be inflated front to back,
+so one thread does that ahead of the reader.
+
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#include "evt0_gz.h"
+
+/* BGZF blocks per unit of work; blocks hold at most 64 kB */
+#define BGZF_UNIT_BLOCKS 16
+/* bytes of output per unit when inflating front to back */
+#define GZ_UNIT (1 << 20)
+
+typedef struct
+{
+  unsigned char *buf;
+  size_t len, cap;
+  long unit;			/* unit held, -1 if free */
+  int ready;
+  int error;			/* the unit could not be inflated */
+} gz_slot;
+
+typedef struct
+{
+  const char *name;
+  unsigned char *map;
+  size_t maplen;
+
+  size_t *boff;			/* BGZF block starts, boff[nblocks] the end */
+  long nblocks;
+  long nunits;			/* units in the file, once known */
+
+  gz_slot *slot;
+  int nslots;
+  long next;			/* next unit for a worker */
+  long cur;			/* unit being read */
+  size_t pos;			/* ... and the position in it */
+  int error, said, stop;	/* error: a worker could not start */
+
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  pthread_t *th;
+  int nth;
+} gz_reader;
+
+/* 1 if filename is a gzip file */
+int evt0_gz_is(const char *filename)
+{
+  unsigned char magic[2];
+  FILE *fp;
+  int gz;
+
+  if ( !(fp = fopen(filename, "rb")) )
+    return 0;
+  gz = fread(magic, 1, 2, fp) == 2 && magic[0] == 0x1f && magic[1] == 0x8b;
+  fclose(fp);
+  return gz;
+}
+
+/* the size of the BGZF block at p, or 0 if it isn't one */
+static size_t bgzf_block(const unsigned char *p, size_t avail)
+{
+  size_t xlen, i;
+
+  if ( avail < 18 || p[0] != 0x1f || p[1] != 0x8b || p[2] != 8
+       || !(p[3] & 4) )
+    return 0;
+  xlen = p[10] | p[11] << 8;
+  for ( i = 12; i + 4 <= 12 + xlen && i + 4 <= avail;
+	i += 4 + (p[i + 2] | p[i + 3] << 8) )
+    if ( p[i] == 'B' && p[i + 1] == 'C' && (p[i + 2] | p[i + 3] << 8) == 2 )
+      {
+	if ( i + 6 > avail )
+	  return 0;
+	return (size_t)(p[i + 4] | p[i + 5] << 8) + 1;
+      }
+  return 0;
+}
+
+/* find the BGZF blocks; 0 if the whole file is made of them */
+static int bgzf_index(gz_reader *r)
+{
+  size_t off, n;
+  long cap = 0;
+  size_t *more;
+
+  r->nblocks = 0;
+  for ( off = 0; off < r->maplen; off += n )
+    {
+      if ( (n = bgzf_block(r->map + off, r->maplen - off)) == 0
+	   || n > r->maplen - off )
+	return -1;
+      if ( r->nblocks + 1 >= cap )
+	{
+	  cap = cap ? 2*cap : 1024;
+	  if ( !(more = realloc(r->boff, cap*sizeof(size_t))) )
+	    return -1;
+	  r->boff = more;
+	}
+      r->boff[r->nblocks++] = off;
+    }
+  r->boff[r->nblocks] = off;
+  return r->nblocks > 0 ? 0 : -1;
+}
+
+static int slot_fit(gz_slot *s, size_t len)
+{
+  unsigned char *more;
+
+  if ( len <= s->cap )
+    return 0;
+  if ( !(more = realloc(s->buf, len)) )
+    return -1;
+  s->buf = more;
+  s->cap = len;
+  return 0;
+}
+
+/*
+  Inflate the blocks of unit u into s. A block of no data, such as the
+  BGZF end-of-file marker, is skipped, and a unit of only such blocks
+  is empty.
+*/
+static int bgzf_unit(gz_reader *r, z_stream *z, long u, gz_slot *s)
+{
+  long b, b0 = u*BGZF_UNIT_BLOCKS, b1 = b0 + BGZF_UNIT_BLOCKS;
+  const unsigned char *end;
+  size_t len = 0, isize;
+
+  if ( b1 > r->nblocks )
+    b1 = r->nblocks;
+  for ( b = b0; b < b1; b++ )
+    {
+      end = r->map + r->boff[b + 1];
+      len += end[-4] | end[-3] << 8 | end[-2] << 16 | (size_t)end[-1] << 24;
+    }
+  if ( slot_fit(s, len) )
+    return -1;
+
+  s->len = 0;
+  for ( b = b0; b < b1; b++ )
+    {
+      end = r->map + r->boff[b + 1];
+      isize = end[-4] | end[-3] << 8 | end[-2] << 16 | (size_t)end[-1] << 24;
+      if ( isize == 0 )
+	continue;
+      if ( inflateReset(z) != Z_OK )
+	return -1;
+      z->next_in = r->map + r->boff[b];
+      z->avail_in = r->boff[b + 1] - r->boff[b];
+      z->next_out = s->buf + s->len;
+      z->avail_out = len - s->len;
+      if ( inflate(z, Z_FINISH) != Z_STREAM_END )
+	return -1;
+      s->len = len - z->avail_out;
+    }
+  return s->len == len ? 0 : -1;
+}
+
+static void *bgzf_worker(void *arg)
+{
+  gz_reader *r = arg;
+  gz_slot *s;
+  z_stream z;
+  long u;
+  int bad;
+
+  memset(&z, 0, sizeof(z));
+  if ( inflateInit2(&z, 15 + 16) != Z_OK )
+    {
+      pthread_mutex_lock(&r->lock);
+      r->error = 1;
+      pthread_cond_broadcast(&r->cond);
+      pthread_mutex_unlock(&r->lock);
+      return 0;
+    }
+
+  for ( ;; )
+    {
+      pthread_mutex_lock(&r->lock);
+      while ( !r->stop && r->next < r->nunits
+	      && r->slot[r->next % r->nslots].unit != -1 )
+	pthread_cond_wait(&r->cond, &r->lock);
+      if ( r->stop || r->next >= r->nunits )
+	{
+	  pthread_mutex_unlock(&r->lock);
+	  break;
+	}
+      u = r->next++;
+      s = &r->slot[u % r->nslots];
+      s->unit = u;
+      s->ready = 0;
+      pthread_mutex_unlock(&r->lock);
+
+      bad = bgzf_unit(r, &z, u, s);
+
+      pthread_mutex_lock(&r->lock);
+      s->ready = 1;
+      s->error = bad;
+      pthread_cond_broadcast(&r->cond);
+      pthread_mutex_unlock(&r->lock);
+    }
+  inflateEnd(&z);
+  return 0;
+}
+
+/* inflate a plain gzip file front to back, a unit at a time */
+static void *gz_worker(void *arg)
+{
+  gz_reader *r = arg;
+  gz_slot *s;
+  z_stream z;
+  long u;
+  int ret = Z_OK, bad = 0, done = 0;
+
+  memset(&z, 0, sizeof(z));
+  if ( inflateInit2(&z, 15 + 16) != Z_OK )
+    {
+      pthread_mutex_lock(&r->lock);
+      r->error = 1;
+      pthread_cond_broadcast(&r->cond);
+      pthread_mutex_unlock(&r->lock);
+      return 0;
+    }
+  z.next_in = r->map;
+  z.avail_in = r->maplen;
+
+  for ( u = 0; !bad && !done; u++ )
+    {
+      pthread_mutex_lock(&r->lock);
+      while ( !r->stop && r->slot[u % r->nslots].unit != -1 )
+	pthread_cond_wait(&r->cond, &r->lock);
+      if ( r->stop )
+	{
+	  pthread_mutex_unlock(&r->lock);
+	  break;
+	}
+      s = &r->slot[u % r->nslots];
+      s->unit = u;
+      s->ready = 0;
+      pthread_mutex_unlock(&r->lock);
+
+      if ( slot_fit(s, GZ_UNIT) )
+	bad = 1;
+      z.next_out = s->buf;
+      z.avail_out = GZ_UNIT;
+      while ( !bad && z.avail_out > 0 )
+	{
+	  ret = inflate(&z, Z_NO_FLUSH);
+	  if ( ret == Z_STREAM_END )
+	    {
+	      /* another member may follow */
+	      if ( z.avail_in >= 2 && z.next_in[0] == 0x1f
+		   && z.next_in[1] == 0x8b )
+		ret = inflateReset(&z);
+	      else
+		{
+		  done = 1;
+		  break;
+		}
+	    }
+	  if ( ret != Z_OK )
+	    bad = 1;
+	  else if ( z.avail_in == 0 && z.avail_out > 0 )
+	    bad = 1;		/* truncated */
+	}
+      s->len = GZ_UNIT - z.avail_out;
+
+      pthread_mutex_lock(&r->lock);
+      s->ready = 1;
+      s->error = bad;
+      if ( done )
+	r->nunits = u + 1;
+      pthread_cond_broadcast(&r->cond);
+      pthread_mutex_unlock(&r->lock);
+    }
+  inflateEnd(&z);
+  return 0;
+}
+
+static ssize_t gz_read(void *cookie, char *buf, size_t size)
+{
+  gz_reader *r = cookie;
+  gz_slot *s;
+  size_t n, copied = 0;
+
+  while ( copied < size )
+    {
+      pthread_mutex_lock(&r->lock);
+      s = &r->slot[r->cur % r->nslots];
+      while ( !r->error && r->cur < r->nunits
+	      && !(s->unit == r->cur && s->ready) )
+	pthread_cond_wait(&r->cond, &r->lock);
+      /* a bad unit is only an error once its data is reached */
+      if ( r->error || r->cur >= r->nunits || s->error )
+	{
+	  if ( (r->error || r->cur < r->nunits) && copied == 0 )
+	    {
+	      pthread_mutex_unlock(&r->lock);
+	      if ( !r->said++ )
+		fprintf(stderr, "%s: corrupt or truncated gzip data\n",
+			r->name);
+	      return -1;
+	    }
+	  pthread_mutex_unlock(&r->lock);
+	  break;
+	}
+      pthread_mutex_unlock(&r->lock);
+
+      n = s->len - r->pos;
+      if ( n > size - copied )
+	n = size - copied;
+      if ( n )
+	memcpy(buf + copied, s->buf + r->pos, n);
+      copied += n;
+      r->pos += n;
+
+      if ( r->pos == s->len )
+	{
+	  pthread_mutex_lock(&r->lock);
+	  s->unit = -1;
+	  s->ready = 0;
+	  r->cur++;
+	  r->pos = 0;
+	  pthread_cond_broadcast(&r->cond);
+	  pthread_mutex_unlock(&r->lock);
+	}
+    }
+  return copied;
+}
+
+static int gz_close(void *cookie)
+{
+  gz_reader *r = cookie;
+  int i;
+
+  pthread_mutex_lock(&r->lock);
+  r->stop = 1;
+  pthread_cond_broadcast(&r->cond);
+  pthread_mutex_unlock(&r->lock);
+  for ( i = 0; i < r->nth; i++ )
+    pthread_join(r->th[i], 0);
+
+  for ( i = 0; r->slot && i < r->nslots; i++ )
+    free(r->slot[i].buf);
+  free(r->slot);
+  free(r->th);
+  free(r->boff);
+  munmap(r->map, r->maplen);
+  pthread_mutex_destroy(&r->lock);
+  pthread_cond_destroy(&r->cond);
+  free(r);
+  return 0;
+}
+
+/*
+  Open the gzip file filename for reading its decompressed contents,
+  with up to nthreads threads inflating. Returns 0 if it can't be
+  opened.
+*/
+FILE *evt0_gz_open(const char *filename, int nthreads)
+{
+  cookie_io_functions_t io = { gz_read, 0, 0, gz_close };
+  gz_reader *r;
+  struct stat st;
+  void *map;
+  FILE *fp;
+  int fd, i, bgzf;
+
+  if ( (fd = open(filename, O_RDONLY)) < 0 )
+    return 0;
+  if ( fstat(fd, &st) || st.st_size == 0
+       || (map = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0))
+       == MAP_FAILED )
+    {
+      close(fd);
+      return 0;
+    }
+  close(fd);
+  madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+  if ( !(r = calloc(1, sizeof(gz_reader))) )
+    {
+      munmap(map, st.st_size);
+      return 0;
+    }
+  r->name = filename;
+  r->map = map;
+  r->maplen = st.st_size;
+  pthread_mutex_init(&r->lock, 0);
+  pthread_cond_init(&r->cond, 0);
+
+  bgzf = nthreads > 1 && bgzf_index(r) == 0;
+  if ( bgzf )
+    {
+      r->nunits = (r->nblocks + BGZF_UNIT_BLOCKS - 1)/BGZF_UNIT_BLOCKS;
+      r->nth = nthreads;
+      r->nslots = 2*nthreads + 2;
+    }
+  else
+    {
+      r->nunits = -1UL >> 1;	/* until the end is found */
+      r->nth = 1;
+      r->nslots = 4;
+    }
+  r->slot = calloc(r->nslots, sizeof(gz_slot));
+  r->th = calloc(r->nth, sizeof(pthread_t));
+  if ( !r->slot || !r->th )
+    {
+      r->nth = 0;
+      gz_close(r);
+      return 0;
+    }
+  for ( i = 0; i < r->nslots; i++ )
+    r->slot[i].unit = -1;
+
+  for ( i = 0; i < r->nth; i++ )
+    if ( pthread_create(&r->th[i], 0, bgzf ? bgzf_worker : gz_worker, r) )
+      break;
+  if ( i == 0 || !(fp = fopencookie(r, "r", io)) )
+    {
+      r->nth = i;
+      gz_close(r);
+      return 0;
+    }
+  r->nth = i;
+  return fp;
+}
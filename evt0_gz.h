@@ -0,0 +1,21 @@
+/*
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+            evt0_gz.h
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+
+Gzipped input decompressed on other threads, and tile-compressed
+output tables. See evt0_gz.c and evt0_ztab.c.
+
+*/
+
+#ifndef EVT0_GZ_H
+#define EVT0_GZ_H
+
+#include <stdio.h>
+
+int evt0_gz_is(const char *filename);
+FILE *evt0_gz_open(const char *filename, int nthreads);
+
+int evt0_ztab_file(const char *filename, int nthreads);
+
+#endif
@@ -0,0 +1,429 @@
+/*
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+            evt0_hist.c
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+
+Dry runs of the evt0 tools. The EVENTS table is read a chunk at a
+time by several threads, each chunk is corrected in memory as the tool
+would correct it, and the values before and after go into histograms
+instead of an output file:
+
+	PHA, PHA_CHANGED	PHA of all events, and of those changed
+	AU3_IN ... AV3_OUT	AU3 and AV3 before and after
+	AU3_AU2_IN ...		AU3 against AU2 (and AV3 against AV2)
+				before and after, in 16 channel bins
+	AMP_SF			new AMP_SF against the old
+
+Each thread fills its own histograms, which are added up at the end,
+so nothing is shared while the events go by. A memory-mapped table
+(see evt0_map.c) is read by all threads at once; otherwise the
+threads take turns reading through cfitsio, which needn't be thread
+safe for that.
+
+The histograms are written as one image extension each to a FITS
+file, or, for a file named *.rdb or -, as an RDB table of the
+non-empty bins.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "evt0_hist.h"
+#include "evt0_map.h"
+
+/* the columns needed for the histograms themselves */
+#define HIST_COLS (EVT0_AMP_SF | EVT0_PHA | EVT0_AU2 | EVT0_AU3 | EVT0_AV2 \
+		   | EVT0_AV3)
+
+typedef struct
+{
+  const char *name;		/* EXTNAME */
+  int nx, ny;
+  int shift;			/* value >> shift is the bin */
+  const char *xname, *yname;	/* CTYPEn */
+} hist_desc;
+
+static const hist_desc desc[EVT0_NHIST] =
+  {
+    { "PHA", 256, 1, 0, "PHA", 0 },
+    { "PHA_CHANGED", 256, 1, 0, "PHA", 0 },
+    { "AU3_IN", 4096, 1, 0, "AU3", 0 },
+    { "AU3_OUT", 4096, 1, 0, "AU3", 0 },
+    { "AV3_IN", 4096, 1, 0, "AV3", 0 },
+    { "AV3_OUT", 4096, 1, 0, "AV3", 0 },
+    { "AU3_AU2_IN", 256, 256, 4, "AU2", "AU3" },
+    { "AU3_AU2_OUT", 256, 256, 4, "AU2", "AU3" },
+    { "AV3_AV2_IN", 256, 256, 4, "AV2", "AV3" },
+    { "AV3_AV2_OUT", 256, 256, 4, "AV2", "AV3" },
+    { "AMP_SF", 4, 4, 0, "AMP_SF_IN", "AMP_SF_OUT" },
+  };
+
+/* state shared by the threads of evt0_hist_run() */
+typedef struct
+{
+  evt0_hist *h;
+  fitsfile *fptr;
+  evt0_map map;
+  int mapped;
+  unsigned cols;
+  int colnums[EVT0_NCOLS];
+  long nrows, next, chunk;
+  evt0_hist_fn correct;
+  void *ctx;
+  int status;			/* of the cfitsio reads */
+  int fail;			/* a thread got no memory */
+  pthread_mutex_t lock;
+} hist_run;
+
+int evt0_hist_alloc(evt0_hist *h)
+{
+  int i, ok = 1;
+
+  for ( i = 0; i < EVT0_NHIST; i++ )
+    ok &= (h->h[i] = CALLOC(desc[i].nx*desc[i].ny, long)) != 0;
+  h->rows = h->nampsf = h->ntaps = 0;
+  if ( !ok )
+    {
+      evt0_hist_free(h);
+      return -1;
+    }
+  return 0;
+}
+
+void evt0_hist_free(evt0_hist *h)
+{
+  int i;
+
+  for ( i = 0; i < EVT0_NHIST; i++ )
+    {
+      free(h->h[i]);
+      h->h[i] = 0;
+    }
+}
+
+static inline int bin(int v, int shift, int n)
+{
+  v = v < 0 ? 0 : v >> shift;
+  return v < n ? v : n - 1;
+}
+
+/*
+  Add the n events of blk, corrected, to h. amp_sf_in, au3_in and
+  av3_in are their values before the correction.
+*/
+void evt0_hist_add(evt0_hist *h, const evt0_block *blk,
+		   const unsigned char *amp_sf_in, const short *au3_in,
+		   const short *av3_in)
+{
+  long **p = h->h, j;
+  int pha, ca, ct, u2, v2;
+
+  for ( j = 0; j < blk->n; j++ )
+    {
+      pha = blk->pha[j];
+      u2 = bin(blk->au2[j], 4, 256);
+      v2 = bin(blk->av2[j], 4, 256);
+
+      p[EVT0_H_PHA][pha]++;
+      p[EVT0_H_AU3_IN][bin(au3_in[j], 0, 4096)]++;
+      p[EVT0_H_AU3_OUT][bin(blk->au3[j], 0, 4096)]++;
+      p[EVT0_H_AV3_IN][bin(av3_in[j], 0, 4096)]++;
+      p[EVT0_H_AV3_OUT][bin(blk->av3[j], 0, 4096)]++;
+      p[EVT0_H_AU3_AU2_IN][bin(au3_in[j], 4, 256)*256 + u2]++;
+      p[EVT0_H_AU3_AU2_OUT][bin(blk->au3[j], 4, 256)*256 + u2]++;
+      p[EVT0_H_AV3_AV2_IN][bin(av3_in[j], 4, 256)*256 + v2]++;
+      p[EVT0_H_AV3_AV2_OUT][bin(blk->av3[j], 4, 256)*256 + v2]++;
+      p[EVT0_H_AMP_SF][bin(blk->amp_sf[j], 0, 4)*4
+		       + bin(amp_sf_in[j], 0, 4)]++;
+
+      ca = blk->amp_sf[j] != amp_sf_in[j];
+      ct = blk->au3[j] != au3_in[j] || blk->av3[j] != av3_in[j];
+      h->nampsf += ca;
+      h->ntaps += ct;
+      p[EVT0_H_PHA_CHANGED][pha] += ca | ct;
+    }
+  h->rows += blk->n;
+}
+
+void evt0_hist_merge(evt0_hist *to, const evt0_hist *from)
+{
+  long k, n;
+  int i;
+
+  for ( i = 0; i < EVT0_NHIST; i++ )
+    for ( k = 0, n = desc[i].nx*desc[i].ny; k < n; k++ )
+      to->h[i][k] += from->h[i][k];
+  to->rows += from->rows;
+  to->nampsf += from->nampsf;
+  to->ntaps += from->ntaps;
+}
+
+/* read rows [row, row+blk->n) through cfitsio, with r->lock held */
+static void read_cols(hist_run *r, evt0_block *blk, long row)
+{
+  unsigned char bnull = 0;
+  short snull = 0;
+  int k, anynull;
+
+  for ( k = 0; k < EVT0_NCOLS; k++ )
+    if ( r->cols & (1u << k) )
+      fits_read_col(r->fptr, k < 3 ? TBYTE : TSHORT, r->colnums[k], row, 1,
+		    blk->n, k < 3 ? (void *)&bnull : (void *)&snull,
+		    evt0_block_col(blk, k), &anynull, &r->status);
+}
+
+static void *hist_thread(void *arg)
+{
+  hist_run *r = arg;
+  evt0_block blk;
+  evt0_hist part;
+  unsigned char *amp_sf_in = CALLOC(r->chunk, unsigned char);
+  short *au3_in = CALLOC(r->chunk, short), *av3_in = CALLOC(r->chunk, short);
+  long row;
+  int ok = 0;
+
+  blk.n = 0;
+  if ( !amp_sf_in || !au3_in || !av3_in || evt0_block_alloc(&blk, r->chunk) )
+    goto done;
+  if ( evt0_hist_alloc(&part) )
+    goto done;
+  ok = 1;
+
+  for ( ;; )
+    {
+      pthread_mutex_lock(&r->lock);
+      row = r->next;
+      if ( row > r->nrows || r->status || r->fail )
+	{
+	  pthread_mutex_unlock(&r->lock);
+	  break;
+	}
+      blk.n = r->nrows - row + 1 < r->chunk ? r->nrows - row + 1 : r->chunk;
+      r->next += blk.n;
+      if ( !r->mapped )
+	read_cols(r, &blk, row);
+      ok = r->status == 0;
+      pthread_mutex_unlock(&r->lock);
+      if ( !ok )
+	break;
+      if ( r->mapped )
+	evt0_map_read(&r->map, &blk, row);
+
+      memcpy(amp_sf_in, blk.amp_sf, blk.n);
+      memcpy(au3_in, blk.au3, blk.n*sizeof(short));
+      memcpy(av3_in, blk.av3, blk.n*sizeof(short));
+      r->correct(r->ctx, &blk);
+      evt0_hist_add(&part, &blk, amp_sf_in, au3_in, av3_in);
+    }
+
+  pthread_mutex_lock(&r->lock);
+  evt0_hist_merge(r->h, &part);
+  pthread_mutex_unlock(&r->lock);
+  evt0_hist_free(&part);
+  ok = 1;
+
+ done:
+  if ( !ok )
+    {
+      pthread_mutex_lock(&r->lock);
+      r->fail = 1;
+      pthread_mutex_unlock(&r->lock);
+    }
+  if ( blk.n )
+    evt0_block_free(&blk);
+  free(amp_sf_in);
+  free(au3_in);
+  free(av3_in);
+  return 0;
+}
+
+/*
+  Histogram the EVENTS table fptr is at (opened as filename), reading
+  the EVT0_* columns cols, chunk_rows at a time, on nthreads threads,
+  each chunk corrected by correct(ctx, ...). h must have been
+  allocated with evt0_hist_alloc(). Returns 0, or -1 after saying why
+  not.
+*/
+int evt0_hist_run(evt0_hist *h, fitsfile *fptr, const char *filename,
+		  unsigned cols, int nthreads, long chunk_rows,
+		  evt0_hist_fn correct, void *ctx, const char *progname)
+{
+  hist_run r;
+  pthread_t *tid;
+  int k, n, status = 0;
+
+  memset(&r, 0, sizeof(r));
+  r.h = h;
+  r.fptr = fptr;
+  r.cols = (cols | HIST_COLS) & EVT0_ALL;
+  r.chunk = chunk_rows;
+  r.next = 1;
+  r.correct = correct;
+  r.ctx = ctx;
+
+  fits_get_num_rows(fptr, &r.nrows, &status);
+  r.mapped = !status && evt0_map_open(&r.map, fptr, filename, r.cols) == 0;
+  for ( k = 0; k < EVT0_NCOLS && !r.mapped; k++ )
+    if ( r.cols & (1u << k) )
+      fits_get_colnum(fptr, CASEINSEN, evt0_colnames[k], &r.colnums[k],
+		      &status);
+  if ( status )
+    {
+      fits_report_error(stderr, status);
+      return -1;
+    }
+
+  if ( nthreads < 1 )
+    nthreads = 1;
+  if ( !(tid = CALLOC(nthreads, pthread_t)) )
+    {
+      fprintf(stderr, "%s: out of memory\n", progname);
+      return -1;
+    }
+  pthread_mutex_init(&r.lock, 0);
+  for ( n = 0; n < nthreads; n++ )
+    if ( pthread_create(&tid[n], 0, hist_thread, &r) )
+      break;
+  for ( k = 0; k < n; k++ )
+    pthread_join(tid[k], 0);
+  pthread_mutex_destroy(&r.lock);
+  free(tid);
+  if ( r.mapped )
+    evt0_map_close(&r.map);
+
+  if ( r.status )
+    {
+      fits_report_error(stderr, r.status);
+      return -1;
+    }
+  if ( r.fail )
+    {
+      fprintf(stderr, "%s: out of memory\n", progname);
+      return -1;
+    }
+  if ( n == 0 )
+    {
+      fprintf(stderr, "%s: could not start threads\n", progname);
+      return -1;
+    }
+  return 0;
+}
+
+static int write_rdb(const evt0_hist *h, const char *filename,
+		     const char *infile, const char *progname)
+{
+  FILE *fp = strcmp(filename, "-") ? fopen(filename, "w") : stdout;
+  long x, y, c;
+  int i;
+
+  if ( !fp )
+    {
+      perror(filename);
+      return -1;
+    }
+  fprintf(fp, "# %s dry run of %s\n", progname, infile);
+  fprintf(fp, "# %lld events, %lld with AMP_SF changed, %lld with AU3 "
+	  "or AV3 changed\n", h->rows, h->nampsf, h->ntaps);
+  fprintf(fp, "# x and y are the first value of the bin; y is 0 for "
+	  "1-D histograms\n");
+  fprintf(fp, "hist\tx\ty\tcount\nS\tN\tN\tN\n");
+  for ( i = 0; i < EVT0_NHIST; i++ )
+    for ( y = 0; y < desc[i].ny; y++ )
+      for ( x = 0; x < desc[i].nx; x++ )
+	if ( (c = h->h[i][y*desc[i].nx + x]) )
+	  fprintf(fp, "%s\t%ld\t%ld\t%ld\n", desc[i].name,
+		  x << desc[i].shift, desc[i].ny > 1 ? y << desc[i].shift : 0,
+		  c);
+  if ( fp != stdout ? fclose(fp) : fflush(fp) )
+    {
+      perror(filename);
+      return -1;
+    }
+  return 0;
+}
+
+/* the WCS keywords of axis n (1 or 2) of histogram d */
+static void write_axis(fitsfile *fptr, const hist_desc *d, int n,
+		       int *status)
+{
+  char key[FLEN_KEYWORD];
+  double w = 1 << d->shift, c = (w - 1)/2, one = 1.0;
+
+  sprintf(key, "CTYPE%d", n);
+  fits_write_key(fptr, TSTRING, key, (char *)(n == 1 ? d->xname : d->yname),
+		 "channel of bin centre", status);
+  sprintf(key, "CRPIX%d", n);
+  fits_write_key(fptr, TDOUBLE, key, &one, NULL, status);
+  sprintf(key, "CRVAL%d", n);
+  fits_write_key(fptr, TDOUBLE, key, &c, NULL, status);
+  sprintf(key, "CDELT%d", n);
+  fits_write_key(fptr, TDOUBLE, key, &w, "channels per bin", status);
+}
+
+static int write_fits(const evt0_hist *h, const char *filename,
+		      const char *infile, const char *progname)
+{
+  fitsfile *fptr;
+  long naxes[2];
+  int i, status = 0, st = 0;
+
+  if ( fits_create_file(&fptr, filename, &status) )
+    {
+      fits_report_error(stderr, status);
+      return -1;
+    }
+  fits_create_img(fptr, SHORT_IMG, 0, naxes, &status);
+  fits_write_key(fptr, TSTRING, "CREATOR", (char *)progname,
+		 "dry run, no events written", &status);
+  fits_write_key(fptr, TSTRING, "INFILE", (char *)infile, NULL, &status);
+  fits_write_key(fptr, TLONGLONG, "NEVENTS", (void *)&h->rows,
+		 "events read", &status);
+  fits_write_key(fptr, TLONGLONG, "NAMPSF", (void *)&h->nampsf,
+		 "events whose AMP_SF would change", &status);
+  fits_write_key(fptr, TLONGLONG, "NTAPS", (void *)&h->ntaps,
+		 "events whose AU3 or AV3 would change", &status);
+  fits_write_date(fptr, &status);
+  fits_write_chksum(fptr, &status);
+
+  for ( i = 0; i < EVT0_NHIST && !status; i++ )
+    {
+      naxes[0] = desc[i].nx;
+      naxes[1] = desc[i].ny;
+      fits_create_img(fptr, LONGLONG_IMG, desc[i].ny > 1 ? 2 : 1, naxes,
+		      &status);
+      fits_write_key(fptr, TSTRING, "EXTNAME", (char *)desc[i].name, NULL,
+		     &status);
+      fits_write_key(fptr, TSTRING, "BUNIT", "count", NULL, &status);
+      write_axis(fptr, &desc[i], 1, &status);
+      if ( desc[i].ny > 1 )
+	write_axis(fptr, &desc[i], 2, &status);
+      fits_write_img(fptr, TLONG, 1, naxes[0]*naxes[1], h->h[i], &status);
+      fits_write_chksum(fptr, &status);
+    }
+
+  fits_close_file(fptr, &st);
+  if ( status || st )
+    {
+      fits_report_error(stderr, status ? status : st);
+      return -1;
+    }
+  return 0;
+}
+
+/*
+  Write h to filename: RDB if it is - or ends in .rdb, else FITS.
+  Returns 0, or -1 after saying why not.
+*/
+int evt0_hist_write(const evt0_hist *h, const char *filename,
+		    const char *infile, const char *progname)
+{
+  size_t n = strlen(filename);
+
+  if ( !strcmp(filename, "-")
+       || (n > 4 && !strcmp(filename + n - 4, ".rdb")) )
+    return write_rdb(h, filename, infile, progname);
+  return write_fits(h, filename, infile, progname);
+}
@@ -0,0 +1,56 @@
+/*
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+            evt0_hist.h
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+
+Dry runs of the evt0 tools: histograms of what a correction would
+change, written to FITS or RDB instead of an event file. See
+evt0_hist.c.
+
+*/
+
+#ifndef EVT0_HIST_H
+#define EVT0_HIST_H
+
+#include "fitsio.h"
+
+#include "evt0_kernels.h"
+
+/* the histograms; _IN before the correction, _OUT after */
+#define EVT0_H_PHA 0		/* PHA of all events */
+#define EVT0_H_PHA_CHANGED 1	/* PHA of the events changed */
+#define EVT0_H_AU3_IN 2
+#define EVT0_H_AU3_OUT 3
+#define EVT0_H_AV3_IN 4
+#define EVT0_H_AV3_OUT 5
+#define EVT0_H_AU3_AU2_IN 6	/* 2-D, AU2 across, AU3 up */
+#define EVT0_H_AU3_AU2_OUT 7
+#define EVT0_H_AV3_AV2_IN 8
+#define EVT0_H_AV3_AV2_OUT 9
+#define EVT0_H_AMP_SF 10	/* 2-D, old AMP_SF across, new up */
+#define EVT0_NHIST 11
+
+typedef struct
+{
+  long *h[EVT0_NHIST];
+  long long rows;
+  long long nampsf;		/* events whose AMP_SF changed */
+  long long ntaps;		/* ... whose AU3 or AV3 changed */
+} evt0_hist;
+
+/* correct blk in place, as the tool would; runs concurrently */
+typedef void (*evt0_hist_fn)(void *ctx, evt0_block *blk);
+
+int evt0_hist_alloc(evt0_hist *h);
+void evt0_hist_free(evt0_hist *h);
+void evt0_hist_add(evt0_hist *h, const evt0_block *blk,
+		   const unsigned char *amp_sf_in, const short *au3_in,
+		   const short *av3_in);
+void evt0_hist_merge(evt0_hist *to, const evt0_hist *from);
+int evt0_hist_run(evt0_hist *h, fitsfile *fptr, const char *filename,
+		  unsigned cols, int nthreads, long chunk_rows,
+		  evt0_hist_fn correct, void *ctx, const char *progname);
+int evt0_hist_write(const evt0_hist *h, const char *filename,
+		    const char *infile, const char *progname);
+
+#endif
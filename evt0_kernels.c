@@ -0,0 +1,218 @@
+/*
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+            evt0_kernels.c
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+
+Per-event HRC level 0 corrections, lifted out of fix_amp_sf_4.c and
+hrc_evt0_correct.c so that several tools can share them. The
+arithmetic is kept exactly as in those programs so that results are
+identical.
+
+*/
+
+#include <stdlib.h>
+#include <math.h>
+
+#include "evt0_kernels.h"
+
+void ampsf_params_default(ampsf_params *p)
+{
+  p->gain = GAIN;
+  p->thresh1 = THRESH1;
+  p->thresh2 = THRESH2;
+  p->thresh3 = THRESH3;
+  p->pha_1to2 = PHA_1TO2;
+  p->pha_2to3 = PHA_2TO3;
+  p->width1 = WIDTH1;
+  p->width2 = WIDTH2;
+}
+
+void tap_params_default(tap_params *p)
+{
+  p->u.a = UAXIS_A;
+  p->u.b = UAXIS_B;
+  p->u.c = UAXIS_C;
+  p->u.d = UAXIS_D;
+  p->u.e = UAXIS_E;
+  p->u.f = UAXIS_F;
+  p->u.g = UAXIS_G;
+  p->u.o = UAXIS_O;
+  p->v.a = VAXIS_A;
+  p->v.b = VAXIS_B;
+  p->v.c = VAXIS_C;
+  p->v.d = VAXIS_D;
+  p->v.e = VAXIS_E;
+  p->v.f = VAXIS_F;
+  p->v.g = VAXIS_G;
+  p->v.o = VAXIS_O;
+  p->use_width = 0;
+}
+
+/* returns 0 on success, -1 if any buffer could not be allocated */
+int evt0_block_alloc(evt0_block *blk, long n)
+{
+  blk->n = n;
+  blk->amp_sf = CALLOC(n, unsigned char);
+  blk->pha = CALLOC(n, unsigned char);
+  blk->vstat = CALLOC(n, unsigned char);
+  blk->au1 = CALLOC(n, short);
+  blk->au2 = CALLOC(n, short);
+  blk->au3 = CALLOC(n, short);
+  blk->av1 = CALLOC(n, short);
+  blk->av2 = CALLOC(n, short);
+  blk->av3 = CALLOC(n, short);
+
+  if ( !blk->amp_sf || !blk->pha || !blk->vstat || !blk->au1 || !blk->au2
+       || !blk->au3 || !blk->av1 || !blk->av2 || !blk->av3 )
+    {
+      evt0_block_free(blk);
+      return -1;
+    }
+  return 0;
+}
+
+void evt0_block_free(evt0_block *blk)
+{
+  free(blk->amp_sf);
+  free(blk->pha);
+  free(blk->vstat);
+  free(blk->au1);
+  free(blk->au2);
+  free(blk->au3);
+  free(blk->av1);
+  free(blk->av2);
+  free(blk->av3);
+  blk->amp_sf = blk->pha = blk->vstat = 0;
+  blk->au1 = blk->au2 = blk->au3 = blk->av1 = blk->av2 = blk->av3 = 0;
+  blk->n = 0;
+}
+
+/*
+  Determine a better AMP_SF value from PHA and the sum of the tap
+  amplitudes. Events inside a switch band whose sum matches neither
+  scale within threshold keep their telemetered AMP_SF.
+*/
+void fix_amp_sf(evt0_block *blk, const ampsf_params *p)
+{
+  long j;
+  double sum_amps, diff1, diff2, diff3;
+  unsigned char *amp_sf = blk->amp_sf, *pha = blk->pha;
+  short *au1 = blk->au1, *au2 = blk->au2, *au3 = blk->au3;
+  short *av1 = blk->av1, *av2 = blk->av2, *av3 = blk->av3;
+
+  for( j = 0; j < blk->n; j++ )
+    {
+      if( pha[j] < (p->pha_1to2 - p->width1))
+	{
+	  amp_sf[j] = 1;
+	}
+      else if(pha[j] < (p->pha_1to2 + p->width1))
+	{
+	  sum_amps =
+	    (double)(au1[j]+au2[j]+au3[j]+av1[j]+av2[j]+av3[j])*0.5
+	    /p->gain;
+	  diff1 = fabs((double)pha[j] - sum_amps);
+	  diff2 = fabs((double)pha[j] - 2.0*sum_amps);
+	  if( (diff1 <= diff2) && (diff1 < p->thresh1) )
+	    {
+	      amp_sf[j] = 1;
+	    }
+	  if((diff2 <= diff1) &&  (diff2 < p->thresh2))
+	    {
+	      amp_sf[j] = 2;
+	    }
+	}
+      else if(pha[j] < (p->pha_2to3 - p->width2))
+	{
+	  amp_sf[j] = 2;
+	}
+      else if(pha[j] < (p->pha_2to3 + p->width2))
+	{
+	  sum_amps =
+	    (double)(au1[j]+au2[j]+au3[j]+av1[j]+av2[j]+av3[j])*0.5
+	    /p->gain;
+	  diff2 = fabs((double)pha[j] - 2.0*sum_amps);
+	  diff3 = fabs((double)pha[j] - 4.0*sum_amps);
+	  if((diff2 <= diff3) && (diff2 < p->thresh2))
+	    {
+	      amp_sf[j] = 2;
+	    }
+	  if((diff3 <= diff2) && (diff3 < p->thresh3))
+	    {
+	      amp_sf[j] = 3;
+	    }
+	}
+      else
+	{
+	  amp_sf[j] = 3;
+	}
+    }
+}
+
+/* amount the ringing adds to the third tap, given taps 1 and 2 */
+double tap_delta(short t1, short t2, const tap_coeffs *c)
+{
+  double a1, a2, phi;
+
+  a1 = (double)t1;
+  a2 = (double)t2;
+  phi = 0.0;
+  if (t1 > 0)
+    phi = c->f*(pow(a2/a1,c->g) - 1.0);
+  return (a2 + c->b)/c->a
+    * sin(2.*PI*(a2-phi)/(a2*c->c + c->d));
+}
+
+/* corrected third tap for one axis, clamped to the 12-bit range */
+short correct_tap(short t1, short t2, short t3, const tap_coeffs *c)
+{
+  double a3;
+  short t;
+
+  a3 = (double)t3;
+  a3 = a3 - tap_delta(t1, t2, c);
+  t = (short)(a3 + 0.5);
+  if(t < 0) t = 0;
+  if(t > 4095) t = 4095;
+  return t;
+}
+
+/*
+  Correct AU3/AV3 of AMP_SF == 3 events affected by the ringing
+  problem. Events are selected either by the tap 1/tap 2 limit or,
+  with use_width set, by the width-exceeded bits of VETOSTT.
+*/
+void correct_taps(evt0_block *blk, const tap_params *p)
+{
+  long jj;
+  int correct;
+  unsigned char *ampsf = blk->amp_sf, *vstat = blk->vstat;
+  short *au1 = blk->au1, *au2 = blk->au2, *au3 = blk->au3;
+  short *av1 = blk->av1, *av2 = blk->av2, *av3 = blk->av3;
+
+  for( jj = 0; jj < blk->n; jj++)
+    {
+      if ( ampsf[jj] != 3 )
+	continue;
+
+      correct = 0;
+      if ( (au1[jj] > au3[jj]) && (p->use_width == 0)
+	   && (au1[jj] > (p->u.e * au2[jj] + p->u.o)) )
+	correct = 1;
+      if ( (au1[jj] > au3[jj]) && (p->use_width != 0)
+	   && ((vstat[jj] & 0x10) == 0) )
+	correct = 1;
+      if ( correct == 1 )
+	au3[jj] = correct_tap(au1[jj], au2[jj], au3[jj], &p->u);
+
+      correct = 0;
+      if ( (av1[jj] > av3[jj]) && (p->use_width == 0)
+	   && (av1[jj] > (p->v.e * av2[jj] + p->v.o)) )
+	correct = 1;
+      if ( (av1[jj] > av3[jj]) && (p->use_width != 0)
+	   && ((vstat[jj] & 0x20) == 0) )
+	correct = 1;
+      if ( correct == 1 )
+	av3[jj] = correct_tap(av1[jj], av2[jj], av3[jj], &p->v);
+    }
+}
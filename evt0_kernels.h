@@ -0,0 +1,119 @@
+/*
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+            evt0_kernels.h
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+
+Per-event HRC level 0 corrections shared by the evt0 tools: the
+AMP_SF reassignment of fix_amp_sf_4.c and the tap "ringing"
+correction of hrc_evt0_correct.c.
+
+*/
+
+#ifndef EVT0_KERNELS_H
+#define EVT0_KERNELS_H
+
+#include <stddef.h>
+
+#include "correction.h"
+
+/* defaults for the AMP_SF reassignment, from fix_amp_sf_4.c */
+#define GAIN 74.0
+#define THRESH1 8
+#define THRESH2 16
+#define THRESH3 32
+#define PHA_1TO2 50.5
+#define PHA_2TO3 99.5
+#define WIDTH1 2.0
+#define WIDTH2 2.0
+
+/* one block of the level 0 event columns used by the corrections */
+typedef struct
+{
+  long n;
+  unsigned char *amp_sf, *pha, *vstat;
+  short *au1, *au2, *au3, *av1, *av2, *av3;
+} evt0_block;
+
+typedef struct
+{
+  double gain;
+  int thresh1, thresh2, thresh3;
+  double pha_1to2, pha_2to3, width1, width2;
+} ampsf_params;
+
+/* ringing correction coefficients for one axis, see correction.h */
+typedef struct
+{
+  double a, b, c, d, e, f, g, o;
+} tap_coeffs;
+
+typedef struct
+{
+  tap_coeffs u, v;
+  int use_width;
+} tap_params;
+
+void ampsf_params_default(ampsf_params *p);
+void tap_params_default(tap_params *p);
+
+int evt0_block_alloc(evt0_block *blk, long n);
+void evt0_block_free(evt0_block *blk);
+
+void fix_amp_sf(evt0_block *blk, const ampsf_params *p);
+double tap_delta(short t1, short t2, const tap_coeffs *c);
+short correct_tap(short t1, short t2, short t3, const tap_coeffs *c);
+void correct_taps(evt0_block *blk, const tap_params *p);
+
+/* AMP_SF reassignment through a table of PHA classes, in evt0_ampsf.c */
+#define AMPSF_BAND12 4		/* classes for the switch bands; 1-3 are */
+#define AMPSF_BAND23 5		/* the AMP_SF to assign */
+
+typedef struct
+{
+  unsigned char cls[256];	/* class by PHA */
+  ampsf_params p;
+} ampsf_lut;
+
+/* flags of ampsf_select() */
+#define AMPSF_NOPROF 1		/* the defaults, not the built-in profile */
+#define AMPSF_FORCE 2		/* even if AMPSFCOR says it's done */
+
+/* the AMP_SF parameter option letters, in the order of ampsf_params */
+#define AMPSF_OPTS "gabcpPtT"
+
+int ampsf_profile(const char *detnam, const char *date_obs, ampsf_params *p);
+int ampsf_select(const char *detnam, const char *date_obs,
+		 const char *ampsfcor, int flags, ampsf_params *p);
+int ampsf_option(ampsf_params *p, int key, const char *val);
+void ampsf_lut_init(ampsf_lut *lut, const ampsf_params *p);
+void fix_amp_sf_lut(evt0_block *blk, const ampsf_lut *lut, int isa);
+
+/* instruction sets for the vectorized correction, in evt0_simd.c */
+#define TAP_ISA_SCALAR 0
+#define TAP_ISA_AVX2 1
+#define TAP_ISA_AVX512 2
+
+int tap_isa_select(int want);
+const char *tap_isa_name(int isa);
+void correct_taps_isa(evt0_block *blk, const tap_params *p, int isa);
+void tap_verify(evt0_block *blk, const short *orig_au3,
+		const short *orig_av3, const tap_params *p,
+		long *ndiff_u, long *ndiff_v);
+
+/* tabulated correction for 12-bit taps, in evt0_lut.c */
+#define TAP_LUT_N 4096
+
+typedef struct
+{
+  const short *k;		/* TAP_LUT_N x TAP_LUT_N, indexed [a1][a2] */
+  void *map;
+  short *own;
+  size_t len;
+} tap_lut;
+
+int tap_lut_open(tap_lut *lut, const tap_coeffs *c, const char *cachedir);
+void tap_lut_close(tap_lut *lut);
+void correct_taps_lut(evt0_block *blk, const tap_params *p,
+		      const tap_lut *ulut, const tap_lut *vlut);
+
+#endif
@@ -0,0 +1,240 @@
+/*
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+            evt0_lut.c
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+
+Table driven tap ringing correction. The correction to the third tap
+depends only on the first two taps and the axis coefficients, so for
+12-bit taps it can be tabulated once per coefficient set:
+
+	k(a1, a2) = floor(0.5 - tap_delta(a1, a2))
+
+and the corrected tap is a3 + k clamped to 0..4095, which is what
+correct_tap() computes. Entries where 0.5 - tap_delta() lies so close
+to an integer that rounding in correct_tap() could go either way are
+marked with LUT_SCALAR, and those events are done with correct_tap(),
+so the output is identical to the scalar code.
+
+A table is 32 MB per axis and takes a couple of seconds to build.
+Given a cache directory, tables are written there named by a hash of
+the coefficients and memory-mapped by later runs. The tables for the
+default coefficients can be made ahead of time with
+
+	hrc_evt0_correct -L <cachedir> -M
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "evt0_kernels.h"
+
+#define LUT_SCALAR (-32768)
+#define LUT_MAGIC "TAPLUT1"
+#define LUT_HDRLEN 4096
+
+typedef struct
+{
+  char magic[8];
+  int n;
+  int endian;			/* 1 as written by this machine */
+  double coeffs[6];
+} lut_header;
+
+/* the coefficients that enter tap_delta(); e and o only select events */
+static void lut_coeffs(const tap_coeffs *c, double *v)
+{
+  v[0] = c->a;
+  v[1] = c->b;
+  v[2] = c->c;
+  v[3] = c->d;
+  v[4] = c->f;
+  v[5] = c->g;
+}
+
+/* FNV-1a over the coefficient bits */
+static unsigned long long lut_hash(const double *v)
+{
+  const unsigned char *b = (const unsigned char *)v;
+  unsigned long long h = 14695981039346656037ULL;
+  size_t i;
+
+  for ( i = 0; i < 6*sizeof(double); i++ )
+    {
+      h ^= b[i];
+      h *= 1099511628211ULL;
+    }
+  return h;
+}
+
+static void lut_fill(short *k, const tap_coeffs *c)
+{
+  int a1, a2;
+  double y, f;
+
+  for ( a1 = 0; a1 < TAP_LUT_N; a1++ )
+    for ( a2 = 0; a2 < TAP_LUT_N; a2++ )
+      {
+	y = 0.5 - tap_delta(a1, a2, c);
+	f = floor(y);
+	if ( !(y - f > 1e-9 && y - f < 1.0 - 1e-9) )
+	  *k++ = LUT_SCALAR;
+	else if ( f < -8192.0 )
+	  *k++ = -8192;		/* clamps to 0 for any 12-bit a3 */
+	else if ( f > 8191.0 )
+	  *k++ = 8191;		/* clamps to 4095 */
+	else
+	  *k++ = (short)f;
+      }
+}
+
+static int lut_map(tap_lut *lut, const char *path, const double *v)
+{
+  struct stat st;
+  lut_header hdr;
+  int fd;
+  void *map;
+
+  if ( (fd = open(path, O_RDONLY)) < 0 )
+    return -1;
+  if ( fstat(fd, &st) || st.st_size != (off_t)lut->len
+       || read(fd, &hdr, sizeof(hdr)) != sizeof(hdr)
+       || strcmp(hdr.magic, LUT_MAGIC) || hdr.n != TAP_LUT_N
+       || hdr.endian != 1 || memcmp(hdr.coeffs, v, sizeof(hdr.coeffs)) )
+    {
+      close(fd);
+      return -1;
+    }
+  map = mmap(0, lut->len, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if ( map == MAP_FAILED )
+    return -1;
+
+  lut->map = map;
+  lut->k = (const short *)((char *)map + LUT_HDRLEN);
+  return 0;
+}
+
+/* write to a temporary name first so readers never see a partial table */
+static void lut_save(const char *path, const double *v, const short *k)
+{
+  char tmp[FILENAME_MAX + 32];
+  char hdrbuf[LUT_HDRLEN];
+  lut_header *hdr = (lut_header *)hdrbuf;
+  size_t nk = (size_t)TAP_LUT_N*TAP_LUT_N;
+  FILE *fp;
+
+  snprintf(tmp, sizeof(tmp), "%s.%ld", path, (long)getpid());
+  if ( !(fp = fopen(tmp, "wb")) )
+    return;
+
+  memset(hdrbuf, 0, sizeof(hdrbuf));
+  strcpy(hdr->magic, LUT_MAGIC);
+  hdr->n = TAP_LUT_N;
+  hdr->endian = 1;
+  memcpy(hdr->coeffs, v, sizeof(hdr->coeffs));
+
+  if ( fwrite(hdrbuf, 1, sizeof(hdrbuf), fp) != sizeof(hdrbuf)
+       || fwrite(k, sizeof(short), nk, fp) != nk
+       || fclose(fp) )
+    {
+      unlink(tmp);
+      return;
+    }
+  if ( rename(tmp, path) )
+    unlink(tmp);
+}
+
+/*
+  Get the table for one axis, from cachedir if it is there, otherwise
+  by building it (and saving it to cachedir, if given). Returns 0 on
+  success.
+*/
+int tap_lut_open(tap_lut *lut, const tap_coeffs *c, const char *cachedir)
+{
+  double v[6];
+  char path[FILENAME_MAX];
+  short *k;
+
+  lut_coeffs(c, v);
+  lut->map = 0;
+  lut->own = 0;
+  lut->len = LUT_HDRLEN + (size_t)TAP_LUT_N*TAP_LUT_N*sizeof(short);
+
+  if ( cachedir )
+    {
+      snprintf(path, sizeof(path), "%s/tap_lut_%016llx.bin", cachedir,
+	       lut_hash(v));
+      if ( lut_map(lut, path, v) == 0 )
+	return 0;
+    }
+
+  if ( !(k = CALLOC((size_t)TAP_LUT_N*TAP_LUT_N, short)) )
+    return -1;
+  lut_fill(k, c);
+  if ( cachedir )
+    lut_save(path, v, k);
+
+  lut->own = k;
+  lut->k = k;
+  return 0;
+}
+
+void tap_lut_close(tap_lut *lut)
+{
+  if ( lut->map )
+    munmap(lut->map, lut->len);
+  free(lut->own);
+  lut->map = 0;
+  lut->own = 0;
+  lut->k = 0;
+}
+
+static void lut_axis(evt0_block *blk, short *t1, short *t2, short *t3,
+		     int wbit, const tap_coeffs *c, int use_width,
+		     const tap_lut *lut)
+{
+  long jj;
+  int correct, k, t;
+
+  for( jj = 0; jj < blk->n; jj++ )
+    {
+      if ( blk->amp_sf[jj] != 3 || t1[jj] <= t3[jj] )
+	continue;
+      if ( use_width == 0 )
+	correct = t1[jj] > (c->e * t2[jj] + c->o);
+      else
+	correct = (blk->vstat[jj] & wbit) == 0;
+      if ( !correct )
+	continue;
+
+      /* t1 > t3 >= 0, so only the upper bound of t1 needs a check */
+      if ( t3[jj] < 0 || t1[jj] >= TAP_LUT_N
+	   || t2[jj] < 0 || t2[jj] >= TAP_LUT_N
+	   || (k = lut->k[t1[jj]*TAP_LUT_N + t2[jj]]) == LUT_SCALAR )
+	{
+	  t3[jj] = correct_tap(t1[jj], t2[jj], t3[jj], c);
+	  continue;
+	}
+
+      t = t3[jj] + k;
+      if(t < 0) t = 0;
+      if(t > 4095) t = 4095;
+      t3[jj] = t;
+    }
+}
+
+void correct_taps_lut(evt0_block *blk, const tap_params *p,
+		      const tap_lut *ulut, const tap_lut *vlut)
+{
+  lut_axis(blk, blk->au1, blk->au2, blk->au3, 0x10, &p->u, p->use_width,
+	   ulut);
+  lut_axis(blk, blk->av1, blk->av2, blk->av3, 0x20, &p->v, p->use_width,
+	   vlut);
+}
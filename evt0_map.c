@@ -0,0 +1,458 @@
+/*
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+            evt0_map.c
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+
+Reads the level 0 event columns from a memory-mapped EVENTS table.
+Reading each column with fits_read_col() walks the row block once per
+column; here one pass over the rows picks out all the columns, with
+the big-endian 16-bit taps byte-swapped eight at a time.
+
+The table is located with cfitsio, then the file itself is mapped.
+The column layout can also be worked out from raw header cards, for
+tables read from a stream (see evt0_stream.c).
+Only plain uncompressed files on disk are mapped, with the columns
+stored as unscaled B, I or (up to 8) X. For anything else -- gzipped
+files, extended file name filters, scaled columns -- evt0_map_open()
+fails and the caller reads with cfitsio as before.
+
+With EVT0_MAP_WRITE the mapping is writable, so a tool working on a
+copy of its input can change cells in place (see evt0_batch.c).
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "evt0_map.h"
+
+typedef unsigned short v8u16 __attribute__ ((vector_size (16)));
+
+char *evt0_colnames[EVT0_NCOLS] =
+  { "AMP_SF", "PHA", "VETOSTT", "AU1", "AU2", "AU3", "AV1", "AV2", "AV3" };
+
+/* bytes taken up in a row by a column of the given TFORM */
+static long tform_bytes(char *tform, int typecode, long repeat, long width)
+{
+  if ( typecode == TBIT )
+    return (repeat + 7)/8;
+  if ( typecode == TSTRING )
+    return repeat;
+  if ( typecode < 0 )		/* variable length array descriptor */
+    return strchr(tform, 'Q') ? 16 : 8;
+  return repeat*width;
+}
+
+/* the byte offset of column colnum in a row of the current table */
+long evt0_col_offset(fitsfile *fptr, int colnum, int *status)
+{
+  char key[FLEN_KEYWORD], tform[FLEN_VALUE];
+  long repeat, width, pos = 0;
+  int i, typecode;
+
+  for ( i = 1; i < colnum; i++ )
+    {
+      snprintf(key, sizeof(key), "TFORM%d", i);
+      if ( fits_read_key(fptr, TSTRING, key, tform, NULL, status)
+	   || fits_binary_tform(tform, &typecode, &repeat, &width, status) )
+	return -1;
+      pos += tform_bytes(tform, typecode, repeat, width);
+    }
+  return pos;
+}
+
+/* stamp a freshly written HDU with its creator and date, and checksum it */
+int evt0_stamp_hdu(fitsfile *out, const char *creator, const char *date,
+		   int *status)
+{
+  fits_update_key(out, TSTRING, "CREATOR", (char *)creator, NULL, status);
+  fits_update_key(out, TSTRING, "DATE", (char *)date, NULL, status);
+  return fits_update_chksum(out, status);
+}
+
+/*
+  Where the table keywords come from: the open HDU of fptr, or if that
+  is 0, the ncards header cards at hdr.
+*/
+typedef struct
+{
+  fitsfile *fptr;
+  const char *hdr;
+  long ncards;
+} key_src;
+
+/*
+  DETNAM, DATE-OBS and AMPSFCOR of the current HDU of fptr, each
+  FLEN_VALUE long and "" where missing, for ampsf_select().
+*/
+void evt0_profile_keys(fitsfile *fptr, char *detnam, char *date_obs,
+		       char *ampsfcor)
+{
+  char *keys[3] = { "DETNAM", "DATE-OBS", "AMPSFCOR" };
+  char *vals[3];
+  int i, status;
+
+  vals[0] = detnam;
+  vals[1] = date_obs;
+  vals[2] = ampsfcor;
+  for ( i = 0; i < 3; i++ )
+    {
+      status = 0;
+      fits_write_errmark();
+      if ( fits_read_key(fptr, TSTRING, keys[i], vals[i], NULL, &status) )
+	*vals[i] = 0;
+      fits_clear_errmark();
+    }
+}
+
+/*
+  The value of keyword key in the ncards header cards at hdr, as a
+  string without quotes and trailing blanks, in value (FLEN_VALUE
+  long). Returns 0 if found or 1 if not.
+*/
+int evt0_card_value(const char *hdr, long ncards, const char *key,
+		    char *value)
+{
+  const char *card, *p;
+  char *q, *end = value + FLEN_VALUE - 1;
+  size_t len = strlen(key);
+  long i;
+
+  for ( i = 0; i < ncards; i++ )
+    {
+      card = hdr + 80*i;
+      if ( strncmp(card, key, len) || (len < 8 && card[len] != ' ')
+	   || card[8] != '=' )
+	continue;
+      p = card + 10;
+      while ( p < card + 80 && *p == ' ' )
+	p++;
+      q = value;
+      if ( p < card + 80 && *p == '\'' )
+	{
+	  for ( p++; p < card + 80 && q < end; p++ )
+	    {
+	      if ( *p == '\'' && (p + 1 == card + 80 || p[1] != '\'') )
+		break;
+	      if ( *p == '\'' )
+		p++;
+	      *q++ = *p;
+	    }
+	}
+      else
+	while ( p < card + 80 && *p != '/' && q < end )
+	  *q++ = *p++;
+      while ( q > value && q[-1] == ' ' )
+	q--;
+      *q = 0;
+      return 0;
+    }
+  return 1;
+}
+
+/*
+  The bytes of data following the ncards header cards at hdr, padded
+  to whole FITS blocks, or -1 if the header doesn't say.
+*/
+long long evt0_data_bytes(const char *hdr, long ncards)
+{
+  char key[FLEN_KEYWORD], value[FLEN_VALUE];
+  long long n = 1, pcount = 0, gcount = 1;
+  int naxis, bitpix, i;
+
+  if ( evt0_card_value(hdr, ncards, "BITPIX", value) )
+    return -1;
+  bitpix = abs(atoi(value));
+  if ( evt0_card_value(hdr, ncards, "NAXIS", value) )
+    return -1;
+  naxis = atoi(value);
+  for ( i = 1; i <= naxis; i++ )
+    {
+      snprintf(key, sizeof(key), "NAXIS%d", i);
+      if ( evt0_card_value(hdr, ncards, key, value) )
+	return -1;
+      n *= atoll(value);
+    }
+  if ( naxis == 0 )
+    n = 0;
+  if ( evt0_card_value(hdr, ncards, "PCOUNT", value) == 0 )
+    pcount = atoll(value);
+  if ( evt0_card_value(hdr, ncards, "GCOUNT", value) == 0 )
+    gcount = atoll(value);
+  n = bitpix/8*gcount*(pcount + n);
+  return (n + 2880 - 1)/2880*2880;
+}
+
+/* as evt0_card_value(), from ks; returns -1 on a cfitsio error */
+static int get_key(const key_src *ks, const char *key, char *value,
+		   int *status)
+{
+  if ( !ks->fptr )
+    return evt0_card_value(ks->hdr, ks->ncards, key, value);
+
+  if ( fits_read_key(ks->fptr, TSTRING, (char *)key, value, NULL,
+		     status) == KEY_NO_EXIST )
+    {
+      *status = 0;
+      return 1;
+    }
+  return *status ? -1 : 0;
+}
+
+static long key_long(const key_src *ks, const char *key, long def,
+		     int *status)
+{
+  char value[FLEN_VALUE];
+
+  return get_key(ks, key, value, status) == 0 ? atol(value) : def;
+}
+
+/* is column i stored without TSCAL/TZERO scaling? */
+static int unscaled(const key_src *ks, int i, int *status)
+{
+  char key[FLEN_KEYWORD], value[FLEN_VALUE];
+  double scale = 1.0, zero = 0.0;
+
+  snprintf(key, sizeof(key), "TSCAL%d", i);
+  if ( get_key(ks, key, value, status) == 0 )
+    scale = atof(value);
+  snprintf(key, sizeof(key), "TZERO%d", i);
+  if ( get_key(ks, key, value, status) == 0 )
+    zero = atof(value);
+  return *status == 0 && scale == 1.0 && zero == 0.0;
+}
+
+/* find the row offsets of the wanted columns; 0 if they can be mapped */
+static int map_columns(evt0_map *m, const key_src *ks, int *status)
+{
+  char key[FLEN_KEYWORD], value[FLEN_VALUE], tform[FLEN_VALUE];
+  int colnum[EVT0_NCOLS], ncols, typecode, i, k;
+  long repeat, width, pos;
+
+  ncols = key_long(ks, "TFIELDS", -1, status);
+  if ( *status || ncols < 0 )
+    return -1;
+  for ( k = 0; k < EVT0_NCOLS; k++ )
+    colnum[k] = 0;
+  for ( i = 1; i <= ncols; i++ )
+    {
+      snprintf(key, sizeof(key), "TTYPE%d", i);
+      if ( get_key(ks, key, value, status) < 0 )
+	return -1;
+      for ( k = 0; k < EVT0_NCOLS; k++ )
+	if ( !colnum[k] && !strcasecmp(value, evt0_colnames[k]) )
+	  colnum[k] = i;
+    }
+  for ( k = 0; k < EVT0_NCOLS; k++ )
+    if ( (m->cols & (1 << k)) && !colnum[k] )
+      return -1;
+
+  for ( i = 1, pos = 0; i <= ncols; i++ )
+    {
+      snprintf(key, sizeof(key), "TFORM%d", i);
+      if ( get_key(ks, key, tform, status)
+	   || fits_binary_tform(tform, &typecode, &repeat, &width, status) )
+	return -1;
+
+      for ( k = 0; k < EVT0_NCOLS; k++ )
+	{
+	  if ( colnum[k] != i || !(m->cols & (1 << k)) )
+	    continue;
+	  if ( typecode == TSHORT && repeat == 1 )
+	    m->size[k] = 2;
+	  else if ( (typecode == TBYTE && repeat == 1)
+		    || (typecode == TBIT && repeat <= 8) )
+	    m->size[k] = 1;
+	  else
+	    return -1;
+	  if ( !unscaled(ks, i, status) )
+	    return -1;
+	  m->off[k] = pos;
+	}
+      pos += tform_bytes(tform, typecode, repeat, width);
+    }
+
+  /* a check that the offsets were worked out right */
+  return pos == m->rowlen ? 0 : -1;
+}
+
+/*
+  Set up m for the EVT0_* columns in cols of a table that isn't mapped
+  but read into memory by the caller, given the ncards cards of its
+  header at hdr. The caller points m->data at the rows. Returns 0, or
+  -1 if the columns can't be read this way.
+*/
+int evt0_map_header(evt0_map *m, const char *hdr, long ncards,
+		    unsigned cols)
+{
+  key_src ks;
+  int status = 0, ok;
+
+  ks.fptr = 0;
+  ks.hdr = hdr;
+  ks.ncards = ncards;
+  m->map = 0;
+  m->maplen = 0;
+  m->data = 0;
+  m->cols = cols & EVT0_ALL;
+  m->rowlen = key_long(&ks, "NAXIS1", -1, &status);
+  m->nrows = key_long(&ks, "NAXIS2", -1, &status);
+
+  fits_write_errmark();
+  ok = m->rowlen >= 0 && m->nrows >= 0 && map_columns(m, &ks, &status) == 0;
+  fits_clear_errmark();
+  return ok ? 0 : -1;
+}
+
+/*
+  Map the current HDU of fptr, which was opened as filename, for
+  reading the EVT0_* columns in cols. Returns 0 on success, or -1 if
+  the table has to be read through cfitsio.
+*/
+int evt0_map_open(evt0_map *m, fitsfile *fptr, const char *filename,
+		  unsigned cols)
+{
+  char urltype[MAX_PREFIX_LEN], path[FLEN_FILENAME], outfile[FLEN_FILENAME];
+  char extspec[FLEN_FILENAME], filter[FLEN_FILENAME];
+  char binspec[FLEN_FILENAME], colspec[FLEN_FILENAME];
+  LONGLONG headstart, datastart, dataend;
+  key_src ks;
+  struct stat st;
+  unsigned char *p;
+  void *map;
+  int fd, status = 0, ok, rw = (cols & EVT0_MAP_WRITE) != 0;
+
+  m->map = 0;
+  m->cols = cols & EVT0_ALL;
+  ks.fptr = fptr;
+  ks.hdr = 0;
+  ks.ncards = 0;
+
+  /* errors here only mean falling back to cfitsio, so don't keep them */
+  fits_write_errmark();
+  ok = fits_parse_input_url((char *)filename, urltype, path, outfile,
+			    extspec, filter, binspec, colspec, &status) == 0
+    && (!*urltype || !strcmp(urltype, "file://"))
+    && !*outfile && !*filter && !*binspec && !*colspec
+    && fits_get_hduaddrll(fptr, &headstart, &datastart, &dataend,
+			  &status) == 0
+    && fits_read_key(fptr, TLONG, "NAXIS1", &m->rowlen, NULL, &status) == 0
+    && fits_read_key(fptr, TLONG, "NAXIS2", &m->nrows, NULL, &status) == 0
+    && map_columns(m, &ks, &status) == 0;
+  fits_clear_errmark();
+  if ( !ok )
+    return -1;
+
+  if ( (fd = open(path, rw ? O_RDWR : O_RDONLY)) < 0 )
+    return -1;
+  if ( fstat(fd, &st)
+       || st.st_size < datastart + (LONGLONG)m->rowlen*m->nrows )
+    {
+      close(fd);
+      return -1;
+    }
+  map = mmap(0, st.st_size, rw ? PROT_READ | PROT_WRITE : PROT_READ,
+	     MAP_SHARED, fd, 0);
+  close(fd);
+  if ( map == MAP_FAILED )
+    return -1;
+
+  /* make sure cfitsio was reading this file and not a decompressed copy */
+  p = map;
+  if ( memcmp(p, "SIMPLE  =", 9)
+       || memcmp(p + headstart, "XTENSION= 'BINTABLE'", 20) )
+    {
+      munmap(map, st.st_size);
+      return -1;
+    }
+  madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+  m->map = map;
+  m->maplen = st.st_size;
+  m->data = p + datastart;
+  return 0;
+}
+
+void evt0_map_close(evt0_map *m)
+{
+  if ( m->map )
+    munmap(m->map, m->maplen);
+  m->map = 0;
+}
+
+/* the raw bytes of the table starting at row (1-based) */
+const unsigned char *evt0_map_rows(const evt0_map *m, long row)
+{
+  return m->data + (row - 1)*m->rowlen;
+}
+
+/* the column of blk for EVT0_* bit k */
+void *evt0_block_col(const evt0_block *blk, int k)
+{
+  switch (k)
+    {
+    case 0: return blk->amp_sf;
+    case 1: return blk->pha;
+    case 2: return blk->vstat;
+    case 3: return blk->au1;
+    case 4: return blk->au2;
+    case 5: return blk->au3;
+    case 6: return blk->av1;
+    case 7: return blk->av2;
+    default: return blk->av3;
+    }
+}
+
+void evt0_map_read(const evt0_map *m, evt0_block *blk, long row)
+{
+  void *dst[EVT0_NCOLS];
+  const unsigned char *r = evt0_map_rows(m, row), *p;
+  long j, n = blk->n, rowlen = m->rowlen;
+  unsigned short x;
+  v8u16 v;
+  int i, k;
+
+  for ( k = 0; k < EVT0_NCOLS; k++ )
+    dst[k] = evt0_block_col(blk, k);
+
+  /* eight rows at a time, all columns while the rows are in cache */
+  for ( j = 0; j + 8 <= n; j += 8, r += 8*rowlen )
+    for ( k = 0; k < EVT0_NCOLS; k++ )
+      {
+	if ( !(m->cols & (1 << k)) )
+	  continue;
+	p = r + m->off[k];
+	if ( m->size[k] == 1 )
+	  {
+	    for ( i = 0; i < 8; i++ )
+	      ((unsigned char *)dst[k])[j+i] = p[i*rowlen];
+	  }
+	else
+	  {
+	    for ( i = 0; i < 8; i++ )
+	      {
+		memcpy(&x, p + i*rowlen, 2);
+		v[i] = x;
+	      }
+	    v = (v << 8) | (v >> 8);
+	    memcpy((short *)dst[k] + j, &v, sizeof(v));
+	  }
+      }
+
+  for ( ; j < n; j++, r += rowlen )
+    for ( k = 0; k < EVT0_NCOLS; k++ )
+      {
+	if ( !(m->cols & (1 << k)) )
+	  continue;
+	p = r + m->off[k];
+	if ( m->size[k] == 1 )
+	  ((unsigned char *)dst[k])[j] = p[0];
+	else
+	  ((short *)dst[k])[j] = (short)(p[0] << 8 | p[1]);
+      }
+}
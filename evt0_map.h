@@ -0,0 +1,65 @@
+/*
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+            evt0_map.h
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+
+Memory-mapped reading of the level 0 event columns straight from an
+uncompressed EVENTS table. See evt0_map.c.
+
+*/
+
+#ifndef EVT0_MAP_H
+#define EVT0_MAP_H
+
+#include "fitsio.h"
+
+#include "evt0_kernels.h"
+
+/* the evt0_block columns, as bits for evt0_map_open() */
+#define EVT0_AMP_SF 0x001
+#define EVT0_PHA 0x002
+#define EVT0_VSTAT 0x004
+#define EVT0_AU1 0x008
+#define EVT0_AU2 0x010
+#define EVT0_AU3 0x020
+#define EVT0_AV1 0x040
+#define EVT0_AV2 0x080
+#define EVT0_AV3 0x100
+#define EVT0_ALL 0x1ff
+#define EVT0_NCOLS 9
+
+/* the column names, in the order of the EVT0_* bits */
+extern char *evt0_colnames[EVT0_NCOLS];
+
+/* or'ed into the columns, map the file writable and shared */
+#define EVT0_MAP_WRITE 0x10000
+
+typedef struct
+{
+  void *map;
+  size_t maplen;
+  const unsigned char *data;	/* first row of the table */
+  long rowlen, nrows;
+  unsigned cols;		/* EVT0_* columns read by evt0_map_read */
+  int off[EVT0_NCOLS];		/* byte offset in the row */
+  int size[EVT0_NCOLS];		/* 1 or 2 */
+} evt0_map;
+
+int evt0_map_open(evt0_map *m, fitsfile *fptr, const char *filename,
+		  unsigned cols);
+void evt0_profile_keys(fitsfile *fptr, char *detnam, char *date_obs,
+		       char *ampsfcor);
+int evt0_card_value(const char *hdr, long ncards, const char *key,
+		    char *value);
+long long evt0_data_bytes(const char *hdr, long ncards);
+int evt0_map_header(evt0_map *m, const char *hdr, long ncards,
+		    unsigned cols);
+void evt0_map_close(evt0_map *m);
+long evt0_col_offset(fitsfile *fptr, int colnum, int *status);
+int evt0_stamp_hdu(fitsfile *out, const char *creator, const char *date,
+		   int *status);
+void *evt0_block_col(const evt0_block *blk, int k);
+void evt0_map_read(const evt0_map *m, evt0_block *blk, long row);
+const unsigned char *evt0_map_rows(const evt0_map *m, long row);
+
+#endif
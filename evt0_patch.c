@@ -0,0 +1,267 @@
+/*
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+            evt0_patch.c
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+
+Patch-only output for the evt0 tools. They change a few columns of a
+few percent of the events, yet copied the whole file and rewrote
+whole columns. Here the output starts as a clone of the input -- a
+reflink where the file system can share extents, otherwise an
+in-kernel copy_file_range() -- and only the runs of cells whose value
+actually changed are written back.
+
+The FITS data checksum is a ones' complement sum of big-endian 32-bit
+words, i.e. a sum modulo 2^32-1 in which every byte has a fixed
+weight. So DATASUM can be brought up to date from the changed bytes
+alone, and then only the header needs summing for CHECKSUM. If the
+input has no checksums, they are computed in full as before.
+
+Patching needs the input table memory-mapped (see evt0_map.c) for the
+old values. If wdata is set, changed cells are stored straight into
+that image of the table -- which may be the mapping of the output
+itself -- instead of going through cfitsio.
+
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <linux/fs.h>
+
+#include "evt0_patch.h"
+
+#define ONES_MOD 0xffffffffULL
+
+/* read/write copy for when the kernel can't do it */
+static int copy_plain(int in, int out)
+{
+  char buf[1 << 16];
+  ssize_t n, w, off;
+
+  if ( lseek(in, 0, SEEK_SET) || lseek(out, 0, SEEK_SET)
+       || ftruncate(out, 0) )
+    return -1;
+  while ( (n = read(in, buf, sizeof(buf))) > 0 )
+    for ( off = 0; off < n; off += w )
+      if ( (w = write(out, buf + off, n - off)) < 0 )
+	return -1;
+  return n < 0 ? -1 : 0;
+}
+
+/*
+  Copy len bytes from the start of in, whatever its file offset. Only
+  a kernel that can't copy between these files falls back to read and
+  write.
+*/
+static int copy_fd(int in, int out, off_t len)
+{
+  loff_t ioff = 0, ooff = 0;
+  ssize_t n;
+
+#ifdef FICLONE
+  if ( ioctl(out, FICLONE, in) == 0 )
+    return 0;
+#endif
+  while ( ioff < len )
+    {
+      n = copy_file_range(in, &ioff, out, &ooff, len - ioff, 0);
+      if ( n < 0 && (errno == EXDEV || errno == ENOSYS || errno == EINVAL) )
+	return copy_plain(in, out);
+      if ( n <= 0 )
+	return -1;
+    }
+  return 0;
+}
+
+/*
+  Make outname a copy of the uncompressed FITS file filename. As with
+  cfitsio, a leading '!' in outname overwrites an existing file.
+  Returns 0 on success, or -1 if the input can't be cloned and the
+  output has to be written in full.
+*/
+int evt0_clone(const char *filename, const char *outname)
+{
+  char urltype[MAX_PREFIX_LEN], path[FLEN_FILENAME], outfile[FLEN_FILENAME];
+  char extspec[FLEN_FILENAME], filter[FLEN_FILENAME];
+  char binspec[FLEN_FILENAME], colspec[FLEN_FILENAME];
+  char magic[9];
+  struct stat st;
+  int in, out, flags = O_WRONLY | O_CREAT | O_EXCL, status = 0;
+
+  fits_write_errmark();
+  if ( fits_parse_input_url((char *)filename, urltype, path, outfile,
+			    extspec, filter, binspec, colspec, &status)
+       || (*urltype && strcmp(urltype, "file://"))
+       || *outfile || *filter || *binspec || *colspec )
+    {
+      fits_clear_errmark();
+      return -1;
+    }
+  fits_clear_errmark();
+
+  if ( (in = open(path, O_RDONLY)) < 0 )
+    return -1;
+  if ( fstat(in, &st) || read(in, magic, 9) != 9
+       || memcmp(magic, "SIMPLE  =", 9) )
+    {
+      close(in);
+      return -1;
+    }
+
+  if ( *outname == '!' )
+    {
+      outname++;
+      flags = O_WRONLY | O_CREAT | O_TRUNC;
+    }
+  if ( (out = open(outname, flags, 0666)) < 0 )
+    {
+      close(in);
+      return -1;
+    }
+
+  if ( copy_fd(in, out, st.st_size) )
+    {
+      close(in);
+      close(out);
+      unlink(outname);
+      return -1;
+    }
+  close(in);
+  return close(out) ? -1 : 0;
+}
+
+void evt0_patch_init(evt0_patch *pt, fitsfile *fptr, const evt0_map *map)
+{
+  pt->fptr = fptr;
+  pt->map = map;
+  pt->wdata = 0;
+  pt->dsum = 0;
+  pt->ncells = pt->nruns = 0;
+}
+
+/* add (new - old) for one byte at data offset pos to the checksum change */
+static void sum_byte(evt0_patch *pt, long long pos, unsigned oldb,
+		     unsigned newb)
+{
+  int shift = 8*(3 - (int)(pos & 3));
+
+  pt->dsum += ((unsigned long long)newb << shift)
+    + (ONES_MOD - ((unsigned long long)oldb << shift));
+  pt->dsum %= ONES_MOD;
+}
+
+/*
+  Write the values vals of column col (an EVT0_* bit) for rows [row,
+  row+n) where they differ from the input, coalesced into runs of
+  consecutive rows. colnum is the column number in the output, not
+  needed when writing to wdata.
+*/
+int evt0_patch_col(evt0_patch *pt, unsigned col, int colnum, long row,
+		   long n, const void *vals, int *status)
+{
+  const evt0_map *m = pt->map;
+  const unsigned char *b = vals, *p;
+  const short *s = vals;
+  unsigned char *w;
+  long long pos;
+  long j, start;
+  int k = __builtin_ctz(col), size = m->size[k];
+  short v;
+
+  p = evt0_map_rows(m, row) + m->off[k];
+  pos = (long long)(row - 1)*m->rowlen + m->off[k];
+  w = pt->wdata ? pt->wdata + pos : 0;
+
+  for ( j = 0; j < n && !*status; )
+    {
+      for ( ; j < n; j++ )
+	if ( size == 1 ? b[j] != p[j*m->rowlen]
+	     : s[j] != (short)(p[j*m->rowlen] << 8 | p[j*m->rowlen + 1]) )
+	  break;
+      if ( j == n )
+	break;
+
+      for ( start = j; j < n; j++ )
+	{
+	  if ( size == 1 )
+	    {
+	      if ( b[j] == p[j*m->rowlen] )
+		break;
+	      sum_byte(pt, pos + j*m->rowlen, p[j*m->rowlen], b[j]);
+	      if ( w )
+		w[j*m->rowlen] = b[j];
+	    }
+	  else
+	    {
+	      v = (short)(p[j*m->rowlen] << 8 | p[j*m->rowlen + 1]);
+	      if ( s[j] == v )
+		break;
+	      sum_byte(pt, pos + j*m->rowlen, p[j*m->rowlen],
+		       (unsigned short)s[j] >> 8);
+	      sum_byte(pt, pos + j*m->rowlen + 1, p[j*m->rowlen + 1],
+		       s[j] & 0xff);
+	      if ( w )
+		{
+		  w[j*m->rowlen] = (unsigned short)s[j] >> 8;
+		  w[j*m->rowlen + 1] = s[j] & 0xff;
+		}
+	    }
+	}
+
+      if ( !w && size == 1 )
+	fits_write_col(pt->fptr, TBYTE, colnum, row + start, 1, j - start,
+		       (void *)(b + start), status);
+      else if ( !w )
+	fits_write_col(pt->fptr, TSHORT, colnum, row + start, 1, j - start,
+		       (void *)(s + start), status);
+      pt->ncells += j - start;
+      pt->nruns++;
+    }
+  return *status;
+}
+
+/* add the changes counted in from, e.g. by another thread, to to */
+void evt0_patch_merge(evt0_patch *to, const evt0_patch *from)
+{
+  to->dsum = (to->dsum + from->dsum) % ONES_MOD;
+  to->ncells += from->ncells;
+  to->nruns += from->nruns;
+}
+
+/*
+  Bring DATASUM and CHECKSUM of the patched HDU up to date. Call after
+  any other header changes.
+*/
+int evt0_patch_finish(evt0_patch *pt, int *status)
+{
+  char datasum[FLEN_VALUE], checksum[FLEN_VALUE];
+  unsigned long long sum, old;
+
+  if ( *status )
+    return *status;
+
+  fits_write_errmark();
+  if ( fits_read_key(pt->fptr, TSTRING, "DATASUM", datasum, NULL, status)
+       || fits_read_key(pt->fptr, TSTRING, "CHECKSUM", checksum, NULL,
+			status) )
+    {
+      fits_clear_errmark();
+      *status = 0;
+      return fits_write_chksum(pt->fptr, status);
+    }
+  fits_clear_errmark();
+
+  old = strtoull(datasum, 0, 10);
+  sum = (old % ONES_MOD + pt->dsum) % ONES_MOD;
+  if ( sum == 0 && old != 0 )
+    sum = ONES_MOD;		/* ones' complement -0 */
+  snprintf(datasum, sizeof(datasum), "%llu", sum);
+  fits_update_key(pt->fptr, TSTRING, "DATASUM", datasum, NULL, status);
+  return fits_update_chksum(pt->fptr, status);
+}
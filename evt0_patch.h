@@ -0,0 +1,34 @@
+/*
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+            evt0_patch.h
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+
+Patch-only output: clone the input file and rewrite only the event
+cells that change. See evt0_patch.c.
+
+*/
+
+#ifndef EVT0_PATCH_H
+#define EVT0_PATCH_H
+
+#include "fitsio.h"
+
+#include "evt0_map.h"
+
+typedef struct
+{
+  fitsfile *fptr;		/* the clone, at the HDU being patched */
+  const evt0_map *map;		/* the same HDU of the input */
+  unsigned char *wdata;		/* if set, write cells here, not via fptr */
+  unsigned long long dsum;	/* change to DATASUM, modulo 2^32-1 */
+  long ncells, nruns;
+} evt0_patch;
+
+int evt0_clone(const char *filename, const char *outname);
+void evt0_patch_init(evt0_patch *pt, fitsfile *fptr, const evt0_map *map);
+int evt0_patch_col(evt0_patch *pt, unsigned col, int colnum, long row,
+		   long n, const void *vals, int *status);
+void evt0_patch_merge(evt0_patch *to, const evt0_patch *from);
+int evt0_patch_finish(evt0_patch *pt, int *status);
+
+#endif
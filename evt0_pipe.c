@@ -0,0 +1,218 @@
+/*
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+            evt0_pipe.c
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+
+Runs the read, correct and write steps of the evt0 tools as a
+pipeline, so the disk is busy while the CPU corrects and vice versa.
+
+The calling thread reads, a pool of workers corrects, and one writer
+thread writes. A fixed set of chunks cycles through the states
+FREE -> READ -> BUSY -> DONE -> FREE, which bounds memory to nchunks
+row blocks. The writer takes chunks strictly in row order, so the
+output is the same as from a serial run.
+
+Reading and writing happen in different threads on different
+fitsfiles, which needs cfitsio built with --enable-reentrant.
+
+*/
+
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "evt0_pipe.h"
+
+#define CH_FREE 0
+#define CH_READ 1
+#define CH_BUSY 2
+#define CH_DONE 3
+
+typedef struct
+{
+  evt0_pipe *pp;
+  evt0_chunk *chunks;
+  int eof;			/* set once everything has been read */
+  int status;			/* first error from read or write */
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+} pipe_state;
+
+/* the READ chunk with the lowest seq, or 0 */
+static evt0_chunk *next_ready(pipe_state *ps)
+{
+  evt0_chunk *best = 0;
+  int i;
+
+  for ( i = 0; i < ps->pp->nchunks; i++ )
+    if ( ps->chunks[i].state == CH_READ
+	 && (!best || ps->chunks[i].seq < best->seq) )
+      best = &ps->chunks[i];
+  return best;
+}
+
+static evt0_chunk *find_seq(pipe_state *ps, long seq, int state)
+{
+  int i;
+
+  for ( i = 0; i < ps->pp->nchunks; i++ )
+    if ( ps->chunks[i].state == state && ps->chunks[i].seq == seq )
+      return &ps->chunks[i];
+  return 0;
+}
+
+static void *worker(void *arg)
+{
+  pipe_state *ps = arg;
+  evt0_chunk *ch = 0;
+
+  pthread_mutex_lock(&ps->lock);
+  for (;;)
+    {
+      while ( !ps->status && !(ch = next_ready(ps)) && !ps->eof )
+	pthread_cond_wait(&ps->cond, &ps->lock);
+      if ( ps->status || !ch )
+	break;
+      ch->state = CH_BUSY;
+      pthread_mutex_unlock(&ps->lock);
+
+      ps->pp->compute(ps->pp->ctx, ch);
+
+      pthread_mutex_lock(&ps->lock);
+      ch->state = CH_DONE;
+      pthread_cond_broadcast(&ps->cond);
+    }
+  pthread_mutex_unlock(&ps->lock);
+  return 0;
+}
+
+static void *writer(void *arg)
+{
+  pipe_state *ps = arg;
+  evt0_chunk *ch;
+  long seq, nseq;
+  int status;
+
+  nseq = (ps->pp->nrows + ps->pp->chunk_rows - 1) / ps->pp->chunk_rows;
+  for ( seq = 0; seq < nseq; seq++ )
+    {
+      pthread_mutex_lock(&ps->lock);
+      ch = 0;
+      while ( !ps->status && !(ch = find_seq(ps, seq, CH_DONE)) )
+	pthread_cond_wait(&ps->cond, &ps->lock);
+      pthread_mutex_unlock(&ps->lock);
+      if ( !ch )
+	break;
+
+      status = ps->pp->write(ps->pp->ctx, ch);
+
+      pthread_mutex_lock(&ps->lock);
+      if ( status && !ps->status )
+	ps->status = status;
+      ch->state = CH_FREE;
+      pthread_cond_broadcast(&ps->cond);
+      pthread_mutex_unlock(&ps->lock);
+    }
+  return 0;
+}
+
+/*
+  Run the pipeline over all rows. user, if not 0, holds nchunks
+  pointers handed to the chunks. Returns the first nonzero status from
+  read or write, -1 if the pipeline could not be set up, else 0.
+*/
+int evt0_pipe_run(evt0_pipe *pp, void **user)
+{
+  pipe_state ps;
+  pthread_t *workers, wtid;
+  evt0_chunk *ch;
+  long seq, nseq;
+  int i, nstarted = 0, have_writer = 0, status;
+
+  ps.pp = pp;
+  ps.status = 0;
+  ps.eof = 0;
+  ps.chunks = CALLOC(pp->nchunks, evt0_chunk);
+  workers = CALLOC(pp->nworkers, pthread_t);
+  if ( !ps.chunks || !workers )
+    {
+      free(ps.chunks);
+      free(workers);
+      return -1;
+    }
+  for ( i = 0; i < pp->nchunks; i++ )
+    {
+      if ( evt0_block_alloc(&ps.chunks[i].blk, pp->chunk_rows) )
+	{
+	  while ( i-- > 0 )
+	    evt0_block_free(&ps.chunks[i].blk);
+	  free(ps.chunks);
+	  free(workers);
+	  return -1;
+	}
+      ps.chunks[i].state = CH_FREE;
+      ps.chunks[i].user = user ? user[i] : 0;
+    }
+
+  pthread_mutex_init(&ps.lock, 0);
+  pthread_cond_init(&ps.cond, 0);
+
+  for ( i = 0; i < pp->nworkers; i++ )
+    if ( pthread_create(&workers[nstarted], 0, worker, &ps) == 0 )
+      nstarted++;
+  if ( nstarted > 0 && pthread_create(&wtid, 0, writer, &ps) == 0 )
+    have_writer = 1;
+  else
+    ps.status = -1;
+
+  /* the calling thread reads */
+  nseq = (pp->nrows + pp->chunk_rows - 1) / pp->chunk_rows;
+  pthread_mutex_lock(&ps.lock);
+  for ( seq = 0; seq < nseq && !ps.status; seq++ )
+    {
+      for (;;)
+	{
+	  for ( i = 0, ch = 0; i < pp->nchunks && !ch; i++ )
+	    if ( ps.chunks[i].state == CH_FREE )
+	      ch = &ps.chunks[i];
+	  if ( ch || ps.status )
+	    break;
+	  pthread_cond_wait(&ps.cond, &ps.lock);
+	}
+      if ( ps.status )
+	break;
+      pthread_mutex_unlock(&ps.lock);
+
+      ch->seq = seq;
+      ch->row = 1 + seq * pp->chunk_rows;
+      ch->blk.n = pp->nrows - (ch->row - 1);
+      if ( ch->blk.n > pp->chunk_rows )
+	ch->blk.n = pp->chunk_rows;
+      status = pp->read(pp->ctx, ch);
+
+      pthread_mutex_lock(&ps.lock);
+      if ( status && !ps.status )
+	ps.status = status;
+      if ( !status )
+	ch->state = CH_READ;
+      pthread_cond_broadcast(&ps.cond);
+    }
+
+  /* idle workers can stop once there is nothing more to read */
+  ps.eof = 1;
+  pthread_cond_broadcast(&ps.cond);
+  pthread_mutex_unlock(&ps.lock);
+
+  if ( have_writer )
+    pthread_join(wtid, 0);
+  for ( i = 0; i < nstarted; i++ )
+    pthread_join(workers[i], 0);
+  status = ps.status;
+
+  pthread_mutex_destroy(&ps.lock);
+  pthread_cond_destroy(&ps.cond);
+  for ( i = 0; i < pp->nchunks; i++ )
+    evt0_block_free(&ps.chunks[i].blk);
+  free(ps.chunks);
+  free(workers);
+  return status;
+}
@@ -0,0 +1,45 @@
+/*
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+            evt0_pipe.h
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+
+Reader / correction workers / ordered writer pipeline over the row
+blocks of an events table. See evt0_pipe.c.
+
+*/
+
+#ifndef EVT0_PIPE_H
+#define EVT0_PIPE_H
+
+#include "evt0_kernels.h"
+
+typedef struct
+{
+  long seq;			/* position of the chunk in the table */
+  long row;			/* first row, 1-based */
+  evt0_block blk;		/* blk.n is the number of rows in the chunk */
+  int state;
+  void *user;			/* per-chunk buffers owned by the caller */
+} evt0_chunk;
+
+typedef struct
+{
+  long nrows;			/* rows in the table */
+  long chunk_rows;		/* rows per chunk */
+  int nworkers;
+  int nchunks;			/* chunks in flight, bounds memory use */
+
+  /*
+    read and write run in one thread each and are called in row
+    order; compute runs concurrently in the workers. read and write
+    return a cfitsio status, nonzero stops the pipeline.
+  */
+  int (*read)(void *ctx, evt0_chunk *ch);
+  void (*compute)(void *ctx, evt0_chunk *ch);
+  int (*write)(void *ctx, evt0_chunk *ch);
+  void *ctx;
+} evt0_pipe;
+
+int evt0_pipe_run(evt0_pipe *pp, void **user);
+
+#endif
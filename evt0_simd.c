@@ -0,0 +1,279 @@
+/*
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+            evt0_simd.c
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+
+Vectorized version of the tap ringing correction in evt0_kernels.c,
+with the instruction set picked at run time.
+
+For each axis the events needing a correction are first compacted
+into dense double arrays, so every vector lane does useful work. The
+phase shift and sinusoid are then evaluated eight events at a time
+with vector versions of the Cephes log, exp and sin routines, and the
+results are rounded, clamped and scattered back exactly as in the
+scalar code. The phase argument has to stay in double precision: for
+small tap 1 values pow(a2/a1, g) reaches ~1e7.
+
+Lanes outside the domain the vector routines handle (non-positive
+taps, huge phase arguments) are done with the scalar code. Results
+can still differ from libm in the last bit, which changes a rounded
+tap value only very rarely; tap_verify() counts how often.
+
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "evt0_kernels.h"
+
+/* widest vector, in doubles */
+#define VL 8
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86_SIMD 1
+#endif
+
+/* events needing a correction on one axis, gathered from a block */
+typedef struct
+{
+  long n;
+  long *idx;
+  double *a1, *a2, *a3;
+} tap_work;
+
+static int tap_work_alloc(tap_work *w, long n)
+{
+  /* round up so the vector loop never needs a partial load */
+  long nalloc = (n + VL - 1) / VL * VL;
+
+  w->n = 0;
+  w->idx = CALLOC(nalloc, long);
+  w->a1 = CALLOC(nalloc, double);
+  w->a2 = CALLOC(nalloc, double);
+  w->a3 = CALLOC(nalloc, double);
+  return (w->idx && w->a1 && w->a2 && w->a3) ? 0 : -1;
+}
+
+static void tap_work_free(tap_work *w)
+{
+  free(w->idx);
+  free(w->a1);
+  free(w->a2);
+  free(w->a3);
+}
+
+/*
+  Select the events of one axis that get a correction and whose
+  arguments the vector code handles. The others that need correcting
+  are done here with the scalar code.
+*/
+static void tap_gather(evt0_block *blk, short *t1, short *t2, short *t3,
+		       int wbit, const tap_coeffs *c, int use_width,
+		       tap_work *w)
+{
+  long jj, k = 0;
+  int correct;
+
+  for( jj = 0; jj < blk->n; jj++ )
+    {
+      if ( blk->amp_sf[jj] != 3 || t1[jj] <= t3[jj] )
+	continue;
+      if ( use_width == 0 )
+	correct = t1[jj] > (c->e * t2[jj] + c->o);
+      else
+	correct = (blk->vstat[jj] & wbit) == 0;
+      if ( !correct )
+	continue;
+
+      if ( t1[jj] > 0 && t2[jj] > 0 )
+	{
+	  w->idx[k] = jj;
+	  w->a1[k] = t1[jj];
+	  w->a2[k] = t2[jj];
+	  w->a3[k] = t3[jj];
+	  k++;
+	}
+      else
+	t3[jj] = correct_tap(t1[jj], t2[jj], t3[jj], c);
+    }
+
+  w->n = k;
+
+  /* pad the last vector with harmless values */
+  for ( ; k % VL; k++ )
+    w->a1[k] = w->a2[k] = w->a3[k] = 1.0;
+}
+
+/*
+  Round, clamp and store the corrected values. The vector code marks
+  lanes it could not evaluate with a NaN.
+*/
+static void tap_scatter(short *t1, short *t2, short *t3,
+			const tap_coeffs *c, tap_work *w)
+{
+  long k, jj;
+  short t;
+
+  for ( k = 0; k < w->n; k++ )
+    {
+      jj = w->idx[k];
+      if ( w->a3[k] != w->a3[k] )
+	{
+	  t3[jj] = correct_tap(t1[jj], t2[jj], t3[jj], c);
+	  continue;
+	}
+      t = (short)(w->a3[k] + 0.5);
+      if(t < 0) t = 0;
+      if(t > 4095) t = 4095;
+      t3[jj] = t;
+    }
+}
+
+#ifdef HAVE_X86_SIMD
+
+/*
+  The helpers carry the target of the loop they are inlined into, so
+  that their vector arguments are passed in registers of that width
+  and gcc has no ABI change to note.
+*/
+#define VINLINE static inline __attribute__ ((always_inline, target (VTARGET)))
+
+/* 1.5*2^52: adding it rounds a double to an integer in the low bits */
+#define MAGIC 6755399441055744.0
+
+/* one copy of the vector math per vector width */
+#define VLEN 4
+#define VF(name) name##_4
+#define VTARGET "avx2,fma"
+#include "evt0_vmath.h"
+#undef VLEN
+#undef VF
+#undef VTARGET
+
+#define VLEN 8
+#define VF(name) name##_8
+#define VTARGET "avx512f"
+#include "evt0_vmath.h"
+#undef VLEN
+#undef VF
+#undef VTARGET
+
+__attribute__ ((target ("avx512f")))
+static void tap_vec_avx512(tap_work *w, const tap_coeffs *c)
+{
+  long k;
+
+  for ( k = 0; k < w->n; k += 8 )
+    tap_vec_8(w->a1 + k, w->a2 + k, w->a3 + k, c);
+}
+
+__attribute__ ((target ("avx2,fma")))
+static void tap_vec_avx2(tap_work *w, const tap_coeffs *c)
+{
+  long k;
+
+  for ( k = 0; k < w->n; k += 4 )
+    tap_vec_4(w->a1 + k, w->a2 + k, w->a3 + k, c);
+}
+
+#endif /* HAVE_X86_SIMD */
+
+/* the widest instruction set no wider than want that this CPU has */
+int tap_isa_select(int want)
+{
+#ifdef HAVE_X86_SIMD
+  __builtin_cpu_init();
+  if ( want >= TAP_ISA_AVX512 && __builtin_cpu_supports("avx512f") )
+    return TAP_ISA_AVX512;
+  if ( want >= TAP_ISA_AVX2 && __builtin_cpu_supports("avx2")
+       && __builtin_cpu_supports("fma") )
+    return TAP_ISA_AVX2;
+#endif
+  return TAP_ISA_SCALAR;
+}
+
+const char *tap_isa_name(int isa)
+{
+  switch (isa)
+    {
+    case TAP_ISA_AVX512: return "avx512";
+    case TAP_ISA_AVX2: return "avx2";
+    default: return "scalar";
+    }
+}
+
+/* isa should come from tap_isa_select() */
+void correct_taps_isa(evt0_block *blk, const tap_params *p, int isa)
+{
+  tap_work w;
+
+#ifndef HAVE_X86_SIMD
+  isa = TAP_ISA_SCALAR;
+#endif
+  if ( isa == TAP_ISA_SCALAR || tap_work_alloc(&w, blk->n) )
+    {
+      if ( isa != TAP_ISA_SCALAR )
+	tap_work_free(&w);
+      correct_taps(blk, p);
+      return;
+    }
+
+  tap_gather(blk, blk->au1, blk->au2, blk->au3, 0x10, &p->u, p->use_width,
+	     &w);
+#ifdef HAVE_X86_SIMD
+  if ( isa == TAP_ISA_AVX512 )
+    tap_vec_avx512(&w, &p->u);
+  else
+    tap_vec_avx2(&w, &p->u);
+#endif
+  tap_scatter(blk->au1, blk->au2, blk->au3, &p->u, &w);
+
+  tap_gather(blk, blk->av1, blk->av2, blk->av3, 0x20, &p->v, p->use_width,
+	     &w);
+#ifdef HAVE_X86_SIMD
+  if ( isa == TAP_ISA_AVX512 )
+    tap_vec_avx512(&w, &p->v);
+  else
+    tap_vec_avx2(&w, &p->v);
+#endif
+  tap_scatter(blk->av1, blk->av2, blk->av3, &p->v, &w);
+
+  tap_work_free(&w);
+}
+
+/*
+  Run the scalar reference on a copy of the block's taps and count the
+  AU3/AV3 values that differ from those already in the block, which
+  must have been corrected by correct_taps_isa() from the same input.
+  orig_au3/orig_av3 are the uncorrected third taps.
+*/
+void tap_verify(evt0_block *blk, const short *orig_au3,
+		const short *orig_av3, const tap_params *p,
+		long *ndiff_u, long *ndiff_v)
+{
+  evt0_block ref = *blk;
+  long jj;
+
+  ref.au3 = CALLOC(blk->n, short);
+  ref.av3 = CALLOC(blk->n, short);
+  if ( !ref.au3 || !ref.av3 )
+    {
+      free(ref.au3);
+      free(ref.av3);
+      return;
+    }
+  memcpy(ref.au3, orig_au3, blk->n * sizeof(short));
+  memcpy(ref.av3, orig_av3, blk->n * sizeof(short));
+
+  correct_taps(&ref, p);
+
+  for ( jj = 0; jj < blk->n; jj++ )
+    {
+      if ( ref.au3[jj] != blk->au3[jj] ) (*ndiff_u)++;
+      if ( ref.av3[jj] != blk->av3[jj] ) (*ndiff_v)++;
+    }
+
+  free(ref.au3);
+  free(ref.av3);
+}
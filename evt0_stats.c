@@ -0,0 +1,226 @@
+/*
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+            evt0_stats.c
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+
+Run statistics of the evt0 tools, to see where reprocessing time goes:
+seconds spent in each stage, rows and chunks processed, events whose
+taps were corrected and how many of those ended at the limits of the
+12-bit range, the AMP_SF reassignments as a from/to matrix, and a
+histogram of the time taken per chunk.
+
+The tools count only when a report is asked for. The stage times are
+summed over chunks; when the stages overlap (hrc_evt0_correct -j, or
+batch mode) they are the time each stage was busy, summed over
+threads, and may add up to more than the wall time.
+
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "evt0_stats.h"
+
+static const char *stage_names[EVT0_NSTAGES] =
+  { "open", "header_copy", "read", "correct", "write", "checksum" };
+
+double evt0_now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + 1e-9*ts.tv_nsec;
+}
+
+void evt0_stats_init(evt0_stats *s)
+{
+  memset(s, 0, sizeof(*s));
+  s->start = evt0_now();
+}
+
+/* add from, e.g. the counts of one thread, to to */
+void evt0_stats_merge(evt0_stats *to, const evt0_stats *from)
+{
+  int i, j;
+
+  for ( i = 0; i < EVT0_NSTAGES; i++ )
+    to->t[i] += from->t[i];
+  to->rows += from->rows;
+  to->chunks += from->chunks;
+  for ( i = 0; i < 2; i++ )
+    {
+      to->ncorr[i] += from->ncorr[i];
+      to->clamp_lo[i] += from->clamp_lo[i];
+      to->clamp_hi[i] += from->clamp_hi[i];
+    }
+  for ( i = 0; i < 4; i++ )
+    for ( j = 0; j < 4; j++ )
+      to->ampsf[i][j] += from->ampsf[i][j];
+  for ( i = 0; i < EVT0_LAT_BINS; i++ )
+    to->lat[i] += from->lat[i];
+}
+
+/* count a chunk of n rows that took seconds from read to write */
+void evt0_stats_chunk(evt0_stats *s, long n, double seconds)
+{
+  double us = seconds*1e6;
+  int k = 0;
+
+  while ( us >= 2.0 && k < EVT0_LAT_BINS - 1 )
+    {
+      us /= 2.0;
+      k++;
+    }
+  s->lat[k]++;
+  s->rows += n;
+  s->chunks++;
+}
+
+/*
+  Count the AU3/AV3 of one axis corrected from orig to a3. An event
+  that ended at 0 or 4095 is counted as clamped only if its unclamped
+  value, worked out again as correct_tap() does, was out of range.
+*/
+static void count_axis(evt0_stats *s, int axis, const evt0_block *blk,
+		       const short *a1, const short *a2, const short *orig,
+		       const short *a3, const tap_coeffs *c, int use_width,
+		       int wbit)
+{
+  long j;
+  int sel;
+  short t;
+
+  for ( j = 0; j < blk->n; j++ )
+    {
+      if ( blk->amp_sf[j] != 3 )
+	continue;
+      /* the selection of correct_taps() */
+      if ( use_width )
+	sel = a1[j] > orig[j] && (blk->vstat[j] & wbit) == 0;
+      else
+	sel = a1[j] > orig[j] && a1[j] > (c->e * a2[j] + c->o);
+      if ( !sel )
+	continue;
+      s->ncorr[axis]++;
+      if ( a3[j] != 0 && a3[j] != 4095 )
+	continue;
+      t = (short)(orig[j] - tap_delta(a1[j], a2[j], c) + 0.5);
+      s->clamp_lo[axis] += t < 0;
+      s->clamp_hi[axis] += t > 4095;
+    }
+}
+
+/* count the tap corrections of a block, given its AU3/AV3 before */
+void evt0_stats_taps(evt0_stats *s, const evt0_block *blk,
+		     const short *orig_au3, const short *orig_av3,
+		     const tap_params *p)
+{
+  count_axis(s, 0, blk, blk->au1, blk->au2, orig_au3, blk->au3, &p->u,
+	     p->use_width, 0x10);
+  count_axis(s, 1, blk, blk->av1, blk->av2, orig_av3, blk->av3, &p->v,
+	     p->use_width, 0x20);
+}
+
+void evt0_stats_ampsf(evt0_stats *s, const unsigned char *from,
+		      const unsigned char *to, long n)
+{
+  long j;
+
+  for ( j = 0; j < n; j++ )
+    s->ampsf[from[j] <= 3 ? from[j] : 0][to[j] <= 3 ? to[j] : 0]++;
+}
+
+static void json_string(FILE *fp, const char *str)
+{
+  const unsigned char *p;
+
+  if ( !str )
+    {
+      fputs("null", fp);
+      return;
+    }
+  putc('"', fp);
+  for ( p = (const unsigned char *)str; *p; p++ )
+    {
+      if ( *p == '"' || *p == '\\' )
+	fprintf(fp, "\\%c", *p);
+      else if ( *p < 0x20 )
+	fprintf(fp, "\\u%04x", *p);
+      else
+	putc(*p, fp);
+    }
+  putc('"', fp);
+}
+
+/*
+  Write the report to filename, or to stdout for "-". sections picks
+  the EVT0_STATS_* counts that apply to the tool. Returns 0, or -1 if
+  the file can't be written.
+*/
+int evt0_stats_write(const evt0_stats *s, const char *filename,
+		     const char *tool, const char *infile,
+		     const char *outfile, unsigned sections)
+{
+  static const char *axes[2] = { "u", "v" };
+  FILE *fp;
+  int i, j, nlat;
+
+  if ( !strcmp(filename, "-") )
+    fp = stdout;
+  else if ( !(fp = fopen(filename, "w")) )
+    return -1;
+
+  fputs("{\n  \"tool\": ", fp);
+  json_string(fp, tool);
+  fputs(",\n  \"input\": ", fp);
+  json_string(fp, infile);
+  fputs(",\n  \"output\": ", fp);
+  json_string(fp, outfile);
+  fprintf(fp, ",\n  \"wall_s\": %.6f,\n  \"stages_s\": {",
+	  evt0_now() - s->start);
+  for ( i = 0; i < EVT0_NSTAGES; i++ )
+    fprintf(fp, "%s\"%s\": %.6f", i ? ", " : "", stage_names[i], s->t[i]);
+  fprintf(fp, "},\n  \"rows\": %lld,\n  \"chunks\": %lld", s->rows,
+	  s->chunks);
+
+  if ( sections & EVT0_STATS_TAPS )
+    {
+      fputs(",\n  \"taps\": {", fp);
+      for ( i = 0; i < 2; i++ )
+	fprintf(fp, "%s\n    \"%s\": {\"corrected\": %lld, \"clamped_0\": %lld,"
+		" \"clamped_4095\": %lld}", i ? "," : "", axes[i],
+		s->ncorr[i], s->clamp_lo[i], s->clamp_hi[i]);
+      fputs("\n  }", fp);
+    }
+
+  if ( sections & EVT0_STATS_AMPSF )
+    {
+      /* rows are the AMP_SF read, columns the AMP_SF written */
+      fputs(",\n  \"amp_sf\": {\n    \"values\": [\"other\", \"1\", \"2\", \"3\"],"
+	    "\n    \"from_to\": [", fp);
+      for ( i = 0; i < 4; i++ )
+	{
+	  fprintf(fp, "%s\n      [", i ? "," : "");
+	  for ( j = 0; j < 4; j++ )
+	    fprintf(fp, "%s%lld", j ? ", " : "", s->ampsf[i][j]);
+	  putc(']', fp);
+	}
+      fputs("\n    ]\n  }", fp);
+    }
+
+  /* bin k is [2^k, 2^(k+1)) us, the first also holding anything faster */
+  for ( nlat = EVT0_LAT_BINS; nlat > 1 && !s->lat[nlat - 1]; nlat-- )
+    ;
+  fputs(",\n  \"chunk_latency_us\": {\"bin_lower\": [", fp);
+  for ( i = 0; i < nlat; i++ )
+    fprintf(fp, "%s%.0f", i ? ", " : "", i ? (double)(1L << i) : 0.0);
+  fputs("], \"count\": [", fp);
+  for ( i = 0; i < nlat; i++ )
+    fprintf(fp, "%s%lld", i ? ", " : "", s->lat[i]);
+  fputs("]}\n}\n", fp);
+
+  if ( fp == stdout )
+    return fflush(fp) ? -1 : 0;
+  return fclose(fp) ? -1 : 0;
+}
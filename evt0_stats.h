@@ -0,0 +1,58 @@
+/*
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+            evt0_stats.h
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+
+Run statistics of the evt0 tools, written as JSON. See evt0_stats.c.
+
+*/
+
+#ifndef EVT0_STATS_H
+#define EVT0_STATS_H
+
+#include <stdio.h>
+
+#include "evt0_kernels.h"
+
+/* the timed stages */
+#define EVT0_T_OPEN 0
+#define EVT0_T_HEADER 1		/* copying HDUs, or cloning the input */
+#define EVT0_T_READ 2
+#define EVT0_T_CORRECT 3
+#define EVT0_T_WRITE 4
+#define EVT0_T_CHECKSUM 5
+#define EVT0_NSTAGES 6
+
+/* chunk latency bins: bin k counts [2^k, 2^(k+1)) microseconds, bin 0
+   everything under 2 */
+#define EVT0_LAT_BINS 32
+
+/* sections in the report */
+#define EVT0_STATS_TAPS 0x1
+#define EVT0_STATS_AMPSF 0x2
+
+typedef struct
+{
+  double start;			/* evt0_now() at evt0_stats_init() */
+  double t[EVT0_NSTAGES];	/* seconds in each stage */
+  long long rows, chunks;
+  long long ncorr[2];		/* events corrected, u and v */
+  long long clamp_lo[2], clamp_hi[2];	/* ... whose AU3/AV3 was clamped */
+  long long ampsf[4][4];	/* AMP_SF [from][to], 0 for values not 1-3 */
+  long long lat[EVT0_LAT_BINS];
+} evt0_stats;
+
+double evt0_now(void);
+void evt0_stats_init(evt0_stats *s);
+void evt0_stats_merge(evt0_stats *to, const evt0_stats *from);
+void evt0_stats_chunk(evt0_stats *s, long n, double seconds);
+void evt0_stats_taps(evt0_stats *s, const evt0_block *blk,
+		     const short *orig_au3, const short *orig_av3,
+		     const tap_params *p);
+void evt0_stats_ampsf(evt0_stats *s, const unsigned char *from,
+		      const unsigned char *to, long n);
+int evt0_stats_write(const evt0_stats *s, const char *filename,
+		     const char *tool, const char *infile,
+		     const char *outfile, unsigned sections);
+
+#endif
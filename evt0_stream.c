@@ -0,0 +1,384 @@
+/*
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+            evt0_stream.c
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+
+Sequential FITS stream mode for the evt0 tools, so that corrections
+can be chained with pipes instead of writing and reading back an
+intermediate file. cfitsio can read stdin and write stdout, but only
+by holding the whole file in memory; here the input is read front to
+back once and each row block of the EVENTS table is corrected and
+written as soon as it arrives, so memory use doesn't grow with the
+file and nothing seeks.
+
+HDUs other than EVENTS tables are passed through untouched, as in the
+patch mode of the tools. In an EVENTS table the DATE keyword is
+brought up to date, and the rows are unpacked with the column layout
+of evt0_map.c and the changed cells written back into the raw rows
+with evt0_patch_col().
+
+The header goes out before the data it describes, so the checksums
+of a corrected table can't be known when it is written. When the
+output is a named file they are brought up to date after the stream
+is done; when it is stdout, CHECKSUM and DATASUM of the corrected
+tables are blanked out so that they aren't taken as valid.
+
+A gzipped input file is decompressed on other threads as it is read
+(see evt0_gz.c); stdin has to be uncompressed FITS.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "fitsio.h"
+
+#include "evt0_stream.h"
+#include "evt0_map.h"
+#include "evt0_patch.h"
+#include "evt0_gz.h"
+
+#define FITS_BLOCK 2880
+#define CARDS_PER_BLOCK 36
+
+/* 0 if all n bytes were read, else the short count is an error */
+static int read_full(FILE *fp, void *buf, size_t n)
+{
+  return fread(buf, 1, n, fp) == n ? 0 : -1;
+}
+
+static int write_full(FILE *fp, const void *buf, size_t n)
+{
+  return fwrite(buf, 1, n, fp) == n ? 0 : -1;
+}
+
+/* pass n bytes from in to out */
+static int copy_bytes(FILE *in, FILE *out, long long n)
+{
+  static char buf[1 << 20];
+  size_t k;
+
+  while ( n > 0 )
+    {
+      k = n < (long long)sizeof(buf) ? (size_t)n : sizeof(buf);
+      if ( read_full(in, buf, k) || write_full(out, buf, k) )
+	return -1;
+      n -= k;
+    }
+  return 0;
+}
+
+/*
+  Read the next header into *hdr, growing it as needed. Returns the
+  number of cards read, whole blocks of them, 0 at the end of the
+  stream, or -1 on error.
+*/
+static long read_header(FILE *in, char **hdr, long *cap)
+{
+  long ncards = 0, i;
+  char *h;
+
+  for ( ;; )
+    {
+      if ( ncards + CARDS_PER_BLOCK > *cap )
+	{
+	  if ( !(h = realloc(*hdr, 80*(*cap + 10*CARDS_PER_BLOCK))) )
+	    return -1;
+	  *hdr = h;
+	  *cap += 10*CARDS_PER_BLOCK;
+	}
+      h = *hdr + 80*ncards;
+      if ( fread(h, 1, FITS_BLOCK, in) != FITS_BLOCK )
+	return ncards == 0 && feof(in) ? 0 : -1;
+      ncards += CARDS_PER_BLOCK;
+      for ( i = 0; i < CARDS_PER_BLOCK; i++ )
+	if ( !strncmp(h + 80*i, "END     ", 8) )
+	  return ncards;
+    }
+}
+
+/* overwrite the card for key, if there is one, with text */
+static void set_card(char *hdr, long ncards, const char *key,
+		     const char *text)
+{
+  char card[81];
+  size_t len = strlen(key);
+  long i;
+
+  snprintf(card, sizeof(card), "%-80s", text);
+  for ( i = 0; i < ncards; i++ )
+    if ( !strncmp(hdr + 80*i, key, len)
+	 && (len == 8 || hdr[80*i + len] == ' ') )
+      memcpy(hdr + 80*i, card, 80);
+}
+
+/* correct the table following an EVENTS header */
+static int stream_table(evt0_stream *sp, FILE *in, FILE *out, evt0_map *m)
+{
+  evt0_stats *st = sp->stats;
+  evt0_block blk;
+  evt0_patch pt;
+  unsigned char *buf;
+  long row, n, rows = sp->chunk_rows;
+  double t = 0.0, t0 = 0.0;
+  int k, status = 0;
+
+  if ( rows > m->nrows )
+    rows = m->nrows > 0 ? m->nrows : 1;
+  if ( !(buf = malloc((size_t)rows*m->rowlen))
+       || evt0_block_alloc(&blk, rows) )
+    {
+      free(buf);
+      fprintf(stderr, "%s: could not allocate buffers\n", sp->progname);
+      return -1;
+    }
+  m->data = buf;
+
+  for ( row = 1; row <= m->nrows && !status; row += n )
+    {
+      n = row + rows <= m->nrows ? rows : 1 + m->nrows - row;
+
+      if ( st )
+	t = evt0_now();
+      if ( read_full(in, buf, (size_t)n*m->rowlen) )
+	{
+	  fprintf(stderr, "%s: input ends in the EVENTS table\n",
+		  sp->progname);
+	  status = -1;
+	  break;
+	}
+      blk.n = n;
+      evt0_map_read(m, &blk, 1);
+      if ( st )
+	st->t[EVT0_T_READ] += evt0_now() - t;
+
+      sp->correct(sp->ctx, &blk);
+
+      if ( st )
+	t0 = evt0_now();
+      evt0_patch_init(&pt, 0, m);
+      pt.wdata = buf;
+      for ( k = 0; k < EVT0_NCOLS; k++ )
+	if ( sp->wcols & (1 << k) )
+	  evt0_patch_col(&pt, 1 << k, 0, 1, n, evt0_block_col(&blk, k),
+			 &status);
+      if ( write_full(out, buf, (size_t)n*m->rowlen) )
+	{
+	  fprintf(stderr, "%s: write error\n", sp->progname);
+	  status = -1;
+	}
+      if ( st )
+	{
+	  st->t[EVT0_T_WRITE] += evt0_now() - t0;
+	  evt0_stats_chunk(st, n, evt0_now() - t);
+	}
+    }
+
+  evt0_block_free(&blk);
+  free(buf);
+  return status ? -1 : 0;
+}
+
+/* bring the checksums of the EVENTS tables of the finished file up to date */
+static int fix_checksums(const char *outname, int *status)
+{
+  fitsfile *fptr;
+  char extname[FLEN_VALUE];
+  int hdunum, hdutype, i;
+
+  if ( fits_open_file(&fptr, outname, READWRITE, status) )
+    return *status;
+  fits_get_num_hdus(fptr, &hdunum, status);
+  for ( i = 2; i <= hdunum && !*status; i++ )
+    {
+      fits_movabs_hdu(fptr, i, &hdutype, status);
+      fits_write_errmark();
+      if ( fits_read_key(fptr, TSTRING, "EXTNAME", extname, NULL, status) )
+	{
+	  fits_clear_errmark();
+	  *status = 0;
+	  continue;
+	}
+      fits_clear_errmark();
+      if ( hdutype == BINARY_TBL && !strcmp(extname, "EVENTS") )
+	fits_write_chksum(fptr, status);
+    }
+  fits_close_file(fptr, status);
+  return *status;
+}
+
+/*
+  Copy inname to outname, correcting the EVENTS tables on the way;
+  either may be "-" for stdin or stdout. As with cfitsio, a leading
+  '!' in outname overwrites an existing file. Returns 0, or -1 after
+  saying what went wrong.
+*/
+int evt0_stream_run(evt0_stream *sp, const char *inname,
+		    const char *outname)
+{
+  evt0_stats *st = sp->stats;
+  FILE *in, *out;
+  evt0_map m;
+  char *hdr = 0, value[FLEN_VALUE], timestr[FLEN_VALUE];
+  char card[FLEN_CARD + FLEN_VALUE];	/* set_card keeps the first 80 */
+  long cap = 0, ncards;
+  long long nbytes;
+  int tostdout = !strcmp(outname, "-"), fd, flags, nhdu = 0, status = 0;
+  int timeref, events, k, ret = -1;
+  double t = 0.0;
+
+  if ( st )
+    t = evt0_now();
+  if ( !strcmp(inname, "-") )
+    in = stdin;
+  else if ( evt0_gz_is(inname) )
+    {
+      if ( !(in = evt0_gz_open(inname, sp->nthreads)) )
+	{
+	  fprintf(stderr, "%s: can't open %s\n", sp->progname, inname);
+	  return -1;
+	}
+    }
+  else if ( !(in = fopen(inname, "rb")) )
+    {
+      perror(inname);
+      return -1;
+    }
+  if ( tostdout )
+    out = stdout;
+  else
+    {
+      flags = O_WRONLY | O_CREAT | O_EXCL;
+      if ( *outname == '!' )
+	{
+	  outname++;
+	  flags = O_WRONLY | O_CREAT | O_TRUNC;
+	}
+      if ( (fd = open(outname, flags, 0666)) < 0
+	   || !(out = fdopen(fd, "wb")) )
+	{
+	  perror(outname);
+	  if ( in != stdin )
+	    fclose(in);
+	  return -1;
+	}
+    }
+  if ( st )
+    st->t[EVT0_T_OPEN] += evt0_now() - t;
+
+  fits_get_system_time(timestr, &timeref, &status);
+  snprintf(card, sizeof(card),
+	   "DATE    = '%s' / file creation date (YYYY-MM-DDThh:mm:ss UT)",
+	   timestr);
+
+  for ( ;; )
+    {
+      if ( st )
+	t = evt0_now();
+      if ( (ncards = read_header(in, &hdr, &cap)) <= 0 )
+	{
+	  if ( ncards < 0 || nhdu == 0 )
+	    fprintf(stderr, "%s: %s is not a FITS stream\n", sp->progname,
+		    inname);
+	  else
+	    ret = 0;
+	  break;
+	}
+      if ( nhdu++ == 0 ? strncmp(hdr, "SIMPLE  =", 9)
+	   : strncmp(hdr, "XTENSION=", 9) )
+	{
+	  fprintf(stderr, "%s: %s is not a FITS stream\n", sp->progname,
+		  inname);
+	  break;
+	}
+      if ( (nbytes = evt0_data_bytes(hdr, ncards)) < 0 )
+	{
+	  fprintf(stderr, "%s: bad header in HDU %d\n", sp->progname, nhdu);
+	  break;
+	}
+
+      events = !strncmp(hdr, "XTENSION= 'BINTABLE'", 20)
+	&& evt0_card_value(hdr, ncards, "EXTNAME", value) == 0
+	&& !strcmp(value, "EVENTS");
+      if ( events && sp->header )
+	{
+	  if ( (k = sp->header(sp->ctx, hdr, ncards)) < 0 )
+	    break;
+	  events = k == 0;
+	}
+      if ( events && evt0_map_header(&m, hdr, ncards, sp->cols) )
+	{
+	  fprintf(stderr, "%s: can't stream the EVENTS table of %s\n",
+		  sp->progname, inname);
+	  break;
+	}
+      if ( events )
+	{
+	  set_card(hdr, ncards, "DATE", card);
+	  if ( tostdout )
+	    {
+	      set_card(hdr, ncards, "CHECKSUM", "");
+	      set_card(hdr, ncards, "DATASUM", "");
+	    }
+	}
+
+      if ( write_full(out, hdr, 80*ncards) )
+	{
+	  fprintf(stderr, "%s: write error\n", sp->progname);
+	  break;
+	}
+      if ( !events )
+	{
+	  if ( copy_bytes(in, out, nbytes) )
+	    {
+	      fprintf(stderr, "%s: %s ends early\n", sp->progname, inname);
+	      break;
+	    }
+	  if ( st )
+	    st->t[EVT0_T_HEADER] += evt0_now() - t;
+	  continue;
+	}
+      if ( st )
+	st->t[EVT0_T_HEADER] += evt0_now() - t;
+
+      if(sp->verb>0) fprintf(stderr,"Streaming %ld rows of EVENTS\n",
+			     m.nrows);
+      if ( stream_table(sp, in, out, &m) )
+	break;
+      if ( st )
+	t = evt0_now();
+      if ( copy_bytes(in, out, nbytes - (long long)m.rowlen*m.nrows) )
+	{
+	  fprintf(stderr, "%s: %s ends early\n", sp->progname, inname);
+	  break;
+	}
+      if ( st )
+	st->t[EVT0_T_HEADER] += evt0_now() - t;
+    }
+
+  free(hdr);
+  if ( in != stdin )
+    fclose(in);
+  if ( (tostdout ? fflush(out) : fclose(out)) && ret == 0 )
+    {
+      fprintf(stderr, "%s: write error\n", sp->progname);
+      ret = -1;
+    }
+
+  if ( ret == 0 && !tostdout )
+    {
+      if ( st )
+	t = evt0_now();
+      if ( fix_checksums(outname, &status) )
+	{
+	  fits_report_error(stderr, status);
+	  ret = -1;
+	}
+      if ( st )
+	st->t[EVT0_T_CHECKSUM] += evt0_now() - t;
+    }
+  return ret;
+}
@@ -0,0 +1,42 @@
+/*
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+            evt0_stream.h
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+
+Correcting level 0 event files as sequential FITS streams, e.g. from
+stdin to stdout. See evt0_stream.c.
+
+*/
+
+#ifndef EVT0_STREAM_H
+#define EVT0_STREAM_H
+
+#include "evt0_kernels.h"
+#include "evt0_stats.h"
+
+typedef struct
+{
+  long chunk_rows;		/* rows corrected at a time */
+  unsigned cols;		/* EVT0_* columns the correction reads */
+  unsigned wcols;		/* ... and those it may change */
+  int nthreads;			/* for decompressing a gzipped input */
+  int verb;
+  const char *progname;
+  evt0_stats *stats;		/* 0 if not wanted */
+
+  /*
+    header, if not 0, sees the header of each EVENTS table before it
+    is written, and returns 0 to correct the table, 1 to pass it
+    through as it is, or -1 to stop after saying why.
+  */
+  int (*header)(void *ctx, const char *hdr, long ncards);
+
+  /* correct the rows in blk */
+  void (*correct)(void *ctx, evt0_block *blk);
+  void *ctx;
+} evt0_stream;
+
+int evt0_stream_run(evt0_stream *sp, const char *inname,
+		    const char *outname);
+
+#endif
@@ -0,0 +1,266 @@
+/*
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+            evt0_synth.c
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+
+Writes synthetic HRC level 0 event files, so the evt0 tools can be
+exercised and timed without flight data.
+
+Each event gets a PHA, the amplifier scale it implies (scale 1 below
+the 1 to 2 switch, 2 up to the 2 to 3 switch, 3 above), and a charge
+cloud spread over three taps on each axis whose sum matches PHA on
+that scale with a few percent noise, in the sense of fix_amp_sf().
+band_frac of the events are put into the switch bands, where the
+telemetered AMP_SF is wrong a third of the time; elsewhere it is
+wrong for 1% of events. Events telemetered at scale 3 that pass the
+ringing selection get the ringing of tap_delta() added to the third
+tap, and VETOSTT has the width-exceeded bits set at random for 5% of
+events on each axis.
+
+The result is reproducible for a given seed.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "fitsio.h"
+
+#include "evt0_synth.h"
+
+/* the EVENTS columns, in the order of a level 0 file */
+#define NCOLS 17
+static char *ttype[NCOLS] =
+  { "TIME", "CRSV", "CRSU", "AMP_SF", "AV1", "AV2", "AV3", "AU1", "AU2",
+    "AU3", "PHA", "VETOSTT", "E_TRIG", "DET_ID", "SUB_MJF", "CLKTICKS",
+    "QUALITY" };
+static char *tform[NCOLS] =
+  { "1D", "1B", "1B", "1B", "1I", "1I", "1I", "1I", "1I", "1I", "1B", "8X",
+    "8X", "1B", "1B", "1J", "1J" };
+static char *tunit[NCOLS] =
+  { "s", "", "", "", "", "", "", "", "", "", "", "", "", "", "", "", "" };
+
+typedef struct
+{
+  unsigned long long s;
+} synth_rng;
+
+/* xorshift64* */
+static double uniform(synth_rng *r)
+{
+  r->s ^= r->s >> 12;
+  r->s ^= r->s << 25;
+  r->s ^= r->s >> 27;
+  return ((r->s * 2685821657736338717ULL) >> 11) * (1.0/9007199254740992.0);
+}
+
+static double gauss(synth_rng *r)
+{
+  double u = uniform(r);
+
+  if ( u < 1e-300 )
+    u = 1e-300;
+  return sqrt(-2.0*log(u)) * cos(2.0*PI*uniform(r));
+}
+
+static short clamp_tap(double a)
+{
+  if ( a < 0.0 )
+    return 0;
+  if ( a > 4095.0 )
+    return 4095;
+  return (short)(a + 0.5);
+}
+
+/* spread total over three taps, for a cloud at x in [0,1) between taps */
+static void spread(synth_rng *r, double total, short *t1, short *t2,
+		   short *t3)
+{
+  double c = 1.5 + uniform(r), w[3], sum = 0.0;
+  int i;
+
+  for ( i = 0; i < 3; i++ )
+    sum += w[i] = exp(-(i + 1 - c)*(i + 1 - c)/(2.0*0.6*0.6));
+  *t1 = clamp_tap(total*w[0]/sum);
+  *t2 = clamp_tap(total*w[1]/sum);
+  *t3 = clamp_tap(total*w[2]/sum);
+}
+
+/* add the ringing that correct_tap() takes out */
+static void ring(short t1, short t2, short *t3, const tap_coeffs *c,
+		 int use_width, int wbit, unsigned char vstat)
+{
+  int affected;
+
+  if ( use_width )
+    affected = t1 > *t3 && (vstat & wbit) == 0;
+  else
+    affected = t1 > *t3 && t1 > (c->e * t2 + c->o);
+  if ( affected )
+    *t3 = clamp_tap(*t3 + tap_delta(t1, t2, c));
+}
+
+static double synth_pha(synth_rng *r, const evt0_synth_params *sp)
+{
+  const ampsf_params *ap = &sp->ap;
+  double u = uniform(r);
+
+  if ( u < sp->band_frac/2 )
+    return ap->pha_1to2 + ap->width1*(2.0*uniform(r) - 1.0);
+  if ( u < sp->band_frac )
+    return ap->pha_2to3 + ap->width2*(2.0*uniform(r) - 1.0);
+  /* a broad hump peaking near the middle of the PHA range */
+  return 255.0*(uniform(r) + uniform(r) + uniform(r))/3.0;
+}
+
+static void synth_event(synth_rng *r, const evt0_synth_params *sp,
+			evt0_block *b, long j)
+{
+  const ampsf_params *ap = &sp->ap;
+  double pha, sum_amps, total, fu;
+  int scale, tel, inband;
+
+  pha = floor(synth_pha(r, sp));
+  if ( pha < 0.0 ) pha = 0.0;
+  if ( pha > 255.0 ) pha = 255.0;
+  b->pha[j] = (unsigned char)pha;
+
+  scale = pha < ap->pha_1to2 ? 1 : pha < ap->pha_2to3 ? 2 : 3;
+  sum_amps = pha/(1 << (scale - 1)) * (1.0 + 0.03*gauss(r));
+  total = sum_amps*ap->gain/0.5;
+
+  fu = 0.5 + 0.05*gauss(r);
+  spread(r, total*fu, &b->au1[j], &b->au2[j], &b->au3[j]);
+  spread(r, total*(1.0 - fu), &b->av1[j], &b->av2[j], &b->av3[j]);
+
+  /* what telemetry says */
+  inband = fabs(pha - ap->pha_1to2) < ap->width1
+    || fabs(pha - ap->pha_2to3) < ap->width2;
+  tel = scale;
+  if ( uniform(r) < (inband ? 1.0/3.0 : 0.01) )
+    tel = scale == 1 ? 2 : scale == 3 ? 2 : (uniform(r) < 0.5 ? 1 : 3);
+  b->amp_sf[j] = tel;
+
+  b->vstat[j] = (uniform(r) < 0.05 ? 0x10 : 0) | (uniform(r) < 0.05 ? 0x20 : 0)
+    | (uniform(r) < 0.02 ? 0x01 : 0);
+
+  if ( tel == 3 )
+    {
+      ring(b->au1[j], b->au2[j], &b->au3[j], &sp->tp.u, sp->tp.use_width,
+	   0x10, b->vstat[j]);
+      ring(b->av1[j], b->av2[j], &b->av3[j], &sp->tp.v, sp->tp.use_width,
+	   0x20, b->vstat[j]);
+    }
+}
+
+void evt0_synth_default(evt0_synth_params *sp)
+{
+  sp->nrows = 1000000;
+  sp->seed = 1;
+  sp->detnam = "HRC-I";
+  sp->date_obs = "2001-01-01T00:00:00";
+  ampsf_params_default(&sp->ap);
+  tap_params_default(&sp->tp);
+  sp->band_frac = 0.1;
+}
+
+/* write the file; returns the cfitsio status */
+int evt0_synth(const char *filename, const evt0_synth_params *sp,
+	       int *status)
+{
+  fitsfile *fptr;
+  synth_rng r;
+  evt0_block b;
+  double *time;
+  unsigned char *crs, *etrig, *detid, *submjf;
+  int *clk, *qual;
+  long numrows, row, n, j;
+  double t = 0.0;
+
+  r.s = sp->seed*0x9e3779b97f4a7c15ULL + 1;
+
+  if ( fits_create_file(&fptr, filename, status)
+       || fits_create_img(fptr, 8, 0, 0, status) )
+    return *status;
+  fits_write_key(fptr, TSTRING, "DETNAM", (void *)sp->detnam, "Detector",
+		 status);
+  fits_write_key(fptr, TSTRING, "DATE-OBS", (void *)sp->date_obs,
+		 "Start of observation", status);
+  fits_write_history(fptr, "Synthetic events from evt0_synth", status);
+  fits_write_chksum(fptr, status);
+
+  fits_create_tbl(fptr, BINARY_TBL, sp->nrows, NCOLS, ttype, tform, tunit,
+		  "EVENTS", status);
+  fits_write_key(fptr, TSTRING, "DETNAM", (void *)sp->detnam, "Detector",
+		 status);
+  fits_write_key(fptr, TSTRING, "DATE-OBS", (void *)sp->date_obs,
+		 "Start of observation", status);
+  fits_get_rowsize(fptr, &numrows, status);
+  if ( *status )
+    {
+      fits_close_file(fptr, status);
+      return *status;
+    }
+
+  time = CALLOC(numrows, double);
+  crs = CALLOC(numrows, unsigned char);
+  etrig = CALLOC(numrows, unsigned char);
+  detid = CALLOC(numrows, unsigned char);
+  submjf = CALLOC(numrows, unsigned char);
+  clk = CALLOC(numrows, int);
+  qual = CALLOC(numrows, int);
+  if ( evt0_block_alloc(&b, numrows) || !time || !crs || !etrig || !detid
+       || !submjf || !clk || !qual )
+    {
+      fits_close_file(fptr, status);
+      return *status = MEMORY_ALLOCATION;
+    }
+
+  for ( row = 1; row <= sp->nrows && !*status; row += n )
+    {
+      n = row + numrows <= sp->nrows ? numrows : 1 + sp->nrows - row;
+      for ( j = 0; j < n; j++ )
+	{
+	  t += -log(1.0 - uniform(&r))/100.0;	/* 100 events/s */
+	  time[j] = 6.0e7 + t;
+	  crs[j] = (unsigned char)(64*uniform(&r));
+	  etrig[j] = 0x80;
+	  detid[j] = 0;
+	  submjf[j] = (unsigned char)(64*uniform(&r));
+	  clk[j] = (int)fmod(t*1.0e5, 65536.0);
+	  qual[j] = 0;
+	  synth_event(&r, sp, &b, j);
+	}
+      fits_write_col(fptr, TDOUBLE, 1, row, 1, n, time, status);
+      fits_write_col(fptr, TBYTE, 2, row, 1, n, crs, status);
+      fits_write_col(fptr, TBYTE, 3, row, 1, n, crs, status);
+      fits_write_col(fptr, TBYTE, 4, row, 1, n, b.amp_sf, status);
+      fits_write_col(fptr, TSHORT, 5, row, 1, n, b.av1, status);
+      fits_write_col(fptr, TSHORT, 6, row, 1, n, b.av2, status);
+      fits_write_col(fptr, TSHORT, 7, row, 1, n, b.av3, status);
+      fits_write_col(fptr, TSHORT, 8, row, 1, n, b.au1, status);
+      fits_write_col(fptr, TSHORT, 9, row, 1, n, b.au2, status);
+      fits_write_col(fptr, TSHORT, 10, row, 1, n, b.au3, status);
+      fits_write_col(fptr, TBYTE, 11, row, 1, n, b.pha, status);
+      fits_write_col(fptr, TBYTE, 12, row, 1, n, b.vstat, status);
+      fits_write_col(fptr, TBYTE, 13, row, 1, n, etrig, status);
+      fits_write_col(fptr, TBYTE, 14, row, 1, n, detid, status);
+      fits_write_col(fptr, TBYTE, 15, row, 1, n, submjf, status);
+      fits_write_col(fptr, TINT, 16, row, 1, n, clk, status);
+      fits_write_col(fptr, TINT, 17, row, 1, n, qual, status);
+    }
+  fits_write_chksum(fptr, status);
+  fits_close_file(fptr, status);
+
+  evt0_block_free(&b);
+  free(time);
+  free(crs);
+  free(etrig);
+  free(detid);
+  free(submjf);
+  free(clk);
+  free(qual);
+  return *status;
+}
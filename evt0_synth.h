@@ -0,0 +1,30 @@
+/*
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+            evt0_synth.h
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+
+Synthetic HRC level 0 event files. See evt0_synth.c.
+
+*/
+
+#ifndef EVT0_SYNTH_H
+#define EVT0_SYNTH_H
+
+#include "evt0_kernels.h"
+
+typedef struct
+{
+  long nrows;
+  unsigned long seed;
+  const char *detnam;		/* HRC-I or HRC-S */
+  const char *date_obs;
+  ampsf_params ap;		/* where the AMP_SF switch bands are */
+  tap_params tp;		/* the ringing to put into AU3/AV3 */
+  double band_frac;		/* fraction of events in the switch bands */
+} evt0_synth_params;
+
+void evt0_synth_default(evt0_synth_params *sp);
+int evt0_synth(const char *filename, const evt0_synth_params *sp,
+	       int *status);
+
+#endif
@@ -0,0 +1,208 @@
+/*
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+            evt0_vmath.h
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+
+Vector math for evt0_simd.c, included there once per vector width
+with VLEN (doubles per vector) and VF() (name suffix) defined. gcc
+lowers vectors wider than the target's registers lane by lane as soon
+as a select is involved, so each target gets its native width.
+
+No include guard on purpose.
+
+*/
+
+#define vd VF(vd)
+#define vl VF(vl)
+#define vdup VF(vdup)
+#define vsel VF(vsel)
+#define vround VF(vround)
+#define vfloor VF(vfloor)
+#define vcvt VF(vcvt)
+#define vpoly VF(vpoly)
+#define vlog VF(vlog)
+#define vexp VF(vexp)
+#define vsin VF(vsin)
+#define tap_vec VF(tap_vec)
+
+typedef double vd __attribute__ ((vector_size (VLEN*8)));
+typedef long long vl __attribute__ ((vector_size (VLEN*8)));
+
+/*
+  Comparisons must be between two vectors; comparing with a scalar
+  makes gcc fall back to lane-by-lane code.
+*/
+VINLINE vd vdup(double x)
+{
+  return (vd){} + x;
+}
+
+VINLINE vd vsel(vl m, vd a, vd b)
+{
+  return (vd)((m & (vl)a) | (~m & (vl)b));
+}
+
+/* round to nearest integer, both as double and as int64 */
+VINLINE vd vround(vd x, vl *n)
+{
+  vd t = x + MAGIC;
+  *n = (vl)t - (vl)vdup(MAGIC);
+  return t - MAGIC;
+}
+
+VINLINE vd vfloor(vd x, vl *n)
+{
+  vd r = vround(x, n);
+  vl m = r > x;
+  *n += m;			/* m is -1 where rounding went up */
+  return vsel(m, r - 1.0, r);
+}
+
+/* small integers to double */
+VINLINE vd vcvt(vl n)
+{
+  return (vd)(n + (vl)vdup(MAGIC)) - MAGIC;
+}
+
+VINLINE vd vpoly(vd x, const double *c, int n)
+{
+  vd y = x * 0.0 + c[0];
+  int i;
+
+  for ( i = 1; i < n; i++ )
+    y = y * x + c[i];
+  return y;
+}
+
+/* Cephes log(), for positive normal x */
+VINLINE vd vlog(vd x)
+{
+  static const double P[] = {
+    1.01875663804580931796E-4, 4.97494994976747001425E-1,
+    4.70579119878881725854E0, 1.44989225341610930846E1,
+    1.79368678507819816313E1, 7.70838733755885391666E0,
+  };
+  static const double Q[] = {
+    1.0, 1.12873587189167450590E1, 4.52279145837532221105E1,
+    8.29875266912776603211E1, 7.11544750618563894466E1,
+    2.31251620126765340583E1,
+  };
+  vl bits = (vl)x, small;
+  vd m, e, z, y;
+
+  /* frexp(): x = m * 2^e with m in [0.5, 1) */
+  e = vcvt(((bits >> 52) & 0x7ff) - 1022);
+  m = (vd)((bits & (long long)0x800fffffffffffffULL) | 0x3fe0000000000000LL);
+
+  small = m < vdup(0.70710678118654752440);
+  e = vsel(small, e - 1.0, e);
+  m = vsel(small, m + m - 1.0, m - 1.0);
+
+  z = m * m;
+  y = m * (z * vpoly(m, P, 6) / vpoly(m, Q, 6));
+  y = y - e * 2.121944400546905827679e-4;
+  y = y - 0.5 * z;
+  return m + y + e * 0.693359375;
+}
+
+/* Cephes exp(), for |x| well inside the double range */
+VINLINE vd vexp(vd x)
+{
+  static const double P[] = {
+    1.26177193074810590878E-4, 3.02994407707441961300E-2,
+    9.99999999999999999910E-1,
+  };
+  static const double Q[] = {
+    3.00198505138664455042E-6, 2.52448340349684104192E-3,
+    2.27265548208155028766E-1, 2.00000000000000000009E0,
+  };
+  vl n;
+  vd px, xx;
+
+  px = vfloor(1.4426950408889634073599 * x + 0.5, &n);
+  x = x - px * 6.93145751953125E-1;
+  x = x - px * 1.42860682030941723212E-6;
+
+  xx = x * x;
+  px = x * vpoly(xx, P, 3);
+  x = px / (vpoly(xx, Q, 4) - px);
+  x = 1.0 + 2.0 * x;
+
+  /* ldexp() */
+  return (vd)((vl)x + (n << 52));
+}
+
+/* Cephes sin(), for |x| below its 2^30 loss threshold */
+VINLINE vd vsin(vd x)
+{
+  static const double S[] = {
+    1.58962301576546568060E-10, -2.50507477628578072866E-8,
+    2.75573136213857245213E-6, -1.98412698295895385996E-4,
+    8.33333333332211858878E-3, -1.66666666666666307295E-1,
+  };
+  static const double C[] = {
+    -1.13585365213876817300E-11, 2.08757008419747316778E-9,
+    -2.75573141792967388112E-7, 2.48015872888517045348E-5,
+    -1.38888888888730564116E-3, 4.16666666666665929218E-2,
+  };
+  vl sign, j, odd, cosq, flip;
+  vd y, z, zz, ps, pc;
+
+  sign = x < vdup(0.0);
+  x = vsel(sign, -x, x);
+
+  y = vfloor(x * 1.27323954473516268615, &j);	/* x/(pi/4) */
+  odd = -(j & 1);
+  j = j + (odd & 1);
+  y = vsel(odd, y + 1.0, y);
+  j = j & 7;
+  flip = j > (vl){} + 3;
+  sign = sign ^ flip;
+  j = j - (flip & 4);
+
+  z = ((x - y * 7.85398125648498535156E-1)
+       - y * 3.77489470793079817668E-8) - y * 2.69515142907905952645E-15;
+  zz = z * z;
+
+  pc = 1.0 - 0.5 * zz + zz * zz * vpoly(zz, C, 6);
+  ps = z + z * (zz * vpoly(zz, S, 6));
+  cosq = (j == (vl){} + 1) | (j == (vl){} + 2);
+  y = vsel(cosq, pc, ps);
+  return vsel(sign, -y, y);
+}
+
+/*
+  Corrected (unrounded) third tap for VLEN compacted events. Lanes that
+  fall outside the range of vsin() come back as NaN.
+*/
+VINLINE void tap_vec(double *pa1, double *pa2, double *pa3,
+		     const tap_coeffs *c)
+{
+  vd a1, a2, a3, phi, x;
+  vl bad;
+
+  memcpy(&a1, pa1, sizeof(a1));
+  memcpy(&a2, pa2, sizeof(a2));
+  memcpy(&a3, pa3, sizeof(a3));
+
+  phi = c->f * (vexp(c->g * vlog(a2 / a1)) - 1.0);
+  x = 2. * PI * (a2 - phi) / (a2 * c->c + c->d);
+  a3 = a3 - (a2 + c->b) / c->a * vsin(x);
+
+  bad = ~((x < vdup(1.0e9)) & (x > vdup(-1.0e9)));
+  a3 = vsel(bad, vdup(NAN), a3);
+  memcpy(pa3, &a3, sizeof(a3));
+}
+
+#undef vd
+#undef vl
+#undef vdup
+#undef vsel
+#undef vround
+#undef vfloor
+#undef vcvt
+#undef vpoly
+#undef vlog
+#undef vexp
+#undef vsin
+#undef tap_vec
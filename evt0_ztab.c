@@ -0,0 +1,560 @@
+/*
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+            evt0_ztab.c
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+
+Tile-compressed output tables for the evt0 tools (-Z), so that
+reprocessed files don't take several times the scratch space of the
+gzipped inputs. The EVENTS tables of a finished output are rewritten
+in the tiled table compression convention that cfitsio's
+fits_compress_table() writes and that any cfitsio reader, or funpack,
+opens transparently: the rows are cut into tiles, and each column of
+a tile is stored as one gzip compressed cell of a variable length
+byte array in the heap. Multi-byte columns are byte-shuffled first
+(GZIP_2), which makes the slowly changing high bytes of e.g. TIME
+compress far better.
+
+fits_compress_table() compresses one tile after another; here the
+tiles are compressed by nthreads threads at once and the file is
+written afterwards in order. Other HDUs are copied as they are.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#include "fitsio.h"
+
+#include "evt0_gz.h"
+#include "evt0_map.h"
+
+#define FITS_BLOCK 2880
+/* uncompressed bytes per tile */
+#define ZTILE_BYTES (4 << 20)
+/* cfitsio uses the fastest level as well */
+#define ZLEVEL 1
+
+typedef struct
+{
+  long off, bytes;		/* in the row */
+  int width;			/* element size, 1 for GZIP_1 */
+  char tform[FLEN_VALUE];
+} ztab_col;
+
+typedef struct
+{
+  unsigned char *buf;
+  long len;
+} ztab_cell;
+
+typedef struct
+{
+  const unsigned char *data;
+  long rowlen, nrows, tilelen, ntiles;
+  ztab_col *col;
+  int ncols;
+  ztab_cell *cell;		/* [tile*ncols + col] */
+  long next;
+  int error;
+  pthread_mutex_t lock;
+} ztab_ctx;
+
+/* gzip the n bytes at in into a new buffer in c */
+static int zcell(ztab_cell *c, const unsigned char *in, long n)
+{
+  z_stream z;
+  uLong bound;
+
+  memset(&z, 0, sizeof(z));
+  if ( deflateInit2(&z, ZLEVEL, Z_DEFLATED, 15 + 16, 8,
+		    Z_DEFAULT_STRATEGY) != Z_OK )
+    return -1;
+  bound = deflateBound(&z, n);
+  if ( !(c->buf = malloc(bound)) )
+    {
+      deflateEnd(&z);
+      return -1;
+    }
+  z.next_in = (unsigned char *)in;
+  z.avail_in = n;
+  z.next_out = c->buf;
+  z.avail_out = bound;
+  if ( deflate(&z, Z_FINISH) != Z_STREAM_END )
+    {
+      deflateEnd(&z);
+      return -1;
+    }
+  c->len = z.total_out;
+  deflateEnd(&z);
+  return 0;
+}
+
+static void *ztab_worker(void *arg)
+{
+  ztab_ctx *zc = arg;
+  const unsigned char *row;
+  unsigned char *raw, *shuf;
+  long t, r, n, i, b, maxn;
+  int k, w, bad = 0;
+
+  maxn = 0;
+  for ( k = 0; k < zc->ncols; k++ )
+    if ( zc->col[k].bytes > maxn )
+      maxn = zc->col[k].bytes;
+  maxn *= zc->tilelen;
+  raw = malloc(maxn);
+  shuf = malloc(maxn);
+  if ( !raw || !shuf )
+    bad = 1;
+
+  for ( ;; )
+    {
+      pthread_mutex_lock(&zc->lock);
+      if ( bad )
+	zc->error = 1;
+      t = zc->error ? zc->ntiles : zc->next++;
+      pthread_mutex_unlock(&zc->lock);
+      if ( t >= zc->ntiles )
+	break;
+
+      n = zc->nrows - t*zc->tilelen;
+      if ( n > zc->tilelen )
+	n = zc->tilelen;
+      for ( k = 0; k < zc->ncols && !bad; k++ )
+	{
+	  ztab_col *c = &zc->col[k];
+
+	  /* the column's cells, one after another */
+	  row = zc->data + t*zc->tilelen*zc->rowlen + c->off;
+	  for ( r = 0; r < n; r++, row += zc->rowlen )
+	    memcpy(raw + r*c->bytes, row, c->bytes);
+
+	  if ( (w = c->width) > 1 )
+	    {
+	      /* the b'th bytes of all elements together */
+	      long nel = n*c->bytes/w;
+
+	      for ( b = 0; b < w; b++ )
+		for ( i = 0; i < nel; i++ )
+		  shuf[b*nel + i] = raw[i*w + b];
+	      bad = zcell(&zc->cell[t*zc->ncols + k], shuf, n*c->bytes);
+	    }
+	  else
+	    bad = zcell(&zc->cell[t*zc->ncols + k], raw, n*c->bytes);
+	}
+    }
+  free(raw);
+  free(shuf);
+  if ( bad )
+    {
+      pthread_mutex_lock(&zc->lock);
+      zc->error = 1;
+      pthread_mutex_unlock(&zc->lock);
+    }
+  return 0;
+}
+
+/* append a card of text, cut to 80 characters, to the header at *out */
+static int add_card(char **out, long *n, long *cap, const char *text)
+{
+  char card[81], *more;
+
+  if ( *n == *cap )
+    {
+      *cap += 36;
+      if ( !(more = realloc(*out, 80*(*cap))) )
+	return -1;
+      *out = more;
+    }
+  snprintf(card, sizeof(card), "%-80s", text);
+  memcpy(*out + 80*(*n), card, 80);
+  (*n)++;
+  return 0;
+}
+
+static int add_int(char **out, long *n, long *cap, const char *key,
+		   long long v, const char *comment)
+{
+  char card[2*80];
+
+  snprintf(card, sizeof(card), "%-8.8s= %20lld / %s", key, v, comment);
+  return add_card(out, n, cap, card);
+}
+
+static int add_str(char **out, long *n, long *cap, const char *key,
+		   const char *v, const char *comment)
+{
+  char card[2*80];
+
+  snprintf(card, sizeof(card), "%-8.8s= '%-8s' / %s", key, v, comment);
+  return add_card(out, n, cap, card);
+}
+
+/*
+  Work out the columns of the table whose ncards header cards are at
+  hdr. Returns -1 if it can't be compressed here: it has a heap or
+  variable length columns already.
+*/
+static int ztab_columns(ztab_ctx *zc, const char *hdr, long ncards)
+{
+  char key[FLEN_KEYWORD], value[FLEN_VALUE];
+  long repeat, width, off = 0;
+  int k, typecode, status = 0;
+
+  if ( evt0_card_value(hdr, ncards, "PCOUNT", value) || atol(value) != 0
+       || evt0_card_value(hdr, ncards, "TFIELDS", value) )
+    return -1;
+  zc->ncols = atoi(value);
+  if ( zc->ncols <= 0
+       || !(zc->col = calloc(zc->ncols, sizeof(ztab_col))) )
+    return -1;
+
+  for ( k = 0; k < zc->ncols; k++ )
+    {
+      ztab_col *c = &zc->col[k];
+
+      snprintf(key, sizeof(key), "TFORM%d", k + 1);
+      if ( evt0_card_value(hdr, ncards, key, c->tform)
+	   || fits_binary_tform(c->tform, &typecode, &repeat, &width,
+				&status)
+	   || typecode < 0 )
+	return -1;
+      if ( typecode == TBIT )
+	c->bytes = (repeat + 7)/8;
+      else if ( typecode == TSTRING )
+	c->bytes = repeat;
+      else
+	c->bytes = repeat*width;
+      switch ( typecode )
+	{
+	case TSHORT: case TLONG: case TLONGLONG: case TFLOAT:
+	case TDOUBLE:
+	  c->width = width;
+	  break;
+	default:
+	  c->width = 1;
+	}
+      c->off = off;
+      off += c->bytes;
+    }
+  return off == zc->rowlen ? 0 : -1;
+}
+
+/*
+  Write the EVENTS table with header hdr and rows at data to out as a
+  compressed table. Returns 1 if it can't be compressed, so that it
+  should be copied instead, and -1 on error.
+*/
+static int ztab_hdu(FILE *out, const char *hdr, long ncards,
+		    const unsigned char *data, int nthreads)
+{
+  ztab_ctx zc;
+  pthread_t *th;
+  char value[FLEN_VALUE], key[FLEN_KEYWORD], text[81];
+  char *oh = 0, *card;
+  long on = 0, ocap = 0, *maxlen = 0, i, t;
+  long long heap = 0, desc[2];
+  unsigned char be[16], pad[FITS_BLOCK];
+  int k, b, q, nth, ret = -1;
+
+  memset(&zc, 0, sizeof(zc));
+  if ( evt0_card_value(hdr, ncards, "NAXIS1", value) )
+    return 1;
+  zc.rowlen = atol(value);
+  if ( evt0_card_value(hdr, ncards, "NAXIS2", value) )
+    return 1;
+  zc.nrows = atol(value);
+  if ( zc.rowlen <= 0 || zc.nrows <= 0 || ztab_columns(&zc, hdr, ncards) )
+    {
+      free(zc.col);
+      return 1;
+    }
+  zc.data = data;
+  zc.tilelen = ZTILE_BYTES/zc.rowlen;
+  if ( zc.tilelen < 1 )
+    zc.tilelen = 1;
+  if ( zc.tilelen > zc.nrows )
+    zc.tilelen = zc.nrows;
+  zc.ntiles = (zc.nrows + zc.tilelen - 1)/zc.tilelen;
+  zc.cell = calloc(zc.ntiles*zc.ncols, sizeof(ztab_cell));
+  maxlen = calloc(zc.ncols, sizeof(long));
+  if ( nthreads > zc.ntiles )
+    nthreads = zc.ntiles;
+  if ( nthreads < 1 )
+    nthreads = 1;
+  th = calloc(nthreads, sizeof(pthread_t));
+  if ( !zc.cell || !maxlen || !th )
+    goto done;
+
+  pthread_mutex_init(&zc.lock, 0);
+  for ( nth = 0; nth < nthreads; nth++ )
+    if ( pthread_create(&th[nth], 0, ztab_worker, &zc) )
+      break;
+  if ( nth == 0 )
+    ztab_worker(&zc);
+  for ( i = 0; i < nth; i++ )
+    pthread_join(th[i], 0);
+  pthread_mutex_destroy(&zc.lock);
+  if ( zc.error )
+    goto done;
+
+  for ( t = 0; t < zc.ntiles*zc.ncols; t++ )
+    {
+      heap += zc.cell[t].len;
+      if ( zc.cell[t].len > maxlen[t % zc.ncols] )
+	maxlen[t % zc.ncols] = zc.cell[t].len;
+    }
+  q = heap > 0x7fffffffLL;
+
+  /* the header of the compressed table */
+  for ( i = 0; i < ncards; i++ )
+    {
+      card = (char *)hdr + 80*i;
+      if ( !strncmp(card, "END     ", 8) )
+	break;
+      if ( !strncmp(card, "NAXIS1  ", 8) )
+	{
+	  if ( add_int(&oh, &on, &ocap, "NAXIS1", (q ? 16 : 8)*zc.ncols,
+		       "width of table in bytes") )
+	    goto done;
+	}
+      else if ( !strncmp(card, "NAXIS2  ", 8) )
+	{
+	  if ( add_int(&oh, &on, &ocap, "NAXIS2", zc.ntiles,
+		       "number of tiles") )
+	    goto done;
+	}
+      else if ( !strncmp(card, "PCOUNT  ", 8) )
+	{
+	  if ( add_int(&oh, &on, &ocap, "PCOUNT", heap,
+		       "size of the heap") )
+	    goto done;
+	}
+      else if ( !strncmp(card, "TFORM", 5) && (k = atoi(card + 5)) > 0
+		&& k <= zc.ncols )
+	{
+	  snprintf(key, sizeof(key), "TFORM%d", k);
+	  snprintf(value, sizeof(value), "1%cB(%ld)", q ? 'Q' : 'P',
+		   maxlen[k - 1]);
+	  if ( add_str(&oh, &on, &ocap, key, value,
+		       "compressed column") )
+	    goto done;
+	  snprintf(key, sizeof(key), "ZFORM%d", k);
+	  if ( add_str(&oh, &on, &ocap, key, zc.col[k - 1].tform,
+		       "original format of the column") )
+	    goto done;
+	  snprintf(key, sizeof(key), "ZCTYP%d", k);
+	  if ( add_str(&oh, &on, &ocap, key,
+		       zc.col[k - 1].width > 1 ? "GZIP_2" : "GZIP_1",
+		       "compression of the column") )
+	    goto done;
+	}
+      else
+	{
+	  memcpy(text, card, 80);
+	  text[80] = 0;
+	  /* these describe the uncompressed table */
+	  if ( !strncmp(text, "CHECKSUM", 8) )
+	    memcpy(text, "ZHECKSUM", 8);
+	  else if ( !strncmp(text, "DATASUM ", 8) )
+	    memcpy(text, "ZDATASUM", 8);
+	  if ( add_card(&oh, &on, &ocap, text) )
+	    goto done;
+	}
+    }
+  if ( add_card(&oh, &on, &ocap,
+		"ZTABLE  =                    T / this is a compressed table")
+       || add_int(&oh, &on, &ocap, "ZTILELEN", zc.tilelen,
+		  "rows per tile")
+       || add_int(&oh, &on, &ocap, "ZNAXIS1", zc.rowlen,
+		  "width of the uncompressed table in bytes")
+       || add_int(&oh, &on, &ocap, "ZNAXIS2", zc.nrows,
+		  "rows in the uncompressed table")
+       || add_int(&oh, &on, &ocap, "ZPCOUNT", 0,
+		  "heap of the uncompressed table")
+       || add_card(&oh, &on, &ocap, "END") )
+    goto done;
+  while ( on % 36 )
+    if ( add_card(&oh, &on, &ocap, "") )
+      goto done;
+  if ( fwrite(oh, 80, on, out) != (size_t)on )
+    goto done;
+
+  /* descriptors, then the heap */
+  desc[1] = 0;
+  for ( t = 0; t < zc.ntiles*zc.ncols; t++ )
+    {
+      desc[0] = zc.cell[t].len;
+      for ( b = 0; b < (q ? 8 : 4); b++ )
+	{
+	  be[b] = desc[0] >> 8*((q ? 8 : 4) - 1 - b);
+	  be[b + (q ? 8 : 4)] = desc[1] >> 8*((q ? 8 : 4) - 1 - b);
+	}
+      if ( fwrite(be, q ? 16 : 8, 1, out) != 1 )
+	goto done;
+      desc[1] += desc[0];
+    }
+  for ( t = 0; t < zc.ntiles*zc.ncols; t++ )
+    if ( fwrite(zc.cell[t].buf, 1, zc.cell[t].len, out)
+	 != (size_t)zc.cell[t].len )
+      goto done;
+  memset(pad, 0, sizeof(pad));
+  t = ((q ? 16 : 8)*zc.ncols*zc.ntiles + heap) % FITS_BLOCK;
+  if ( t && fwrite(pad, 1, FITS_BLOCK - t, out) != (size_t)(FITS_BLOCK - t) )
+    goto done;
+  ret = 0;
+
+ done:
+  for ( t = 0; zc.cell && t < zc.ntiles*zc.ncols; t++ )
+    free(zc.cell[t].buf);
+  free(zc.cell);
+  free(zc.col);
+  free(maxlen);
+  free(th);
+  free(oh);
+  return ret;
+}
+
+/* the checksums of the compressed tables */
+static int ztab_checksums(const char *filename, int *status)
+{
+  fitsfile *fptr;
+  int hdunum, hdutype, i, ztable;
+
+  if ( fits_open_file(&fptr, filename, READWRITE, status) )
+    return *status;
+  fits_get_num_hdus(fptr, &hdunum, status);
+  for ( i = 2; i <= hdunum && !*status; i++ )
+    {
+      fits_movabs_hdu(fptr, i, &hdutype, status);
+      fits_write_errmark();
+      if ( fits_read_key(fptr, TLOGICAL, "ZTABLE", &ztable, NULL, status) )
+	{
+	  fits_clear_errmark();
+	  *status = 0;
+	  continue;
+	}
+      fits_clear_errmark();
+      if ( ztable )
+	fits_write_chksum(fptr, status);
+    }
+  fits_close_file(fptr, status);
+  return *status;
+}
+
+/*
+  Replace the EVENTS tables of filename by tile-compressed ones,
+  compressing with nthreads threads. Returns 0, or -1 after saying
+  what went wrong; filename is left as it was then.
+*/
+int evt0_ztab_file(const char *filename, int nthreads)
+{
+  struct stat st;
+  unsigned char *map;
+  char *tmp, value[FLEN_VALUE];
+  const char *hdr;
+  size_t off = 0, hlen;
+  long ncards;
+  long long nbytes;
+  FILE *out;
+  int fd, i, end, ret = -1, events, status = 0;
+
+  if ( (fd = open(filename, O_RDONLY)) < 0 )
+    {
+      perror(filename);
+      return -1;
+    }
+  if ( fstat(fd, &st)
+       || (map = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0))
+       == MAP_FAILED )
+    {
+      perror(filename);
+      close(fd);
+      return -1;
+    }
+  close(fd);
+  madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+  if ( !(tmp = malloc(strlen(filename) + 8)) )
+    {
+      munmap(map, st.st_size);
+      return -1;
+    }
+  sprintf(tmp, "%s.ztmp", filename);
+  if ( (fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL, 0666)) < 0
+       || !(out = fdopen(fd, "wb")) )
+    {
+      perror(tmp);
+      munmap(map, st.st_size);
+      free(tmp);
+      return -1;
+    }
+
+  while ( off < (size_t)st.st_size )
+    {
+      /* the header: whole blocks up to the one with END */
+      hdr = (const char *)map + off;
+      for ( hlen = 0, end = 0;
+	    !end && off + hlen + FITS_BLOCK <= (size_t)st.st_size;
+	    hlen += FITS_BLOCK )
+	for ( i = 0; i < 36; i++ )
+	  if ( !strncmp(hdr + hlen + 80*i, "END     ", 8) )
+	    end = 1;
+      ncards = hlen/80;
+      if ( !end || (nbytes = evt0_data_bytes(hdr, ncards)) < 0
+	   || off + hlen + nbytes > (size_t)st.st_size )
+	{
+	  fprintf(stderr, "%s: not a FITS file\n", filename);
+	  goto done;
+	}
+
+      events = !strncmp(hdr, "XTENSION= 'BINTABLE'", 20)
+	&& evt0_card_value(hdr, ncards, "EXTNAME", value) == 0
+	&& !strcmp(value, "EVENTS");
+      if ( events )
+	events = ztab_hdu(out, hdr, ncards, map + off + hlen, nthreads);
+      else
+	events = 1;
+      if ( events < 0 )
+	{
+	  fprintf(stderr, "%s: can't compress the EVENTS table\n", filename);
+	  goto done;
+	}
+      if ( events > 0 && fwrite(hdr, 1, hlen + nbytes, out) != hlen + nbytes )
+	{
+	  perror(tmp);
+	  goto done;
+	}
+      off += hlen + nbytes;
+    }
+  ret = 0;
+
+ done:
+  munmap(map, st.st_size);
+  if ( fclose(out) && ret == 0 )
+    {
+      perror(tmp);
+      ret = -1;
+    }
+  if ( ret == 0 && ztab_checksums(tmp, &status) )
+    {
+      fits_report_error(stderr, status);
+      ret = -1;
+    }
+  if ( ret == 0 && rename(tmp, filename) )
+    {
+      perror(filename);
+      ret = -1;
+    }
+  if ( ret )
+    unlink(tmp);
+  free(tmp);
+  return ret;
+}
@@ -0,0 +1,119 @@
+/*
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+            evt_gti.c
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+
+Reading GTIs, from the START and STOP columns of a GTI table or from
+"start stop" text lines, into a sorted list with overlapping and
+touching intervals merged, which is what evt_gti_in() expects.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "correction.h"
+#include "evt_gti.h"
+
+static int cmp_interval(const void *a, const void *b)
+{
+  double x = ((const evt_interval *)a)->start;
+  double y = ((const evt_interval *)b)->start;
+
+  return x < y ? -1 : x > y;
+}
+
+/* sort the n intervals of gti and merge overlaps; returns how many are left */
+long evt_gti_merge(evt_interval *gti, long n)
+{
+  long i, m = 0;
+
+  qsort(gti, n, sizeof(evt_interval), cmp_interval);
+  for ( i = 0; i < n; i++ )
+    {
+      if ( m && gti[i].start <= gti[m-1].stop )
+	{
+	  if ( gti[i].stop > gti[m-1].stop )
+	    gti[m-1].stop = gti[i].stop;
+	  continue;
+	}
+      gti[m++] = gti[i];
+    }
+  return m;
+}
+
+/* the sorted, merged GTIs of the current HDU of fptr, or -1 */
+long evt_gti_read_hdu(fitsfile *fptr, evt_interval **gti, int *status)
+{
+  double *start, *stop;
+  long n, i;
+  int scol, ecol, anynul;
+
+  *gti = 0;
+  if ( fits_get_num_rows(fptr, &n, status)
+       || fits_get_colnum(fptr, CASEINSEN, "start", &scol, status)
+       || fits_get_colnum(fptr, CASEINSEN, "stop", &ecol, status) )
+    return -1;
+  start = CALLOC(n + 1, double);
+  stop = CALLOC(n + 1, double);
+  *gti = CALLOC(n + 1, evt_interval);
+  if ( !start || !stop || !*gti )
+    {
+      free(start);
+      free(stop);
+      *status = MEMORY_ALLOCATION;
+      return -1;
+    }
+  fits_read_col(fptr, TDOUBLE, scol, 1, 1, n, NULL, start, &anynul, status);
+  fits_read_col(fptr, TDOUBLE, ecol, 1, 1, n, NULL, stop, &anynul, status);
+  for ( i = 0; i < n; i++ )
+    {
+      (*gti)[i].start = start[i];
+      (*gti)[i].stop = stop[i];
+    }
+  free(start);
+  free(stop);
+  if ( *status )
+    return -1;
+  return evt_gti_merge(*gti, n);
+}
+
+/* the sorted, merged GTIs of the "start stop" lines of a file, or -1 */
+long evt_gti_read_file(const char *filename, evt_interval **gti)
+{
+  char line[256];
+  FILE *fp;
+  evt_interval *g = 0, *p;
+  long n = 0, max = 0;
+  double start, stop;
+
+  *gti = 0;
+  if ( !(fp = fopen(filename, "r")) )
+    {
+      perror(filename);
+      return -1;
+    }
+  while ( fgets(line, sizeof(line), fp) )
+    {
+      if ( sscanf(line, "%lf %lf", &start, &stop) != 2 )
+	continue;
+      if ( n == max )
+	{
+	  max = max ? 2*max : 64;
+	  if ( !(p = realloc(g, max*sizeof(evt_interval))) )
+	    {
+	      fprintf(stderr, "%s: out of memory\n", filename);
+	      free(g);
+	      fclose(fp);
+	      return -1;
+	    }
+	  g = p;
+	}
+      g[n].start = start;
+      g[n++].stop = stop;
+    }
+  fclose(fp);
+
+  *gti = g;
+  return evt_gti_merge(g, n);
+}
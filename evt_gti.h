@@ -0,0 +1,55 @@
+/*
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+            evt_gti.h
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+
+Good time intervals, sorted and with overlaps merged, and the test of
+an event time against them. See evt_gti.c.
+
+*/
+
+#ifndef EVT_GTI_H
+#define EVT_GTI_H
+
+#include "fitsio.h"
+
+typedef struct
+{
+  double start, stop;
+} evt_interval;
+
+long evt_gti_merge(evt_interval *gti, long n);
+long evt_gti_read_hdu(fitsfile *fptr, evt_interval **gti, int *status);
+long evt_gti_read_file(const char *filename, evt_interval **gti);
+
+/*
+  Is t in one of the ngti GTIs (start <= t <= stop)? *cur is where the
+  last event was, so for time-ordered events this is a step forward
+  at most.
+*/
+static inline int evt_gti_in(const evt_interval *gti, long ngti, double t,
+			     long *cur)
+{
+  long i = *cur, lo, hi, mid;
+
+  if ( i > 0 && t <= gti[i-1].stop )
+    {
+      /* went back in time: the first GTI not ending before t */
+      for ( lo = 0, hi = ngti; lo < hi; )
+	{
+	  mid = (lo + hi)/2;
+	  if ( gti[mid].stop < t )
+	    lo = mid + 1;
+	  else
+	    hi = mid;
+	}
+      i = lo;
+    }
+  else
+    while ( i < ngti && gti[i].stop < t )
+      i++;
+  *cur = i;
+  return i < ngti && gti[i].start <= t;
+}
+
+#endif
@@ -0,0 +1,265 @@
+/*
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+            evt_tindex.c
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+
+A sidecar time index of an EVENTS table. The rows are taken in blocks
+of step, and for each block the index keeps the smallest and largest
+TIME in it and the byte offset of its first row in the file. Given a
+set of GTIs, evt_tindex_ranges() turns that into the row ranges that
+can hold events inside them, so a reader goes straight to those rows
+and skips the rest; no order of the events is assumed, though for
+time-ordered events the ranges are tight.
+
+The index is written next to the events file, as file.tidx (see
+time_index.c), and records the HDU, its size and its DATASUM. It is
+used only while those still match the table, so rewriting the events
+(which a tool stamping checksums changes DATASUM for) makes readers
+fall back to reading every row. Tables without a DATASUM are not
+indexed.
+
+The file is a header and the blocks, in the byte order of the machine
+that wrote it; the header's magic number is checked, so an index from
+a machine of the other byte order is taken as no index.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "evt_tindex.h"
+
+#define TINDEX_MAGIC "EVTTIDX1"
+#define TINDEX_ORDER 0x01020304
+
+/* the header of an index file */
+typedef struct
+{
+  char magic[8];
+  int order;
+  int hdunum;
+  long long nrows, rowlen, step, nblocks;
+  char datasum[FLEN_VALUE];
+} tindex_head;
+
+/*
+  Index the current HDU of fptr in blocks of step rows. Returns 0, or
+  a cfitsio status.
+*/
+int evt_tindex_build(evt_tindex *ix, fitsfile *fptr, long step, int *status)
+{
+  LONGLONG headstart, datastart, dataend;
+  double *t;
+  long nrows, rowlen, row, n, j, b;
+  int colnum, anynul;
+
+  memset(ix, 0, sizeof(*ix));
+  if ( step < 1 )
+    step = 1;
+  fits_get_hdu_num(fptr, &ix->hdunum);
+  if ( fits_read_key(fptr, TSTRING, "DATASUM", ix->datasum, NULL, status)
+       || fits_read_key(fptr, TLONG, "NAXIS1", &rowlen, NULL, status)
+       || fits_get_num_rows(fptr, &nrows, status)
+       || fits_get_colnum(fptr, CASEINSEN, "time", &colnum, status)
+       || fits_get_hduaddrll(fptr, &headstart, &datastart, &dataend,
+			     status) )
+    return *status;
+
+  ix->nrows = nrows;
+  ix->rowlen = rowlen;
+  ix->step = step;
+  ix->nblocks = (nrows + step - 1)/step;
+  ix->blk = calloc(ix->nblocks + 1, sizeof(evt_tindex_block));
+  t = calloc(step, sizeof(double));
+  if ( !ix->blk || !t )
+    {
+      free(t);
+      return *status = MEMORY_ALLOCATION;
+    }
+
+  for ( row = 1, b = 0; row <= nrows; row += n, b++ )
+    {
+      n = nrows - row + 1 < step ? nrows - row + 1 : step;
+      if ( fits_read_col(fptr, TDOUBLE, colnum, row, 1, n, NULL, t, &anynul,
+			 status) )
+	break;
+      ix->blk[b].tmin = HUGE_VAL;
+      ix->blk[b].tmax = -HUGE_VAL;
+      ix->blk[b].offset = datastart + (long long)(row - 1)*rowlen;
+      for ( j = 0; j < n; j++ )
+	{
+	  if ( t[j] < ix->blk[b].tmin )
+	    ix->blk[b].tmin = t[j];
+	  if ( t[j] > ix->blk[b].tmax )
+	    ix->blk[b].tmax = t[j];
+	}
+    }
+  free(t);
+  return *status;
+}
+
+int evt_tindex_write(const evt_tindex *ix, const char *filename)
+{
+  tindex_head h;
+  FILE *fp;
+  int ok;
+
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, TINDEX_MAGIC, 8);
+  h.order = TINDEX_ORDER;
+  h.hdunum = ix->hdunum;
+  h.nrows = ix->nrows;
+  h.rowlen = ix->rowlen;
+  h.step = ix->step;
+  h.nblocks = ix->nblocks;
+  strcpy(h.datasum, ix->datasum);
+
+  if ( !(fp = fopen(filename, "wb")) )
+    return -1;
+  ok = fwrite(&h, sizeof(h), 1, fp) == 1
+    && fwrite(ix->blk, sizeof(evt_tindex_block), ix->nblocks, fp)
+    == (size_t)ix->nblocks;
+  if ( fclose(fp) || !ok )
+    {
+      remove(filename);
+      return -1;
+    }
+  return 0;
+}
+
+/* read an index file; -1 if it is not there or not readable */
+int evt_tindex_read(evt_tindex *ix, const char *filename)
+{
+  tindex_head h;
+  FILE *fp;
+  int ok;
+
+  memset(ix, 0, sizeof(*ix));
+  if ( !(fp = fopen(filename, "rb")) )
+    return -1;
+  ok = fread(&h, sizeof(h), 1, fp) == 1
+    && !memcmp(h.magic, TINDEX_MAGIC, 8) && h.order == TINDEX_ORDER
+    && h.nblocks >= 0 && h.step > 0
+    && h.nblocks == (h.nrows + h.step - 1)/h.step
+    && (ix->blk = calloc(h.nblocks + 1, sizeof(evt_tindex_block)))
+    && fread(ix->blk, sizeof(evt_tindex_block), h.nblocks, fp)
+    == (size_t)h.nblocks;
+  fclose(fp);
+  if ( !ok )
+    {
+      evt_tindex_free(ix);
+      return -1;
+    }
+  ix->hdunum = h.hdunum;
+  ix->nrows = h.nrows;
+  ix->rowlen = h.rowlen;
+  ix->step = h.step;
+  ix->nblocks = h.nblocks;
+  h.datasum[FLEN_VALUE-1] = 0;
+  strcpy(ix->datasum, h.datasum);
+  return 0;
+}
+
+/*
+  The index file name of the events file evtname, which must be a
+  plain file on disk with no row filter or other extended syntax
+  (anything that changes the rows). Returns -1 if there is none.
+*/
+int evt_tindex_name(const char *evtname, char *name, size_t len)
+{
+  char urltype[MAX_PREFIX_LEN], path[FLEN_FILENAME], outfile[FLEN_FILENAME];
+  char extspec[FLEN_FILENAME], filter[FLEN_FILENAME];
+  char binspec[FLEN_FILENAME], colspec[FLEN_FILENAME];
+  int status = 0, ok;
+
+  fits_write_errmark();
+  ok = fits_parse_input_url((char *)evtname, urltype, path, outfile,
+			    extspec, filter, binspec, colspec, &status) == 0
+    && (!*urltype || !strcmp(urltype, "file://"))
+    && !*outfile && !*filter && !*binspec && !*colspec;
+  fits_clear_errmark();
+  if ( !ok || (size_t)snprintf(name, len, "%s.tidx", path) >= len )
+    return -1;
+  return 0;
+}
+
+/*
+  Load the index of the current HDU of fptr, opened as evtname.
+  Returns 0, or -1 if there is no index or it no longer matches the
+  table.
+*/
+int evt_tindex_open(evt_tindex *ix, fitsfile *fptr, const char *evtname)
+{
+  char name[FLEN_FILENAME + 8], datasum[FLEN_VALUE];
+  long nrows, rowlen;
+  int hdunum, status = 0, ok;
+
+  memset(ix, 0, sizeof(*ix));
+  if ( evt_tindex_name(evtname, name, sizeof(name))
+       || evt_tindex_read(ix, name) )
+    return -1;
+
+  fits_get_hdu_num(fptr, &hdunum);
+  fits_write_errmark();
+  ok = fits_read_key(fptr, TSTRING, "DATASUM", datasum, NULL, &status) == 0
+    && fits_read_key(fptr, TLONG, "NAXIS1", &rowlen, NULL, &status) == 0
+    && fits_get_num_rows(fptr, &nrows, &status) == 0;
+  fits_clear_errmark();
+  if ( !ok || hdunum != ix->hdunum || nrows != ix->nrows
+       || rowlen != ix->rowlen || strcmp(datasum, ix->datasum) )
+    {
+      evt_tindex_free(ix);
+      return -1;
+    }
+  return 0;
+}
+
+/*
+  The rows, first[i] to last[i] (1-based, inclusive), of the blocks
+  that have some TIME in one of the ngti sorted, disjoint intervals
+  start <= t <= stop; adjacent blocks are merged. first and last must
+  have room for ix->nblocks ranges. Returns the number of ranges.
+*/
+long evt_tindex_ranges(const evt_tindex *ix, const double *start,
+		       const double *stop, long ngti, long long *first,
+		       long long *last)
+{
+  const evt_tindex_block *b;
+  long i, lo, hi, mid, n = 0;
+  long long r0, r1;
+
+  for ( i = 0, b = ix->blk; i < ix->nblocks; i++, b++ )
+    {
+      /* the first interval not ending before the block */
+      for ( lo = 0, hi = ngti; lo < hi; )
+	{
+	  mid = (lo + hi)/2;
+	  if ( stop[mid] < b->tmin )
+	    lo = mid + 1;
+	  else
+	    hi = mid;
+	}
+      if ( lo == ngti || start[lo] > b->tmax )
+	continue;
+
+      r0 = i*ix->step + 1;
+      r1 = r0 + ix->step - 1 < ix->nrows ? r0 + ix->step - 1 : ix->nrows;
+      if ( n && last[n-1] + 1 == r0 )
+	last[n-1] = r1;
+      else
+	{
+	  first[n] = r0;
+	  last[n++] = r1;
+	}
+    }
+  return n;
+}
+
+void evt_tindex_free(evt_tindex *ix)
+{
+  free(ix->blk);
+  ix->blk = 0;
+  ix->nblocks = 0;
+}
@@ -0,0 +1,43 @@
+/*
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+            evt_tindex.h
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+
+A sidecar time index of an EVENTS table, for reading only the rows
+that can fall in a set of GTIs. See evt_tindex.c.
+
+*/
+
+#ifndef EVT_TINDEX_H
+#define EVT_TINDEX_H
+
+#include "fitsio.h"
+
+/* a block of step rows: its TIME range and where it is in the file */
+typedef struct
+{
+  double tmin, tmax;
+  long long offset;
+} evt_tindex_block;
+
+typedef struct
+{
+  int hdunum;
+  long long nrows, rowlen, step;
+  char datasum[FLEN_VALUE];	/* of the table indexed */
+  long nblocks;
+  evt_tindex_block *blk;
+} evt_tindex;
+
+int evt_tindex_build(evt_tindex *ix, fitsfile *fptr, long step,
+		     int *status);
+int evt_tindex_write(const evt_tindex *ix, const char *filename);
+int evt_tindex_read(evt_tindex *ix, const char *filename);
+int evt_tindex_name(const char *evtname, char *name, size_t len);
+int evt_tindex_open(evt_tindex *ix, fitsfile *fptr, const char *evtname);
+long evt_tindex_ranges(const evt_tindex *ix, const double *start,
+		       const double *stop, long ngti, long long *first,
+		       long long *last);
+void evt_tindex_free(evt_tindex *ix);
+
+#endif
@@ -0,0 +1,589 @@
+/*
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+            evt_xform
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+
+Copies an event list, rewriting one kind of column of every event
+with a per-event kernel. This does the work of undoppler, time_shift
+and time_dist. The kernels are
+
+	doppler	TG_R, TG_LAM and TG_MLAM (those there are) times the
+		ratio of rest to apparent wavelength of a circular
+		binary orbit at TIME, as undoppler
+	next	TIME of the following event, dropping the last
+		event, as time_shift
+	offset	TIME plus a constant
+	dither	TIME plus a uniform deviate in [0, 1) times the
+		smallest step between successive times, as time_dist
+
+Rows are copied as raw bytes, a chunk at a time. Only the rewritten
+columns are decoded, each into a contiguous array, transformed there
+in a plain loop the compiler vectorizes, and encoded back into the
+rows. The other HDUs are copied, and the events header is copied with
+a HISTORY record added. dither makes a first pass over TIME for its
+step.
+
+Build:
+	cc -O2 -o evt_xform evt_xform.c evt0_map.c -lcfitsio -lm
+
+*/
+
+/*** include files ***/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#include "fitsio.h"
+
+#include "evt0_map.h"
+
+#define R_SOL 6.960e10		/* cm */
+#define C_LIGHT 2.998e10	/* cm/s */
+
+#define XF_MAXCOLS 3
+
+enum
+  {
+    XF_SCALE,			/* multiply by w */
+    XF_ADD,			/* add w */
+    XF_NEXT			/* take the next row's value */
+  };
+
+typedef struct
+{
+  /* doppler */
+  double period;		/* days */
+  double minimum;		/* JD of primary minimum */
+  double inclination;		/* degrees */
+  double radius;		/* R_sol */
+  double jdref;			/* JD of TIME zero, from MJDREF */
+  /* offset */
+  double shift;
+  /* dither */
+  double step;
+  unsigned long long seed;
+} xf_params;
+
+typedef struct xf_kernel
+{
+  const char *name;
+  int op;
+  const char *cols[XF_MAXCOLS + 1];	/* 0-terminated */
+  /* w[i] for the events at times t[i] */
+  void (*weights)(xf_params *p, const double *t, double *w, long n);
+} xf_kernel;
+
+/* a column rewritten, in the raw rows */
+typedef struct
+{
+  int colnum, typecode;
+  long off;
+  double scale, zero;
+} xf_col;
+
+static char *progname;
+static char DATE[FLEN_VALUE];
+
+void printerror(int status)
+{
+  /*****************************************************/
+  /* Print out cfitsio error messages and exit program */
+  /*****************************************************/
+
+  if (status)
+    fprintf(stderr, "\n*** Error occurred during program execution ***\n");
+  fits_report_error(stderr, status);
+  exit( status );
+}
+
+static void doppler_weights(xf_params *p, const double *t, double *w,
+			    long n)
+{
+  double k = sin(p->inclination*M_PI/180)*2*M_PI*p->radius*R_SOL
+    / (p->period*86400);
+  double phase, v;
+  long i;
+
+  /* no heliocentric corrections done */
+  for ( i = 0; i < n; i++ )
+    {
+      phase = (p->jdref + t[i]/86400 - p->minimum)/p->period;
+      v = k*cos(phase*2*M_PI + M_PI/2);
+      w[i] = 1/(1 - v/C_LIGHT);
+    }
+}
+
+static void offset_weights(xf_params *p, const double *t, double *w, long n)
+{
+  long i;
+
+  (void)t;
+  for ( i = 0; i < n; i++ )
+    w[i] = p->shift;
+}
+
+/* xorshift64* */
+static void dither_weights(xf_params *p, const double *t, double *w, long n)
+{
+  unsigned long long s = p->seed;
+  long i;
+
+  (void)t;
+  for ( i = 0; i < n; i++ )
+    {
+      s ^= s >> 12;
+      s ^= s << 25;
+      s ^= s >> 27;
+      w[i] = ((s * 2685821657736338717ULL) >> 11)
+	* (1.0/9007199254740992.0) * p->step;
+    }
+  p->seed = s;
+}
+
+static const xf_kernel kernels[] =
+  {
+    { "doppler", XF_SCALE, { "tg_r", "tg_lam", "tg_mlam", 0 },
+      doppler_weights },
+    { "next", XF_NEXT, { "time", 0 }, 0 },
+    { "offset", XF_ADD, { "time", 0 }, offset_weights },
+    { "dither", XF_ADD, { "time", 0 }, dither_weights },
+    { 0, 0, { 0 }, 0 }
+  };
+
+int print_usage(void)
+{
+  int k;
+
+  fprintf(stderr, "\nUsage:\n\t%s [options] <KERNEL> <INFILE> <OUTFILE>\n",
+	  progname);
+  fprintf(stderr, "\n\tKERNEL is one of");
+  for ( k = 0; kernels[k].name; k++ )
+    fprintf(stderr, " %s", kernels[k].name);
+  fprintf(stderr, "\n\n\te[events]:\tname of the events extension\n");
+  fprintf(stderr,"\tm[65536]:\trows read at a time\n");
+  fprintf(stderr,"\tH[command line]:\tHISTORY record for the EVENTS header\n");
+  fprintf(stderr,"\td[0]:\toffset: seconds added to TIME\n");
+  fprintf(stderr,"\tS[clock]:\tdither: random seed\n");
+  fprintf(stderr,"\t--period[2.8673285]:\tdoppler: orbital period (days)\n");
+  fprintf(stderr,"\t--minimum[2445739.003]:\tdoppler: JD of primary minimum\n");
+  fprintf(stderr,"\t--inclination[81.4]:\tdoppler: inclination (degrees)\n");
+  fprintf(stderr,"\t--radius[11.5079]:\tdoppler: orbit radius (R_sol)\n");
+  fprintf(stderr,"\t--nommap:\tread the input through cfitsio only\n");
+  fprintf(stderr,"\th or ?:\tprint usage\n");
+  return 0;
+}
+
+enum
+  {
+    OPT_NOMMAP = 256,
+    OPT_PERIOD,
+    OPT_MINIMUM,
+    OPT_INCLINATION,
+    OPT_RADIUS
+  };
+
+static struct option long_options[] =
+  {
+    {"nommap", no_argument, 0, OPT_NOMMAP},
+    {"period", required_argument, 0, OPT_PERIOD},
+    {"minimum", required_argument, 0, OPT_MINIMUM},
+    {"inclination", required_argument, 0, OPT_INCLINATION},
+    {"radius", required_argument, 0, OPT_RADIUS},
+    {"help", no_argument, 0, 'h'},
+    {0, 0, 0, 0}
+  };
+
+/*
+  Find column name; 0 with c->colnum 0 if it is not there. Only
+  scalar E and D columns can be rewritten.
+*/
+static int find_col(fitsfile *fptr, const char *name, xf_col *c,
+		    int *status)
+{
+  char key[FLEN_KEYWORD];
+  long repeat, width;
+
+  c->colnum = 0;
+  c->scale = 1.0;
+  c->zero = 0.0;
+  fits_write_errmark();
+  if ( fits_get_colnum(fptr, CASEINSEN, (char *)name, &c->colnum, status) )
+    {
+      *status = 0;
+      c->colnum = 0;
+      fits_clear_errmark();
+      return 0;
+    }
+  snprintf(key, sizeof(key), "TSCAL%d", c->colnum);
+  if ( fits_read_key(fptr, TDOUBLE, key, &c->scale, NULL, status) )
+    *status = 0;
+  snprintf(key, sizeof(key), "TZERO%d", c->colnum);
+  if ( fits_read_key(fptr, TDOUBLE, key, &c->zero, NULL, status) )
+    *status = 0;
+  fits_clear_errmark();
+
+  if ( fits_get_coltype(fptr, c->colnum, &c->typecode, &repeat, &width,
+			status)
+       || (c->off = evt0_col_offset(fptr, c->colnum, status)) < 0 )
+    return *status;
+  if ( repeat != 1 || (c->typecode != TFLOAT && c->typecode != TDOUBLE) )
+    {
+      fprintf(stderr, "%s: %s is not a scalar E or D column\n", progname,
+	      name);
+      return *status = BAD_TFORM;
+    }
+  return 0;
+}
+
+/* n values of column c of the rows into v */
+static void decode_col(const xf_col *c, const unsigned char *rows,
+		       long rowlen, double *v, long n)
+{
+  union { unsigned int u; float f; } f4;
+  union { unsigned long long u; double d; } f8;
+  const unsigned char *p = rows + c->off;
+  long i;
+
+  if ( c->typecode == TFLOAT )
+    for ( i = 0; i < n; i++, p += rowlen )
+      {
+	memcpy(&f4.u, p, 4);
+	f4.u = __builtin_bswap32(f4.u);
+	v[i] = f4.f;
+      }
+  else
+    for ( i = 0; i < n; i++, p += rowlen )
+      {
+	memcpy(&f8.u, p, 8);
+	f8.u = __builtin_bswap64(f8.u);
+	v[i] = f8.d;
+      }
+  if ( c->scale != 1.0 || c->zero != 0.0 )
+    for ( i = 0; i < n; i++ )
+      v[i] = c->scale*v[i] + c->zero;
+}
+
+static void encode_col(const xf_col *c, unsigned char *rows, long rowlen,
+		       double *v, long n)
+{
+  union { unsigned int u; float f; } f4;
+  union { unsigned long long u; double d; } f8;
+  unsigned char *p = rows + c->off;
+  long i;
+
+  if ( c->scale != 1.0 || c->zero != 0.0 )
+    for ( i = 0; i < n; i++ )
+      v[i] = (v[i] - c->zero)/c->scale;
+  if ( c->typecode == TFLOAT )
+    for ( i = 0; i < n; i++, p += rowlen )
+      {
+	f4.f = (float)v[i];
+	f4.u = __builtin_bswap32(f4.u);
+	memcpy(p, &f4.u, 4);
+      }
+  else
+    for ( i = 0; i < n; i++, p += rowlen )
+      {
+	f8.d = v[i];
+	f8.u = __builtin_bswap64(f8.u);
+	memcpy(p, &f8.u, 8);
+      }
+}
+
+/* the smallest positive step between successive times, for dither */
+static int time_step(fitsfile *in, const xf_col *tc, long nrows,
+		     long chunk, double *t, double *step, int *status)
+{
+  double last = 0.0, d;
+  long row, n, j;
+  int anynul;
+
+  *step = HUGE_VAL;
+  for ( row = 1; row <= nrows; row += n )
+    {
+      n = nrows - row + 1 < chunk ? nrows - row + 1 : chunk;
+      if ( fits_read_col(in, TDOUBLE, tc->colnum, row, 1, n, NULL, t,
+			 &anynul, status) )
+	return *status;
+      for ( j = 0; j < n; j++ )
+	{
+	  d = t[j] - (j ? t[j-1] : last);
+	  if ( (row > 1 || j) && d > 0 && d < *step )
+	    *step = d;
+	}
+      last = t[n-1];
+    }
+  if ( *step == HUGE_VAL )
+    {
+      fprintf(stderr, "%s: no two events have different times\n", progname);
+      return *status = BAD_DATA_FILL;
+    }
+  return 0;
+}
+
+/*
+  Stream the EVENTS table, the current HDU of in, through kernel k
+  into out, whose header is already written with no rows.
+*/
+static int xform_events(fitsfile *in, const char *inname, fitsfile *out,
+			const xf_kernel *k, xf_params *p, long chunk,
+			int usemap, int *status)
+{
+  xf_col tc, cols[XF_MAXCOLS];
+  evt0_map m;
+  unsigned char *buf = 0;
+  const unsigned char *src;
+  double *t = 0, *v = 0, *w = 0;
+  long rowlen, nrows, pcount, row, n, nread, nout, written = 0, j;
+  int ncols = 0, i, mapped = 0;
+
+  if ( fits_read_key(in, TLONG, "NAXIS1", &rowlen, NULL, status)
+       || fits_read_key(in, TLONG, "PCOUNT", &pcount, NULL, status)
+       || fits_get_num_rows(in, &nrows, status) )
+    return *status;
+  if ( pcount )
+    {
+      fprintf(stderr, "%s: variable length columns are not supported\n",
+	      progname);
+      return *status = BAD_TFORM;
+    }
+  if ( find_col(in, "time", &tc, status) )
+    return *status;
+  if ( !tc.colnum )
+    {
+      fprintf(stderr, "%s: no TIME column\n", progname);
+      return *status = COL_NOT_FOUND;
+    }
+  for ( i = 0; k->cols[i]; i++ )
+    {
+      if ( find_col(in, k->cols[i], cols + ncols, status) )
+	return *status;
+      if ( cols[ncols].colnum )
+	ncols++;
+    }
+  if ( !ncols )
+    fprintf(stderr, "%s: none of the %s columns are here; copying\n",
+	    progname, k->name);
+
+  if ( chunk < 1 )
+    chunk = 1;
+  t = CALLOC(chunk + 1, double);
+  v = CALLOC(chunk + 1, double);
+  w = CALLOC(chunk + 1, double);
+  buf = CALLOC((chunk + 1)*rowlen, unsigned char);
+  if ( !t || !v || !w || !buf )
+    return *status = MEMORY_ALLOCATION;
+
+  if ( k->weights == dither_weights
+       && time_step(in, &tc, nrows, chunk, t, &p->step, status) )
+    goto done;
+  if ( usemap )
+    mapped = evt0_map_open(&m, in, inname, 0) == 0;
+
+  fprintf(stderr, "Writing events...    ");
+
+  for ( row = 1; row <= nrows && !*status; row += n )
+    {
+      fprintf(stderr, "\b\b\b\b %2d%%", (int)(100.0*(row - 1)/nrows));
+
+      /* next looks one row past the chunk, and writes one less in all */
+      n = nrows - row + 1 < chunk ? nrows - row + 1 : chunk;
+      nread = (k->op == XF_NEXT && row + n <= nrows) ? n + 1 : n;
+      nout = (k->op == XF_NEXT && row + n > nrows) ? n - 1 : n;
+      if ( mapped )
+	{
+	  src = evt0_map_rows(&m, row);
+	  memcpy(buf, src, (size_t)nread*rowlen);
+	}
+      else if ( fits_read_tblbytes(in, row, 1, (LONGLONG)nread*rowlen, buf,
+				   status) )
+	break;
+
+      if ( k->weights )
+	{
+	  decode_col(&tc, buf, rowlen, t, n);
+	  k->weights(p, t, w, n);
+	}
+      for ( i = 0; i < ncols; i++ )
+	{
+	  decode_col(cols + i, buf, rowlen, v, nread);
+	  switch ( k->op )
+	    {
+	    case XF_SCALE:
+	      for ( j = 0; j < n; j++ )
+		v[j] *= w[j];
+	      break;
+	    case XF_ADD:
+	      for ( j = 0; j < n; j++ )
+		v[j] += w[j];
+	      break;
+	    case XF_NEXT:
+	      for ( j = 0; j < nout; j++ )
+		v[j] = v[j+1];
+	      break;
+	    }
+	  encode_col(cols + i, buf, rowlen, v, nout);
+	}
+
+      if ( nout > 0 )
+	fits_write_tblbytes(out, written + 1, 1, (LONGLONG)nout*rowlen, buf,
+			    status);
+      written += nout;
+    }
+  if ( !*status )
+    fprintf(stderr, "\b\b\b\b100%% done\n");
+
+  if ( mapped )
+    evt0_map_close(&m);
+ done:
+  free(t);
+  free(v);
+  free(w);
+  free(buf);
+  return *status;
+}
+
+int main(int argc, char *argv[])
+{
+  fitsfile *in, *out;
+  const xf_kernel *k;
+  xf_params p;
+  char *inname, *extname = "events", *history = 0, *s;
+  char outname[FLEN_FILENAME + 1];
+  double mjdref = 50814.0;
+  long chunk = 65536, len;
+  int nhdus, target, timeref, usemap = 1, c, i, status = 0;
+
+  progname = argv[0];
+  if ( (s = strrchr(progname, '/')) )
+    progname = s + 1;
+
+  memset(&p, 0, sizeof(p));
+  p.period = 2.8673285;
+  p.minimum = 2445739.003;
+  p.inclination = 81.4;
+  p.radius = 11.5079;
+  p.seed = (unsigned long long)time(0) << 20 ^ getpid();
+
+  while ((c = getopt_long(argc, argv, "e:m:H:d:S:h?", long_options, NULL))
+	 != -1)
+    {
+      switch (c)
+	{
+	case 'e':
+	  extname = optarg;
+	  break;
+	case 'm':
+	  chunk = atol(optarg);
+	  break;
+	case 'H':
+	  history = optarg;
+	  break;
+	case 'd':
+	  p.shift = atof(optarg);
+	  break;
+	case 'S':
+	  p.seed = strtoull(optarg, 0, 0);
+	  break;
+	case OPT_NOMMAP:
+	  usemap = 0;
+	  break;
+	case OPT_PERIOD:
+	  p.period = atof(optarg);
+	  break;
+	case OPT_MINIMUM:
+	  p.minimum = atof(optarg);
+	  break;
+	case OPT_INCLINATION:
+	  p.inclination = atof(optarg);
+	  break;
+	case OPT_RADIUS:
+	  p.radius = atof(optarg);
+	  break;
+	case 'h':
+	case '?':
+	default:
+	  print_usage();
+	  exit(1);
+	}
+    }
+  if ( argc - optind != 3 )
+    {
+      print_usage();
+      exit(1);
+    }
+  for ( k = kernels; k->name && strcmp(k->name, argv[optind]); k++ )
+    ;
+  if ( !k->name )
+    {
+      fprintf(stderr, "%s: unknown kernel '%s'\n", progname, argv[optind]);
+      print_usage();
+      exit(1);
+    }
+  inname = argv[optind+1];
+  snprintf(outname, sizeof(outname), "%s%s",
+	   *argv[optind+2] == '!' ? "" : "!", argv[optind+2]);
+  if ( !p.seed )
+    p.seed = 1;
+
+  /* the command line, for the HISTORY record */
+  if ( !history )
+    {
+      for ( i = 0, len = 1; i < argc; i++ )
+	len += strlen(argv[i]) + 1;
+      if ( !(history = CALLOC(len, char)) )
+	exit(1);
+      strcpy(history, progname);
+      for ( i = 1; i < argc; i++ )
+	strcat(strcat(history, " "), argv[i]);
+    }
+
+  fits_get_system_time(DATE, &timeref, &status);
+  if ( fits_open_file(&in, inname, READONLY, &status)
+       || fits_get_num_hdus(in, &nhdus, &status)
+       || fits_movnam_hdu(in, ANY_HDU, extname, 0, &status)
+       || fits_create_file(&out, outname, &status) )
+    printerror(status);
+  fits_get_hdu_num(in, &target);
+
+  /* TIME is counted from MJDREF, 1998.0 for Chandra */
+  fits_write_errmark();
+  if ( fits_read_key(in, TDOUBLE, "MJDREF", &mjdref, NULL, &status) )
+    status = 0;
+  fits_clear_errmark();
+  p.jdref = mjdref + 2400000.5;
+
+  for ( i = 1; i <= nhdus && !status; i++ )
+    {
+      fits_movabs_hdu(in, i, NULL, &status);
+      if ( i != target )
+	{
+	  fits_copy_hdu(in, out, 0, &status);
+	  evt0_stamp_hdu(out, progname, DATE, &status);
+	  continue;
+	}
+      fits_copy_header(in, out, &status);
+      fits_modify_key_lng(out, "NAXIS2", 0, "&", &status);
+      fits_set_hdustruc(out, &status);
+      fits_write_history(out, history, &status);
+      if ( !xform_events(in, inname, out, k, &p, chunk, usemap, &status) )
+	evt0_stamp_hdu(out, progname, DATE, &status);
+    }
+  if ( status )
+    {
+      fits_report_error(stderr, status);
+      status = 0;
+      fits_delete_file(out, &status);
+      exit(1);
+    }
+
+  fits_close_file(out, &status);
+  fits_close_file(in, &status);
+  if ( status )
+    printerror(status);
+  return 0;
+}
@@ -6,6 +6,30 @@
 
 Correct the values reported in telemetry for AMP_SF
 
+The PHA ranges are tabulated and only events in the two switch bands
+are resolved from their taps, with AVX2 when the CPU has it (see
+evt0_ampsf.c). Uncompressed input is read memory-mapped (see
+evt0_map.c), and with -S the output is a clone of the input with only
+the changed AMP_SF values written (see evt0_patch.c). With -m, the
+files listed in a manifest are corrected in one run (see
+evt0_batch.c). With -J, run statistics are written as JSON (see
+evt0_stats.c). With -i - or -o -, stdin or stdout is corrected as a
+sequential FITS stream (see evt0_stream.c); so is a gzipped input,
+decompressed on other threads (see evt0_gz.c). With -Z, the EVENTS
+table of the output is tile-compressed (see evt0_ztab.c). With -H,
+nothing is written but histograms of what the correction would change
+(see evt0_hist.c).
+
+The parameters are picked for each file from the DETNAM and DATE-OBS
+of its EVENTS table, as fix_amp_sf_4.pl used to (see ampsf_profile()
+in evt0_ampsf.c); options given override them, and -d starts from the
+defaults instead. A file whose AMPSFCOR is true has been corrected
+already and is left alone unless -f is given; in stream mode its
+EVENTS table is passed through unchanged.
+
+Build:
+	cc -O2 -pthread -o fix_amp_sf_4 fix_amp_sf_4.c evt0_kernels.c evt0_ampsf.c evt0_simd.c evt0_map.c evt0_patch.c evt0_batch.c evt0_stats.c evt0_stream.c evt0_gz.c evt0_ztab.c evt0_hist.c -lcfitsio -lz -lm
+
 $Header: /juda1.real/juda1/juda/asc/hrc/code/evt_tools/RCS/fix_amp_sf_3.c,v 1.2 2001/11/21 20:07:46 juda Exp $
 
 */
@@ -19,16 +43,190 @@ $Header: /juda1.real/juda1/juda/asc/hrc/code/evt_tools/RCS/fix_amp_sf_3.c,v 1.2
 
 #include "fitsio.h"
 
-#define CALLOC(n,x)  ((x *) calloc(n,sizeof(x)))
+#include "evt0_kernels.h"
+#include "evt0_map.h"
+#include "evt0_patch.h"
+#include "evt0_batch.h"
+#include "evt0_stats.h"
+#include "evt0_stream.h"
+#include "evt0_gz.h"
+#include "evt0_hist.h"
+
+/* rows per unit of work in batch mode */
+#define BATCH_ROWS 262144
+
+/* rows corrected at a time in stream mode */
+#define STREAM_ROWS 65536
+
+/*
+  How the parameters for a file are picked: the built-in profile for
+  its DETNAM and DATE-OBS (see evt0_ampsf.c) unless noprof, with the
+  options given on the command line on top.
+*/
+typedef struct
+{
+  const char *optval[8];	/* 0 where not given */
+  int noprof;
+  int force;			/* even if AMPSFCOR says it's done */
+  const char *progname;
+} ampsf_cfg;
+
+/*
+  The parameters for file name, whose EVENTS header has the given
+  DETNAM, DATE-OBS and AMPSFCOR values ("" where missing). Returns 0,
+  1 if AMP_SF has been corrected already, or -1 if there is no
+  profile for it; either is reported.
+*/
+static int file_params(const ampsf_cfg *cfg, const char *name,
+		       const char *detnam, const char *date_obs,
+		       const char *ampsfcor, ampsf_params *p)
+{
+  int i, k;
+
+  k = ampsf_select(detnam, date_obs, ampsfcor,
+		   (cfg->noprof ? AMPSF_NOPROF : 0)
+		   | (cfg->force ? AMPSF_FORCE : 0), p);
+  if ( k > 0 )
+    {
+      fprintf(stderr, "%s: %s: AMP_SF is corrected already (AMPSFCOR), "
+	      "not rewritten\n", cfg->progname, name);
+      return 1;
+    }
+  if ( k < 0 )
+    {
+      fprintf(stderr, "%s: %s: no AMP_SF parameters for DETNAM='%s' "
+	      "DATE-OBS='%s'\n\t(-d uses the defaults)\n", cfg->progname,
+	      name, detnam, date_obs);
+      return -1;
+    }
+  for ( i = 0; i < 8; i++ )
+    if ( cfg->optval[i] )
+      ampsf_option(p, AMPSF_OPTS[i], cfg->optval[i]);
+  return 0;
+}
+
+/* batch mode: how to pick the parameters, and the statistics of all files */
+typedef struct
+{
+  ampsf_cfg *cfg;
+  int isa;
+  evt0_stats *stats;		/* 0 if not wanted */
+  pthread_mutex_t lock;
+} batch_ctx;
+
+/* pick a file's parameters, then apply its overrides, given with the
+   option letters */
+static int batch_setup(void *ctx, evt0_job *job)
+{
+  batch_ctx *bc = ctx;
+  ampsf_lut *lut;
+  ampsf_params p;
+  char detnam[FLEN_VALUE], date_obs[FLEN_VALUE], ampsfcor[FLEN_VALUE];
+  char *key;
+  int i, k;
+
+  if ( !(lut = CALLOC(1, ampsf_lut)) )
+    return -1;
+  job->params = lut;
+  evt0_profile_keys(job->fptr, detnam, date_obs, ampsfcor);
+  if ( (k = file_params(bc->cfg, job->in, detnam, date_obs, ampsfcor, &p)) )
+    return k > 0 ? 1 : -2;
+
+  for ( i = 0; i < job->nover; i++ )
+    {
+      key = job->over[i];
+      if ( key[1] != '=' || ampsf_option(&p, key[0], key + 2) )
+	return -1;
+    }
+  ampsf_lut_init(lut, &p);
+  return 0;
+}
+
+static void batch_fix(void *ctx, evt0_job *job, evt0_block *blk, long row,
+		      evt0_patch *pt)
+{
+  batch_ctx *bc = ctx;
+  evt0_stats st;
+  unsigned char *from = 0;
+  double t = 0.0;
+  int status = 0;
+
+  if ( bc->stats && (from = CALLOC(blk->n, unsigned char)) )
+    {
+      evt0_stats_init(&st);
+      memcpy(from, blk->amp_sf, blk->n);
+      t = evt0_now();
+    }
+
+  fix_amp_sf_lut(blk, job->params, bc->isa);
+  if ( from )
+    {
+      st.t[EVT0_T_CORRECT] += evt0_now() - t;
+      t = evt0_now();
+    }
+  evt0_patch_col(pt, EVT0_AMP_SF, 0, row, blk->n, blk->amp_sf, &status);
+
+  if ( from )
+    {
+      st.t[EVT0_T_WRITE] += evt0_now() - t;
+      evt0_stats_ampsf(&st, from, blk->amp_sf, blk->n);
+      evt0_stats_chunk(&st, blk->n, evt0_now() - st.start);
+      pthread_mutex_lock(&bc->lock);
+      evt0_stats_merge(bc->stats, &st);
+      pthread_mutex_unlock(&bc->lock);
+      free(from);
+    }
+}
+
+/* stream mode: the parameters, and the AMP_SF read for statistics */
+typedef struct
+{
+  ampsf_cfg *cfg;
+  const char *name;
+  ampsf_lut lut;
+  int isa;
+  unsigned char *from;
+  evt0_stats *stats;		/* 0 if not wanted */
+} stream_ctx;
+
+/* pick the parameters for each EVENTS table as its header goes by */
+static int stream_header(void *ctx, const char *hdr, long ncards)
+{
+  stream_ctx *sc = ctx;
+  ampsf_params p;
+  char detnam[FLEN_VALUE], date_obs[FLEN_VALUE], ampsfcor[FLEN_VALUE];
+  int k;
+
+  if ( evt0_card_value(hdr, ncards, "DETNAM", detnam) )
+    *detnam = 0;
+  if ( evt0_card_value(hdr, ncards, "DATE-OBS", date_obs) )
+    *date_obs = 0;
+  if ( evt0_card_value(hdr, ncards, "AMPSFCOR", ampsfcor) )
+    *ampsfcor = 0;
+  if ( (k = file_params(sc->cfg, sc->name, detnam, date_obs, ampsfcor, &p)) )
+    return k;
+  ampsf_lut_init(&sc->lut, &p);
+  return 0;
+}
+
+/* stream mode, and the blocks of a dry run (with no statistics) */
+static void stream_fix(void *ctx, evt0_block *blk)
+{
+  stream_ctx *sc = ctx;
+  double t = 0.0;
 
-#define GAIN 74.0
-#define THRESH1 8
-#define THRESH2 16
-#define THRESH3 32
-#define PHA_1TO2 50.5
-#define PHA_2TO3 99.5
-#define WIDTH1 2.0
-#define WIDTH2 2.0
+  if ( sc->stats )
+    {
+      memcpy(sc->from, blk->amp_sf, blk->n);
+      t = evt0_now();
+    }
+  fix_amp_sf_lut(blk, &sc->lut, sc->isa);
+  if ( sc->stats )
+    {
+      sc->stats->t[EVT0_T_CORRECT] += evt0_now() - t;
+      evt0_stats_ampsf(sc->stats, sc->from, blk->amp_sf, blk->n);
+    }
+}
 
 void printerror(int status)
 {
@@ -62,8 +260,8 @@ int main(argc,argv)
 int argc;
 char *argv[];
 {
-  char *progname, c, *inname, *outname;
-  int kk, i, j;
+  char *progname, c, *inname = 0, *outname = 0;
+  int kk, i;
 
   /* FITSIO variables */
   fitsfile *infile, *outfile;
@@ -90,9 +288,36 @@ char *argv[];
     *sub_mjf, *quality;
   short *av1, *av2, *av3, *au1, *au2, *au3;
 
-  double gain, sum_amps, diff1, diff2, diff3;
-  int thresh1, thresh2, thresh3;
-  double pha_1to2, pha_2to3, width1, width2;
+  ampsf_cfg cfg;
+  ampsf_params ap;
+  ampsf_lut lut;
+  int isa, k;
+  char detnam[FLEN_VALUE], date_obs[FLEN_VALUE], ampsfcor[FLEN_VALUE];
+
+  /* memory-mapped input */
+  int use_map = 1, mapped;
+  evt0_map map;
+  evt0_block blk;
+
+  /* patch-only output */
+  int patch = 0, patching;
+  evt0_patch pt;
+
+  /* batch mode */
+  char *manifest = 0;
+  int nthreads = 0;
+
+  /* tile-compressed output */
+  int ztab = 0;
+
+  /* dry run */
+  char *histname = 0;
+
+  /* run statistics */
+  char *statsfile = 0;
+  evt0_stats stats, *st = 0;
+  unsigned char *amp_sf_in = 0;
+  double t, t0 = 0.0;
 
   progname = strrchr(argv[0], '/');
   if(progname)
@@ -100,19 +325,12 @@ char *argv[];
   else
     progname = argv[0];
 
-  /* set the default input parameters */
-  gain = GAIN;
-  thresh1 = THRESH1;
-  thresh2 = THRESH2;
-  thresh3 = THRESH3;
-  pha_1to2 = PHA_1TO2;
-  pha_2to3 = PHA_2TO3;
-  width1 = WIDTH1;
-  width2 = WIDTH2;
-
+  /* the parameters come from the profile for each file unless given */
+  memset(&cfg, 0, sizeof(cfg));
+  cfg.progname = progname;
 
   /* check for command line variables */
-  while ((c = getopt(argc, argv, "i:o:g:a:b:c:p:P:t:T:h?")) != EOF)
+  while ((c = getopt(argc, argv, "i:o:g:a:b:c:p:P:t:T:dfNSZH:m:j:J:h?")) != EOF)
     {
       switch (c) 
         {
@@ -123,35 +341,54 @@ char *argv[];
 	  outname = optarg;
 	  break;
         case 'g':
-          gain = atof(optarg);
-          break;
         case 'a':
-          thresh1 = atoi(optarg);
-          break;
         case 'b':
-          thresh2 = atoi(optarg);
-          break;
         case 'c':
-          thresh3 = atoi(optarg);
-          break;
+        case 'p':
+        case 'P':
         case 't':
-          width1 = atof(optarg);
-          break;
         case 'T':
-          width2 = atof(optarg);
+          cfg.optval[strchr(AMPSF_OPTS, c) - AMPSF_OPTS] = optarg;
           break;
-        case 'p':
-          pha_1to2 = atof(optarg);
+        case 'd':
+          cfg.noprof = 1;
           break;
-        case 'P':
-          pha_2to3 = atof(optarg);
+        case 'f':
+          cfg.force = 1;
+          break;
+        case 'N':
+          use_map = 0;
+          break;
+        case 'S':
+          patch = 1;
+          break;
+        case 'Z':
+          ztab = 1;
+          break;
+        case 'H':
+          histname = optarg;
+          break;
+        case 'm':
+          manifest = optarg;
+          break;
+        case 'j':
+          nthreads = atoi(optarg);
+          break;
+        case 'J':
+          statsfile = optarg;
           break;
         case 'h':
         case '?':
-          fprintf(stderr,"\nUsage: %s -i infile -o outfile -[abcpPtTh]",
-		  progname);
-          fprintf(stderr,"\n\t-i infile:\tinput evt0.fits file");
-          fprintf(stderr,"\n\t-o outfile:\toutput evt0.fits file");
+          fprintf(stderr,"\nUsage: %s -i infile -o outfile -[gabcpPtTdfNSZjh]"
+		  "\n       %s -m manifest -[gabcpPtTdfZjh]", progname, progname);
+          fprintf(stderr,"\n\t-i infile:\tinput evt0.fits file, - for "
+		  "stdin");
+          fprintf(stderr,"\n\t-o outfile:\toutput evt0.fits file, - for "
+		  "stdout");
+          fprintf(stderr,"\n\tthe AMP_SF parameters default to the profile "
+		  "for the DETNAM and");
+          fprintf(stderr,"\n\tDATE-OBS of the EVENTS table; the values "
+		  "shown are those of -d");
 	  fprintf(stderr,"\n\tg[%.1f]:\tgain for PHA to SUMAMPS", GAIN);
           fprintf(stderr,"\n\ta[%d]:\tscale 1 threshold", THRESH1);
           fprintf(stderr,"\n\tb[%d]:\tscale 2 threshold", THRESH2);
@@ -164,30 +401,235 @@ char *argv[];
 		  WIDTH1);
 	  fprintf(stderr,"\n\tT[%.1f]:\t+/- band on PHA scale 2 to 3 switch", 
 		  WIDTH2);
+          fprintf(stderr,"\n\td:\tuse the defaults, not the detector/epoch "
+		  "profile");
+          fprintf(stderr,"\n\tf:\tcorrect even if AMPSFCOR says it's "
+		  "done");
+          fprintf(stderr,"\n\tN:\tread the input through cfitsio only");
+          fprintf(stderr,"\n\tS:\tclone the input and write only changed "
+		  "AMP_SF values");
+          fprintf(stderr,"\n\tZ:\ttile-compress the EVENTS table of the "
+		  "output");
+          fprintf(stderr,"\n\tH file:\tdry run: no outfile, write "
+		  "histograms of what would");
+          fprintf(stderr,"\n\t\tchange to file, RDB if it is - or "
+		  "*.rdb, else FITS");
+          fprintf(stderr,"\n\tm file:\tcorrect the files listed in file, one");
+          fprintf(stderr,"\n\t\t'infile outfile [key=value ...]' per line");
+          fprintf(stderr,"\n\tj[all CPUs]:\tthreads for -m, -Z and gzipped input");
+          fprintf(stderr,"\n\tJ file:\twrite run statistics as JSON to file "
+		  "(- for stdout)");
           fprintf(stderr,"\n\th or ?:\tprint usage\n");
           exit(0);
         }
     }
 
+  isa = tap_isa_select(TAP_ISA_AVX512);
+
+  if ( nthreads <= 0 )
+    nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+  if ( statsfile )
+    {
+      evt0_stats_init(&stats);
+      st = &stats;
+    }
+
+  if ( manifest )
+    {
+      batch_ctx bc;
+      evt0_batch b;
+      evt0_job *jobs;
+      int njobs, nfail;
+
+      if ( evt0_batch_read(manifest, &jobs, &njobs) )
+	exit(1);
+      b.nthreads = nthreads;
+      b.range_rows = BATCH_ROWS;
+      b.cols = EVT0_AMP_SF | EVT0_PHA | EVT0_AU1 | EVT0_AU2 | EVT0_AU3
+	| EVT0_AV1 | EVT0_AV2 | EVT0_AV3;
+      b.ztab = ztab;
+      b.verb = 0;
+      b.progname = progname;
+      b.setup = batch_setup;
+      b.range = batch_fix;
+      b.ctx = &bc;
+      bc.cfg = &cfg;
+      bc.isa = isa;
+      bc.stats = st;
+      pthread_mutex_init(&bc.lock, 0);
+      nfail = evt0_batch_run(&b, jobs, njobs);
+      if ( nfail )
+	fprintf(stderr, "%s: %d of %d files failed\n", progname, nfail,
+		njobs);
+      if ( st && evt0_stats_write(st, statsfile, progname, manifest, 0,
+				  EVT0_STATS_AMPSF) )
+	fprintf(stderr, "%s: cannot write %s\n", progname, statsfile);
+      evt0_batch_free(jobs, njobs);
+      exit(nfail ? 1 : 0);
+    }
+
+  if ( !inname || (!outname && !histname) )
+    {
+      fprintf(stderr, "%s: need -i infile and -o outfile\n", progname);
+      exit(1);
+    }
+
+  if ( ztab && outname && !strcmp(outname, "-") )
+    {
+      fprintf(stderr, "%s: -Z needs an output file\n", progname);
+      exit(1);
+    }
+
+  /* stream mode; a dry run reads through cfitsio instead */
+  if ( !histname
+       && (!strcmp(inname, "-") || !strcmp(outname, "-")
+	   || (use_map && evt0_gz_is(inname))) )
+    {
+      evt0_stream sm;
+      stream_ctx sc;
+
+      if ( st && !strcmp(statsfile, "-") && !strcmp(outname, "-") )
+	{
+	  fprintf(stderr, "%s: -J - would mix the statistics into the "
+		  "output stream\n", progname);
+	  exit(1);
+	}
+      sc.cfg = &cfg;
+      sc.name = inname;
+      sc.isa = isa;
+      sc.stats = st;
+      if ( st && !(sc.from = CALLOC(STREAM_ROWS, unsigned char)) )
+	{
+	  fprintf(stderr, "%s: out of memory\n", progname);
+	  exit(1);
+	}
+      sm.chunk_rows = STREAM_ROWS;
+      sm.cols = EVT0_AMP_SF | EVT0_PHA | EVT0_AU1 | EVT0_AU2 | EVT0_AU3
+	| EVT0_AV1 | EVT0_AV2 | EVT0_AV3;
+      sm.wcols = EVT0_AMP_SF;
+      sm.nthreads = nthreads;
+      sm.verb = 0;
+      sm.progname = progname;
+      sm.stats = st;
+      sm.header = stream_header;
+      sm.correct = stream_fix;
+      sm.ctx = &sc;
+      if ( evt0_stream_run(&sm, inname, outname) )
+	exit(1);
+      t = evt0_now();
+      if ( ztab && evt0_ztab_file(outname + (*outname == '!'), nthreads) )
+	exit(1);
+      if ( st )
+	st->t[EVT0_T_WRITE] += evt0_now() - t;
+      if ( st && evt0_stats_write(st, statsfile, progname, inname, outname,
+				  EVT0_STATS_AMPSF) )
+	{
+	  fprintf(stderr, "%s: cannot write %s\n", progname, statsfile);
+	  exit(1);
+	}
+      exit(0);
+    }
+
   /* open existing FITS file */
+  t = evt0_now();
   if (fits_open_file(&infile, inname, READONLY, &status))
     printerror( status );           /* call printerror if error occurs */
+  if ( st )
+    st->t[EVT0_T_OPEN] += evt0_now() - t;
 
   /* determine number of HDUs in input file */
   if (fits_get_num_hdus(infile, &hdunum, &status))
     printerror( status );
 
-  /* create new FITS file */
-  if (fits_create_file(&outfile, outname, &status))
-    printerror( status );           /* call printerror if error occurs */
+  /* pick the parameters from the EVENTS header */
+  fits_write_errmark();
+  if ( fits_movnam_hdu(infile, BINARY_TBL, "EVENTS", 0, &status) )
+    *detnam = *date_obs = *ampsfcor = 0;
+  else
+    evt0_profile_keys(infile, detnam, date_obs, ampsfcor);
+  status = 0;
+  fits_clear_errmark();
+  if (fits_movabs_hdu(infile, 1, &hdutype, &status))
+    printerror( status );
+  if ( (k = file_params(&cfg, inname, detnam, date_obs, ampsfcor, &ap)) )
+    {
+      fits_close_file(infile, &status);
+      exit(k > 0 ? 0 : 1);
+    }
+  ampsf_lut_init(&lut, &ap);
 
-  /* copy primary HDU */
-  if (fits_copy_hdu( infile, outfile, 0, &status))
-    printerror( status );           /* call printerror if error occurs */
+  /* dry run: histograms of what would change, and no output */
+  if ( histname )
+    {
+      evt0_hist h;
+      stream_ctx hc;
+
+      hc.lut = lut;
+      hc.isa = isa;
+      hc.stats = 0;
+      if ( fits_movnam_hdu(infile, BINARY_TBL, "EVENTS", 0, &status) )
+	printerror( status );
+      if ( evt0_hist_alloc(&h) )
+	{
+	  fprintf(stderr, "%s: out of memory\n", progname);
+	  exit(1);
+	}
+      if ( evt0_hist_run(&h, infile, inname, EVT0_AMP_SF | EVT0_PHA
+			 | EVT0_AU1 | EVT0_AU2 | EVT0_AU3 | EVT0_AV1
+			 | EVT0_AV2 | EVT0_AV3, nthreads,
+			 STREAM_ROWS, stream_fix, &hc, progname)
+	   || evt0_hist_write(&h, histname, inname, progname) )
+	exit(1);
+      fprintf(stderr, "%s: %s: %lld of %lld events would change AMP_SF\n",
+	      progname, inname, h.nampsf, h.rows);
+      evt0_hist_free(&h);
+      fits_close_file(infile, &status);
+      exit(0);
+    }
 
-  /* Update the DATE keyword in the output file and update the checksums */
-  fits_write_date(outfile, &status);
-  fits_write_chksum(outfile, &status);
+  /* clone the input for patching, if it is a plain file */
+  t = evt0_now();
+  if ( patch && evt0_clone(inname, outname) )
+    {
+      fprintf(stderr, "%s: cannot clone %s, writing a full copy\n",
+	      progname, inname);
+      patch = 0;
+    }
+  if ( st )
+    st->t[EVT0_T_HEADER] += evt0_now() - t;
+
+  if ( patch )
+    {
+      t = evt0_now();
+      if (fits_open_file(&outfile, outname + (*outname == '!'), READWRITE,
+			 &status))
+	printerror( status );
+      if ( st )
+	st->t[EVT0_T_OPEN] += evt0_now() - t;
+    }
+  else
+    {
+      /* create new FITS file */
+      t = evt0_now();
+      if (fits_create_file(&outfile, outname, &status))
+	printerror( status );           /* call printerror if error occurs */
+      if ( st )
+	st->t[EVT0_T_OPEN] += evt0_now() - t;
+
+      /* copy primary HDU */
+      t = evt0_now();
+      if (fits_copy_hdu( infile, outfile, 0, &status))
+	printerror( status );           /* call printerror if error occurs */
+      if ( st )
+	st->t[EVT0_T_HEADER] += evt0_now() - t;
+
+      /* Update the DATE keyword in the output file and update the checksums */
+      t = evt0_now();
+      fits_write_date(outfile, &status);
+      fits_write_chksum(outfile, &status);
+      if ( st )
+	st->t[EVT0_T_CHECKSUM] += evt0_now() - t;
+    }
 
   /* cycle through the FITS extensions */
   for ( kk = 2; kk < hdunum+1; kk++ )
@@ -199,9 +641,14 @@ char *argv[];
           exit(1);
         }
 
-      /* copy the extension */
-      if (fits_copy_hdu( infile, outfile, 0, &status))
+      /* copy the extension, or move to it in the clone */
+      t = evt0_now();
+      if (patch ? fits_movabs_hdu(outfile, kk, &hdutype, &status)
+	  : fits_copy_hdu( infile, outfile, 0, &status))
 	printerror( status );           /* call printerror if error occurs */
+      if ( st )
+	st->t[EVT0_T_HEADER] += evt0_now() - t;
+      patching = 0;
 
       /* Get EXTNAME keyword value to see if this is an events extension */
       if (fits_read_key(infile, TSTRING, "EXTNAME", &extname, comment, 
@@ -255,101 +702,138 @@ char *argv[];
 	  av1 = CALLOC(numrows, short);
 	  av2 = CALLOC(numrows, short);
 	  av3 = CALLOC(numrows, short);
+	  if ( st && !(amp_sf_in = CALLOC(numrows, unsigned char)) )
+	    {
+	      fprintf(stderr, "%s: out of memory\n", progname);
+	      exit(1);
+	    }
+
+	  mapped = use_map
+	    && evt0_map_open(&map, infile, inname, EVT0_AMP_SF | EVT0_PHA
+			     | EVT0_AU1 | EVT0_AU2 | EVT0_AU3
+			     | EVT0_AV1 | EVT0_AV2 | EVT0_AV3) == 0;
+	  blk.amp_sf = amp_sf;
+	  blk.pha = pha;
+	  blk.vstat = 0;
+	  blk.au1 = au1;
+	  blk.au2 = au2;
+	  blk.au3 = au3;
+	  blk.av1 = av1;
+	  blk.av2 = av2;
+	  blk.av3 = av3;
+
+	  patching = patch && mapped;
+	  if ( patching )
+	    evt0_patch_init(&pt, outfile, &map);
 
 	  i = 1;
 	  while (i <= nrows)
 	    {
-	      if( i+numrows < nrows )
+	      if( i+numrows <= nrows )
 		i_numrows = numrows;
 	      else
  		i_numrows = 1 + nrows - i;
 
-	      if( fits_read_col(infile, TBYTE, sf_colnum, i, 1, i_numrows, 
-				&snull, amp_sf, &anynull, &status) )
-		printerror( status );
-	      if( fits_read_col(infile, TSHORT, au1_colnum, i, 1, i_numrows, 
-				&snull, au1, &anynull, &status) )
-		printerror( status );
-	      if( fits_read_col(infile, TSHORT, au2_colnum, i, 1, i_numrows, 
-				&snull, au2, &anynull, &status) )
-		printerror( status );
-	      if( fits_read_col(infile, TSHORT, au3_colnum, i, 1, i_numrows, 
-				&snull, au3, &anynull, &status) )
-		printerror( status );
-	      if( fits_read_col(infile, TSHORT, av1_colnum, i, 1, i_numrows, 
-				&snull, av1, &anynull, &status) )
-		printerror( status );
-	      if( fits_read_col(infile, TSHORT, av2_colnum, i, 1, i_numrows, 
-				&snull, av2, &anynull, &status) )
-		printerror( status );
-	      if( fits_read_col(infile, TSHORT, av3_colnum, i, 1, i_numrows, 
-				&snull, av3, &anynull, &status) )
-		printerror( status );
-	      if( fits_read_col(infile, TBYTE, pha_colnum, i, 1, i_numrows, 
-				&snull, pha, &anynull, &status) )
-		printerror( status );
+	      t = evt0_now();
+	      if ( mapped )
+		{
+		  blk.n = i_numrows;
+		  evt0_map_read(&map, &blk, i);
+		}
+	      else
+		{
+		  if( fits_read_col(infile, TBYTE, sf_colnum, i, 1, i_numrows, 
+				    &snull, amp_sf, &anynull, &status) )
+		    printerror( status );
+		  if( fits_read_col(infile, TSHORT, au1_colnum, i, 1, i_numrows, 
+				    &snull, au1, &anynull, &status) )
+		    printerror( status );
+		  if( fits_read_col(infile, TSHORT, au2_colnum, i, 1, i_numrows, 
+				    &snull, au2, &anynull, &status) )
+		    printerror( status );
+		  if( fits_read_col(infile, TSHORT, au3_colnum, i, 1, i_numrows, 
+				    &snull, au3, &anynull, &status) )
+		    printerror( status );
+		  if( fits_read_col(infile, TSHORT, av1_colnum, i, 1, i_numrows, 
+				    &snull, av1, &anynull, &status) )
+		    printerror( status );
+		  if( fits_read_col(infile, TSHORT, av2_colnum, i, 1, i_numrows, 
+				    &snull, av2, &anynull, &status) )
+		    printerror( status );
+		  if( fits_read_col(infile, TSHORT, av3_colnum, i, 1, i_numrows, 
+				    &snull, av3, &anynull, &status) )
+		    printerror( status );
+		  if( fits_read_col(infile, TBYTE, pha_colnum, i, 1, i_numrows, 
+				    &snull, pha, &anynull, &status) )
+		    printerror( status );
+		}
+
+	      if ( st )
+		{
+		  memcpy(amp_sf_in, amp_sf, i_numrows);
+		  t0 = evt0_now();
+		  st->t[EVT0_T_READ] += t0 - t;
+		}
 
 	      /* determine a better AMP_SF value */
-	      for( j = 0; j < i_numrows; j++ )
+	      fix_amp_sf_lut(&blk, &lut, isa);
+
+	      if ( st )
 		{
-		  if( pha[j] < (pha_1to2 - width1))
-		    {
-		      amp_sf[j] = 1;
-		    }
-		  else if(pha[j] < (pha_1to2 + width1))
-		    {
-		      sum_amps = 
-			(double)(au1[j]+au2[j]+au3[j]+av1[j]+av2[j]+av3[j])*0.5
-			/gain;
-		      diff1 = fabs((double)pha[j] - sum_amps);
-		      diff2 = fabs((double)pha[j] - 2.0*sum_amps);
-		      if( (diff1 <= diff2) && (diff1 < thresh1) ) 
-			{
-			  amp_sf[j] = 1;
-			} 
-		      if((diff2 <= diff1) &&  (diff2 < thresh2))
-			{
-			  amp_sf[j] = 2;
-			} 
-		    }
-		  else if(pha[j] < (pha_2to3 - width2))
-		    {
-		      amp_sf[j] = 2;
-		    }
-		  else if(pha[j] < (pha_2to3 + width2))
-		    {
-		      sum_amps = 
-			(double)(au1[j]+au2[j]+au3[j]+av1[j]+av2[j]+av3[j])*0.5
-			/gain;
-		      diff2 = fabs((double)pha[j] - 2.0*sum_amps);
-		      diff3 = fabs((double)pha[j] - 4.0*sum_amps);
-		      if((diff2 <= diff3) && (diff2 < thresh2))
-			{
-			  amp_sf[j] = 2;
-			}
-		      if((diff3 <= diff2) && (diff3 < thresh3))
-			{
-			  amp_sf[j] = 3;
-			}
-		    }
-		  else
-		    {
-		      amp_sf[j] = 3;
-		    }
+		  st->t[EVT0_T_CORRECT] += evt0_now() - t0;
+		  evt0_stats_ampsf(st, amp_sf_in, amp_sf, i_numrows);
+		  t0 = evt0_now();
 		}
 
 	      /* write the corrected AMP_SF values to the output file */
-	      if( fits_write_col(outfile, TBYTE, sf_colnum, i, 1, i_numrows,
-				 amp_sf, &status) )
+	      if ( patching )
+		{
+		  if ( evt0_patch_col(&pt, EVT0_AMP_SF, sf_colnum, i, i_numrows,
+				      amp_sf, &status) )
+		    printerror( status );
+		}
+	      else if( fits_write_col(outfile, TBYTE, sf_colnum, i, 1, i_numrows,
+				      amp_sf, &status) )
 		printerror( status );
+	      if ( st )
+		{
+		  st->t[EVT0_T_WRITE] += evt0_now() - t0;
+		  evt0_stats_chunk(st, i_numrows, evt0_now() - t);
+		}
 	      i += numrows;
 	    }
+	  if ( mapped )
+	    evt0_map_close(&map);
+	}
+      t = evt0_now();
+      if ( patching )
+	{
+	  if ( fits_write_date(outfile, &status) ) printerror( status );
+	  if ( evt0_patch_finish(&pt, &status) ) printerror( status );
+	}
+      else if ( !patch || !strcmp(extname,"EVENTS") )
+	{
+	  if ( fits_write_date(outfile, &status) ) printerror( status );
+	  if ( fits_write_chksum(outfile, &status) ) printerror( status );
 	}
-      if ( fits_write_date(outfile, &status) ) printerror( status );
-      if ( fits_write_chksum(outfile, &status) ) printerror( status );
+      if ( st )
+	st->t[EVT0_T_CHECKSUM] += evt0_now() - t;
     }
   if ( fits_close_file(infile, &status) ) printerror( status );         
   if ( fits_close_file(outfile, &status) ) printerror( status );
 
+  t = evt0_now();
+  if ( ztab && evt0_ztab_file(outname + (*outname == '!'), nthreads) )
+    exit(1);
+  if ( st )
+    st->t[EVT0_T_WRITE] += evt0_now() - t;
+
+  if ( st && evt0_stats_write(st, statsfile, progname, inname, outname,
+			      EVT0_STATS_AMPSF) )
+    {
+      fprintf(stderr, "%s: cannot write %s\n", progname, statsfile);
+      exit(1);
+    }
+
   return 0;
 }
@@ -0,0 +1,718 @@
+/*
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+            gti_split
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+
+Splits an event list into several, each keeping the events that fall
+in its own set of good time intervals, in one pass over the input.
+This does the writing for time_split and dither_split.
+
+The GTI file has one interval per line,
+
+	outfile start stop
+
+with the intervals of an output in any order; they may overlap. An
+event with start <= TIME <= stop of one of them goes to outfile. Blank
+lines and lines starting with # are skipped.
+
+All the interval boundaries are sorted together into one table of
+segments, each with the outputs it feeds, so an event is placed with
+one lookup however many outputs there are. For time-ordered events
+the lookup is a step forward from the last event's segment. Rows are
+copied as raw bytes into a buffer per output, which is appended to its
+file when full; the buffers share one budget. Other HDUs are copied
+to every output, and the EVENTS header is copied with a HISTORY
+record added. If the events have a time index (see time_index.c) only
+the rows that can fall in some interval are read.
+
+As many outputs are written at once as the open file limit allows
+(see -k). A deep dither split can have thousands; they are then
+written in batches, with a pass over the input for each.
+
+Build:
+	cc -O2 -o gti_split gti_split.c evt0_map.c evt_tindex.c -lcfitsio
+
+*/
+
+/*** include files ***/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <getopt.h>
+#include <sys/resource.h>
+
+#include "fitsio.h"
+
+#include "evt0_map.h"
+#include "evt_tindex.h"
+
+/* one output file */
+typedef struct
+{
+  char *name;
+  fitsfile *fptr;
+  long ngti, maxgti;
+  double *start, *stop;
+  unsigned char *buf;		/* rows waiting to be written */
+  long nbuf, maxbuf;
+  long nrows;			/* rows written so far */
+} split_out;
+
+/*
+  The real line cut at the nb distinct GTI boundaries b[i]. Segment
+  2*i+1 is the point b[i] and segment 2*i the open interval below it,
+  so segment 2*nb is everything above b[nb-1]. The outputs an event in
+  segment s goes to are out[first[s]] ... out[first[s+1]-1].
+*/
+typedef struct
+{
+  long nb;
+  double *b;
+  long *first;
+  int *out;
+} seg_table;
+
+static char *progname;
+static char DATE[FLEN_VALUE];
+
+void printerror(int status)
+{
+  /*****************************************************/
+  /* Print out cfitsio error messages and exit program */
+  /*****************************************************/
+
+  if (status)
+    fprintf(stderr, "\n*** Error occurred during program execution ***\n");
+  fits_report_error(stderr, status);
+  exit( status );
+}
+
+int print_usage(void)
+{
+  fprintf(stderr,
+	  "\nUsage:\n\t%s [options] <GTI_FILE> <EVENTS>\n", progname);
+  fprintf(stderr,"\n\tGTI_FILE lines are \"outfile start stop\"\n\n");
+  fprintf(stderr,"\te[events]:\tname of the events extension\n");
+  fprintf(stderr,"\tm[65536]:\trows read at a time\n");
+  fprintf(stderr,"\tb[16384]:\toutput buffers of all open files, in kbytes\n");
+  fprintf(stderr,"\tk[open file limit]:\toutputs written at a time\n");
+  fprintf(stderr,"\tH[command line]:\tHISTORY record for the EVENTS header\n");
+  fprintf(stderr,"\t--nommap:\tread the input through cfitsio only\n");
+  fprintf(stderr,"\t--noindex:\tread every row, ignoring a time index\n");
+  fprintf(stderr,"\tv[0]:\tverbosity of diagnostic output\n");
+  fprintf(stderr,"\th or ?:\tprint usage\n");
+  return 0;
+}
+
+enum
+  {
+    OPT_NOMMAP = 256,
+    OPT_NOINDEX
+  };
+
+static struct option long_options[] =
+  {
+    {"nommap", no_argument, 0, OPT_NOMMAP},
+    {"noindex", no_argument, 0, OPT_NOINDEX},
+    {"help", no_argument, 0, 'h'},
+    {0, 0, 0, 0}
+  };
+
+static int cmp_double(const void *a, const void *b)
+{
+  double x = *(const double *)a, y = *(const double *)b;
+
+  return x < y ? -1 : x > y;
+}
+
+/* order intervals by start, for merging */
+typedef struct
+{
+  double start, stop;
+} interval;
+
+static int cmp_interval(const void *a, const void *b)
+{
+  return cmp_double(&((const interval *)a)->start,
+		    &((const interval *)b)->start);
+}
+
+/* the output called name, added to outs if it is new */
+static split_out *find_out(split_out **outs, int *nouts, int *maxouts,
+			   const char *name)
+{
+  split_out *o;
+  int k;
+
+  for ( k = *nouts - 1; k >= 0; k-- )
+    if ( !strcmp((*outs)[k].name, name) )
+      return *outs + k;
+
+  if ( *nouts == *maxouts )
+    {
+      *maxouts = *maxouts ? 2 * *maxouts : 16;
+      if ( !(o = realloc(*outs, *maxouts * sizeof(split_out))) )
+	return 0;
+      *outs = o;
+    }
+  o = *outs + (*nouts)++;
+  memset(o, 0, sizeof(*o));
+  o->name = strdup(name);
+  return o->name ? o : 0;
+}
+
+/* read the GTI file; returns the number of outputs, or -1 */
+static int read_gti(const char *filename, split_out **outs)
+{
+  char line[2*FLEN_FILENAME], name[FLEN_FILENAME];
+  FILE *fp;
+  split_out *o;
+  double start, stop;
+  int nouts = 0, maxouts = 0, lineno = 0;
+
+  *outs = 0;
+  if ( !(fp = fopen(filename, "r")) )
+    {
+      perror(filename);
+      return -1;
+    }
+  while ( fgets(line, sizeof(line), fp) )
+    {
+      lineno++;
+      if ( sscanf(line, " %1s", name) != 1 || *name == '#' )
+	continue;
+      if ( sscanf(line, "%1024s %lf %lf", name, &start, &stop) != 3
+	   || !(stop >= start) )
+	{
+	  fprintf(stderr, "%s: %s line %d: want \"outfile start stop\"\n",
+		  progname, filename, lineno);
+	  fclose(fp);
+	  return -1;
+	}
+      if ( !(o = find_out(outs, &nouts, &maxouts, name)) )
+	{
+	  fclose(fp);
+	  return -1;
+	}
+      if ( o->ngti == o->maxgti )
+	{
+	  o->maxgti = o->maxgti ? 2*o->maxgti : 16;
+	  o->start = realloc(o->start, o->maxgti*sizeof(double));
+	  o->stop = realloc(o->stop, o->maxgti*sizeof(double));
+	  if ( !o->start || !o->stop )
+	    {
+	      fclose(fp);
+	      return -1;
+	    }
+	}
+      o->start[o->ngti] = start;
+      o->stop[o->ngti++] = stop;
+    }
+  fclose(fp);
+  return nouts;
+}
+
+/* sort the intervals of o and merge those that overlap */
+static int merge_gti(split_out *o)
+{
+  interval *iv = CALLOC(o->ngti + 1, interval);
+  long i, n = 0;
+
+  if ( !iv )
+    return -1;
+  for ( i = 0; i < o->ngti; i++ )
+    {
+      iv[i].start = o->start[i];
+      iv[i].stop = o->stop[i];
+    }
+  qsort(iv, o->ngti, sizeof(interval), cmp_interval);
+  for ( i = 0; i < o->ngti; i++ )
+    {
+      if ( n && iv[i].start <= o->stop[n-1] )
+	{
+	  if ( iv[i].stop > o->stop[n-1] )
+	    o->stop[n-1] = iv[i].stop;
+	  continue;
+	}
+      o->start[n] = iv[i].start;
+      o->stop[n++] = iv[i].stop;
+    }
+  o->ngti = n;
+  free(iv);
+  return 0;
+}
+
+/* the intervals of all the outputs in one merged list */
+static int union_gti(split_out *u, const split_out *outs, int nouts)
+{
+  long n = 0;
+  int k;
+
+  memset(u, 0, sizeof(*u));
+  for ( k = 0; k < nouts; k++ )
+    n += outs[k].ngti;
+  u->start = CALLOC(n + 1, double);
+  u->stop = CALLOC(n + 1, double);
+  if ( !u->start || !u->stop )
+    return -1;
+  for ( k = 0; k < nouts; k++ )
+    {
+      memcpy(u->start + u->ngti, outs[k].start, outs[k].ngti*sizeof(double));
+      memcpy(u->stop + u->ngti, outs[k].stop, outs[k].ngti*sizeof(double));
+      u->ngti += outs[k].ngti;
+    }
+  return merge_gti(u);
+}
+
+/* the index of x in the ascending b[0 .. n-1], which must hold it */
+static long boundary(const double *b, long n, double x)
+{
+  long lo = 0, hi = n - 1, mid;
+
+  while ( lo < hi )
+    {
+      mid = (lo + hi)/2;
+      if ( b[mid] < x )
+	lo = mid + 1;
+      else
+	hi = mid;
+    }
+  return lo;
+}
+
+/* build the segment table of the (merged) intervals of all outputs */
+static int seg_build(seg_table *st, const split_out *outs, int nouts)
+{
+  long nb = 0, nseg, i, p, q, s;
+  long *fill;
+  int k;
+
+  for ( k = 0; k < nouts; k++ )
+    nb += 2*outs[k].ngti;
+  st->b = CALLOC(nb + 1, double);
+  if ( !st->b )
+    return -1;
+  for ( k = 0, i = 0; k < nouts; k++ )
+    for ( s = 0; s < outs[k].ngti; s++ )
+      {
+	st->b[i++] = outs[k].start[s];
+	st->b[i++] = outs[k].stop[s];
+      }
+  qsort(st->b, nb, sizeof(double), cmp_double);
+  for ( i = 0, p = 0; i < nb; i++ )
+    if ( !p || st->b[i] != st->b[p-1] )
+      st->b[p++] = st->b[i];
+  st->nb = nb = p;
+
+  /*
+    Count the outputs of each segment, then fill them in; an interval
+    [b[p], b[q]] covers segments 2p+1 ... 2q+1.
+  */
+  nseg = 2*nb + 1;
+  st->first = CALLOC(nseg + 1, long);
+  fill = CALLOC(nseg + 1, long);
+  if ( !st->first || !fill )
+    return -1;
+  for ( k = 0; k < nouts; k++ )
+    for ( s = 0; s < outs[k].ngti; s++ )
+      {
+	p = boundary(st->b, nb, outs[k].start[s]);
+	q = boundary(st->b, nb, outs[k].stop[s]);
+	for ( i = 2*p + 1; i <= 2*q + 1; i++ )
+	  st->first[i+1]++;
+      }
+  for ( i = 0; i < nseg; i++ )
+    st->first[i+1] += st->first[i];
+  st->out = CALLOC(st->first[nseg] + 1, int);
+  if ( !st->out )
+    return -1;
+  for ( k = 0; k < nouts; k++ )
+    for ( s = 0; s < outs[k].ngti; s++ )
+      {
+	p = boundary(st->b, nb, outs[k].start[s]);
+	q = boundary(st->b, nb, outs[k].stop[s]);
+	for ( i = 2*p + 1; i <= 2*q + 1; i++ )
+	  st->out[st->first[i] + fill[i]++] = k;
+      }
+  free(fill);
+  return 0;
+}
+
+static void seg_free(seg_table *st)
+{
+  free(st->b);
+  free(st->first);
+  free(st->out);
+}
+
+/*
+  The segment of time t. *cur is the boundary index found for the last
+  event, which for sorted times is at most a step or two behind.
+*/
+static long seg_find(const seg_table *st, double t, long *cur)
+{
+  long i = *cur;
+
+  if ( i > 0 && t <= st->b[i-1] )
+    i = t > st->b[0] ? boundary(st->b, st->nb, t) : 0;
+  else
+    while ( i < st->nb && st->b[i] < t )
+      i++;
+  *cur = i;
+  return (i < st->nb && st->b[i] == t) ? 2*i + 1 : 2*i;
+}
+
+/* append the buffered rows of o to its table */
+static int flush_out(split_out *o, long rowlen, int *status)
+{
+  if ( o->nbuf )
+    fits_write_tblbytes(o->fptr, o->nrows + 1, 1, (LONGLONG)o->nbuf*rowlen,
+			o->buf, status);
+  o->nrows += o->nbuf;
+  o->nbuf = 0;
+  return *status;
+}
+
+/* the big-endian TIME value at p */
+static double time_value(int typecode, const unsigned char *p)
+{
+  union { unsigned int u; float f; } f4;
+  union { unsigned long long u; double d; } f8;
+  unsigned long long x = 0;
+  int i;
+
+  switch ( typecode )
+    {
+    case TSHORT:
+      return (short)(p[0] << 8 | p[1]);
+    case TLONG:
+      return (int)((unsigned)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3]);
+    case TFLOAT:
+      f4.u = (unsigned)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+      return f4.f;
+    }
+  for ( i = 0; i < 8; i++ )
+    x = x << 8 | p[i];
+  if ( typecode == TLONGLONG )
+    return (double)(long long)x;
+  f8.u = x;
+  return f8.d;
+}
+
+/*
+  Stream the EVENTS table, the current HDU of in, into the outputs.
+  The output headers are already written. With a time index, only the
+  rows that can fall in some output's intervals (all of them merged
+  in u) are read.
+*/
+static int split_events(fitsfile *in, const char *inname, split_out *outs,
+			int nouts, const seg_table *st, const split_out *u,
+			long chunk_rows, long bufbytes, int usemap,
+			int useindex, int verb, int *status)
+{
+  evt_tindex ix;
+  long long *first = 0, *last = 0, one_first = 1, one_last;
+  long nranges = 1, rr;
+  char key[FLEN_KEYWORD];
+  evt0_map m;
+  split_out *o;
+  unsigned char *inbuf = 0;
+  const unsigned char *rows, *r;
+  double scale = 1.0, zero = 0.0, t;
+  long rowlen, nrows, pcount, row, n, j, off, cur = 0, s, i;
+  int colnum, typecode, k, mapped = 0;
+  long repeat, width;
+
+  if ( fits_read_key(in, TLONG, "NAXIS1", &rowlen, NULL, status)
+       || fits_read_key(in, TLONG, "PCOUNT", &pcount, NULL, status)
+       || fits_get_num_rows(in, &nrows, status)
+       || fits_get_colnum(in, CASEINSEN, "time", &colnum, status)
+       || fits_get_coltype(in, colnum, &typecode, &repeat, &width, status)
+       || (off = evt0_col_offset(in, colnum, status)) < 0 )
+    return *status;
+  if ( pcount )
+    {
+      fprintf(stderr, "%s: variable length columns are not supported\n",
+	      progname);
+      return *status = BAD_TFORM;
+    }
+  if ( repeat != 1 || (typecode != TSHORT && typecode != TLONG
+		       && typecode != TLONGLONG && typecode != TFLOAT
+		       && typecode != TDOUBLE) )
+    {
+      fprintf(stderr, "%s: TIME is not a scalar number\n", progname);
+      return *status = BAD_TFORM;
+    }
+  fits_write_errmark();
+  snprintf(key, sizeof(key), "TSCAL%d", colnum);
+  if ( fits_read_key(in, TDOUBLE, key, &scale, NULL, status) )
+    *status = 0;
+  snprintf(key, sizeof(key), "TZERO%d", colnum);
+  if ( fits_read_key(in, TDOUBLE, key, &zero, NULL, status) )
+    *status = 0;
+  fits_clear_errmark();
+
+  if ( chunk_rows < 1 )
+    chunk_rows = 1;
+  if ( usemap )
+    mapped = evt0_map_open(&m, in, inname, 0) == 0;
+  if ( !mapped && !(inbuf = CALLOC(chunk_rows*rowlen, unsigned char)) )
+    return *status = MEMORY_ALLOCATION;
+
+  /* bufbytes shared out, but at least a row per output */
+  for ( k = 0; k < nouts; k++ )
+    {
+      o = outs + k;
+      o->maxbuf = bufbytes/nouts/rowlen > 1 ? bufbytes/nouts/rowlen : 1;
+      if ( !(o->buf = CALLOC(o->maxbuf*rowlen, unsigned char)) )
+	return *status = MEMORY_ALLOCATION;
+    }
+
+  one_last = nrows;
+  first = &one_first;
+  last = &one_last;
+  if ( useindex && evt_tindex_open(&ix, in, inname) == 0 )
+    {
+      first = CALLOC(ix.nblocks + 1, long long);
+      last = CALLOC(ix.nblocks + 1, long long);
+      if ( !first || !last )
+	return *status = MEMORY_ALLOCATION;
+      nranges = evt_tindex_ranges(&ix, u->start, u->stop, u->ngti, first,
+				  last);
+      if ( verb )
+	fprintf(stderr, "%s: time index: %ld row ranges\n", progname,
+		nranges);
+      evt_tindex_free(&ix);
+    }
+
+  fprintf(stderr, "Writing event lists...    ");
+
+  for ( rr = 0; rr < nranges && !*status; rr++ )
+    for ( row = first[rr]; row <= last[rr] && !*status; row += n )
+      {
+	fprintf(stderr, "\b\b\b\b %2d%%", (int)(100.0*(row - 1)/nrows));
+
+	n = last[rr] - row + 1 < chunk_rows ? last[rr] - row + 1 : chunk_rows;
+	if ( mapped )
+	  rows = evt0_map_rows(&m, row);
+	else
+	  {
+	    if ( fits_read_tblbytes(in, row, 1, (LONGLONG)n*rowlen, inbuf,
+				    status) )
+	      break;
+	    rows = inbuf;
+	  }
+
+	for ( j = 0, r = rows; j < n && !*status; j++, r += rowlen )
+	  {
+	    t = scale*time_value(typecode, r + off) + zero;
+	    if ( isnan(t) )
+	      continue;
+	    s = seg_find(st, t, &cur);
+	    for ( i = st->first[s]; i < st->first[s+1]; i++ )
+	      {
+		o = outs + st->out[i];
+		memcpy(o->buf + o->nbuf*rowlen, r, rowlen);
+		if ( ++o->nbuf == o->maxbuf )
+		  flush_out(o, rowlen, status);
+	      }
+	  }
+      }
+
+  for ( k = 0; k < nouts && !*status; k++ )
+    flush_out(outs + k, rowlen, status);
+  if ( !*status )
+    fprintf(stderr, "\b\b\b\b100%% done\n");
+
+  if ( mapped )
+    evt0_map_close(&m);
+  free(inbuf);
+  if ( first != &one_first )
+    {
+      free(first);
+      free(last);
+    }
+  for ( k = 0; k < nouts; k++ )
+    {
+      free(outs[k].buf);
+      outs[k].buf = 0;
+    }
+  return *status;
+}
+
+int main(int argc, char *argv[])
+{
+  fitsfile *in;
+  split_out *outs;
+  seg_table st;
+  split_out all;
+  char *gtiname, *inname, *extname = "events", *history = 0, *p;
+  char outname[FLEN_FILENAME + 1];
+  long chunk_rows = 65536, bufbytes = 16*1024L*1024, len;
+  int nouts, nhdus, target, timeref, usemap = 1, useindex = 1, verb = 0;
+  int c, i, k, k0, nbatch, maxopen = 0, status = 0;
+  struct rlimit rl;
+
+  progname = argv[0];
+  if ( (p = strrchr(progname, '/')) )
+    progname = p + 1;
+
+  while ((c = getopt_long(argc, argv, "e:m:b:k:H:v:h?", long_options, NULL))
+	 != -1)
+    {
+      switch (c)
+	{
+	case 'e':
+	  extname = optarg;
+	  break;
+	case 'm':
+	  chunk_rows = atol(optarg);
+	  break;
+	case 'b':
+	  bufbytes = atol(optarg)*1024L;
+	  break;
+	case 'k':
+	  maxopen = atoi(optarg);
+	  break;
+	case 'H':
+	  history = optarg;
+	  break;
+	case OPT_NOMMAP:
+	  usemap = 0;
+	  break;
+	case OPT_NOINDEX:
+	  useindex = 0;
+	  break;
+	case 'v':
+	  verb = atoi(optarg);
+	  break;
+	case 'h':
+	case '?':
+	default:
+	  print_usage();
+	  exit(1);
+	}
+    }
+  if ( argc - optind != 2 )
+    {
+      print_usage();
+      exit(1);
+    }
+  gtiname = argv[optind];
+  inname = argv[optind+1];
+
+  /* the command line, for the HISTORY record */
+  if ( !history )
+    {
+      for ( i = 0, len = 1; i < argc; i++ )
+	len += strlen(argv[i]) + 1;
+      if ( !(history = CALLOC(len, char)) )
+	exit(1);
+      strcpy(history, progname);
+      for ( i = 1; i < argc; i++ )
+	strcat(strcat(history, " "), argv[i]);
+    }
+
+  if ( (nouts = read_gti(gtiname, &outs)) < 0 )
+    exit(1);
+  if ( nouts == 0 )
+    {
+      fprintf(stderr, "%s: no intervals in %s\n", progname, gtiname);
+      exit(1);
+    }
+  for ( k = 0; k < nouts; k++ )
+    if ( merge_gti(outs + k) )
+      exit(1);
+
+  /* leave room under the open file limit for the input and stdio */
+  if ( maxopen < 1 )
+    {
+      maxopen = 1024;
+      if ( getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY )
+	maxopen = rl.rlim_cur > 16 ? (int)rl.rlim_cur - 16 : 1;
+#ifdef NMAXFILES
+      if ( maxopen > NMAXFILES - 8 )
+	maxopen = NMAXFILES - 8;
+#endif
+    }
+  if ( verb && nouts > maxopen )
+    fprintf(stderr, "%s: %d outputs, written %d at a time\n", progname,
+	    nouts, maxopen);
+
+  fits_get_system_time(DATE, &timeref, &status);
+  if ( fits_open_file(&in, inname, READONLY, &status)
+       || fits_get_num_hdus(in, &nhdus, &status)
+       || fits_movnam_hdu(in, ANY_HDU, extname, 0, &status) )
+    printerror(status);
+  fits_get_hdu_num(in, &target);
+
+  for ( k0 = 0; k0 < nouts; k0 += nbatch )
+    {
+      nbatch = nouts - k0 < maxopen ? nouts - k0 : maxopen;
+      if ( seg_build(&st, outs + k0, nbatch)
+	   || union_gti(&all, outs + k0, nbatch) )
+	{
+	  fprintf(stderr, "%s: out of memory\n", progname);
+	  exit(1);
+	}
+      if ( verb )
+	fprintf(stderr, "%s: %d outputs, %ld distinct boundaries\n",
+		progname, nbatch, st.nb);
+
+      for ( k = k0; k < k0 + nbatch; k++ )
+	{
+	  snprintf(outname, sizeof(outname), "%s%s",
+		   *outs[k].name == '!' ? "" : "!", outs[k].name);
+	  if ( fits_create_file(&outs[k].fptr, outname, &status) )
+	    printerror(status);
+	}
+
+      /*
+	Copy the HDUs before and after the events to every output, and
+	the events header with no rows; then fill in the rows.
+      */
+      for ( i = 1; i <= nhdus && !status; i++ )
+	{
+	  fits_movabs_hdu(in, i, NULL, &status);
+	  for ( k = k0; k < k0 + nbatch && !status; k++ )
+	    {
+	      if ( i != target )
+		{
+		  fits_copy_hdu(in, outs[k].fptr, 0, &status);
+		  evt0_stamp_hdu(outs[k].fptr, progname, DATE, &status);
+		  continue;
+		}
+	      fits_copy_header(in, outs[k].fptr, &status);
+	      fits_modify_key_lng(outs[k].fptr, "NAXIS2", 0, "&", &status);
+	      fits_set_hdustruc(outs[k].fptr, &status);
+	      fits_write_history(outs[k].fptr, history, &status);
+	    }
+	  if ( i == target && !status
+	       && !split_events(in, inname, outs + k0, nbatch, &st, &all,
+				chunk_rows, bufbytes, usemap, useindex, verb,
+				&status) )
+	    for ( k = k0; k < k0 + nbatch; k++ )
+	      evt0_stamp_hdu(outs[k].fptr, progname, DATE, &status);
+	}
+      if ( status )
+	printerror(status);
+
+      for ( k = k0; k < k0 + nbatch; k++ )
+	{
+	  if ( verb )
+	    fprintf(stderr, "%s: %s: %ld events in %ld intervals\n",
+		    progname, outs[k].name, outs[k].nrows, outs[k].ngti);
+	  fits_close_file(outs[k].fptr, &status);
+	}
+      if ( status )
+	printerror(status);
+      seg_free(&st);
+      free(all.start);
+      free(all.stop);
+    }
+  fits_close_file(in, &status);
+  if ( status )
+    printerror(status);
+  return 0;
+}
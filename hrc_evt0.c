@@ -0,0 +1,156 @@
+/*
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+            hrc_evt0.c
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+
+The library interface of hrc_evt0.h. The caller's columns are wrapped
+in an evt0_block and handed to the same kernels the tools use
+(evt0_simd.c, evt0_ampsf.c), so the results are those of
+hrc_evt0_correct and fix_amp_sf_4. Any number of threads may call in
+at once on different rows.
+
+*/
+
+#include "hrc_evt0.h"
+#include "evt0_kernels.h"
+
+static void to_coeffs(tap_coeffs *c, const double *x)
+{
+  c->a = x[0];
+  c->b = x[1];
+  c->c = x[2];
+  c->d = x[3];
+  c->e = x[4];
+  c->f = x[5];
+  c->g = x[6];
+  c->o = x[7];
+}
+
+static void from_coeffs(double *x, const tap_coeffs *c)
+{
+  x[0] = c->a;
+  x[1] = c->b;
+  x[2] = c->c;
+  x[3] = c->d;
+  x[4] = c->e;
+  x[5] = c->f;
+  x[6] = c->g;
+  x[7] = c->o;
+}
+
+static void to_ampsf(ampsf_params *a, const hrc_evt0_ampsf_params *p)
+{
+  a->gain = p->gain;
+  a->thresh1 = p->thresh1;
+  a->thresh2 = p->thresh2;
+  a->thresh3 = p->thresh3;
+  a->pha_1to2 = p->pha_1to2;
+  a->pha_2to3 = p->pha_2to3;
+  a->width1 = p->width1;
+  a->width2 = p->width2;
+}
+
+static void from_ampsf(hrc_evt0_ampsf_params *p, const ampsf_params *a)
+{
+  p->gain = a->gain;
+  p->thresh1 = a->thresh1;
+  p->thresh2 = a->thresh2;
+  p->thresh3 = a->thresh3;
+  p->pha_1to2 = a->pha_1to2;
+  p->pha_2to3 = a->pha_2to3;
+  p->width1 = a->width1;
+  p->width2 = a->width2;
+}
+
+/* the correction.h coefficients */
+void hrc_evt0_tap_defaults(hrc_evt0_tap_params *p)
+{
+  tap_params tp;
+
+  tap_params_default(&tp);
+  from_coeffs(p->u, &tp.u);
+  from_coeffs(p->v, &tp.v);
+  p->use_width = tp.use_width;
+}
+
+/* the fix_amp_sf_4 defaults (its -d) */
+void hrc_evt0_ampsf_defaults(hrc_evt0_ampsf_params *p)
+{
+  ampsf_params ap;
+
+  ampsf_params_default(&ap);
+  from_ampsf(p, &ap);
+}
+
+/*
+  The parameters fix_amp_sf_4 picks for an EVENTS header with these
+  DETNAM and DATE-OBS values. Returns -1, leaving p alone, if there
+  are none.
+*/
+int hrc_evt0_ampsf_profile(const char *detnam, const char *date_obs,
+			   hrc_evt0_ampsf_params *p)
+{
+  ampsf_params ap;
+
+  if ( ampsf_profile(detnam, date_obs, &ap) )
+    return -1;
+  from_ampsf(p, &ap);
+  return 0;
+}
+
+/*
+  Correct au3 and av3 of the n events in place, as hrc_evt0_correct
+  does. vstat is only read with p->use_width set, and may be 0
+  otherwise.
+*/
+void hrc_evt0_correct_taps(long n, const unsigned char *amp_sf,
+			   const unsigned char *vstat, const short *au1,
+			   const short *au2, short *au3, const short *av1,
+			   const short *av2, short *av3,
+			   const hrc_evt0_tap_params *p, int isa)
+{
+  evt0_block blk;
+  tap_params tp;
+
+  /* the kernels only write au3 and av3 */
+  blk.n = n;
+  blk.amp_sf = (unsigned char *)amp_sf;
+  blk.pha = 0;
+  blk.vstat = (unsigned char *)vstat;
+  blk.au1 = (short *)au1;
+  blk.au2 = (short *)au2;
+  blk.au3 = au3;
+  blk.av1 = (short *)av1;
+  blk.av2 = (short *)av2;
+  blk.av3 = av3;
+  to_coeffs(&tp.u, p->u);
+  to_coeffs(&tp.v, p->v);
+  tp.use_width = p->use_width;
+  correct_taps_isa(&blk, &tp, tap_isa_select(isa));
+}
+
+/* Reassign amp_sf of the n events in place, as fix_amp_sf_4 does */
+void hrc_evt0_fix_amp_sf(long n, unsigned char *amp_sf,
+			 const unsigned char *pha, const short *au1,
+			 const short *au2, const short *au3, const short *av1,
+			 const short *av2, const short *av3,
+			 const hrc_evt0_ampsf_params *p, int isa)
+{
+  evt0_block blk;
+  ampsf_params ap;
+  ampsf_lut lut;
+
+  blk.n = n;
+  blk.amp_sf = amp_sf;
+  blk.pha = (unsigned char *)pha;
+  blk.vstat = 0;
+  blk.au1 = (short *)au1;
+  blk.au2 = (short *)au2;
+  blk.au3 = (short *)au3;
+  blk.av1 = (short *)av1;
+  blk.av2 = (short *)av2;
+  blk.av3 = (short *)av3;
+  to_ampsf(&ap, p);
+  ampsf_lut_init(&lut, &ap);
+  fix_amp_sf_lut(&blk, &lut, tap_isa_select(isa));
+}
@@ -0,0 +1,66 @@
+/*
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+            hrc_evt0.h
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+
+The HRC level 0 corrections of hrc_evt0_correct and fix_amp_sf_4 as
+a library, applied in place to columns the caller holds in memory.
+No FITS I/O is done and nothing is copied. See hrc_evt0.c; the Perl
+and Python bindings are HRCEvt0.pm and hrc_evt0.py.
+
+Build:
+	cc -O2 -fPIC -shared -o libhrc_evt0.so hrc_evt0.c evt0_kernels.c evt0_simd.c evt0_ampsf.c -lm
+
+*/
+
+#ifndef HRC_EVT0_H
+#define HRC_EVT0_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* the widest instruction set the corrections may use */
+#define HRC_EVT0_ISA_SCALAR 0
+#define HRC_EVT0_ISA_AVX2 1
+#define HRC_EVT0_ISA_AVX512 2
+
+/*
+  Ringing correction coefficients of each axis, in the order of the
+  hrc_evt0_correct options: a b c d e f g o (u) and A ... O (v).
+*/
+typedef struct
+{
+  double u[8], v[8];
+  int use_width;		/* select events by the VETOSTT width bits */
+} hrc_evt0_tap_params;
+
+/* AMP_SF reassignment parameters, as the fix_amp_sf_4 options */
+typedef struct
+{
+  double gain;
+  int thresh1, thresh2, thresh3;
+  double pha_1to2, pha_2to3, width1, width2;
+} hrc_evt0_ampsf_params;
+
+void hrc_evt0_tap_defaults(hrc_evt0_tap_params *p);
+void hrc_evt0_ampsf_defaults(hrc_evt0_ampsf_params *p);
+int hrc_evt0_ampsf_profile(const char *detnam, const char *date_obs,
+			   hrc_evt0_ampsf_params *p);
+
+void hrc_evt0_correct_taps(long n, const unsigned char *amp_sf,
+			   const unsigned char *vstat, const short *au1,
+			   const short *au2, short *au3, const short *av1,
+			   const short *av2, short *av3,
+			   const hrc_evt0_tap_params *p, int isa);
+void hrc_evt0_fix_amp_sf(long n, unsigned char *amp_sf,
+			 const unsigned char *pha, const short *au1,
+			 const short *au2, const short *au3, const short *av1,
+			 const short *av2, const short *av3,
+			 const hrc_evt0_ampsf_params *p, int isa);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
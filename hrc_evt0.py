@@ -0,0 +1,191 @@
+"""Python binding of libhrc_evt0 (see hrc_evt0.h).
+
+The corrections work in place on any C-contiguous buffers of the
+right item size -- numpy arrays, array.array, memoryviews -- without
+copying them: AMP_SF, PHA and VETOSTT as 1 byte integers, the taps as
+2 byte integers in native byte order (columns read from FITS are
+big-endian and have to be byteswapped first).
+
+    import numpy as np
+    import hrc_evt0
+
+    p = hrc_evt0.tap_defaults()
+    hrc_evt0.correct_taps(amp_sf, au1, au2, au3, av1, av2, av3, params=p)
+
+The library is looked for in $HRC_EVT0_LIB, next to this file, and
+then on the normal search path.
+"""
+
+import ctypes
+import os
+import sys
+
+ISA_SCALAR = 0
+ISA_AVX2 = 1
+ISA_AVX512 = 2
+
+_PyBUF_WRITABLE = 0x0001
+_PyBUF_FORMAT = 0x0004
+_PyBUF_C_CONTIGUOUS = 0x0038
+
+# struct codes of the item types, and byte order prefixes of other machines
+_CODES = {1: 'Bbc?', 2: 'hH'}
+_FOREIGN = '>!' if sys.byteorder == 'little' else '<'
+
+
+class TapParams(ctypes.Structure):
+    """Coefficients a b c d e f g o of each axis, as hrc_evt0_correct."""
+    _fields_ = [('u', ctypes.c_double * 8),
+                ('v', ctypes.c_double * 8),
+                ('use_width', ctypes.c_int)]
+
+
+class AmpsfParams(ctypes.Structure):
+    """AMP_SF reassignment parameters, as fix_amp_sf_4."""
+    _fields_ = [('gain', ctypes.c_double),
+                ('thresh1', ctypes.c_int),
+                ('thresh2', ctypes.c_int),
+                ('thresh3', ctypes.c_int),
+                ('pha_1to2', ctypes.c_double),
+                ('pha_2to3', ctypes.c_double),
+                ('width1', ctypes.c_double),
+                ('width2', ctypes.c_double)]
+
+
+class _Py_buffer(ctypes.Structure):
+    _fields_ = [('buf', ctypes.c_void_p),
+                ('obj', ctypes.py_object),
+                ('len', ctypes.c_ssize_t),
+                ('itemsize', ctypes.c_ssize_t),
+                ('readonly', ctypes.c_int),
+                ('ndim', ctypes.c_int),
+                ('format', ctypes.c_char_p),
+                ('shape', ctypes.POINTER(ctypes.c_ssize_t)),
+                ('strides', ctypes.POINTER(ctypes.c_ssize_t)),
+                ('suboffsets', ctypes.POINTER(ctypes.c_ssize_t)),
+                ('internal', ctypes.c_void_p)]
+
+
+def _load():
+    names = [os.environ.get('HRC_EVT0_LIB'),
+             os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                          'libhrc_evt0.so'),
+             'libhrc_evt0.so']
+    for name in names:
+        if name:
+            try:
+                return ctypes.CDLL(name)
+            except OSError:
+                pass
+    raise ImportError('cannot load libhrc_evt0.so; set HRC_EVT0_LIB')
+
+
+_lib = _load()
+_lib.hrc_evt0_correct_taps.restype = None
+_lib.hrc_evt0_correct_taps.argtypes = [ctypes.c_long] + [ctypes.c_void_p] * 8 \
+    + [ctypes.POINTER(TapParams), ctypes.c_int]
+_lib.hrc_evt0_fix_amp_sf.restype = None
+_lib.hrc_evt0_fix_amp_sf.argtypes = [ctypes.c_long] + [ctypes.c_void_p] * 8 \
+    + [ctypes.POINTER(AmpsfParams), ctypes.c_int]
+_lib.hrc_evt0_ampsf_profile.argtypes = [ctypes.c_char_p, ctypes.c_char_p,
+                                        ctypes.POINTER(AmpsfParams)]
+
+_get_buffer = ctypes.pythonapi.PyObject_GetBuffer
+_get_buffer.argtypes = [ctypes.py_object, ctypes.POINTER(_Py_buffer),
+                        ctypes.c_int]
+_release_buffer = ctypes.pythonapi.PyBuffer_Release
+_release_buffer.argtypes = [ctypes.POINTER(_Py_buffer)]
+_release_buffer.restype = None
+
+
+class _Buffers(object):
+    """The buffers of one call, held until it returns."""
+
+    def __init__(self):
+        self.views = []
+        self.n = None
+
+    def get(self, obj, itemsize, name, writable=False):
+        if obj is None:
+            return None
+        view = _Py_buffer()
+        flags = _PyBUF_C_CONTIGUOUS | _PyBUF_FORMAT
+        if writable:
+            flags |= _PyBUF_WRITABLE
+        _get_buffer(obj, ctypes.byref(view), flags)
+        self.views.append(view)
+        fmt = (view.format or b'B').decode()
+        if view.itemsize != itemsize or fmt[-1] not in _CODES[itemsize]:
+            raise TypeError('%s: want %d byte integers, not %r'
+                            % (name, itemsize, fmt))
+        if itemsize > 1 and fmt[0] in _FOREIGN:
+            raise TypeError('%s: not in native byte order (FITS columns '
+                            'need byteswapping first)' % name)
+        n = view.len // itemsize
+        if self.n is None:
+            self.n = n
+        elif n != self.n:
+            raise ValueError('%s: %d events, not %d' % (name, n, self.n))
+        return view.buf
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc):
+        for view in self.views:
+            _release_buffer(ctypes.byref(view))
+        return False
+
+
+def tap_defaults():
+    """The coefficients of correction.h."""
+    p = TapParams()
+    _lib.hrc_evt0_tap_defaults(ctypes.byref(p))
+    return p
+
+
+def ampsf_defaults():
+    """The fix_amp_sf_4 defaults (its -d)."""
+    p = AmpsfParams()
+    _lib.hrc_evt0_ampsf_defaults(ctypes.byref(p))
+    return p
+
+
+def ampsf_profile(detnam, date_obs):
+    """The parameters fix_amp_sf_4 picks for DETNAM and DATE-OBS, or None."""
+    p = AmpsfParams()
+    if _lib.hrc_evt0_ampsf_profile(detnam.encode(), date_obs.encode(),
+                                   ctypes.byref(p)):
+        return None
+    return p
+
+
+def correct_taps(amp_sf, au1, au2, au3, av1, av2, av3, vstat=None,
+                 params=None, isa=ISA_AVX512):
+    """Correct au3 and av3 in place, as hrc_evt0_correct.
+
+    vstat is needed only when params.use_width is set.
+    """
+    if params is None:
+        params = tap_defaults()
+    if params.use_width and vstat is None:
+        raise ValueError('use_width needs vstat')
+    with _Buffers() as b:
+        args = [b.get(amp_sf, 1, 'amp_sf'), b.get(vstat, 1, 'vstat'),
+                b.get(au1, 2, 'au1'), b.get(au2, 2, 'au2'),
+                b.get(au3, 2, 'au3', True), b.get(av1, 2, 'av1'),
+                b.get(av2, 2, 'av2'), b.get(av3, 2, 'av3', True)]
+        _lib.hrc_evt0_correct_taps(b.n, *(args + [ctypes.byref(params), isa]))
+
+
+def fix_amp_sf(amp_sf, pha, au1, au2, au3, av1, av2, av3, params=None,
+               isa=ISA_AVX512):
+    """Reassign amp_sf in place, as fix_amp_sf_4."""
+    if params is None:
+        params = ampsf_defaults()
+    with _Buffers() as b:
+        args = [b.get(amp_sf, 1, 'amp_sf', True), b.get(pha, 1, 'pha'),
+                b.get(au1, 2, 'au1'), b.get(au2, 2, 'au2'),
+                b.get(au3, 2, 'au3'), b.get(av1, 2, 'av1'),
+                b.get(av2, 2, 'av2'), b.get(av3, 2, 'av3')]
+        _lib.hrc_evt0_fix_amp_sf(b.n, *(args + [ctypes.byref(params), isa]))
@@ -0,0 +1,410 @@
+/*
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+                 hrc_evt0_bench
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+
+Throughput of the evt0 correction stages on synthetic event files (see
+evt0_synth.c), so that performance changes show up without flight
+data. For each file size a file is generated and then timed through
+
+	synth		writing the file
+	read_cfitsio	the nine corrected columns through fits_read_col
+	read_mmap	the same through evt0_map
+	ampsf		the AMP_SF reassignment
+	ampsf_lut_<isa>	the same through the PHA class table
+	taps_<isa>	the ringing correction, for each instruction set
+	taps_lut	the tabulated ringing correction
+	copy		fits_copy_file of the whole file
+	write		the nine columns back through fits_write_col
+	checksum	fits_write_chksum of the written file
+	patch		clone and patch of the changed AMP_SF, AU3 and AV3
+
+and then through each -x command, in which %i and %o are replaced by
+the input and an output file name, e.g.
+
+	hrc_evt0_bench -x 'fix_amp_sf_4 -i %i -o %o' \
+		-x 'hrc_evt0_correct -j 4 %i %o'
+
+Events/s and MB/s are given for each; MB is the size of the EVENTS
+table. Reads follow the write of the file and so come from the page
+cache, as they would for a file just fetched.
+
+Build:
+	cc -O2 -pthread -o hrc_evt0_bench hrc_evt0_bench.c evt0_synth.c evt0_kernels.c evt0_ampsf.c evt0_simd.c evt0_lut.c evt0_map.c evt0_patch.c -lcfitsio -lm
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "fitsio.h"
+
+#include "evt0_synth.h"
+#include "evt0_map.h"
+#include "evt0_patch.h"
+
+#define MAX_CMDS 16
+
+static long size_rows;
+static double size_mb;
+
+static double now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + 1e-9*ts.tv_nsec;
+}
+
+static void report(const char *stage, double t)
+{
+  printf("%10ld  %-14s %9.3f %12.0f %9.1f\n", size_rows, stage, t,
+	 t > 0 ? size_rows/t : 0.0, t > 0 ? size_mb/t : 0.0);
+  fflush(stdout);
+}
+
+/* n rows of blk starting at row offset off */
+static evt0_block sub_block(const evt0_block *blk, long off, long n)
+{
+  evt0_block b;
+
+  b.n = n;
+  b.amp_sf = blk->amp_sf + off;
+  b.pha = blk->pha + off;
+  b.vstat = blk->vstat + off;
+  b.au1 = blk->au1 + off;
+  b.au2 = blk->au2 + off;
+  b.au3 = blk->au3 + off;
+  b.av1 = blk->av1 + off;
+  b.av2 = blk->av2 + off;
+  b.av3 = blk->av3 + off;
+  return b;
+}
+
+static void copy_block(evt0_block *to, const evt0_block *from)
+{
+  long n = from->n;
+
+  memcpy(to->amp_sf, from->amp_sf, n);
+  memcpy(to->pha, from->pha, n);
+  memcpy(to->vstat, from->vstat, n);
+  memcpy(to->au1, from->au1, n*sizeof(short));
+  memcpy(to->au2, from->au2, n*sizeof(short));
+  memcpy(to->au3, from->au3, n*sizeof(short));
+  memcpy(to->av1, from->av1, n*sizeof(short));
+  memcpy(to->av2, from->av2, n*sizeof(short));
+  memcpy(to->av3, from->av3, n*sizeof(short));
+}
+
+static int open_events(fitsfile **fptr, const char *name, int mode,
+		       int *colnums, int *status)
+{
+  int k;
+
+  if ( fits_open_file(fptr, name, mode, status) )
+    return *status;
+  fits_movnam_hdu(*fptr, BINARY_TBL, "EVENTS", 0, status);
+  for ( k = 0; k < EVT0_NCOLS; k++ )
+    fits_get_colnum(*fptr, CASEINSEN, evt0_colnames[k], &colnums[k],
+		    status);
+  return *status;
+}
+
+/* read or write the nine columns of blk, a rowsize at a time */
+static int rw_cols(fitsfile *fptr, const int *colnums, evt0_block *blk,
+		   int write, int *status)
+{
+  evt0_block b;
+  long numrows, row, n;
+  int k, type;
+
+  fits_get_rowsize(fptr, &numrows, status);
+  for ( row = 1; row <= blk->n && !*status; row += n )
+    {
+      n = row + numrows <= blk->n ? numrows : 1 + blk->n - row;
+      b = sub_block(blk, row - 1, n);
+      for ( k = 0; k < EVT0_NCOLS; k++ )
+	{
+	  type = k < 3 ? TBYTE : TSHORT;
+	  if ( write )
+	    fits_write_col(fptr, type, colnums[k], row, 1, n,
+			   evt0_block_col(&b, k), status);
+	  else
+	    fits_read_col(fptr, type, colnums[k], row, 1, n, 0,
+			  evt0_block_col(&b, k), 0, status);
+	}
+    }
+  return *status;
+}
+
+/* run cmd with %i and %o replaced */
+static double run_cmd(const char *cmd, const char *in, const char *out)
+{
+  char buf[4096], *p = buf, *end = buf + sizeof(buf) - 1;
+  const char *s;
+  double t;
+
+  for ( s = cmd; *s && p < end; s++ )
+    {
+      if ( s[0] == '%' && (s[1] == 'i' || s[1] == 'o') )
+	{
+	  p += snprintf(p, end - p, "%s", *++s == 'i' ? in : out);
+	  if ( p > end )
+	    p = end;
+	}
+      else
+	*p++ = *s;
+    }
+  *p = 0;
+
+  unlink(out);
+  t = now();
+  if ( system(buf) != 0 )
+    {
+      fprintf(stderr, "failed: %s\n", buf);
+      return -1.0;
+    }
+  return now() - t;
+}
+
+static int bench_size(long nrows, const char *dir, char **cmds, int ncmds,
+		      int keep)
+{
+  evt0_synth_params sp;
+  char in[FLEN_FILENAME], out[FLEN_FILENAME], name[32];
+  fitsfile *fptr;
+  evt0_map map;
+  evt0_block orig, work, b;
+  evt0_patch pt;
+  tap_lut ulut, vlut;
+  ampsf_lut alut;
+  int colnums[EVT0_NCOLS], status = 0, isa, k;
+  long rowlen, numrows, row, n;
+  double t;
+
+  snprintf(in, sizeof(in), "%s/evt0_bench_%ld.fits", dir, nrows);
+  snprintf(out, sizeof(out), "%s/evt0_bench_%ld_out.fits", dir, nrows);
+  size_rows = nrows;
+
+  evt0_synth_default(&sp);
+  sp.nrows = nrows;
+  unlink(in);
+  t = now();
+  if ( evt0_synth(in, &sp, &status) )
+    {
+      fits_report_error(stderr, status);
+      return status;
+    }
+  t = now() - t;
+
+  if ( open_events(&fptr, in, READONLY, colnums, &status)
+       || fits_read_key(fptr, TLONG, "NAXIS1", &rowlen, 0, &status) )
+    {
+      fits_report_error(stderr, status);
+      return status;
+    }
+  size_mb = nrows*(double)rowlen/1e6;
+  report("synth", t);
+
+  if ( evt0_block_alloc(&orig, nrows) || evt0_block_alloc(&work, nrows) )
+    {
+      fprintf(stderr, "out of memory for %ld rows\n", nrows);
+      return MEMORY_ALLOCATION;
+    }
+
+  t = now();
+  rw_cols(fptr, colnums, &orig, 0, &status);
+  report("read_cfitsio", now() - t);
+
+  t = now();
+  if ( evt0_map_open(&map, fptr, in, EVT0_ALL) == 0 )
+    {
+      fits_get_rowsize(fptr, &numrows, &status);
+      for ( row = 1; row <= nrows; row += n )
+	{
+	  n = row + numrows <= nrows ? numrows : 1 + nrows - row;
+	  b = sub_block(&work, row - 1, n);
+	  evt0_map_read(&map, &b, row);
+	}
+      report("read_mmap", now() - t);
+      evt0_map_close(&map);
+    }
+  fits_close_file(fptr, &status);
+
+  copy_block(&work, &orig);
+  t = now();
+  fix_amp_sf(&work, &sp.ap);
+  report("ampsf", now() - t);
+
+  ampsf_lut_init(&alut, &sp.ap);
+  for ( k = TAP_ISA_SCALAR; k <= TAP_ISA_AVX2; k++ )
+    {
+      if ( (isa = tap_isa_select(k)) != k )
+	continue;
+      copy_block(&work, &orig);
+      t = now();
+      fix_amp_sf_lut(&work, &alut, isa);
+      snprintf(name, sizeof(name), "ampsf_lut_%s", tap_isa_name(isa));
+      report(name, now() - t);
+    }
+
+  for ( k = TAP_ISA_SCALAR; k <= TAP_ISA_AVX512; k++ )
+    {
+      if ( (isa = tap_isa_select(k)) != k )
+	continue;
+      copy_block(&work, &orig);
+      t = now();
+      correct_taps_isa(&work, &sp.tp, isa);
+      snprintf(name, sizeof(name), "taps_%s", tap_isa_name(isa));
+      report(name, now() - t);
+    }
+
+  /* the tables are built once, as with a cache directory */
+  if ( tap_lut_open(&ulut, &sp.tp.u, 0) == 0 )
+    {
+      if ( tap_lut_open(&vlut, &sp.tp.v, 0) == 0 )
+	{
+	  copy_block(&work, &orig);
+	  t = now();
+	  correct_taps_lut(&work, &sp.tp, &ulut, &vlut);
+	  report("taps_lut", now() - t);
+	  tap_lut_close(&vlut);
+	}
+      tap_lut_close(&ulut);
+    }
+
+  /* the fully corrected columns, for writing */
+  copy_block(&work, &orig);
+  fix_amp_sf(&work, &sp.ap);
+  correct_taps(&work, &sp.tp);
+
+  unlink(out);
+  t = now();
+  if ( fits_open_file(&fptr, in, READONLY, &status) == 0 )
+    {
+      fitsfile *ofptr;
+
+      if ( fits_create_file(&ofptr, out, &status) == 0 )
+	{
+	  fits_copy_file(fptr, ofptr, 1, 1, 1, &status);
+	  fits_close_file(ofptr, &status);
+	}
+      fits_close_file(fptr, &status);
+    }
+  report("copy", now() - t);
+
+  if ( open_events(&fptr, out, READWRITE, colnums, &status) == 0 )
+    {
+      t = now();
+      rw_cols(fptr, colnums, &work, 1, &status);
+      fits_flush_file(fptr, &status);
+      report("write", now() - t);
+
+      t = now();
+      fits_write_chksum(fptr, &status);
+      report("checksum", now() - t);
+      fits_close_file(fptr, &status);
+    }
+
+  unlink(out);
+  t = now();
+  if ( evt0_clone(in, out) == 0 )
+    {
+      if ( open_events(&fptr, out, READWRITE, colnums, &status) == 0
+	   && evt0_map_open(&map, fptr, in, EVT0_ALL) == 0 )
+	{
+	  evt0_patch_init(&pt, fptr, &map);
+	  evt0_patch_col(&pt, EVT0_AMP_SF, colnums[0], 1, nrows,
+			 work.amp_sf, &status);
+	  evt0_patch_col(&pt, EVT0_AU3, colnums[5], 1, nrows, work.au3,
+			 &status);
+	  evt0_patch_col(&pt, EVT0_AV3, colnums[8], 1, nrows, work.av3,
+			 &status);
+	  evt0_patch_finish(&pt, &status);
+	  fits_close_file(fptr, &status);
+	  evt0_map_close(&map);
+	  report("patch", now() - t);
+	}
+    }
+
+  for ( k = 0; k < ncmds; k++ )
+    {
+      if ( (t = run_cmd(cmds[k], in, out)) >= 0 )
+	{
+	  snprintf(name, sizeof(name), "cmd%d", k + 1);
+	  report(name, t);
+	}
+    }
+
+  if ( status )
+    fits_report_error(stderr, status);
+  evt0_block_free(&orig);
+  evt0_block_free(&work);
+  if ( !keep )
+    {
+      unlink(in);
+      unlink(out);
+    }
+  return status;
+}
+
+int main(int argc, char *argv[])
+{
+  char *progname = argv[0], *sizes = "100000,1000000,4000000", *p;
+  char *dir = "/tmp", *cmds[MAX_CMDS];
+  int c, ncmds = 0, keep = 0, k, fail = 0;
+  long nrows;
+
+  while ((c = getopt(argc, argv, "n:d:x:kh?")) != EOF)
+    {
+      switch (c)
+	{
+	case 'n':
+	  sizes = optarg;
+	  break;
+	case 'd':
+	  dir = optarg;
+	  break;
+	case 'x':
+	  if ( ncmds < MAX_CMDS )
+	    cmds[ncmds++] = optarg;
+	  break;
+	case 'k':
+	  keep = 1;
+	  break;
+	case 'h':
+	case '?':
+	  fprintf(stderr,"\nUsage: %s -[ndxkh]", progname);
+	  fprintf(stderr,"\n\tn[100000,1000000,4000000]:\tfile sizes in events");
+	  fprintf(stderr,"\n\td[/tmp]:\tdirectory for the files");
+	  fprintf(stderr,"\n\tx cmd:\talso time cmd, with %%i and %%o the");
+	  fprintf(stderr,"\n\t\tinput and output files; may be repeated");
+	  fprintf(stderr,"\n\tk:\tkeep the files");
+	  fprintf(stderr,"\n\th or ?:\tprint usage\n");
+	  exit(0);
+	}
+    }
+
+  for ( k = 0; k < ncmds; k++ )
+    printf("# cmd%d: %s\n", k + 1, cmds[k]);
+  printf("# %8s  %-14s %9s %12s %9s\n", "events", "stage", "seconds",
+	 "events/s", "MB/s");
+
+  for ( p = sizes; *p; )
+    {
+      nrows = strtol(p, &p, 10);
+      if ( nrows > 0 && bench_size(nrows, dir, cmds, ncmds, keep) )
+	fail = 1;
+      while ( *p == ',' )
+	p++;
+      if ( *p && (*p < '0' || *p > '9') )
+	{
+	  fprintf(stderr, "%s: bad size list %s\n", progname, sizes);
+	  exit(1);
+	}
+    }
+  return fail;
+}
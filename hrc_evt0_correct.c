@@ -9,16 +9,54 @@ $Id: hrc_evt0_correct.c,v 1.9 2002/01/08 20:45:21 juda Exp $
 Corrects tap data for events that are affected by the hardware "ringing" 
 problem (e.g. events with amp_sf = 3, a1 > a3, and a1 > const1*a2+const2).
 
+The correction is vectorized with AVX2 or AVX-512 when the CPU has
+them (see evt0_simd.c), or with -T done by table lookup (see
+evt0_lut.c). With -j, reading, correcting and writing overlap (see
+evt0_pipe.c). Uncompressed input is read memory-mapped (see
+evt0_map.c), and with -S the output is a clone of the input with only
+the changed AU3/AV3 values written (see evt0_patch.c). With -m, the
+files listed in a manifest are corrected in one run (see evt0_batch.c).
+With -J, run statistics are written as JSON (see evt0_stats.c). Given
+- for the input or output file, stdin or stdout is corrected as a
+sequential FITS stream (see evt0_stream.c); so is a gzipped input,
+decompressed on other threads (see evt0_gz.c). With -Z, the EVENTS
+table of the output is tile-compressed (see evt0_ztab.c). With -H,
+nothing is written but histograms of what the correction would change
+(see evt0_hist.c).
+
+Build:
+	cc -O2 -pthread -o hrc_evt0_correct hrc_evt0_correct.c evt0_kernels.c evt0_simd.c evt0_lut.c evt0_pipe.c evt0_map.c evt0_patch.c evt0_batch.c evt0_stats.c evt0_stream.c evt0_gz.c evt0_ztab.c evt0_hist.c -lcfitsio -lz -lm
+
 */
 
 /*** include files ***/
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <unistd.h>
 
 #include "fitsio.h"
 
-#include "correction.h"
+#include "evt0_kernels.h"
+#include "evt0_pipe.h"
+#include "evt0_map.h"
+#include "evt0_patch.h"
+#include "evt0_batch.h"
+#include "evt0_stats.h"
+#include "evt0_stream.h"
+#include "evt0_gz.h"
+#include "evt0_hist.h"
+
+/* rows per unit of work in batch mode */
+#define BATCH_ROWS 262144
+
+/* rows corrected at a time in stream mode */
+#define STREAM_ROWS 65536
+
+/* the columns read by the correction */
+#define CORRECT_COLS (EVT0_AMP_SF | EVT0_VSTAT | EVT0_AU1 | EVT0_AU2 \
+		      | EVT0_AU3 | EVT0_AV1 | EVT0_AV2 | EVT0_AV3)
 
 #define RCS "$Revision: 1.9 $\n"
 
@@ -29,13 +67,368 @@ int getopt();
 int atoi();
 double atof();
 
+/* how the taps are to be corrected */
+typedef struct
+{
+  tap_params *tp;
+  int isa;
+  int use_lut;
+  tap_lut *ulut, *vlut;
+  int verify;
+} correct_ctx;
+
+/*
+  Correct one block. With verification or statistics the uncorrected
+  AU3/AV3 are saved in orig_au3/orig_av3. The differences from the
+  scalar code are added to ndiff_u/ndiff_v, and the time taken and
+  corrections made to st, if it is not 0.
+*/
+static void correct_block(correct_ctx *cc, evt0_block *blk,
+			  short *orig_au3, short *orig_av3,
+			  long *ndiff_u, long *ndiff_v, evt0_stats *st)
+{
+  double t = 0.0;
+
+  if ( cc->verify || st )
+    {
+      memcpy(orig_au3, blk->au3, blk->n*sizeof(short));
+      memcpy(orig_av3, blk->av3, blk->n*sizeof(short));
+    }
+  if ( st )
+    t = evt0_now();
+  if ( cc->use_lut )
+    correct_taps_lut(blk, cc->tp, cc->ulut, cc->vlut);
+  else
+    correct_taps_isa(blk, cc->tp, cc->isa);
+  if ( st )
+    {
+      st->t[EVT0_T_CORRECT] += evt0_now() - t;
+      evt0_stats_taps(st, blk, orig_au3, orig_av3, cc->tp);
+    }
+  if ( cc->verify )
+    tap_verify(blk, orig_au3, orig_av3, cc->tp, ndiff_u, ndiff_v);
+}
+
+/* pipelined mode: state shared by the reader, workers and writer */
+typedef struct
+{
+  fitsfile *infile, *outfile;
+  int colnums[8];		/* AMP_SF, VETOSTT, AU1-3, AV1-3 */
+  evt0_map *map;		/* 0 to read with cfitsio */
+  evt0_patch *patch;		/* 0 to write whole columns */
+  correct_ctx *cc;
+  long ndiff_u, ndiff_v;
+  evt0_stats *stats;		/* 0 if not wanted */
+} pipe_ctx;
+
+typedef struct
+{
+  short *orig_au3, *orig_av3;
+  long ndiff_u, ndiff_v;
+  double t0;			/* when reading of the chunk started */
+  evt0_stats st;		/* the chunk's share of the statistics */
+} chunk_extra;
+
+static int pipe_read(void *ctx, evt0_chunk *ch)
+{
+  pipe_ctx *pc = ctx;
+  chunk_extra *x = ch->user;
+  evt0_block *b = &ch->blk;
+  unsigned char bnull = 0;
+  short snull = 0;
+  int anynull, status = 0;
+
+  if ( pc->stats )
+    {
+      evt0_stats_init(&x->st);
+      x->t0 = x->st.start;
+    }
+
+  if ( pc->map )
+    {
+      evt0_map_read(pc->map, b, ch->row);
+      if ( pc->stats )
+	x->st.t[EVT0_T_READ] += evt0_now() - x->t0;
+      return 0;
+    }
+
+  fits_read_col(pc->infile, TBYTE, pc->colnums[0], ch->row, 1, b->n,
+		&bnull, b->amp_sf, &anynull, &status);
+  fits_read_col(pc->infile, TBYTE, pc->colnums[1], ch->row, 1, b->n,
+		&bnull, b->vstat, &anynull, &status);
+  fits_read_col(pc->infile, TSHORT, pc->colnums[2], ch->row, 1, b->n,
+		&snull, b->au1, &anynull, &status);
+  fits_read_col(pc->infile, TSHORT, pc->colnums[3], ch->row, 1, b->n,
+		&snull, b->au2, &anynull, &status);
+  fits_read_col(pc->infile, TSHORT, pc->colnums[4], ch->row, 1, b->n,
+		&snull, b->au3, &anynull, &status);
+  fits_read_col(pc->infile, TSHORT, pc->colnums[5], ch->row, 1, b->n,
+		&snull, b->av1, &anynull, &status);
+  fits_read_col(pc->infile, TSHORT, pc->colnums[6], ch->row, 1, b->n,
+		&snull, b->av2, &anynull, &status);
+  fits_read_col(pc->infile, TSHORT, pc->colnums[7], ch->row, 1, b->n,
+		&snull, b->av3, &anynull, &status);
+  if ( pc->stats )
+    x->st.t[EVT0_T_READ] += evt0_now() - x->t0;
+  return status;
+}
+
+static void pipe_compute(void *ctx, evt0_chunk *ch)
+{
+  pipe_ctx *pc = ctx;
+  chunk_extra *x = ch->user;
+
+  x->ndiff_u = x->ndiff_v = 0;
+  correct_block(pc->cc, &ch->blk, x->orig_au3, x->orig_av3,
+		&x->ndiff_u, &x->ndiff_v, pc->stats ? &x->st : 0);
+}
+
+/* the writer is a single thread, so it can also do the bookkeeping */
+static int pipe_write(void *ctx, evt0_chunk *ch)
+{
+  pipe_ctx *pc = ctx;
+  chunk_extra *x = ch->user;
+  int status = 0;
+  double t = 0.0;
+
+  if ( pc->stats )
+    t = evt0_now();
+  if ( pc->patch )
+    {
+      evt0_patch_col(pc->patch, EVT0_AV3, pc->colnums[7], ch->row,
+		     ch->blk.n, ch->blk.av3, &status);
+      evt0_patch_col(pc->patch, EVT0_AU3, pc->colnums[4], ch->row,
+		     ch->blk.n, ch->blk.au3, &status);
+    }
+  else
+    {
+      fits_write_col(pc->outfile, TSHORT, pc->colnums[7], ch->row, 1,
+		     ch->blk.n, ch->blk.av3, &status);
+      fits_write_col(pc->outfile, TSHORT, pc->colnums[4], ch->row, 1,
+		     ch->blk.n, ch->blk.au3, &status);
+    }
+  pc->ndiff_u += x->ndiff_u;
+  pc->ndiff_v += x->ndiff_v;
+  if ( pc->stats )
+    {
+      x->st.t[EVT0_T_WRITE] += evt0_now() - t;
+      evt0_stats_chunk(&x->st, ch->blk.n, evt0_now() - x->t0);
+      evt0_stats_merge(pc->stats, &x->st);
+    }
+  return status;
+}
+
+/*
+  Correct the current EVENTS extension of infile into the copy already
+  made in outfile, with nthreads correction workers and chunks of
+  nevents rows. If map is not 0 the input is read from it, and if
+  patch is not 0 only changed values are written through it. If stats
+  is not 0 the run statistics are added to it. Returns a cfitsio
+  status, or -1 if the pipeline could not be set up.
+*/
+static int correct_pipelined(fitsfile *infile, fitsfile *outfile, long nrows,
+			     long nevents, int nthreads, evt0_map *map,
+			     evt0_patch *patch, correct_ctx *cc,
+			     long *ndiff_u, long *ndiff_v, evt0_stats *stats,
+			     int *status)
+{
+  static char *colnames[] =
+    { "AMP_SF", "VETOSTT", "AU1", "AU2", "AU3", "AV1", "AV2", "AV3" };
+  pipe_ctx pc;
+  evt0_pipe pp;
+  chunk_extra *extra;
+  void **user;
+  int i;
+
+  pc.infile = infile;
+  pc.outfile = outfile;
+  pc.map = map;
+  pc.patch = patch;
+  pc.cc = cc;
+  pc.ndiff_u = pc.ndiff_v = 0;
+  pc.stats = stats;
+  for ( i = 0; i < 8; i++ )
+    fits_get_colnum(infile, CASEINSEN, colnames[i], &pc.colnums[i], status);
+  if ( *status )
+    return *status;
+
+  pp.nrows = nrows;
+  pp.chunk_rows = nevents;
+  pp.nworkers = nthreads;
+  pp.nchunks = 2*nthreads + 2;
+  pp.read = pipe_read;
+  pp.compute = pipe_compute;
+  pp.write = pipe_write;
+  pp.ctx = &pc;
+
+  extra = CALLOC(pp.nchunks, chunk_extra);
+  user = CALLOC(pp.nchunks, void *);
+  if ( !extra || !user )
+    return -1;
+  for ( i = 0; i < pp.nchunks; i++ )
+    {
+      if ( cc->verify || stats )
+	{
+	  extra[i].orig_au3 = CALLOC(nevents, short);
+	  extra[i].orig_av3 = CALLOC(nevents, short);
+	  if ( !extra[i].orig_au3 || !extra[i].orig_av3 )
+	    return -1;
+	}
+      user[i] = &extra[i];
+    }
+
+  *status = evt0_pipe_run(&pp, user);
+
+  *ndiff_u += pc.ndiff_u;
+  *ndiff_v += pc.ndiff_v;
+  for ( i = 0; i < pp.nchunks; i++ )
+    {
+      free(extra[i].orig_au3);
+      free(extra[i].orig_av3);
+    }
+  free(extra);
+  free(user);
+  return *status;
+}
+
+/* batch mode: the defaults, and the statistics of all files */
+typedef struct
+{
+  correct_ctx *cc;
+  evt0_stats *stats;		/* 0 if not wanted */
+  pthread_mutex_t lock;
+} batch_ctx;
+
+/* batch mode: the coefficients for one file */
+typedef struct
+{
+  correct_ctx cc;
+  tap_params tp;
+} batch_params;
+
+/* apply a file's overrides, given with the option letters, to the defaults */
+static int batch_setup(void *ctx, evt0_job *job)
+{
+  correct_ctx *def = ((batch_ctx *)ctx)->cc;
+  batch_params *bp;
+  char *key;
+  double x;
+  int i;
+
+  if ( !(bp = CALLOC(1, batch_params)) )
+    return -1;
+  job->params = bp;
+  bp->tp = *def->tp;
+  bp->cc = *def;
+  bp->cc.tp = &bp->tp;
+  bp->cc.verify = 0;
+
+  for ( i = 0; i < job->nover; i++ )
+    {
+      key = job->over[i];
+      if ( key[1] != '=' )
+	return -1;
+      x = atof(key + 2);
+      switch ( key[0] )
+	{
+	case 'a': bp->tp.u.a = x; break;
+	case 'b': bp->tp.u.b = x; break;
+	case 'c': bp->tp.u.c = x; break;
+	case 'd': bp->tp.u.d = x; break;
+	case 'e': bp->tp.u.e = x; break;
+	case 'f': bp->tp.u.f = x; break;
+	case 'g': bp->tp.u.g = x; break;
+	case 'o': bp->tp.u.o = x; break;
+	case 'A': bp->tp.v.a = x; break;
+	case 'B': bp->tp.v.b = x; break;
+	case 'C': bp->tp.v.c = x; break;
+	case 'D': bp->tp.v.d = x; break;
+	case 'E': bp->tp.v.e = x; break;
+	case 'F': bp->tp.v.f = x; break;
+	case 'G': bp->tp.v.g = x; break;
+	case 'O': bp->tp.v.o = x; break;
+	case 'w': bp->tp.use_width = x != 0; break;
+	default: return -1;
+	}
+    }
+
+  /* the tables only hold the corrections for the default coefficients */
+  if ( memcmp(&bp->tp.u, &def->tp->u, sizeof(tap_coeffs))
+       || memcmp(&bp->tp.v, &def->tp->v, sizeof(tap_coeffs)) )
+    bp->cc.use_lut = 0;
+  return 0;
+}
+
+static void batch_correct(void *ctx, evt0_job *job, evt0_block *blk,
+			  long row, evt0_patch *pt)
+{
+  batch_ctx *bc = ctx;
+  batch_params *bp = job->params;
+  evt0_stats st, *sp = 0;
+  short *orig = 0;
+  double t = 0.0;
+  int status = 0;
+
+  if ( bc->stats && (orig = CALLOC(2*blk->n, short)) )
+    {
+      evt0_stats_init(&st);
+      sp = &st;
+    }
+
+  correct_block(&bp->cc, blk, orig, orig ? orig + blk->n : 0, 0, 0, sp);
+  if ( sp )
+    t = evt0_now();
+  evt0_patch_col(pt, EVT0_AV3, 0, row, blk->n, blk->av3, &status);
+  evt0_patch_col(pt, EVT0_AU3, 0, row, blk->n, blk->au3, &status);
+
+  if ( sp )
+    {
+      st.t[EVT0_T_WRITE] += evt0_now() - t;
+      evt0_stats_chunk(&st, blk->n, evt0_now() - st.start);
+      pthread_mutex_lock(&bc->lock);
+      evt0_stats_merge(bc->stats, &st);
+      pthread_mutex_unlock(&bc->lock);
+      free(orig);
+    }
+}
+
+/* stream mode: the buffers and counts of the correction */
+typedef struct
+{
+  correct_ctx *cc;
+  short *orig_au3, *orig_av3;
+  long ndiff_u, ndiff_v;
+  evt0_stats *stats;
+} stream_ctx;
+
+static void stream_correct(void *ctx, evt0_block *blk)
+{
+  stream_ctx *sc = ctx;
+
+  correct_block(sc->cc, blk, sc->orig_au3, sc->orig_av3, &sc->ndiff_u,
+		&sc->ndiff_v, sc->stats);
+}
+
+/* a block of a dry run, on any thread */
+static void hist_correct(void *ctx, evt0_block *blk)
+{
+  correct_ctx *cc = ctx;
+
+  if ( cc->use_lut )
+    correct_taps_lut(blk, cc->tp, cc->ulut, cc->vlut);
+  else
+    correct_taps_isa(blk, cc->tp, cc->isa);
+}
+
 int print_usage(char *progname)
 {
   fprintf(stderr, RCS);
 
   fprintf(stderr, 
-	  "\nUsage:\n\t%s [-abcdefgoABCDEFGOv] <HRC_L0_EVENTS> <HRC_L0_EVENTS>\n", 
-	  progname);
+	  "\nUsage:\n\t%s [-abcdefgoABCDEFGOv] <HRC_L0_EVENTS> <HRC_L0_EVENTS>\n"
+	  "\t%s [-abcdefgoABCDEFGOv] -m <manifest>\n"
+	  "\t%s [-abcdefgoABCDEFGOv] -H <histograms> <HRC_L0_EVENTS>\n",
+	  progname, progname, progname);
   fprintf(stderr,"\ta[%.3f]:\tu-axis sinusoid amplitude 'slope'\n",
 	  UAXIS_A);
   fprintf(stderr,"\tb[%.3f]:\tu-axis sinusoid amplitude intercept\n",
@@ -71,7 +464,34 @@ int print_usage(char *progname)
 	  VAXIS_O);
 
   fprintf(stderr,"\tw:\tuse width-exceeded bits to ID events\n");
+  fprintf(stderr,"\tI[auto]:\twidest instruction set to use "
+	  "(scalar, avx2, avx512, auto)\n");
+  fprintf(stderr,"\tV:\tverify against the scalar code and report "
+	  "differing AU3/AV3\n");
+  fprintf(stderr,"\tT:\tcorrect by table lookup\n");
+  fprintf(stderr,"\tj[0]:\tcorrection threads, overlapping reading and "
+	  "writing;\n\t\t0 processes serially\n");
+  fprintf(stderr,"\tL dir:\tcache correction tables in dir (implies -T)\n");
+  fprintf(stderr,"\tM:\tonly make the tables for the given coefficients "
+	  "(needs -L)\n");
 
+  fprintf(stderr,"\tN:\tread the input through cfitsio only\n");
+  fprintf(stderr,"\tm file:\tcorrect the files listed in file, one\n"
+	  "\t\t'infile outfile [key=value ...]' per line, with -j threads\n"
+	  "\t\t(default: all CPUs)\n");
+  fprintf(stderr,"\tS:\tclone the input and write only changed values;\n"
+	  "\t\tother HDUs are left as they are\n");
+  fprintf(stderr,"\tA file name of - streams from stdin or to stdout; other\n"
+	  "\t\tHDUs are left as they are. A gzipped input is streamed\n"
+	  "\t\tas well, unless -N, with -j threads decompressing it\n"
+	  "\t\t(default: all CPUs)\n");
+  fprintf(stderr,"\tZ:\ttile-compress the EVENTS table of the output, "
+	  "with -j\n\t\tthreads (default: all CPUs)\n");
+  fprintf(stderr,"\tH file:\tdry run: write no output, but histograms of "
+	  "what would\n\t\tchange, with -j threads (default: all CPUs), "
+	  "as RDB\n\t\tif file is - or *.rdb, else FITS\n");
+  fprintf(stderr,"\tJ file:\twrite run statistics as JSON to file "
+	  "(- for stdout)\n");
   fprintf(stderr,"\tv[0]:\tverbosity of diagnostic output\n");
   fprintf(stderr,"\th or ?:\tprint usage\n");
   return 0;
@@ -83,13 +503,25 @@ int argc;
 char *argv[];
 
 {
-  int c, verb = 0, ii, jj, kk, ncycle, use_width, correct;
+  int c, verb = 0, ii, kk, ncycle, use_width, isa, verify = 0;
+  int use_lut = 0, make_lut = 0, nthreads = 0, use_map = 1, mapped;
+  int patch = 0, patching;
+  int ztab = 0, zthreads, gzin;
+  char *manifest = 0;
+  char *statsfile = 0;
+  char *histname = 0;
+  evt0_stats stats, *st = 0;
+  double t, t0 = 0.0;
+  char *lutdir = 0;
   char *progname, *inname, *outname;
   double uaxis_a, uaxis_b, uaxis_c, uaxis_d, uaxis_e, uaxis_f, uaxis_g, 
     uaxis_o;
   double vaxis_a, vaxis_b, vaxis_c, vaxis_d, vaxis_e, vaxis_f, vaxis_g, 
     vaxis_o;
-  double a1, a2, a3, phi;
+  tap_params tp;
+  tap_lut ulut, vlut;
+  correct_ctx cc;
+  long ndiff_u = 0, ndiff_v = 0;
 
   /* ============== FITSIO variables ================== */
 
@@ -106,8 +538,10 @@ char *argv[];
   int ncols, colnum, *anynull = 0;
 
   /* data from essential level 0 events columns */
-  unsigned char *ampsf, *vstat;
-  short *av1, *av2, *av3, *au1, *au2, *au3;
+  evt0_block blk;
+  evt0_map map;
+  evt0_patch pt;
+  short *orig_au3 = 0, *orig_av3 = 0;
 
   /* Initialize command correction coefficients */
   uaxis_a = UAXIS_A;
@@ -127,6 +561,7 @@ char *argv[];
   vaxis_g = VAXIS_G;
   vaxis_o = VAXIS_O;
   use_width = 0;
+  isa = TAP_ISA_AVX512;
 
   progname = strrchr(argv[0], '/');
   if(progname)
@@ -135,7 +570,7 @@ char *argv[];
     progname = argv[0];
 
   /* check for command line variables */
-  while ((c = getopt(argc, argv, "a:b:c:d:e:f:g:o:A:B:C:D:E:F:G:O:v:wh?")) != EOF)
+  while ((c = getopt(argc, argv, "a:b:c:d:e:f:g:o:A:B:C:D:E:F:G:O:v:wI:VTL:Mj:NSZH:m:J:h?")) != EOF)
     {
       switch (c) 
         {
@@ -193,6 +628,54 @@ char *argv[];
         case 'w':
 	  use_width = 1;
           break;
+        case 'I':
+	  if ( !strcmp(optarg, "scalar") )
+	    isa = TAP_ISA_SCALAR;
+	  else if ( !strcmp(optarg, "avx2") )
+	    isa = TAP_ISA_AVX2;
+	  else if ( !strcmp(optarg, "avx512") || !strcmp(optarg, "auto") )
+	    isa = TAP_ISA_AVX512;
+	  else
+	    {
+	      fprintf(stderr, "%s: unknown instruction set '%s'\n", progname,
+		      optarg);
+	      exit(1);
+	    }
+          break;
+        case 'V':
+	  verify = 1;
+          break;
+        case 'T':
+	  use_lut = 1;
+          break;
+        case 'L':
+	  use_lut = 1;
+	  lutdir = optarg;
+          break;
+        case 'M':
+	  make_lut = 1;
+          break;
+        case 'j':
+	  nthreads = atoi(optarg);
+          break;
+        case 'N':
+	  use_map = 0;
+          break;
+        case 'S':
+	  patch = 1;
+          break;
+        case 'Z':
+	  ztab = 1;
+          break;
+        case 'H':
+	  histname = optarg;
+          break;
+        case 'm':
+	  manifest = optarg;
+          break;
+        case 'J':
+	  statsfile = optarg;
+          break;
         case 'h':
         case '?':
 	  print_usage(progname);
@@ -200,21 +683,191 @@ char *argv[];
         }
     }
 
-  if( argc < 3 )
+  if ( statsfile )
+    {
+      evt0_stats_init(&stats);
+      st = &stats;
+    }
+  zthreads = nthreads > 0 ? nthreads : sysconf(_SC_NPROCESSORS_ONLN);
+
+  if( make_lut && !lutdir )
+    {
+      fprintf(stderr, "%s: -M needs a cache directory given with -L\n",
+	      progname);
+      exit(1);
+    }
+
+  if( argc < (histname ? 4 : 3) && !make_lut && !manifest )
     {
       print_usage(progname);
       exit(1);
     }
 
 
+  tp.u.a = uaxis_a; tp.u.b = uaxis_b; tp.u.c = uaxis_c; tp.u.d = uaxis_d;
+  tp.u.e = uaxis_e; tp.u.f = uaxis_f; tp.u.g = uaxis_g; tp.u.o = uaxis_o;
+  tp.v.a = vaxis_a; tp.v.b = vaxis_b; tp.v.c = vaxis_c; tp.v.d = vaxis_d;
+  tp.v.e = vaxis_e; tp.v.f = vaxis_f; tp.v.g = vaxis_g; tp.v.o = vaxis_o;
+  tp.use_width = use_width;
+  isa = tap_isa_select(isa);
+
   if(verb > 0) fprintf(stderr, "\n\n***** Running %s *****\n\t", progname);
   if(verb > 0) fprintf(stderr, RCS);
+  if(verb > 0 && !use_lut) fprintf(stderr, "Correction uses %s instructions\n",
+				  tap_isa_name(isa));
+
+  if ( use_lut )
+    {
+      if(verb > 0) fprintf(stderr, "Loading correction tables\n");
+      if ( tap_lut_open(&ulut, &tp.u, lutdir)
+	   || tap_lut_open(&vlut, &tp.v, lutdir) )
+	{
+	  fprintf(stderr, "%s: could not make correction tables\n", progname);
+	  exit(1);
+	}
+      if ( make_lut )
+	exit(0);
+    }
+
+  cc.tp = &tp;
+  cc.isa = isa;
+  cc.use_lut = use_lut;
+  cc.ulut = &ulut;
+  cc.vlut = &vlut;
+  cc.verify = verify;
+
+  if ( manifest )
+    {
+      evt0_batch b;
+      batch_ctx bc;
+      evt0_job *jobs;
+      int njobs, nfail;
+
+      if ( verify )
+	fprintf(stderr, "%s: -V is ignored in batch mode\n", progname);
+      if ( evt0_batch_read(manifest, &jobs, &njobs) )
+	exit(1);
+      b.nthreads = zthreads;
+      b.range_rows = BATCH_ROWS;
+      b.cols = CORRECT_COLS;
+      b.ztab = ztab;
+      b.verb = verb;
+      b.progname = progname;
+      b.setup = batch_setup;
+      b.range = batch_correct;
+      b.ctx = &bc;
+      bc.cc = &cc;
+      bc.stats = st;
+      pthread_mutex_init(&bc.lock, 0);
+      nfail = evt0_batch_run(&b, jobs, njobs);
+      if ( nfail )
+	fprintf(stderr, "%s: %d of %d files failed\n", progname, nfail,
+		njobs);
+      if ( st && evt0_stats_write(st, statsfile, progname, manifest, 0,
+				  EVT0_STATS_TAPS) )
+	fprintf(stderr, "%s: cannot write %s\n", progname, statsfile);
+      evt0_batch_free(jobs, njobs);
+      if ( use_lut )
+	{
+	  tap_lut_close(&ulut);
+	  tap_lut_close(&vlut);
+	}
+      exit(nfail ? 1 : 0);
+    }
+
+  if ( nthreads > 0 && !fits_is_reentrant() )
+    {
+      fprintf(stderr, "%s: cfitsio is not thread safe, ignoring -j\n",
+	      progname);
+      nthreads = 0;
+    }
+
+  /* dry run: histograms of what would change, and no output */
+  if ( histname )
+    {
+      evt0_hist h;
+
+      inname = argv[argc-1];
+      if ( fits_open_file(&infile, inname, READONLY, &status)
+	   || fits_movnam_hdu(infile, BINARY_TBL, "EVENTS", 0, &status) )
+	{
+	  fits_report_error(stderr, status);
+	  exit(1);
+	}
+      if ( evt0_hist_alloc(&h) )
+	{
+	  fprintf(stderr, "%s: could not allocate buffers\n", progname);
+	  exit(1);
+	}
+      if ( evt0_hist_run(&h, infile, inname, CORRECT_COLS, zthreads,
+			 STREAM_ROWS, hist_correct, &cc, progname)
+	   || evt0_hist_write(&h, histname, inname, progname) )
+	exit(1);
+      fprintf(stderr, "%s: %s: %lld of %lld events would have AU3 or AV3 "
+	      "corrected\n", progname, inname, h.ntaps, h.rows);
+      evt0_hist_free(&h);
+      fits_close_file(infile, &status);
+      exit(0);
+    }
 
   inname = argv[argc-2];
   outname = argv[argc-1];
 
+  if ( ztab && !strcmp(outname, "-") )
+    {
+      fprintf(stderr, "%s: -Z needs an output file\n", progname);
+      exit(1);
+    }
+
+  gzin = use_map && strcmp(inname, "-") && evt0_gz_is(inname);
+  if ( !strcmp(inname, "-") || !strcmp(outname, "-") || gzin )
+    {
+      evt0_stream sm;
+      stream_ctx sc;
+
+      if ( st && !strcmp(statsfile, "-") && !strcmp(outname, "-") )
+	{
+	  fprintf(stderr, "%s: -J - would mix the statistics into the "
+		  "output stream\n", progname);
+	  exit(1);
+	}
+      if ( patch || !use_map )
+	fprintf(stderr, "%s: -S and -N are ignored when streaming\n",
+		progname);
+      else if ( nthreads > 0 && !gzin )
+	fprintf(stderr, "%s: -j is ignored when streaming\n", progname);
+      sc.cc = &cc;
+      sc.orig_au3 = CALLOC(STREAM_ROWS, short);
+      sc.orig_av3 = CALLOC(STREAM_ROWS, short);
+      sc.ndiff_u = sc.ndiff_v = 0;
+      sc.stats = st;
+      sm.chunk_rows = STREAM_ROWS;
+      sm.cols = CORRECT_COLS;
+      sm.wcols = EVT0_AU3 | EVT0_AV3;
+      sm.nthreads = zthreads;
+      sm.verb = verb;
+      sm.progname = progname;
+      sm.stats = st;
+      sm.header = 0;
+      sm.correct = stream_correct;
+      sm.ctx = &sc;
+      if ( !sc.orig_au3 || !sc.orig_av3 )
+	{
+	  fprintf(stderr, "%s: could not allocate buffers\n", progname);
+	  exit(1);
+	}
+      if ( evt0_stream_run(&sm, inname, outname) )
+	exit(1);
+      ndiff_u = sc.ndiff_u;
+      ndiff_v = sc.ndiff_v;
+      free(sc.orig_au3);
+      free(sc.orig_av3);
+      goto done;
+    }
+
   /* open input FITS file */
   if(verb > 0) fprintf(stderr, "\nInput file:  %s\n", inname);
+  t = evt0_now();
   if (fits_open_file(&infile, inname, READONLY, &status))
     {
       fits_report_error(stderr, status);
@@ -224,26 +877,54 @@ char *argv[];
   if(verb > 0) 
     fprintf(stderr, "Input file has %d Header-Data units\n", hdunum);
 
+  if ( st )
+    st->t[EVT0_T_OPEN] += evt0_now() - t;
+
+  /* clone the input for patching, if it is a plain file */
+  t = evt0_now();
+  if ( patch && evt0_clone(inname, outname) )
+    {
+      fprintf(stderr, "%s: cannot clone %s, writing a full copy\n",
+	      progname, inname);
+      patch = 0;
+    }
+  if ( st )
+    st->t[EVT0_T_HEADER] += evt0_now() - t;
+
   /* open output FITS file */
   if(verb > 0) fprintf(stderr, "Output file: %s\n", outname);
-  if (fits_create_file(&outfile, outname, &status))
+  t = evt0_now();
+  if (patch ? fits_open_file(&outfile, outname + (*outname == '!'),
+			     READWRITE, &status)
+      : fits_create_file(&outfile, outname, &status))
     {
       fits_report_error(stderr, status);
       exit(1);
     }
+  if ( st )
+    st->t[EVT0_T_OPEN] += evt0_now() - t;
 
-  if(verb > 0) fprintf(stderr, "Copy Primary HDU to output file\n");
-  /* Copy primary HDU from input to output file */  
-  if (fits_copy_hdu(infile, outfile, 0, &status))
+  if ( !patch )
     {
-      fits_report_error(stderr, status);
-      exit(1);
-    }
+      if(verb > 0) fprintf(stderr, "Copy Primary HDU to output file\n");
+      /* Copy primary HDU from input to output file */  
+      t = evt0_now();
+      if (fits_copy_hdu(infile, outfile, 0, &status))
+	{
+	  fits_report_error(stderr, status);
+	  exit(1);
+	}
+      if ( st )
+	st->t[EVT0_T_HEADER] += evt0_now() - t;
 
-  /* Update the DATE keyword in the output file and update the checksums */
-  if(verb > 0) fprintf(stderr, "Update DATE and Checksums\n");
-  fits_write_date(outfile, &status);
-  fits_write_chksum(outfile, &status);
+      /* Update the DATE keyword in the output file and update the checksums */
+      if(verb > 0) fprintf(stderr, "Update DATE and Checksums\n");
+      t = evt0_now();
+      fits_write_date(outfile, &status);
+      fits_write_chksum(outfile, &status);
+      if ( st )
+	st->t[EVT0_T_CHECKSUM] += evt0_now() - t;
+    }
 
   if(verb > 0) fprintf(stderr, "Move on to extensions\n");
   for ( kk = 2; kk < hdunum+1; kk++ )
@@ -254,6 +935,11 @@ char *argv[];
 	  fits_report_error(stderr, status);
 	  exit(1);
 	}
+      if ( patch && fits_movabs_hdu(outfile, kk, &hdutype, &status) )
+	{
+	  fits_report_error(stderr, status);
+	  exit(1);
+	}
       if(verb > 0) fprintf(stderr, "Extension %d\n", kk-1);
 
       /* Get EXTNAME keyword value to see if this is an events extension */
@@ -273,11 +959,14 @@ char *argv[];
 	  if(verb > 0) fprintf(stderr,"Extension has %d columns and %d rows\n",
 			       (int)ncols, (int)nrows);
 	  /* Copy HDU from input file to output file */
-	  if (fits_copy_hdu(infile, outfile, 0, &status))
+	  t = evt0_now();
+	  if (!patch && fits_copy_hdu(infile, outfile, 0, &status))
 	    {
 	      fits_report_error(stderr, status);
 	      exit(1);
 	    }
+	  if ( st )
+	    st->t[EVT0_T_HEADER] += evt0_now() - t;
 
 	  fits_get_rowsize(infile, &numrows, &status);
 	  if(verb > 0) fprintf(stderr,"FITSIO optimal buffer %d rows\n", 
@@ -285,7 +974,8 @@ char *argv[];
 
 	  if ((numrows/2) > nrows)
 	    {
-	      nevents = nrows/2;
+	      nevents = nrows;
+	      ncycle = 1;
 	    }
 	  else
 	    {
@@ -296,129 +986,178 @@ char *argv[];
 	  if(verb>0) fprintf(stderr,"Will use %d cycles to process data\n",
 			     ncycle);
 
-	  ampsf = CALLOC(nevents, unsigned char);
-	  av1 = CALLOC(nevents, short);
-	  av2 = CALLOC(nevents, short);
-	  av3 = CALLOC(nevents, short);
-	  au1 = CALLOC(nevents, short);
-	  au2 = CALLOC(nevents, short);
-	  au3 = CALLOC(nevents, short);
-	  vstat = CALLOC(nevents, unsigned char);
+	  mapped = use_map
+	    && evt0_map_open(&map, infile, inname, CORRECT_COLS) == 0;
+	  if(verb>0) fprintf(stderr,"Reading %s\n",
+			     mapped ? "memory-mapped table" : "with cfitsio");
+	  patching = patch && mapped;
+	  if ( patching )
+	    evt0_patch_init(&pt, outfile, &map);
 
-	  if(verb>0) fprintf(stderr,"Internal buffers allocated\n");
-
-	  for( ii = 0; ii < ncycle; ii++ )
+	  if ( nthreads > 0 )
+	    {
+	      if(verb>0) fprintf(stderr,"Correcting with %d threads\n",
+				 nthreads);
+	      if ( correct_pipelined(infile, outfile, nrows, nevents, nthreads,
+				     mapped ? &map : 0, patching ? &pt : 0,
+				     &cc, &ndiff_u, &ndiff_v, st, &status) )
+		{
+		  if ( status > 0 )
+		    fits_report_error(stderr, status);
+		  else
+		    fprintf(stderr, "%s: could not start threads\n", progname);
+		  exit(1);
+		}
+	    }
+	  else
 	    {
-	      init_row = 1 + ii*nevents;
-	      if(verb>0) fprintf(stderr,"Cycle: %d - First Row:%d\n", (int)ii,
-				 (int)init_row);
-	      if( (init_row + nevents) >= nrows ) 
-		nevents = 1 + nrows - init_row;
-
-	      fits_get_colnum(infile, CASEINSEN, "AMP_SF", &colnum, 
-			      &status);
-	      fits_read_col(infile, TBYTE, colnum, init_row, 1, nevents, 
-			    bnull, ampsf, anynull, &status);
-
-	      fits_get_colnum(infile, CASEINSEN, "AV1", &colnum, &status);
-	      fits_read_col(infile, TSHORT, colnum, init_row, 1, nevents, 
-			    snull, av1, anynull, &status);
-	      fits_get_colnum(infile, CASEINSEN, "AV2", &colnum, &status);
-	      fits_read_col(infile, TSHORT, colnum, init_row, 1, nevents, 
-			    snull, av2, anynull, &status);
-	      fits_get_colnum(infile, CASEINSEN, "AV3", &colnum, &status);
-	      fits_read_col(infile, TSHORT, colnum, init_row, 1, nevents, 
-			    snull, av3, anynull, &status);
-
-	      fits_get_colnum(infile, CASEINSEN, "AU1", &colnum, &status);
-	      fits_read_col(infile, TSHORT, colnum, init_row, 1, nevents, 
-			    snull, au1, anynull, &status);
-	      fits_get_colnum(infile, CASEINSEN, "AU2", &colnum, &status);
-	      fits_read_col(infile, TSHORT, colnum, init_row, 1, nevents, 
-			    snull, au2, anynull, &status);
-	      fits_get_colnum(infile, CASEINSEN, "AU3", &colnum, &status);
-	      fits_read_col(infile, TSHORT, colnum, init_row, 1, nevents, 
-			    snull, au3, anynull, &status);
-
-	      fits_get_colnum(infile, CASEINSEN, "VETOSTT", &colnum, 
-			      &status);
-	      fits_read_col(infile, TBYTE, colnum, init_row, 1, nevents, 
-			    bnull, vstat, anynull, &status);
-
-	      if(verb>0) fprintf(stderr,"Correcting events\n");
-	      for( jj = 0; jj < nevents; jj++)
+	      if ( evt0_block_alloc(&blk, nevents) )
 		{
-		  if ( ampsf[jj] == 3 )
+		  fprintf(stderr, "%s: could not allocate buffers\n", progname);
+		  exit(1);
+		}
+	      if ( verify || st )
+		{
+		  orig_au3 = CALLOC(nevents, short);
+		  orig_av3 = CALLOC(nevents, short);
+		}
+
+	      if(verb>0) fprintf(stderr,"Internal buffers allocated\n");
+
+	      for( ii = 0; ii < ncycle; ii++ )
+		{
+		  init_row = 1 + ii*nevents;
+		  if(verb>0) fprintf(stderr,"Cycle: %d - First Row:%d\n", (int)ii,
+				     (int)init_row);
+		  if ( init_row > nrows )
+		    break;
+		  if( (init_row + nevents - 1) > nrows ) 
+		    nevents = 1 + nrows - init_row;
+
+		  blk.n = nevents;
+		  t = evt0_now();
+		  if ( mapped )
+		    evt0_map_read(&map, &blk, init_row);
+		  else
 		    {
-		      correct = 0;
-
-		      if ( (au1[jj] > au3[jj]) && (use_width == 0)
-			   && (au1[jj] > (uaxis_e * au2[jj] + uaxis_o)) )
-			correct = 1;
-		      if ( (au1[jj] > au3[jj]) && (use_width != 0)
-			   && ((vstat[jj] & 0x10) == 0) )
-			correct = 1;
-
-		      if ( correct == 1 )
-			{
-			  a1 = (double)au1[jj];
-			  a2 = (double)au2[jj];
-			  a3 = (double)au3[jj];
-			  phi = 0.0;
-			  if (au1[jj] > 0)
-			    phi = uaxis_f*(pow(a2/a1,uaxis_g) - 1.0);
-			  a3 = a3 - (a2 + uaxis_b)/uaxis_a
-			    * sin(2.*PI*(a2-phi)/(a2*uaxis_c + uaxis_d));
-			  au3[jj] = (short)(a3 + 0.5);
-			  if(au3[jj] < 0) au3[jj] = 0;
-			  if(au3[jj] > 4095) au3[jj] = 4095;
-			}
-
-		      correct = 0;
-
-		      if ( (av1[jj] > av3[jj]) && (use_width == 0)
-			   && (av1[jj] > (vaxis_e * av2[jj] + vaxis_o)) )
-			correct = 1;
-		      if ( (av1[jj] > av3[jj]) && (use_width != 0)
-				&& ((vstat[jj] & 0x20) == 0) )
-			correct = 1;
-
-		      if ( correct == 1 )
-			{
-			  a1 = (double)av1[jj];
-			  a2 = (double)av2[jj];
-			  a3 = (double)av3[jj];
-			  phi = 0.0;
-			  if (av1[jj] > 0)
-			    phi = vaxis_f*(pow(a2/a1,vaxis_g) - 1.0);
-			  a3 = a3 - (a2 + vaxis_b)/vaxis_a 
-			    * sin(2.*PI*(a2-phi)/(a2*vaxis_c + vaxis_d));
-			  av3[jj] = (short)(a3 + 0.5);
-			  if(av3[jj] < 0) av3[jj] = 0;
-			  if(av3[jj] > 4095) av3[jj] = 4095;
-			}
+		      fits_get_colnum(infile, CASEINSEN, "AMP_SF", &colnum, 
+				      &status);
+		      fits_read_col(infile, TBYTE, colnum, init_row, 1, nevents, 
+				    bnull, blk.amp_sf, anynull, &status);
+
+		      fits_get_colnum(infile, CASEINSEN, "AV1", &colnum, &status);
+		      fits_read_col(infile, TSHORT, colnum, init_row, 1, nevents, 
+				    snull, blk.av1, anynull, &status);
+		      fits_get_colnum(infile, CASEINSEN, "AV2", &colnum, &status);
+		      fits_read_col(infile, TSHORT, colnum, init_row, 1, nevents, 
+				    snull, blk.av2, anynull, &status);
+		      fits_get_colnum(infile, CASEINSEN, "AV3", &colnum, &status);
+		      fits_read_col(infile, TSHORT, colnum, init_row, 1, nevents, 
+				    snull, blk.av3, anynull, &status);
+
+		      fits_get_colnum(infile, CASEINSEN, "AU1", &colnum, &status);
+		      fits_read_col(infile, TSHORT, colnum, init_row, 1, nevents, 
+				    snull, blk.au1, anynull, &status);
+		      fits_get_colnum(infile, CASEINSEN, "AU2", &colnum, &status);
+		      fits_read_col(infile, TSHORT, colnum, init_row, 1, nevents, 
+				    snull, blk.au2, anynull, &status);
+		      fits_get_colnum(infile, CASEINSEN, "AU3", &colnum, &status);
+		      fits_read_col(infile, TSHORT, colnum, init_row, 1, nevents, 
+				    snull, blk.au3, anynull, &status);
+
+		      fits_get_colnum(infile, CASEINSEN, "VETOSTT", &colnum, 
+				      &status);
+		      fits_read_col(infile, TBYTE, colnum, init_row, 1, nevents, 
+				    bnull, blk.vstat, anynull, &status);
 		    }
-		}
 
-	      fits_get_colnum(infile, CASEINSEN, "AV3", &colnum, &status);
-	      fits_write_col(outfile, TSHORT, colnum, init_row, 1, 
-			     nevents, av3, &status);
-	      fits_get_colnum(infile, CASEINSEN, "AU3", &colnum, &status);
-	      fits_write_col(outfile, TSHORT, colnum, init_row, 1, 
-			     nevents, au3, &status);
+		  if ( st )
+		    st->t[EVT0_T_READ] += evt0_now() - t;
 
+		  if(verb>0) fprintf(stderr,"Correcting events\n");
+		  correct_block(&cc, &blk, orig_au3, orig_av3, &ndiff_u, &ndiff_v,
+				st);
+
+		  if ( st )
+		    t0 = evt0_now();
+
+		  fits_get_colnum(infile, CASEINSEN, "AV3", &colnum, &status);
+		  if ( patching )
+		    evt0_patch_col(&pt, EVT0_AV3, colnum, init_row, nevents,
+				   blk.av3, &status);
+		  else
+		    fits_write_col(outfile, TSHORT, colnum, init_row, 1, 
+				   nevents, blk.av3, &status);
+		  fits_get_colnum(infile, CASEINSEN, "AU3", &colnum, &status);
+		  if ( patching )
+		    evt0_patch_col(&pt, EVT0_AU3, colnum, init_row, nevents,
+				   blk.au3, &status);
+		  else
+		    fits_write_col(outfile, TSHORT, colnum, init_row, 1, 
+				   nevents, blk.au3, &status);
+		  if ( st )
+		    {
+		      st->t[EVT0_T_WRITE] += evt0_now() - t0;
+		      evt0_stats_chunk(st, nevents, evt0_now() - t);
+		    }
+		}
 	    }
+
+	  t = evt0_now();
+	  fits_write_date(outfile, &status);
+	  if ( patching )
+	    {
+	      if(verb>0) fprintf(stderr,"Patched %ld values in %ld runs\n",
+				 pt.ncells, pt.nruns);
+	      evt0_patch_finish(&pt, &status);
+	    }
+	  else
+	    fits_write_chksum(outfile, &status);
+	  if ( st )
+	    st->t[EVT0_T_CHECKSUM] += evt0_now() - t;
+	  if ( mapped )
+	    evt0_map_close(&map);
 	}
-      else
+      else if ( !patch )
 	{
+	  t = evt0_now();
 	  fits_copy_hdu(infile, outfile, 0, &status);
+	  if ( st )
+	    st->t[EVT0_T_HEADER] += evt0_now() - t;
+	  t = evt0_now();
+	  fits_write_date(outfile, &status);
+	  fits_write_chksum(outfile, &status);
+	  if ( st )
+	    st->t[EVT0_T_CHECKSUM] += evt0_now() - t;
 	}
-      fits_write_date(outfile, &status);
-      fits_write_chksum(outfile, &status);
     }
 
   fits_close_file(infile, &status);	    
   fits_close_file(outfile, &status);
 
+ done:
+  if ( use_lut )
+    {
+      tap_lut_close(&ulut);
+      tap_lut_close(&vlut);
+    }
+
+  t = evt0_now();
+  if ( ztab && evt0_ztab_file(outname + (*outname == '!'), zthreads) )
+    exit(1);
+  if ( st )
+    st->t[EVT0_T_WRITE] += evt0_now() - t;
+
+  if ( verify )
+    fprintf(stderr, "%s: %s differs from scalar in %ld AU3 and %ld AV3 values\n",
+	    progname, use_lut ? "table" : tap_isa_name(isa), ndiff_u, ndiff_v);
+
+  if ( st && evt0_stats_write(st, statsfile, progname, inname, outname,
+			      EVT0_STATS_TAPS) )
+    {
+      fprintf(stderr, "%s: cannot write %s\n", progname, statsfile);
+      exit(1);
+    }
+
   return 0;
 }
@@ -0,0 +1,462 @@
+/*
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+            hrc_evt0_fix
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+
+Single pass replacement for running fix_amp_sf_4 followed by
+hrc_evt0_correct. Each block of EVENTS rows is read once, AMP_SF is
+recomputed, AU3/AV3 of the ringing-affected events are corrected using
+the new AMP_SF, and the block is written once.
+
+The AMP_SF parameters are picked from DETNAM and DATE-OBS, and a file
+whose AMPSFCOR is true only has its ringing corrected, just as
+fix_amp_sf_4 would (see ampsf_select() in evt0_ampsf.c).
+
+Build:
+	cc -O2 -o hrc_evt0_fix hrc_evt0_fix.c evt0_kernels.c evt0_ampsf.c evt0_simd.c evt0_lut.c evt0_map.c -lcfitsio -lm
+
+*/
+
+/*** include files ***/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+
+#include "fitsio.h"
+
+#include "evt0_kernels.h"
+#include "evt0_map.h"
+
+void printerror(int status)
+{
+  /*****************************************************/
+  /* Print out cfitsio error messages and exit program */
+  /*****************************************************/
+
+  if (status)
+    fprintf(stderr, "\n*** Error occurred during program execution ***\n");
+  fits_report_error(stderr, status);
+  exit( status );
+}
+
+int print_usage(char *progname)
+{
+  fprintf(stderr,
+	  "\nUsage:\n\t%s [options] <HRC_L0_EVENTS> <HRC_L0_EVENTS>\n",
+	  progname);
+
+  fprintf(stderr,"\n  AMP_SF reassignment (as fix_amp_sf_4):\n");
+  fprintf(stderr,"\t--gain[%.1f]:\tgain for PHA to SUMAMPS\n", GAIN);
+  fprintf(stderr,"\t--thresh1[%d]:\tscale 1 threshold\n", THRESH1);
+  fprintf(stderr,"\t--thresh2[%d]:\tscale 2 threshold\n", THRESH2);
+  fprintf(stderr,"\t--thresh3[%d]:\tscale 3 threshold\n", THRESH3);
+  fprintf(stderr,"\t--pha1to2[%.1f]:\tPHA for scale 1 to 2 switch\n",
+	  PHA_1TO2);
+  fprintf(stderr,"\t--pha2to3[%.1f]:\tPHA for scale 2 to 3 switch\n",
+	  PHA_2TO3);
+  fprintf(stderr,"\t--width1[%.1f]:\t+/- band on PHA scale 1 to 2 switch\n",
+	  WIDTH1);
+  fprintf(stderr,"\t--width2[%.1f]:\t+/- band on PHA scale 2 to 3 switch\n",
+	  WIDTH2);
+  fprintf(stderr,"\t--defaults:\tuse the defaults, not the detector/epoch "
+	  "profile\n");
+  fprintf(stderr,"\t--force:\tcorrect even if AMPSFCOR says it's done\n");
+  fprintf(stderr,"\t--noampsf:\tkeep the telemetered AMP_SF\n");
+
+  fprintf(stderr,"\n  Ringing correction (as hrc_evt0_correct):\n");
+  fprintf(stderr,"\ta[%.3f] b[%.3f] c[%.3f] d[%.3f]:\tu-axis sinusoid\n",
+	  UAXIS_A, UAXIS_B, UAXIS_C, UAXIS_D);
+  fprintf(stderr,"\te[%.3f] o[%.3f]:\tAU1/AU2 limit slope and offset\n",
+	  UAXIS_E, UAXIS_O);
+  fprintf(stderr,"\tf[%.3f] g[%.3f]:\tAU1/AU2 phase shift amplitude and power\n",
+	  UAXIS_F, UAXIS_G);
+  fprintf(stderr,"\tA[%.3f] B[%.3f] C[%.3f] D[%.3f]:\tv-axis sinusoid\n",
+	  VAXIS_A, VAXIS_B, VAXIS_C, VAXIS_D);
+  fprintf(stderr,"\tE[%.3f] O[%.3f]:\tAV1/AV2 limit slope and offset\n",
+	  VAXIS_E, VAXIS_O);
+  fprintf(stderr,"\tF[%.3f] G[%.3f]:\tAV1/AV2 phase shift amplitude and power\n",
+	  VAXIS_F, VAXIS_G);
+  fprintf(stderr,"\tw:\tuse width-exceeded bits to ID events\n");
+  fprintf(stderr,"\tI[auto]:\twidest instruction set to use "
+	  "(scalar, avx2, avx512, auto)\n");
+  fprintf(stderr,"\tV:\tverify against the scalar code and report "
+	  "differing AU3/AV3\n");
+  fprintf(stderr,"\tT:\tcorrect by table lookup\n");
+  fprintf(stderr,"\tL dir:\tcache correction tables in dir (implies -T)\n");
+  fprintf(stderr,"\t--notaps:\tskip the ringing correction\n");
+
+  fprintf(stderr,"\n\t--nommap:\tread the input through cfitsio only\n");
+  fprintf(stderr,"\tv[0]:\tverbosity of diagnostic output\n");
+  fprintf(stderr,"\th or ?:\tprint usage\n");
+  return 0;
+}
+
+enum
+  {
+    OPT_GAIN = 256, OPT_THRESH1, OPT_THRESH2, OPT_THRESH3, OPT_PHA1TO2,
+    OPT_PHA2TO3, OPT_WIDTH1, OPT_WIDTH2, OPT_NOAMPSF, OPT_NOTAPS, OPT_NOMMAP,
+    OPT_DEFAULTS, OPT_FORCE
+  };
+
+static struct option long_options[] =
+  {
+    {"gain", required_argument, 0, OPT_GAIN},
+    {"thresh1", required_argument, 0, OPT_THRESH1},
+    {"thresh2", required_argument, 0, OPT_THRESH2},
+    {"thresh3", required_argument, 0, OPT_THRESH3},
+    {"pha1to2", required_argument, 0, OPT_PHA1TO2},
+    {"pha2to3", required_argument, 0, OPT_PHA2TO3},
+    {"width1", required_argument, 0, OPT_WIDTH1},
+    {"width2", required_argument, 0, OPT_WIDTH2},
+    {"noampsf", no_argument, 0, OPT_NOAMPSF},
+    {"notaps", no_argument, 0, OPT_NOTAPS},
+    {"nommap", no_argument, 0, OPT_NOMMAP},
+    {"defaults", no_argument, 0, OPT_DEFAULTS},
+    {"force", no_argument, 0, OPT_FORCE},
+    {"help", no_argument, 0, 'h'},
+    {0, 0, 0, 0}
+  };
+
+/*
+  Read the correction columns for rows [row, row+blk->n) of the
+  input EVENTS extension.
+*/
+static void read_block(fitsfile *infile, int *colnums, long row,
+		       evt0_block *blk, int *status)
+{
+  unsigned char bnull = 0;
+  short snull = 0;
+  int anynull;
+  long n = blk->n;
+
+  fits_read_col(infile, TBYTE, colnums[0], row, 1, n, &bnull, blk->amp_sf,
+		&anynull, status);
+  fits_read_col(infile, TBYTE, colnums[1], row, 1, n, &bnull, blk->pha,
+		&anynull, status);
+  fits_read_col(infile, TBYTE, colnums[2], row, 1, n, &bnull, blk->vstat,
+		&anynull, status);
+  fits_read_col(infile, TSHORT, colnums[3], row, 1, n, &snull, blk->au1,
+		&anynull, status);
+  fits_read_col(infile, TSHORT, colnums[4], row, 1, n, &snull, blk->au2,
+		&anynull, status);
+  fits_read_col(infile, TSHORT, colnums[5], row, 1, n, &snull, blk->au3,
+		&anynull, status);
+  fits_read_col(infile, TSHORT, colnums[6], row, 1, n, &snull, blk->av1,
+		&anynull, status);
+  fits_read_col(infile, TSHORT, colnums[7], row, 1, n, &snull, blk->av2,
+		&anynull, status);
+  fits_read_col(infile, TSHORT, colnums[8], row, 1, n, &snull, blk->av3,
+		&anynull, status);
+}
+
+static void write_block(fitsfile *outfile, int *colnums, long row,
+			evt0_block *blk, int *status)
+{
+  fits_write_col(outfile, TBYTE, colnums[0], row, 1, blk->n, blk->amp_sf,
+		 status);
+  fits_write_col(outfile, TSHORT, colnums[5], row, 1, blk->n, blk->au3,
+		 status);
+  fits_write_col(outfile, TSHORT, colnums[8], row, 1, blk->n, blk->av3,
+		 status);
+}
+
+/*============================================================*/
+int main(int argc, char *argv[])
+{
+  int c, k, verb = 0, kk, do_ampsf = 1, do_taps = 1;
+  int isa = TAP_ISA_AVX512, verify = 0, use_lut = 0;
+  int use_map = 1, mapped, ampsf_flags = 0;
+  char *lutdir = 0;
+  const char *ampsf_val[8] = { 0 };	/* overrides, as AMPSF_OPTS */
+  char detnam[FLEN_VALUE], date_obs[FLEN_VALUE], ampsfcor[FLEN_VALUE];
+  tap_lut ulut, vlut;
+  long ndiff_u = 0, ndiff_v = 0;
+  char *progname, *inname, *outname;
+  ampsf_params ap;
+  ampsf_lut alut;
+  tap_params tp;
+
+  /* ============== FITSIO variables ================== */
+
+  fitsfile *infile, *outfile;
+
+  int hdunum, hdutype, status = 0;
+  long nrows, numrows, rowlen, pcount, row;
+  char extname[FLEN_VALUE];
+
+  int colnums[EVT0_NCOLS];
+
+  evt0_block blk;
+  evt0_map map;
+  unsigned char *rowbuf;
+  short *orig_au3 = 0, *orig_av3 = 0;
+
+  tap_params_default(&tp);
+
+  progname = strrchr(argv[0], '/');
+  if(progname)
+    progname++;
+  else
+    progname = argv[0];
+
+  /* check for command line variables */
+  while ((c = getopt_long(argc, argv, "a:b:c:d:e:f:g:o:A:B:C:D:E:F:G:O:v:wI:VTL:h?",
+			  long_options, 0)) != EOF)
+    {
+      switch (c)
+        {
+        case 'a': tp.u.a = atof(optarg); break;
+        case 'b': tp.u.b = atof(optarg); break;
+        case 'c': tp.u.c = atof(optarg); break;
+        case 'd': tp.u.d = atof(optarg); break;
+        case 'e': tp.u.e = atof(optarg); break;
+        case 'f': tp.u.f = atof(optarg); break;
+        case 'g': tp.u.g = atof(optarg); break;
+        case 'o': tp.u.o = atof(optarg); break;
+        case 'A': tp.v.a = atof(optarg); break;
+        case 'B': tp.v.b = atof(optarg); break;
+        case 'C': tp.v.c = atof(optarg); break;
+        case 'D': tp.v.d = atof(optarg); break;
+        case 'E': tp.v.e = atof(optarg); break;
+        case 'F': tp.v.f = atof(optarg); break;
+        case 'G': tp.v.g = atof(optarg); break;
+        case 'O': tp.v.o = atof(optarg); break;
+        case 'w': tp.use_width = 1; break;
+        case 'v': verb = atoi(optarg); break;
+        case 'V': verify = 1; break;
+        case 'T': use_lut = 1; break;
+        case 'L': use_lut = 1; lutdir = optarg; break;
+        case 'I':
+	  if ( !strcmp(optarg, "scalar") )
+	    isa = TAP_ISA_SCALAR;
+	  else if ( !strcmp(optarg, "avx2") )
+	    isa = TAP_ISA_AVX2;
+	  else if ( !strcmp(optarg, "avx512") || !strcmp(optarg, "auto") )
+	    isa = TAP_ISA_AVX512;
+	  else
+	    {
+	      fprintf(stderr, "%s: unknown instruction set '%s'\n", progname,
+		      optarg);
+	      exit(1);
+	    }
+	  break;
+        case OPT_GAIN: case OPT_THRESH1: case OPT_THRESH2: case OPT_THRESH3:
+        case OPT_PHA1TO2: case OPT_PHA2TO3: case OPT_WIDTH1: case OPT_WIDTH2:
+	  ampsf_val[c - OPT_GAIN] = optarg;
+	  break;
+        case OPT_DEFAULTS: ampsf_flags |= AMPSF_NOPROF; break;
+        case OPT_FORCE: ampsf_flags |= AMPSF_FORCE; break;
+        case OPT_NOAMPSF: do_ampsf = 0; break;
+        case OPT_NOTAPS: do_taps = 0; break;
+        case OPT_NOMMAP: use_map = 0; break;
+        case 'h':
+        case '?':
+	  print_usage(progname);
+	  exit(0);
+        }
+    }
+
+  if( argc - optind != 2 )
+    {
+      print_usage(progname);
+      exit(1);
+    }
+
+  inname = argv[optind];
+  outname = argv[optind+1];
+
+  isa = tap_isa_select(isa);
+  if ( use_lut && do_taps )
+    {
+      if ( tap_lut_open(&ulut, &tp.u, lutdir)
+	   || tap_lut_open(&vlut, &tp.v, lutdir) )
+	{
+	  fprintf(stderr, "%s: could not make correction tables\n", progname);
+	  exit(1);
+	}
+    }
+  else if(verb > 0)
+    fprintf(stderr, "Correction uses %s instructions\n", tap_isa_name(isa));
+
+  if(verb > 0) fprintf(stderr, "\nInput file:  %s\n", inname);
+  if (fits_open_file(&infile, inname, READONLY, &status))
+    printerror( status );
+  if (fits_get_num_hdus(infile, &hdunum, &status))
+    printerror( status );
+
+  /* the AMP_SF parameters from the EVENTS header, as fix_amp_sf_4 */
+  if ( do_ampsf )
+    {
+      fits_write_errmark();
+      if ( fits_movnam_hdu(infile, BINARY_TBL, "EVENTS", 0, &status) )
+	*detnam = *date_obs = *ampsfcor = 0;
+      else
+	evt0_profile_keys(infile, detnam, date_obs, ampsfcor);
+      status = 0;
+      fits_clear_errmark();
+      if (fits_movabs_hdu(infile, 1, &hdutype, &status))
+	printerror( status );
+
+      k = ampsf_select(detnam, date_obs, ampsfcor, ampsf_flags, &ap);
+      if ( k < 0 )
+	{
+	  fprintf(stderr, "%s: %s: no AMP_SF parameters for DETNAM='%s' "
+		  "DATE-OBS='%s'\n\t(--defaults uses the defaults)\n",
+		  progname, inname, detnam, date_obs);
+	  exit(1);
+	}
+      if ( k > 0 )
+	{
+	  fprintf(stderr, "%s: %s: AMP_SF is corrected already (AMPSFCOR), "
+		  "only the ringing is corrected\n", progname, inname);
+	  do_ampsf = 0;
+	}
+      for ( k = 0; k < 8; k++ )
+	if ( ampsf_val[k] )
+	  ampsf_option(&ap, AMPSF_OPTS[k], ampsf_val[k]);
+      ampsf_lut_init(&alut, &ap);
+    }
+
+  if(verb > 0) fprintf(stderr, "Output file: %s\n", outname);
+  if (fits_create_file(&outfile, outname, &status))
+    printerror( status );
+
+  /* Copy primary HDU from input to output file */
+  if (fits_copy_hdu(infile, outfile, 0, &status))
+    printerror( status );
+  fits_write_date(outfile, &status);
+  fits_write_chksum(outfile, &status);
+
+  for ( kk = 2; kk < hdunum+1; kk++ )
+    {
+      if (fits_movabs_hdu(infile, kk, &hdutype, &status))
+	printerror( status );
+
+      if (fits_read_key(infile, TSTRING, "EXTNAME", extname, NULL, &status))
+	printerror( status );
+      if(verb > 0) fprintf(stderr, "Extension %d: %s\n", kk-1, extname);
+
+      if ( strcmp(extname, "EVENTS") )
+	{
+	  if (fits_copy_hdu(infile, outfile, 0, &status))
+	    printerror( status );
+	}
+      else
+	{
+	  fits_get_num_rows(infile, &nrows, &status);
+	  fits_read_key(infile, TLONG, "NAXIS1", &rowlen, NULL, &status);
+	  fits_read_key(infile, TLONG, "PCOUNT", &pcount, NULL, &status);
+	  for ( c = 0; c < 9; c++ )
+	    fits_get_colnum(infile, CASEINSEN, evt0_colnames[c], &colnums[c],
+			    &status);
+	  fits_get_rowsize(infile, &numrows, &status);
+	  if (status)
+	    printerror( status );
+
+	  if(verb > 0) fprintf(stderr,"%ld rows, %ld per block\n",
+			       nrows, numrows);
+
+	  mapped = use_map && evt0_map_open(&map, infile, inname, EVT0_ALL) == 0;
+	  if(verb > 0) fprintf(stderr,"Reading %s\n",
+			       mapped ? "memory-mapped table" : "with cfitsio");
+
+	  /*
+	    Only the header is copied; the data unit is streamed through
+	    a row buffer. A heap would have to be copied separately, so
+	    tables with one fall back to copying the whole HDU first.
+	  */
+	  if (pcount == 0)
+	    fits_copy_header(infile, outfile, &status);
+	  else
+	    fits_copy_hdu(infile, outfile, 0, &status);
+	  if (status)
+	    printerror( status );
+
+	  if ( verify )
+	    {
+	      orig_au3 = CALLOC(numrows, short);
+	      orig_av3 = CALLOC(numrows, short);
+	    }
+	  if ( evt0_block_alloc(&blk, numrows)
+	       || !(rowbuf = CALLOC(numrows*rowlen, unsigned char))
+	       || (verify && (!orig_au3 || !orig_av3)) )
+	    {
+	      fprintf(stderr, "%s: could not allocate buffers\n", progname);
+	      exit(1);
+	    }
+
+	  for ( row = 1; row <= nrows; row += numrows )
+	    {
+	      blk.n = (row + numrows <= nrows) ? numrows : 1 + nrows - row;
+	      if(verb > 1) fprintf(stderr,"First Row: %ld\n", row);
+
+	      if (pcount == 0 && mapped)
+		fits_write_tblbytes(outfile, row, 1, blk.n*rowlen,
+				    (unsigned char *)evt0_map_rows(&map, row),
+				    &status);
+	      else if (pcount == 0)
+		{
+		  fits_read_tblbytes(infile, row, 1, blk.n*rowlen, rowbuf,
+				     &status);
+		  fits_write_tblbytes(outfile, row, 1, blk.n*rowlen, rowbuf,
+				      &status);
+		}
+	      if (mapped)
+		evt0_map_read(&map, &blk, row);
+	      else
+		read_block(infile, colnums, row, &blk, &status);
+	      if (status)
+		printerror( status );
+
+	      if (do_ampsf) fix_amp_sf_lut(&blk, &alut, isa);
+	      if (do_taps)
+		{
+		  if ( verify )
+		    {
+		      memcpy(orig_au3, blk.au3, blk.n*sizeof(short));
+		      memcpy(orig_av3, blk.av3, blk.n*sizeof(short));
+		    }
+		  if ( use_lut )
+		    correct_taps_lut(&blk, &tp, &ulut, &vlut);
+		  else
+		    correct_taps_isa(&blk, &tp, isa);
+		  if ( verify )
+		    tap_verify(&blk, orig_au3, orig_av3, &tp, &ndiff_u,
+			       &ndiff_v);
+		}
+
+	      write_block(outfile, colnums, row, &blk, &status);
+	      if (status)
+		printerror( status );
+	    }
+
+	  if (mapped)
+	    evt0_map_close(&map);
+	  evt0_block_free(&blk);
+	  free(rowbuf);
+	  free(orig_au3);
+	  free(orig_av3);
+	}
+
+      fits_write_date(outfile, &status);
+      fits_write_chksum(outfile, &status);
+      if (status)
+	printerror( status );
+    }
+
+  if ( fits_close_file(infile, &status) ) printerror( status );
+  if ( fits_close_file(outfile, &status) ) printerror( status );
+
+  if ( use_lut && do_taps )
+    {
+      tap_lut_close(&ulut);
+      tap_lut_close(&vlut);
+    }
+
+  if ( verify )
+    fprintf(stderr, "%s: %s differs from scalar in %ld AU3 and %ld AV3 values\n",
+	    progname, use_lut ? "table" : tap_isa_name(isa), ndiff_u, ndiff_v);
+
+  return 0;
+}
@@ -0,0 +1,776 @@
+/*
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+                 hrc_evt0_sweep
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+
+Calibration sweep of the ringing correction coefficients of
+correction.h. The AMP_SF = 3 events of an evt0 file are read once,
+and each of a list or grid of coefficient sets is applied to them in
+memory, with the same correction hrc_evt0_correct does (see
+evt0_simd.c), on several threads. No event file is written; instead
+each set gets a line of an RDB table, best first:
+
+	ripple_u, ripple_v	what is left of the ringing: the RMS, in
+				channels, of the mean corrected tap 3 in
+				bins of tap 2 about a quadratic in tap 2
+	corr_u, corr_v		fraction of the events corrected
+	clamp_u, clamp_v	fraction of those whose tap 3 ended up
+				clamped to 0 or 4095
+
+The sets are ranked by ripple_u + ripple_v; a comment at the top of
+the table gives the ripple of the uncorrected taps.
+
+Sets are read from a list file, one per line as 'key=value ...' with
+the coefficient letters of hrc_evt0_correct (-a to -O, and w=1 for
+-w) as keys; what a line doesn't give keeps its correction.h value.
+Each -s key=lo:hi:n then multiplies the sets with n values of one
+coefficient from lo to hi, e.g.
+
+	hrc_evt0_sweep -i evt0.fits -s c=0.22:0.26:9 -s d=950:1010:13 -j 16
+
+tries 117 sets of the U axis coefficients c and d.
+
+Build:
+	cc -O2 -pthread -o hrc_evt0_sweep hrc_evt0_sweep.c evt0_kernels.c evt0_simd.c evt0_map.c evt0_stats.c -lcfitsio -lm
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "fitsio.h"
+
+#include "evt0_kernels.h"
+#include "evt0_map.h"
+#include "evt0_stats.h"
+
+/* rows read, and events corrected, at a time */
+#define SWEEP_ROWS 65536
+
+/* fewest events for a tap 2 bin to count in the ripple */
+#define MIN_BIN 10
+
+#define MAX_AXES 16
+
+/* the columns the correction reads */
+#define SWEEP_COLS (EVT0_AMP_SF | EVT0_VSTAT | EVT0_AU1 | EVT0_AU2 \
+		    | EVT0_AU3 | EVT0_AV1 | EVT0_AV2 | EVT0_AV3)
+
+/* one coefficient set and how it did */
+typedef struct
+{
+  tap_params tp;
+  double ripple[2], corr[2], clamp[2];
+} sweep_set;
+
+/* the AMP_SF = 3 events, and their number in each tap 2 bin */
+typedef struct
+{
+  evt0_block ev;
+  long cap;
+  int binw, nbins;
+  long *count[2];
+} sweep_data;
+
+/* the sets, handed out to the threads one at a time */
+typedef struct
+{
+  const sweep_data *d;
+  sweep_set *sets;
+  int nsets, next, isa;
+  pthread_mutex_t lock;
+} sweep_run;
+
+/* one grid axis: n values of coefficient key from lo to hi */
+typedef struct
+{
+  int key;
+  double lo, hi;
+  int n;
+} sweep_axis;
+
+static char *progname;
+
+/* set the coefficient of option letter key; -1 if there is none */
+static int set_coeff(tap_params *tp, int key, double x)
+{
+  switch ( key )
+    {
+    case 'a': tp->u.a = x; break;
+    case 'b': tp->u.b = x; break;
+    case 'c': tp->u.c = x; break;
+    case 'd': tp->u.d = x; break;
+    case 'e': tp->u.e = x; break;
+    case 'f': tp->u.f = x; break;
+    case 'g': tp->u.g = x; break;
+    case 'o': tp->u.o = x; break;
+    case 'A': tp->v.a = x; break;
+    case 'B': tp->v.b = x; break;
+    case 'C': tp->v.c = x; break;
+    case 'D': tp->v.d = x; break;
+    case 'E': tp->v.e = x; break;
+    case 'F': tp->v.f = x; break;
+    case 'G': tp->v.g = x; break;
+    case 'O': tp->v.o = x; break;
+    case 'w': tp->use_width = x != 0; break;
+    default: return -1;
+    }
+  return 0;
+}
+
+/*
+  Make room for cap events in the columns of d. Each column is stored
+  back as soon as it is reallocated, so that on failure d->ev still
+  holds live buffers (some of them already grown) and d->cap what they
+  all have room for.
+*/
+static int grow(sweep_data *d, long cap)
+{
+  evt0_block *b = &d->ev;
+  unsigned char **bytes[2] = { &b->amp_sf, &b->vstat };
+  short **shorts[6] =
+    { &b->au1, &b->au2, &b->au3, &b->av1, &b->av2, &b->av3 };
+  void *q;
+  int k;
+
+  for ( k = 0; k < 2; k++ )
+    {
+      if ( !(q = realloc(*bytes[k], cap)) )
+	return -1;
+      *bytes[k] = q;
+    }
+  for ( k = 0; k < 6; k++ )
+    {
+      if ( !(q = realloc(*shorts[k], cap*sizeof(short))) )
+	return -1;
+      *shorts[k] = q;
+    }
+  d->cap = cap;
+  return 0;
+}
+
+/*
+  Read the AMP_SF = 3 events of the EVENTS table of filename into d,
+  memory-mapped if it can be. Returns 0, or -1 after saying why not.
+*/
+static int sweep_load(const char *filename, sweep_data *d)
+{
+  fitsfile *fptr;
+  evt0_map map;
+  evt0_block blk;
+  long nrows, row, j, m;
+  int colnums[EVT0_NCOLS], k, mapped, status = 0, anynull;
+  short snull = 0;
+  unsigned char bnull = 0;
+
+  memset(&d->ev, 0, sizeof(d->ev));
+  d->cap = 0;
+  if ( fits_open_file(&fptr, filename, READONLY, &status)
+       || fits_movnam_hdu(fptr, BINARY_TBL, "EVENTS", 0, &status)
+       || fits_get_num_rows(fptr, &nrows, &status) )
+    {
+      fits_report_error(stderr, status);
+      return -1;
+    }
+  for ( k = 0; k < EVT0_NCOLS; k++ )
+    if ( SWEEP_COLS & (1u << k) )
+      fits_get_colnum(fptr, CASEINSEN, evt0_colnames[k], &colnums[k],
+		      &status);
+  if ( status || evt0_block_alloc(&blk, SWEEP_ROWS) )
+    {
+      if ( status )
+	fits_report_error(stderr, status);
+      else
+	fprintf(stderr, "%s: out of memory\n", progname);
+      fits_close_file(fptr, &status);
+      return -1;
+    }
+  mapped = evt0_map_open(&map, fptr, filename, SWEEP_COLS) == 0;
+
+  for ( row = 1; row <= nrows && !status; row += blk.n )
+    {
+      blk.n = nrows - row + 1 < SWEEP_ROWS ? nrows - row + 1 : SWEEP_ROWS;
+      if ( mapped )
+	evt0_map_read(&map, &blk, row);
+      else
+	for ( k = 0; k < EVT0_NCOLS; k++ )
+	  if ( SWEEP_COLS & (1u << k) )
+	    fits_read_col(fptr, k < 3 ? TBYTE : TSHORT, colnums[k], row, 1,
+			  blk.n, k < 3 ? (void *)&bnull : (void *)&snull,
+			  evt0_block_col(&blk, k), &anynull, &status);
+
+      if ( d->ev.n + blk.n > d->cap
+	   && grow(d, d->cap ? 2*d->cap : SWEEP_ROWS) )
+	{
+	  fprintf(stderr, "%s: out of memory\n", progname);
+	  status = -1;
+	  break;
+	}
+      for ( j = 0, m = d->ev.n; j < blk.n; j++ )
+	if ( blk.amp_sf[j] == 3 )
+	  {
+	    d->ev.amp_sf[m] = 3;
+	    d->ev.vstat[m] = blk.vstat[j];
+	    d->ev.au1[m] = blk.au1[j];
+	    d->ev.au2[m] = blk.au2[j];
+	    d->ev.au3[m] = blk.au3[j];
+	    d->ev.av1[m] = blk.av1[j];
+	    d->ev.av2[m] = blk.av2[j];
+	    d->ev.av3[m] = blk.av3[j];
+	    m++;
+	  }
+      d->ev.n = m;
+    }
+
+  if ( mapped )
+    evt0_map_close(&map);
+  evt0_block_free(&blk);
+  if ( status > 0 )
+    fits_report_error(stderr, status);
+  k = status;
+  status = 0;
+  fits_close_file(fptr, &status);
+  return k ? -1 : 0;
+}
+
+static int tap_bin(const sweep_data *d, short t2)
+{
+  int i = t2 / d->binw;
+
+  return i < 0 ? 0 : i >= d->nbins ? d->nbins - 1 : i;
+}
+
+/* count the events in each tap 2 bin, for each axis */
+static int sweep_bins(sweep_data *d)
+{
+  long j;
+
+  d->nbins = (4095 + d->binw) / d->binw;
+  d->count[0] = CALLOC(d->nbins, long);
+  d->count[1] = CALLOC(d->nbins, long);
+  if ( !d->count[0] || !d->count[1] )
+    return -1;
+  for ( j = 0; j < d->ev.n; j++ )
+    {
+      d->count[0][tap_bin(d, d->ev.au2[j])]++;
+      d->count[1][tap_bin(d, d->ev.av2[j])]++;
+    }
+  return 0;
+}
+
+/* solve the 3x3 system m x = y in place; -1 if it is singular */
+static int solve3(double m[3][3], double y[3], double x[3])
+{
+  double f, t;
+  int i, j, k, p;
+
+  for ( i = 0; i < 3; i++ )
+    {
+      for ( p = i, k = i + 1; k < 3; k++ )
+	if ( fabs(m[k][i]) > fabs(m[p][i]) )
+	  p = k;
+      if ( m[p][i] == 0.0 )
+	return -1;
+      for ( j = 0; j < 3; j++ )
+	{
+	  t = m[i][j]; m[i][j] = m[p][j]; m[p][j] = t;
+	}
+      t = y[i]; y[i] = y[p]; y[p] = t;
+      for ( k = i + 1; k < 3; k++ )
+	{
+	  f = m[k][i] / m[i][i];
+	  for ( j = i; j < 3; j++ )
+	    m[k][j] -= f*m[i][j];
+	  y[k] -= f*y[i];
+	}
+    }
+  for ( i = 2; i >= 0; i-- )
+    {
+      for ( t = y[i], j = i + 1; j < 3; j++ )
+	t -= m[i][j]*x[j];
+      x[i] = t / m[i][i];
+    }
+  return 0;
+}
+
+/*
+  The RMS, weighted by events, of the mean tap 3 in each tap 2 bin
+  (sum/count) about a weighted quadratic fit to the means. Bins with
+  fewer than MIN_BIN events are left out.
+*/
+static double ripple(const sweep_data *d, const double *sum,
+		     const long *count)
+{
+  double m[3][3], y[3], c[3], x, w, r, mean, sw = 0.0, s2 = 0.0;
+  int i, j, k;
+
+  memset(m, 0, sizeof(m));
+  memset(y, 0, sizeof(y));
+  for ( i = 0; i < d->nbins; i++ )
+    {
+      if ( count[i] < MIN_BIN )
+	continue;
+      /* tap 2 scaled to about 0-1, to keep the system well conditioned */
+      x = (i + 0.5)*d->binw / 4096.0;
+      w = count[i];
+      mean = sum[i] / w;
+      for ( j = 0; j < 3; j++ )
+	{
+	  for ( k = 0; k < 3; k++ )
+	    m[j][k] += w*pow(x, j + k);
+	  y[j] += w*mean*pow(x, j);
+	}
+    }
+  if ( solve3(m, y, c) )
+    return 0.0;
+
+  for ( i = 0; i < d->nbins; i++ )
+    {
+      if ( count[i] < MIN_BIN )
+	continue;
+      x = (i + 0.5)*d->binw / 4096.0;
+      r = sum[i]/count[i] - (c[0] + c[1]*x + c[2]*x*x);
+      sw += count[i];
+      s2 += count[i]*r*r;
+    }
+  return sw > 0.0 ? sqrt(s2/sw) : 0.0;
+}
+
+/*
+  Correct a copy of the taps with the coefficients of s, a SWEEP_ROWS
+  chunk at a time in au3/av3, and fill in the figures of merit. sum
+  has room for both axes' bins.
+*/
+static void sweep_eval(const sweep_data *d, sweep_set *s, int isa,
+		       short *au3, short *av3, double *sum)
+{
+  evt0_block b;
+  long off, j, ncorr[2] = { 0, 0 }, nclamp[2] = { 0, 0 };
+  double *usum = sum, *vsum = sum + d->nbins;
+  int k;
+
+  memset(sum, 0, 2*d->nbins*sizeof(double));
+  for ( off = 0; off < d->ev.n; off += b.n )
+    {
+      b = d->ev;
+      b.n = d->ev.n - off < SWEEP_ROWS ? d->ev.n - off : SWEEP_ROWS;
+      b.amp_sf += off;
+      b.vstat += off;
+      b.au1 += off;
+      b.au2 += off;
+      b.av1 += off;
+      b.av2 += off;
+      b.au3 = au3;
+      b.av3 = av3;
+      memcpy(au3, d->ev.au3 + off, b.n*sizeof(short));
+      memcpy(av3, d->ev.av3 + off, b.n*sizeof(short));
+      correct_taps_isa(&b, &s->tp, isa);
+
+      for ( j = 0; j < b.n; j++ )
+	{
+	  if ( au3[j] != d->ev.au3[off + j] )
+	    {
+	      ncorr[0]++;
+	      nclamp[0] += au3[j] == 0 || au3[j] == 4095;
+	    }
+	  if ( av3[j] != d->ev.av3[off + j] )
+	    {
+	      ncorr[1]++;
+	      nclamp[1] += av3[j] == 0 || av3[j] == 4095;
+	    }
+	  usum[tap_bin(d, b.au2[j])] += au3[j];
+	  vsum[tap_bin(d, b.av2[j])] += av3[j];
+	}
+    }
+
+  for ( k = 0; k < 2; k++ )
+    {
+      s->ripple[k] = ripple(d, sum + k*d->nbins, d->count[k]);
+      s->corr[k] = d->ev.n ? (double)ncorr[k]/d->ev.n : 0.0;
+      s->clamp[k] = ncorr[k] ? (double)nclamp[k]/ncorr[k] : 0.0;
+    }
+}
+
+static void *sweep_thread(void *arg)
+{
+  sweep_run *r = arg;
+  short *au3 = CALLOC(SWEEP_ROWS, short), *av3 = CALLOC(SWEEP_ROWS, short);
+  double *sum = CALLOC(2*r->d->nbins, double);
+  int i;
+
+  if ( !au3 || !av3 || !sum )
+    {
+      free(au3);
+      free(av3);
+      free(sum);
+      return r;
+    }
+  for ( ;; )
+    {
+      pthread_mutex_lock(&r->lock);
+      i = r->next++;
+      pthread_mutex_unlock(&r->lock);
+      if ( i >= r->nsets )
+	break;
+      sweep_eval(r->d, &r->sets[i], r->isa, au3, av3, sum);
+    }
+  free(au3);
+  free(av3);
+  free(sum);
+  return 0;
+}
+
+/* evaluate all the sets on nthreads threads; -1 if any failed */
+static int sweep_all(sweep_run *r, int nthreads)
+{
+  pthread_t *tid = CALLOC(nthreads, pthread_t);
+  void *ret;
+  int i, n, fail = 0;
+
+  if ( !tid )
+    return -1;
+  pthread_mutex_init(&r->lock, 0);
+  r->next = 0;
+  for ( n = 0; n < nthreads; n++ )
+    if ( pthread_create(&tid[n], 0, sweep_thread, r) )
+      break;
+  if ( n == 0 )
+    fail = 1;
+  for ( i = 0; i < n; i++ )
+    {
+      pthread_join(tid[i], &ret);
+      fail |= ret != 0;
+    }
+  pthread_mutex_destroy(&r->lock);
+  free(tid);
+  return fail || r->next < r->nsets ? -1 : 0;
+}
+
+static int by_score(const void *a, const void *b)
+{
+  const sweep_set *x = a, *y = b;
+  double sx = x->ripple[0] + x->ripple[1], sy = y->ripple[0] + y->ripple[1];
+
+  if ( sx != sy )
+    return sx < sy ? -1 : 1;
+  sx = x->clamp[0] + x->clamp[1];
+  sy = y->clamp[0] + y->clamp[1];
+  return sx < sy ? -1 : sx > sy;
+}
+
+/*
+  Read the sets of a list file, each starting from base. Returns the
+  number of sets, or -1 after saying what was wrong.
+*/
+static int read_list(const char *filename, const tap_params *base,
+		     sweep_set **sets)
+{
+  FILE *fp;
+  char line[1024], *tok, *save;
+  sweep_set *s = 0, *t;
+  int n = 0, cap = 0, lineno = 0;
+
+  if ( !(fp = fopen(filename, "r")) )
+    {
+      perror(filename);
+      return -1;
+    }
+  while ( fgets(line, sizeof(line), fp) )
+    {
+      lineno++;
+      if ( (tok = strchr(line, '#')) )
+	*tok = 0;
+      if ( !(tok = strtok_r(line, " \t\n", &save)) )
+	continue;
+      if ( n == cap )
+	{
+	  cap = cap ? 2*cap : 64;
+	  if ( !(t = realloc(s, cap*sizeof(*s))) )
+	    {
+	      fprintf(stderr, "%s: out of memory\n", progname);
+	      goto fail;
+	    }
+	  s = t;
+	}
+      memset(&s[n], 0, sizeof(*s));
+      s[n].tp = *base;
+      for ( ; tok; tok = strtok_r(0, " \t\n", &save) )
+	if ( tok[1] != '=' || set_coeff(&s[n].tp, tok[0], atof(tok + 2)) )
+	  {
+	    fprintf(stderr, "%s: %s:%d: bad coefficient '%s'\n", progname,
+		    filename, lineno, tok);
+	    goto fail;
+	  }
+      n++;
+    }
+  fclose(fp);
+  *sets = s;
+  return n;
+
+ fail:
+  fclose(fp);
+  free(s);
+  return -1;
+}
+
+/* multiply the nsets sets by the values of axis x; the new number */
+static int apply_axis(sweep_set **sets, int nsets, const sweep_axis *x)
+{
+  sweep_set *s;
+  int i, k;
+
+  if ( !(s = CALLOC((size_t)nsets*x->n, sweep_set)) )
+    return -1;
+  for ( i = 0; i < nsets; i++ )
+    for ( k = 0; k < x->n; k++ )
+      {
+	s[i*x->n + k] = (*sets)[i];
+	set_coeff(&s[i*x->n + k].tp, x->key,
+		  x->n > 1 ? x->lo + k*(x->hi - x->lo)/(x->n - 1) : x->lo);
+      }
+  free(*sets);
+  *sets = s;
+  return nsets*x->n;
+}
+
+static void write_table(FILE *fp, const sweep_data *d, const double *ripple0,
+			const sweep_set *s, int nsets)
+{
+  static const char *cols[] =
+    { "rank", "score", "ripple_u", "ripple_v", "corr_u", "corr_v",
+      "clamp_u", "clamp_v", "ua", "ub", "uc", "ud", "ue", "uf", "ug", "uo",
+      "va", "vb", "vc", "vd", "ve", "vf", "vg", "vo", "w" };
+  const int ncols = sizeof(cols)/sizeof(cols[0]);
+  const tap_coeffs *c[2];
+  int i, k;
+
+  fprintf(fp, "# %ld AMP_SF = 3 events, tap 2 bins of %d\n", d->ev.n,
+	  d->binw);
+  fprintf(fp, "# uncorrected: ripple_u %.4f ripple_v %.4f\n", ripple0[0],
+	  ripple0[1]);
+  for ( k = 0; k < ncols; k++ )
+    fprintf(fp, "%s%c", cols[k], k < ncols - 1 ? '\t' : '\n');
+  for ( k = 0; k < ncols; k++ )
+    fprintf(fp, "N%c", k < ncols - 1 ? '\t' : '\n');
+
+  for ( i = 0; i < nsets; i++ )
+    {
+      c[0] = &s[i].tp.u;
+      c[1] = &s[i].tp.v;
+      fprintf(fp, "%d\t%.4f\t%.4f\t%.4f\t%.6f\t%.6f\t%.6f\t%.6f", i + 1,
+	      s[i].ripple[0] + s[i].ripple[1], s[i].ripple[0], s[i].ripple[1],
+	      s[i].corr[0], s[i].corr[1], s[i].clamp[0], s[i].clamp[1]);
+      for ( k = 0; k < 2; k++ )
+	fprintf(fp, "\t%g\t%g\t%g\t%g\t%g\t%g\t%g\t%g", c[k]->a, c[k]->b,
+		c[k]->c, c[k]->d, c[k]->e, c[k]->f, c[k]->g, c[k]->o);
+      fprintf(fp, "\t%d\n", s[i].tp.use_width);
+    }
+}
+
+static void print_usage(void)
+{
+  fprintf(stderr,"\nUsage: %s -i infile -[lswbnoIjvh]", progname);
+  fprintf(stderr,"\n\t-i infile:\tinput evt0.fits file");
+  fprintf(stderr,"\n\tl file:\tcoefficient sets, one 'key=value ...' per "
+	  "line,");
+  fprintf(stderr,"\n\t\twith the letters of hrc_evt0_correct as keys");
+  fprintf(stderr,"\n\ts key=lo:hi:n:\ttry n values of a coefficient; "
+	  "may be repeated");
+  fprintf(stderr,"\n\tw:\tselect events by VETOSTT width bits in every set");
+  fprintf(stderr,"\n\tb[32]:\twidth of the tap 2 bins for the ripple");
+  fprintf(stderr,"\n\tn[all]:\tnumber of best sets to write");
+  fprintf(stderr,"\n\to[stdout]:\toutput RDB table");
+  fprintf(stderr,"\n\tI[auto]:\tinstruction set: scalar, avx2, avx512 or "
+	  "auto");
+  fprintf(stderr,"\n\tj[all CPUs]:\tthreads");
+  fprintf(stderr,"\n\tv[0]:\tverbosity level");
+  fprintf(stderr,"\n\th or ?:\tprint usage\n");
+}
+
+int main(int argc, char *argv[])
+{
+  char *inname = 0, *outname = 0, *listname = 0;
+  sweep_axis axes[MAX_AXES];
+  int naxes = 0, nthreads = 0, nbest = 0, verb = 0, use_width = 0;
+  int isa = TAP_ISA_AVX512, nsets, c, i, k;
+  tap_params base, chk;
+  sweep_data d;
+  sweep_set *sets;
+  sweep_run r;
+  double ripple0[2], *sum, t;
+  FILE *fp;
+
+  progname = strrchr(argv[0], '/');
+  if(progname)
+    progname++;
+  else
+    progname = argv[0];
+
+  d.binw = 32;
+  while ((c = getopt(argc, argv, "i:l:s:wb:n:o:I:j:v:h?")) != EOF)
+    {
+      switch (c)
+	{
+	case 'i':
+	  inname = optarg;
+	  break;
+	case 'l':
+	  listname = optarg;
+	  break;
+	case 's':
+	  if ( naxes == MAX_AXES )
+	    {
+	      fprintf(stderr, "%s: at most %d -s\n", progname, MAX_AXES);
+	      exit(1);
+	    }
+	  axes[naxes].key = optarg[0];
+	  if ( optarg[1] != '='
+	       || sscanf(optarg + 2, "%lf:%lf:%d", &axes[naxes].lo,
+			 &axes[naxes].hi, &axes[naxes].n) != 3
+	       || axes[naxes].n < 1
+	       || set_coeff(&chk, axes[naxes].key, 0.0) )
+	    {
+	      fprintf(stderr, "%s: bad -s %s, want key=lo:hi:n\n", progname,
+		      optarg);
+	      exit(1);
+	    }
+	  naxes++;
+	  break;
+	case 'w':
+	  use_width = 1;
+	  break;
+	case 'b':
+	  d.binw = atoi(optarg);
+	  break;
+	case 'n':
+	  nbest = atoi(optarg);
+	  break;
+	case 'o':
+	  outname = optarg;
+	  break;
+	case 'I':
+	  if ( !strcmp(optarg, "scalar") )
+	    isa = TAP_ISA_SCALAR;
+	  else if ( !strcmp(optarg, "avx2") )
+	    isa = TAP_ISA_AVX2;
+	  else if ( !strcmp(optarg, "avx512") || !strcmp(optarg, "auto") )
+	    isa = TAP_ISA_AVX512;
+	  else
+	    {
+	      fprintf(stderr, "%s: unknown instruction set '%s'\n", progname,
+		      optarg);
+	      exit(1);
+	    }
+	  break;
+	case 'j':
+	  nthreads = atoi(optarg);
+	  break;
+	case 'v':
+	  verb = atoi(optarg);
+	  break;
+	case 'h':
+	case '?':
+	  print_usage();
+	  exit(0);
+	}
+    }
+
+  if ( !inname )
+    {
+      print_usage();
+      exit(1);
+    }
+  if ( d.binw < 1 || d.binw > 4096 )
+    {
+      fprintf(stderr, "%s: bad bin width %d\n", progname, d.binw);
+      exit(1);
+    }
+  if ( nthreads <= 0 )
+    nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+  isa = tap_isa_select(isa);
+
+  /* the sets: the list, or just the defaults, times each grid axis */
+  tap_params_default(&base);
+  base.use_width = use_width;
+  if ( listname )
+    {
+      if ( (nsets = read_list(listname, &base, &sets)) < 0 )
+	exit(1);
+    }
+  else
+    {
+      if ( !(sets = CALLOC(1, sweep_set)) )
+	exit(1);
+      sets[0].tp = base;
+      nsets = 1;
+    }
+  for ( k = 0; k < naxes && nsets > 0; k++ )
+    if ( (nsets = apply_axis(&sets, nsets, &axes[k])) < 0 )
+      {
+	fprintf(stderr, "%s: out of memory\n", progname);
+	exit(1);
+      }
+  if ( nsets == 0 )
+    {
+      fprintf(stderr, "%s: no coefficient sets in %s\n", progname, listname);
+      exit(1);
+    }
+
+  t = evt0_now();
+  if ( sweep_load(inname, &d) || sweep_bins(&d) )
+    exit(1);
+  if(verb > 0) fprintf(stderr, "%ld AMP_SF = 3 events read in %.2f s\n",
+		       d.ev.n, evt0_now() - t);
+
+  /* the ripple before any correction */
+  if ( !(sum = CALLOC(2*d.nbins, double)) )
+    exit(1);
+  for ( i = 0; i < d.ev.n; i++ )
+    {
+      sum[tap_bin(&d, d.ev.au2[i])] += d.ev.au3[i];
+      sum[d.nbins + tap_bin(&d, d.ev.av2[i])] += d.ev.av3[i];
+    }
+  ripple0[0] = ripple(&d, sum, d.count[0]);
+  ripple0[1] = ripple(&d, sum + d.nbins, d.count[1]);
+  free(sum);
+
+  t = evt0_now();
+  r.d = &d;
+  r.sets = sets;
+  r.nsets = nsets;
+  r.isa = isa;
+  if ( sweep_all(&r, nthreads < nsets ? nthreads : nsets) )
+    {
+      fprintf(stderr, "%s: could not start threads\n", progname);
+      exit(1);
+    }
+  if(verb > 0) fprintf(stderr, "%d sets tried in %.2f s with %s "
+		       "instructions on %d threads\n", nsets, evt0_now() - t,
+		       tap_isa_name(isa), nthreads);
+  qsort(sets, nsets, sizeof(*sets), by_score);
+
+  if ( !outname || !strcmp(outname, "-") )
+    fp = stdout;
+  else if ( !(fp = fopen(outname, "w")) )
+    {
+      perror(outname);
+      exit(1);
+    }
+  write_table(fp, &d, ripple0, sets, nbest > 0 && nbest < nsets ? nbest
+	      : nsets);
+  if ( fp != stdout && fclose(fp) )
+    {
+      perror(outname);
+      exit(1);
+    }
+
+  evt0_block_free(&d.ev);
+  free(d.count[0]);
+  free(d.count[1]);
+  free(sets);
+  return 0;
+}
@@ -0,0 +1,111 @@
+/*
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+                 hrc_evt0_synth
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+
+Write a synthetic HRC level 0 event file for testing and timing
+fix_amp_sf_4 and hrc_evt0_correct (see evt0_synth.c). The switch band
+options are those of fix_amp_sf_4, so a file can be made to match the
+bands a run will be corrected with.
+
+Build:
+	cc -O2 -o hrc_evt0_synth hrc_evt0_synth.c evt0_synth.c evt0_kernels.c -lcfitsio -lm
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "fitsio.h"
+
+#include "evt0_synth.h"
+
+static void printerror(int status)
+{
+  if (status)
+    {
+      fits_report_error(stderr, status);
+      exit( status );
+    }
+}
+
+int main(int argc, char *argv[])
+{
+  evt0_synth_params sp;
+  char *progname = argv[0];
+  int c, status = 0;
+
+  evt0_synth_default(&sp);
+
+  while ((c = getopt(argc, argv, "n:s:d:D:f:g:p:P:t:T:wh?")) != EOF)
+    {
+      switch (c)
+	{
+	case 'n':
+	  sp.nrows = atol(optarg);
+	  break;
+	case 's':
+	  sp.seed = strtoul(optarg, 0, 10);
+	  break;
+	case 'd':
+	  sp.detnam = optarg;
+	  break;
+	case 'D':
+	  sp.date_obs = optarg;
+	  break;
+	case 'f':
+	  sp.band_frac = atof(optarg);
+	  break;
+	case 'g':
+	  sp.ap.gain = atof(optarg);
+	  break;
+	case 'p':
+	  sp.ap.pha_1to2 = atof(optarg);
+	  break;
+	case 'P':
+	  sp.ap.pha_2to3 = atof(optarg);
+	  break;
+	case 't':
+	  sp.ap.width1 = atof(optarg);
+	  break;
+	case 'T':
+	  sp.ap.width2 = atof(optarg);
+	  break;
+	case 'w':
+	  sp.tp.use_width = 1;
+	  break;
+	case 'h':
+	case '?':
+	  fprintf(stderr,"\nUsage: %s -[nsdDfgpPtTwh] outfile", progname);
+	  fprintf(stderr,"\n\tn[1000000]:\tnumber of events");
+	  fprintf(stderr,"\n\ts[1]:\trandom seed");
+	  fprintf(stderr,"\n\td[HRC-I]:\tDETNAM");
+	  fprintf(stderr,"\n\tD[2001-01-01T00:00:00]:\tDATE-OBS");
+	  fprintf(stderr,"\n\tf[0.1]:\tfraction of events in the switch bands");
+	  fprintf(stderr,"\n\tg[%.1f]:\tgain for PHA to SUMAMPS", GAIN);
+	  fprintf(stderr,"\n\tp[%.1f]:\tPHA for scale 1 to 2 switch",
+		  PHA_1TO2);
+	  fprintf(stderr,"\n\tP[%.1f]:\tPHA for scale 2 to 3 switch",
+		  PHA_2TO3);
+	  fprintf(stderr,"\n\tt[%.1f]:\t+/- band on PHA scale 1 to 2 switch",
+		  WIDTH1);
+	  fprintf(stderr,"\n\tT[%.1f]:\t+/- band on PHA scale 2 to 3 switch",
+		  WIDTH2);
+	  fprintf(stderr,"\n\tw:\tselect ringing events by VETOSTT width bits");
+	  fprintf(stderr,"\n\th or ?:\tprint usage\n");
+	  exit(0);
+	}
+    }
+
+  if ( optind != argc - 1 || sp.nrows < 1 )
+    {
+      fprintf(stderr, "%s: need one output file and at least one event\n",
+	      progname);
+      exit(1);
+    }
+
+  if ( evt0_synth(argv[optind], &sp, &status) )
+    printerror( status );
+  return 0;
+}
@@ -0,0 +1,792 @@
+/*
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+            lcurve_bin
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+
+The binning behind lcurve: for each time bin, the good time in it,
+the mean deadtime factor, and the events of every source and
+background region, written as one RDB table.
+
+The bins are those of lcurve: timebin wide from the start of the
+first GTI to past the end of the last, bin i covering
+[tstart + i*timebin, tstart + (i+1)*timebin). The good time of each
+bin is added up from the GTIs in one walk over them. The events, read
+a chunk at a time, are kept if inside a GTI (start <= TIME <= stop),
+and counted in the source circle (d < r) and background annulus
+(rin < d < rout) of each region they fall in. The regions are put on
+a uniform grid of cells at least as wide as the largest annulus, so
+that each event is tested only against the regions listed in its
+cell, however many sources there are. Deadtime factors are
+averaged, and their errors added in quadrature, over the samples in
+each bin. Only bins with some good time are written.
+
+Without a row filter, the events of a file with a time index (see
+time_index.c) are read only in the rows that can fall in the GTIs.
+Without GTIs, the events of the regions from first to last are used;
+-R just prints that time range, for lcurve to truncate.
+
+lcurve's pictures of each region come from the same pass: with -i,
+the x, y and whether in the source circle (1), the background annulus
+(2) or both (3) of each good event of region k are appended to
+<prefix>.k as three native floats. With -c the CHIPX and CHIPY of
+every event inside some region's outer circle, good time or not, go
+to <prefix>.chip as two floats; every row is then read.
+
+Build:
+	cc -O2 -o lcurve_bin lcurve_bin.c evt_gti.c evt_tindex.c -lcfitsio -lm
+
+*/
+
+/*** include files ***/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <getopt.h>
+
+#include "fitsio.h"
+
+#include "correction.h"
+#include "evt_gti.h"
+#include "evt_tindex.h"
+
+/* a source circle and its background annulus, radii squared */
+typedef struct
+{
+  double x, y, r2, in2, out2, out;
+} lc_region;
+
+/*
+  Regions by grid cell: cell (i,j) covers [x0 + i*cell, x0 + (i+1)*cell)
+  in x, likewise in y, and lists reg[first[c]] ... reg[first[c+1]-1],
+  c = j*nx + i, the regions whose bounding square overlaps it.
+*/
+typedef struct
+{
+  double x0, y0, cell;
+  long nx, ny;
+  long *first;
+  int *reg;
+} region_grid;
+
+typedef struct
+{
+  double tstart, timebin;
+  long nbins;
+  double *size;			/* good time in each bin */
+  double *dtf_sum, *dtf_err2;
+  long *ndtf;
+  int nreg;
+  lc_region *reg;
+  region_grid grid;
+  long *src, *bg;		/* nreg counts per bin */
+  FILE **evf;			/* nreg files of region events, or 0 */
+  FILE *chipf;			/* CHIPX/CHIPY of region events, or 0 */
+} lc_bins;
+
+static char *progname;
+
+void printerror(int status)
+{
+  /*****************************************************/
+  /* Print out cfitsio error messages and exit program */
+  /*****************************************************/
+
+  if (status)
+    fprintf(stderr, "\n*** Error occurred during program execution ***\n");
+  fits_report_error(stderr, status);
+  exit( status );
+}
+
+int print_usage(void)
+{
+  fprintf(stderr,
+	  "\nUsage:\n\t%s [options] -r x,y,r,rin,rout [-r ...] <EVENTS>\n",
+	  progname);
+  fprintf(stderr,"\n\tr x,y,r,rin,rout:\tsource circle and background annulus (sky pixels)\n");
+  fprintf(stderr,"\tt[100]:\ttime bin size (s)\n");
+  fprintf(stderr,"\tg[all events]:\ttext file of GTI \"start stop\" lines\n");
+  fprintf(stderr,"\td[none]:\tdeadtime factor file (DTF extension)\n");
+  fprintf(stderr,"\tf[none]:\tcfitsio row filter for the events\n");
+  fprintf(stderr,"\te[events]:\tname of the events extension\n");
+  fprintf(stderr,"\tm[65536]:\trows read at a time\n");
+  fprintf(stderr,"\to[stdout]:\toutput RDB file\n");
+  fprintf(stderr,"\ti[none]:\tprefix of the region event files\n");
+  fprintf(stderr,"\tc:\twrite <prefix>.chip too (needs -i)\n");
+  fprintf(stderr,"\tR:\tprint the time range of the region events\n");
+  fprintf(stderr,"\tN:\tread every row, ignoring a time index\n");
+  fprintf(stderr,"\th or ?:\tprint usage\n");
+  return 0;
+}
+
+/* source x,y,r,rin,rout */
+static int parse_region(const char *arg, lc_region *r)
+{
+  double x, y, rad, in, out;
+
+  if ( sscanf(arg, "%lf,%lf,%lf,%lf,%lf", &x, &y, &rad, &in, &out) != 5 )
+    return -1;
+  r->x = x;
+  r->y = y;
+  r->r2 = rad*rad;
+  r->in2 = in*in;
+  r->out2 = out*out;
+  r->out = out > rad ? out : rad;
+  return 0;
+}
+
+/* the cells of the grid, within the grid, over x0 +- half */
+static void grid_span(const region_grid *g, double x, double y,
+		      double half, long *i0, long *i1, long *j0, long *j1)
+{
+  *i0 = (long)floor((x - half - g->x0)/g->cell);
+  *i1 = (long)floor((x + half - g->x0)/g->cell);
+  *j0 = (long)floor((y - half - g->y0)/g->cell);
+  *j1 = (long)floor((y + half - g->y0)/g->cell);
+  if ( *i0 < 0 ) *i0 = 0;
+  if ( *j0 < 0 ) *j0 = 0;
+  if ( *i1 >= g->nx ) *i1 = g->nx - 1;
+  if ( *j1 >= g->ny ) *j1 = g->ny - 1;
+}
+
+/*
+  Put the regions on a grid over their bounding squares, with cells no
+  narrower than the largest square and no more than about 64 cells per
+  region.
+*/
+static int grid_build(region_grid *g, const lc_region *reg, int nreg)
+{
+  double xmin, xmax, ymin, ymax, cell = 0;
+  long i, j, i0, i1, j0, j1, c, ncell, *fill;
+  int k;
+
+  xmin = xmax = reg[0].x;
+  ymin = ymax = reg[0].y;
+  for ( k = 0; k < nreg; k++ )
+    {
+      if ( reg[k].x - reg[k].out < xmin ) xmin = reg[k].x - reg[k].out;
+      if ( reg[k].x + reg[k].out > xmax ) xmax = reg[k].x + reg[k].out;
+      if ( reg[k].y - reg[k].out < ymin ) ymin = reg[k].y - reg[k].out;
+      if ( reg[k].y + reg[k].out > ymax ) ymax = reg[k].y + reg[k].out;
+      if ( 2*reg[k].out > cell )
+	cell = 2*reg[k].out;
+    }
+  if ( !(cell > 0) )
+    cell = 1;
+  g->nx = (long)((xmax - xmin)/cell) + 1;
+  g->ny = (long)((ymax - ymin)/cell) + 1;
+  if ( (double)g->nx*g->ny > 64.0*nreg )
+    {
+      cell *= sqrt((double)g->nx*g->ny/(64.0*nreg));
+      g->nx = (long)((xmax - xmin)/cell) + 1;
+      g->ny = (long)((ymax - ymin)/cell) + 1;
+    }
+  g->x0 = xmin;
+  g->y0 = ymin;
+  g->cell = cell;
+
+  /* count the regions of each cell, then fill them in */
+  ncell = g->nx*g->ny;
+  g->first = CALLOC(ncell + 1, long);
+  fill = CALLOC(ncell + 1, long);
+  if ( !g->first || !fill )
+    return -1;
+  for ( k = 0; k < nreg; k++ )
+    {
+      grid_span(g, reg[k].x, reg[k].y, reg[k].out, &i0, &i1, &j0, &j1);
+      for ( j = j0; j <= j1; j++ )
+	for ( i = i0; i <= i1; i++ )
+	  g->first[j*g->nx + i + 1]++;
+    }
+  for ( c = 0; c < ncell; c++ )
+    g->first[c+1] += g->first[c];
+  g->reg = CALLOC(g->first[ncell] + 1, int);
+  if ( !g->reg )
+    return -1;
+  for ( k = 0; k < nreg; k++ )
+    {
+      grid_span(g, reg[k].x, reg[k].y, reg[k].out, &i0, &i1, &j0, &j1);
+      for ( j = j0; j <= j1; j++ )
+	for ( i = i0; i <= i1; i++ )
+	  {
+	    c = j*g->nx + i;
+	    g->reg[g->first[c] + fill[c]++] = k;
+	  }
+    }
+  free(fill);
+  return 0;
+}
+
+static void grid_free(region_grid *g)
+{
+  free(g->first);
+  free(g->reg);
+}
+
+/* the grid cell of x,y, or -1 if it is outside every region */
+static long grid_cell(const region_grid *g, double x, double y)
+{
+  double i = (x - g->x0)/g->cell, j = (y - g->y0)/g->cell;
+
+  if ( !(i >= 0 && i < g->nx && j >= 0 && j < g->ny) )
+    return -1;
+  return (long)j*g->nx + (long)i;
+}
+
+/* is x,y inside the outer circle of some region? */
+static int in_regions(const lc_bins *lb, double x, double y)
+{
+  const lc_region *r;
+  double dx, dy;
+  long c, m;
+
+  if ( (c = grid_cell(&lb->grid, x, y)) < 0 )
+    return 0;
+  for ( m = lb->grid.first[c]; m < lb->grid.first[c+1]; m++ )
+    {
+      r = lb->reg + lb->grid.reg[m];
+      dx = x - r->x;
+      dy = y - r->y;
+      if ( dx*dx + dy*dy < r->out*r->out )
+	return 1;
+    }
+  return 0;
+}
+
+/*
+  Open the table called extname of filename, through the row filter
+  if there is one.
+*/
+static int open_table(fitsfile **fptr, const char *filename,
+		      const char *extname, const char *filter, int *status)
+{
+  char name[3*FLEN_FILENAME];
+
+  if ( filter )
+    snprintf(name, sizeof(name), "%s[%s][%s]", filename, extname, filter);
+  else
+    snprintf(name, sizeof(name), "%s[%s]", filename, extname);
+  return fits_open_file(fptr, name, READONLY, status);
+}
+
+/*
+  The first and last TIME of the events inside some region, for
+  binning without GTIs.
+*/
+static int time_range(const lc_bins *lb, fitsfile *fptr, long chunk,
+		      double *tmin, double *tmax, int *status)
+{
+  double *t, *x, *y;
+  long nrows, row, n, j;
+  int tcol, xcol, ycol, anynul;
+
+  *tmin = HUGE_VAL;
+  *tmax = -HUGE_VAL;
+  if ( fits_get_num_rows(fptr, &nrows, status)
+       || fits_get_colnum(fptr, CASEINSEN, "time", &tcol, status)
+       || fits_get_colnum(fptr, CASEINSEN, "x", &xcol, status)
+       || fits_get_colnum(fptr, CASEINSEN, "y", &ycol, status) )
+    return *status;
+
+  t = CALLOC(chunk, double);
+  x = CALLOC(chunk, double);
+  y = CALLOC(chunk, double);
+  if ( !t || !x || !y )
+    return *status = MEMORY_ALLOCATION;
+  for ( row = 1; row <= nrows && !*status; row += n )
+    {
+      n = nrows - row + 1 < chunk ? nrows - row + 1 : chunk;
+      fits_read_col(fptr, TDOUBLE, tcol, row, 1, n, NULL, t, &anynul, status);
+      fits_read_col(fptr, TDOUBLE, xcol, row, 1, n, NULL, x, &anynul, status);
+      fits_read_col(fptr, TDOUBLE, ycol, row, 1, n, NULL, y, &anynul, status);
+      for ( j = 0; j < n && !*status; j++ )
+	if ( in_regions(lb, x[j], y[j]) )
+	  {
+	    if ( t[j] < *tmin )
+	      *tmin = t[j];
+	    if ( t[j] > *tmax )
+	      *tmax = t[j];
+	  }
+    }
+  free(t);
+  free(x);
+  free(y);
+  return *status;
+}
+
+
+/* add the good time of each bin, in one walk over the sorted GTIs */
+static void bin_good_time(lc_bins *lb, const evt_interval *gti, long ngti)
+{
+  double lo, hi, s, e, tend = lb->tstart + lb->nbins*lb->timebin;
+  long i, b;
+
+  for ( i = 0; i < ngti; i++ )
+    {
+      s = gti[i].start > lb->tstart ? gti[i].start : lb->tstart;
+      e = gti[i].stop < tend ? gti[i].stop : tend;
+      if ( e <= s )
+	continue;
+      for ( b = (long)floor((s - lb->tstart)/lb->timebin);
+	    b < lb->nbins; b++ )
+	{
+	  lo = lb->tstart + b*lb->timebin;
+	  hi = lo + lb->timebin;
+	  if ( lo >= e )
+	    break;
+	  lb->size[b] += (e < hi ? e : hi) - (s > lo ? s : lo);
+	}
+    }
+}
+
+/* the bin of time t, or -1 */
+static inline long time_bin(const lc_bins *lb, double t)
+{
+  double b = floor((t - lb->tstart)/lb->timebin);
+
+  return (b >= 0 && b < lb->nbins) ? (long)b : -1;
+}
+
+/*
+  Count the events of every region, a chunk of rows at a time; with a
+  time index, only in the rows that can fall in the GTIs. Each event
+  is tested against the regions of its grid cell. The region events
+  and chip positions are written out as they are found.
+*/
+static int bin_events(lc_bins *lb, fitsfile *fptr, const char *evtname,
+		      int useindex, const evt_interval *gti, long ngti,
+		      long chunk, int *status)
+{
+  evt_tindex ix;
+  const region_grid *grid = &lb->grid;
+  double *t, *x, *y, *cx = 0, *cy = 0, *gstart, *gstop, dx, dy, d2;
+  long long *first = 0, *last = 0, one_first = 1, one_last;
+  long nrows, row, n, j, b, cur = 0, nranges = 1, rr, c, m;
+  int tcol, xcol, ycol, cxcol = 0, cycol = 0, anynul, k, good, inany;
+  int flag;
+  float v[3];
+  const lc_region *r;
+
+  if ( fits_get_num_rows(fptr, &nrows, status)
+       || fits_get_colnum(fptr, CASEINSEN, "time", &tcol, status)
+       || fits_get_colnum(fptr, CASEINSEN, "x", &xcol, status)
+       || fits_get_colnum(fptr, CASEINSEN, "y", &ycol, status) )
+    return *status;
+  if ( lb->chipf
+       && (fits_get_colnum(fptr, CASEINSEN, "chipx", &cxcol, status)
+	   || fits_get_colnum(fptr, CASEINSEN, "chipy", &cycol, status)) )
+    return *status;
+
+  t = CALLOC(chunk, double);
+  x = CALLOC(chunk, double);
+  y = CALLOC(chunk, double);
+  if ( lb->chipf )
+    {
+      cx = CALLOC(chunk, double);
+      cy = CALLOC(chunk, double);
+    }
+  if ( !t || !x || !y || (lb->chipf && (!cx || !cy)) )
+    return *status = MEMORY_ALLOCATION;
+
+  one_last = nrows;
+  first = &one_first;
+  last = &one_last;
+  if ( useindex && evt_tindex_open(&ix, fptr, evtname) == 0 )
+    {
+      first = CALLOC(ix.nblocks + 1, long long);
+      last = CALLOC(ix.nblocks + 1, long long);
+      gstart = CALLOC(ngti + 1, double);
+      gstop = CALLOC(ngti + 1, double);
+      if ( !first || !last || !gstart || !gstop )
+	return *status = MEMORY_ALLOCATION;
+      for ( j = 0; j < ngti; j++ )
+	{
+	  gstart[j] = gti[j].start;
+	  gstop[j] = gti[j].stop;
+	}
+      nranges = evt_tindex_ranges(&ix, gstart, gstop, ngti, first, last);
+      evt_tindex_free(&ix);
+      free(gstart);
+      free(gstop);
+    }
+
+  for ( rr = 0; rr < nranges && !*status; rr++ )
+    for ( row = first[rr]; row <= last[rr] && !*status; row += n )
+      {
+	n = last[rr] - row + 1 < chunk ? last[rr] - row + 1 : chunk;
+	fits_read_col(fptr, TDOUBLE, tcol, row, 1, n, NULL, t, &anynul,
+		      status);
+	fits_read_col(fptr, TDOUBLE, xcol, row, 1, n, NULL, x, &anynul,
+		      status);
+	fits_read_col(fptr, TDOUBLE, ycol, row, 1, n, NULL, y, &anynul,
+		      status);
+	if ( lb->chipf )
+	  {
+	    fits_read_col(fptr, TDOUBLE, cxcol, row, 1, n, NULL, cx, &anynul,
+			  status);
+	    fits_read_col(fptr, TDOUBLE, cycol, row, 1, n, NULL, cy, &anynul,
+			  status);
+	  }
+	if ( *status )
+	  break;
+
+	for ( j = 0; j < n; j++ )
+	  {
+	    b = evt_gti_in(gti, ngti, t[j], &cur) ? time_bin(lb, t[j]) : -1;
+	    good = b >= 0;
+	    if ( (!good && !lb->chipf)
+		 || (c = grid_cell(grid, x[j], y[j])) < 0 )
+	      continue;
+	    inany = 0;
+	    for ( m = grid->first[c]; m < grid->first[c+1]; m++ )
+	      {
+		k = grid->reg[m];
+		r = lb->reg + k;
+		dx = x[j] - r->x;
+		dy = y[j] - r->y;
+		if ( fabs(dx) >= r->out || fabs(dy) >= r->out )
+		  continue;
+		d2 = dx*dx + dy*dy;
+		if ( d2 < r->out*r->out )
+		  inany = 1;
+		if ( !good )
+		  continue;
+		flag = 0;
+		if ( d2 < r->r2 )
+		  {
+		    lb->src[b*lb->nreg + k]++;
+		    flag |= 1;
+		  }
+		if ( d2 > r->in2 && d2 < r->out2 )
+		  {
+		    lb->bg[b*lb->nreg + k]++;
+		    flag |= 2;
+		  }
+		if ( flag && lb->evf )
+		  {
+		    v[0] = x[j];
+		    v[1] = y[j];
+		    v[2] = flag;
+		    fwrite(v, sizeof(float), 3, lb->evf[k]);
+		  }
+	      }
+	    if ( inany && lb->chipf )
+	      {
+		v[0] = cx[j];
+		v[1] = cy[j];
+		fwrite(v, sizeof(float), 2, lb->chipf);
+	      }
+	  }
+      }
+  if ( first != &one_first )
+    {
+      free(first);
+      free(last);
+    }
+  free(t);
+  free(x);
+  free(y);
+  free(cx);
+  free(cy);
+  return *status;
+}
+
+/* add up the deadtime factors of each bin */
+static int bin_dtf(lc_bins *lb, const char *filename, long chunk,
+		   int *status)
+{
+  fitsfile *fptr;
+  double *t, *dtf, *err;
+  long nrows, row, n, j, b;
+  int tcol, dcol, ecol, anynul;
+
+  if ( open_table(&fptr, filename, "dtf", 0, status)
+       || fits_get_num_rows(fptr, &nrows, status)
+       || fits_get_colnum(fptr, CASEINSEN, "time", &tcol, status)
+       || fits_get_colnum(fptr, CASEINSEN, "dtf", &dcol, status)
+       || fits_get_colnum(fptr, CASEINSEN, "dtf_err", &ecol, status) )
+    return *status;
+
+  t = CALLOC(chunk, double);
+  dtf = CALLOC(chunk, double);
+  err = CALLOC(chunk, double);
+  if ( !t || !dtf || !err )
+    return *status = MEMORY_ALLOCATION;
+
+  for ( row = 1; row <= nrows && !*status; row += n )
+    {
+      n = nrows - row + 1 < chunk ? nrows - row + 1 : chunk;
+      fits_read_col(fptr, TDOUBLE, tcol, row, 1, n, NULL, t, &anynul, status);
+      fits_read_col(fptr, TDOUBLE, dcol, row, 1, n, NULL, dtf, &anynul,
+		    status);
+      fits_read_col(fptr, TDOUBLE, ecol, row, 1, n, NULL, err, &anynul,
+		    status);
+      for ( j = 0; j < n && !*status; j++ )
+	if ( (b = time_bin(lb, t[j])) >= 0 )
+	  {
+	    lb->dtf_sum[b] += dtf[j];
+	    lb->dtf_err2[b] += err[j]*err[j];
+	    lb->ndtf[b]++;
+	  }
+    }
+  free(t);
+  free(dtf);
+  free(err);
+  fits_close_file(fptr, status);
+  return *status;
+}
+
+static void write_rdb(FILE *fp, const lc_bins *lb, const char *evtfile,
+		      int have_dtf)
+{
+  double exposure = 0.0, dtf, err, mid;
+  long b, nsrc, nbg;
+  int k;
+
+  for ( b = 0; b < lb->nbins; b++ )
+    exposure += lb->size[b];
+
+  fprintf(fp, "# %s: %s\n", progname, evtfile);
+  fprintf(fp, "# timebin: %g\n", lb->timebin);
+  fprintf(fp, "# exposure: %.3f\n", exposure);
+  for ( k = 0; k < lb->nreg; k++ )
+    {
+      for ( b = 0, nsrc = nbg = 0; b < lb->nbins; b++ )
+	if ( lb->size[b] > 0 )
+	  {
+	    nsrc += lb->src[b*lb->nreg + k];
+	    nbg += lb->bg[b*lb->nreg + k];
+	  }
+      fprintf(fp, "# region %d: %.2f,%.2f,%.2f,%.2f,%.2f src=%ld bg=%ld\n",
+	      k + 1, lb->reg[k].x, lb->reg[k].y, sqrt(lb->reg[k].r2),
+	      sqrt(lb->reg[k].in2), sqrt(lb->reg[k].out2), nsrc, nbg);
+    }
+
+  fprintf(fp, "time\tbin\tdtf\tdtf_err");
+  for ( k = 0; k < lb->nreg; k++ )
+    fprintf(fp, "\tsrc_%d\tbg_%d", k + 1, k + 1);
+  fprintf(fp, "\nN\tN\tN\tN");
+  for ( k = 0; k < lb->nreg; k++ )
+    fprintf(fp, "\tN\tN");
+  fprintf(fp, "\n");
+
+  for ( b = 0; b < lb->nbins; b++ )
+    {
+      if ( !(lb->size[b] > 0) )
+	continue;
+      mid = lb->tstart + (b + 0.5)*lb->timebin;
+      dtf = 1.0;
+      err = 0.0;
+      if ( lb->ndtf[b] )
+	{
+	  dtf = lb->dtf_sum[b]/lb->ndtf[b];
+	  err = sqrt(lb->dtf_err2[b]);
+	}
+      else if ( have_dtf )
+	fprintf(stderr, "No deadtime corrections for time = %d +/- %d\n",
+		(int)mid, (int)(lb->timebin/2));
+      fprintf(fp, "%.6f\t%.6f\t%.9g\t%.9g", mid, lb->size[b], dtf, err);
+      for ( k = 0; k < lb->nreg; k++ )
+	fprintf(fp, "\t%ld\t%ld", lb->src[b*lb->nreg + k],
+		lb->bg[b*lb->nreg + k]);
+      fprintf(fp, "\n");
+    }
+}
+
+int main(int argc, char *argv[])
+{
+  fitsfile *fptr;
+  lc_bins lb;
+  evt_interval *gti = 0;
+  FILE *out = stdout;
+  char *gtifile = 0, *dtffile = 0, *filter = 0, *outfile = 0, *p;
+  char *extname = "events", *prefix = 0, *evtname;
+  double tmin, tmax;
+  long ngti, chunk = 65536, nbins;
+  int c, k, useindex = 1, chip = 0, range = 0, status = 0;
+
+  progname = argv[0];
+  if ( (p = strrchr(progname, '/')) )
+    progname = p + 1;
+
+  memset(&lb, 0, sizeof(lb));
+  lb.timebin = 100.0;
+  if ( !(lb.reg = CALLOC(argc, lc_region)) )
+    exit(1);
+
+  while ((c = getopt(argc, argv, "r:t:g:d:f:e:m:o:i:cRNh?")) != -1)
+    {
+      switch (c)
+	{
+	case 'r':
+	  if ( parse_region(optarg, lb.reg + lb.nreg) )
+	    {
+	      fprintf(stderr, "%s: want -r x,y,r,rin,rout, not '%s'\n",
+		      progname, optarg);
+	      exit(1);
+	    }
+	  lb.nreg++;
+	  break;
+	case 't':
+	  lb.timebin = atof(optarg);
+	  break;
+	case 'g':
+	  gtifile = optarg;
+	  break;
+	case 'd':
+	  dtffile = optarg;
+	  break;
+	case 'f':
+	  filter = optarg;
+	  break;
+	case 'e':
+	  extname = optarg;
+	  break;
+	case 'm':
+	  chunk = atol(optarg);
+	  break;
+	case 'o':
+	  outfile = optarg;
+	  break;
+	case 'i':
+	  prefix = optarg;
+	  break;
+	case 'c':
+	  chip = 1;
+	  break;
+	case 'R':
+	  range = 1;
+	  break;
+	case 'N':
+	  useindex = 0;
+	  break;
+	case 'h':
+	case '?':
+	default:
+	  print_usage();
+	  exit(1);
+	}
+    }
+  if ( argc - optind != 1 || !lb.nreg || !(lb.timebin > 0)
+       || (chip && !prefix) )
+    {
+      print_usage();
+      exit(1);
+    }
+  if ( chunk < 1 )
+    chunk = 1;
+  evtname = argv[optind];
+  if ( grid_build(&lb.grid, lb.reg, lb.nreg) )
+    {
+      fprintf(stderr, "%s: out of memory\n", progname);
+      exit(1);
+    }
+
+  if ( open_table(&fptr, evtname, extname, filter, &status) )
+    printerror(status);
+
+  /* without GTIs, the events of the regions */
+  if ( gtifile && !range )
+    {
+      if ( (ngti = evt_gti_read_file(gtifile, &gti)) < 0 )
+	exit(1);
+    }
+  else
+    {
+      if ( !(gti = CALLOC(1, evt_interval)) )
+	exit(1);
+      if ( time_range(&lb, fptr, chunk, &tmin, &tmax, &status) )
+	printerror(status);
+      gti[0].start = tmin;
+      gti[0].stop = tmax;
+      ngti = tmin <= tmax;
+      if ( range )
+	{
+	  if ( ngti )
+	    printf("%.17g %.17g\n", tmin, tmax);
+	  fits_close_file(fptr, &status);
+	  return ngti ? 0 : 1;
+	}
+    }
+  if ( !ngti )
+    {
+      fprintf(stderr, "%s: empty GTI list\n", progname);
+      exit(1);
+    }
+
+  /* as PDL's hist() from tstart to tstop + timebin */
+  lb.tstart = gti[0].start;
+  nbins = (long)((gti[ngti-1].stop + lb.timebin - lb.tstart)/lb.timebin
+		 + 0.5);
+  lb.nbins = nbins;
+  lb.size = CALLOC(nbins, double);
+  lb.dtf_sum = CALLOC(nbins, double);
+  lb.dtf_err2 = CALLOC(nbins, double);
+  lb.ndtf = CALLOC(nbins, long);
+  lb.src = CALLOC(nbins*lb.nreg, long);
+  lb.bg = CALLOC(nbins*lb.nreg, long);
+  if ( !lb.size || !lb.dtf_sum || !lb.dtf_err2 || !lb.ndtf || !lb.src
+       || !lb.bg )
+    {
+      fprintf(stderr, "%s: out of memory for %ld bins\n", progname, nbins);
+      exit(1);
+    }
+
+  /* a file of region events per region, and of chip positions */
+  if ( prefix )
+    {
+      char name[FLEN_FILENAME];
+
+      if ( !(lb.evf = CALLOC(lb.nreg, FILE *)) )
+	exit(1);
+      for ( k = 0; k < lb.nreg; k++ )
+	{
+	  snprintf(name, sizeof(name), "%s.%d", prefix, k + 1);
+	  if ( !(lb.evf[k] = fopen(name, "wb")) )
+	    {
+	      perror(name);
+	      if ( errno == EMFILE )
+		fprintf(stderr, "%s: %d regions need as many open files; "
+			"raise the limit (ulimit -n)\n", progname, lb.nreg);
+	      exit(1);
+	    }
+	}
+      snprintf(name, sizeof(name), "%s.chip", prefix);
+      if ( chip && !(lb.chipf = fopen(name, "wb")) )
+	{
+	  perror(name);
+	  exit(1);
+	}
+    }
+
+  bin_good_time(&lb, gti, ngti);
+  if ( bin_events(&lb, fptr, evtname, useindex && !filter && !chip, gti,
+		  ngti, chunk, &status) )
+    printerror(status);
+  fits_close_file(fptr, &status);
+  for ( k = 0; lb.evf && k < lb.nreg; k++ )
+    if ( ferror(lb.evf[k]) | fclose(lb.evf[k]) )
+      {
+	perror(prefix);
+	exit(1);
+      }
+  if ( lb.chipf && (ferror(lb.chipf) | fclose(lb.chipf)) )
+    {
+      perror(prefix);
+      exit(1);
+    }
+  if ( dtffile && bin_dtf(&lb, dtffile, chunk, &status) )
+    printerror(status);
+
+  if ( outfile && !(out = fopen(outfile, "w")) )
+    {
+      perror(outfile);
+      exit(1);
+    }
+  write_rdb(out, &lb, evtname, dtffile != 0);
+  if ( out != stdout )
+    fclose(out);
+  grid_free(&lb.grid);
+  return 0;
+}
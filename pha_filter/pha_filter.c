@@ -0,0 +1,896 @@
+/*
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+            pha_filter
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+
+Filters an HRC event list on PHA, with lower and upper limits that
+depend on position: the 'phalim' table of the filter file gives them
+for cells of 128x128 RAW pixels, numbered by lab_u (RAWX) and lab_v
+(RAWY) from 1. An event is kept if pha_low <= PHA <= pha_high in its
+cell; events outside the table, or in cells it leaves out, are
+dropped.
+
+This is pha_filter.pl without PDL. The limits are laid out once as an
+image of the cells, from the mapped filter table if it can be mapped.
+The events are then streamed through a block of rows at a time: the
+cell limits of eight events are fetched at once with AVX2 gathers
+where the CPU has them, and the surviving rows are copied as raw bytes
+into the output table, so memory use is set by --nrows alone. The
+EVENTS header is rebuilt as pha_filter.pl does it; all other HDUs are
+copied as they are.
+
+Build:
+	cc -O2 -I.. -o pha_filter pha_filter.c ../evt0_map.c -lcfitsio
+
+*/
+
+/*** include files ***/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+
+#include "fitsio.h"
+
+#include "evt0_map.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+#define VERSION "0.3"
+
+#define DEFAULT_FILTER "/data/legs/rpete/flight/filters/more_conservative.fits"
+#define DEFAULT_NROWS 65536
+#define DEFAULT_EXTNAME "events"
+
+#define CELL 128		/* RAW pixels on a side of a filter cell */
+
+/* RAWY offsets of the CHIPY of chip_id 1 to 3 */
+static const int chip_yoff[4] = { 0, -12, 16460, 32930 };
+
+/* EVENTS keywords carried over to the output, as pha_filter.pl has them */
+static char *copy_keywords[] = {
+  "HDUNAME", "CONTENT", "HDUCLASS", "HDUCLAS1", "HDUCLAS2", "ORIGIN",
+  "CREATOR", "REVISION", "ASCDSVER", "CHECKSUM", "DATASUM", "DATE",
+  "DATE-OBS", "DATE-END", "TIMESYS", "MJDREF", "TIMEZERO", "TIMEUNIT",
+  "BTIMNULL", "BTIMRATE", "BTIMDRFT", "BTIMCORR", "TIMEREF", "TASSIGN",
+  "CLOCKAPP", "TIERRELA", "TIERABSO", "TIMVERSN", "TSTART", "TSTOP",
+  "TIMEPIXR", "TIMEDEL", "MISSION", "TELESCOP", "INSTRUME", "DETNAM",
+  "OBS_ID", "DATAMODE", "EQUINOX", "RADECSYS", "DATACLAS", "TLM_FMT",
+  "GRATING", "OBJECT", "TITLE", "OBSERVER", "OBI_NUM", "SEQ_NUM", "SIM_X",
+  "SIM_Y", "SIM_Z", "DEFOCUS", "FOC_LEN", "OBS_MODE", "RA_NOM", "DEC_NOM",
+  "ROLL_NOM", "ROLL_PNT", "ACSYS1", "ACSYS2", "ACSYS3", "ACSYS4", "ACSYS5",
+  "MIR_AL_X", "MIR_AL_Y", "MIR_AL_Z", "STG_AL_X", "STG_AL_Y", "STG_AL_Z",
+  "ASPTYPE", "MTYPE1", "MFORM1", "MTYPE2", "MFORM2", "MTYPE3", "MFORM3",
+  "MTYPE4", "MFORM4", "MTYPE5", "MFORM5", "MTYPE6", "MFORM6", "MTYPE7",
+  "MFORM7", "MTYPE8", "MFORM8", "ONTIME", "DSTYP1", "DSVAL1", "DSFORM1",
+  "DSREF1", "DTCOR", "LIVETIME", "EXPOSURE", "DTYPE1", "DFORM1", 0
+};
+
+/*
+  Per-column keywords, renumbered to the output column. The TC* ones
+  are copied by pha_filter.pl; the scaling and null keywords have to
+  come along as well since the cells are copied as raw bytes.
+*/
+static char *copy_colkeys[] = {
+  "TCNAM", "TCTYP", "TCRVL", "TCRPX", "TCDLT",
+  "TSCAL", "TZERO", "TNULL", "TDIM", 0
+};
+
+/* the PHA limits of the filter cells, v (RAWY) running fastest */
+typedef struct
+{
+  int nu, nv;
+  int *lo, *hi;		/* nu*nv cells, and one more rejecting everything */
+} cut_image;
+
+/* a scalar numeric column, read from raw table rows */
+typedef struct
+{
+  int colnum, typecode;
+  long off;			/* byte offset in the row */
+  double scale, zero;
+} col_ref;
+
+/* the byte offset and width in the row of each column, from 1 */
+typedef struct
+{
+  int ncols;
+  long rowlen;
+  long *off, *len;
+} table_layout;
+
+static char *progname;
+static char DATE[FLEN_VALUE], CREATOR[FLEN_VALUE];
+
+void printerror(int status)
+{
+  /*****************************************************/
+  /* Print out cfitsio error messages and exit program */
+  /*****************************************************/
+
+  if (status)
+    fprintf(stderr, "\n*** Error occurred during program execution ***\n");
+  fits_report_error(stderr, status);
+  exit( status );
+}
+
+void print_usage(int code)
+{
+  fprintf(stderr,"\nUsage: %s [options] infile outfile\n", progname);
+  fprintf(stderr,"\n  Options:\n");
+  fprintf(stderr,"  --help        This message.\n");
+  fprintf(stderr,"  --version     Print version information.\n");
+  fprintf(stderr,"  --filter      PHA filter file, default is %s.\n",
+	  DEFAULT_FILTER);
+  fprintf(stderr,"  --extname     Name of extension containing events, default is '%s'.\n",
+	  DEFAULT_EXTNAME);
+  fprintf(stderr,"  --nrows       Number of events to process at a time, default is %d.\n",
+	  DEFAULT_NROWS);
+  fprintf(stderr,"  --nostatus    Do not copy status column.\n");
+  fprintf(stderr,"  --chip        Use CHIP coordinates instead of RAW.\n");
+  fprintf(stderr,"\n  The keywords of the events header copied to the output are a fixed\n");
+  fprintf(stderr,"  list, as in pha_filter.pl.\n\n");
+  exit(code);
+}
+
+/* work out where each column of the current table sits in a row */
+static int get_layout(fitsfile *fptr, table_layout *t, int *status)
+{
+  char key[FLEN_KEYWORD], tform[FLEN_VALUE];
+  int i, typecode;
+  long repeat, width, pos = 0;
+
+  if ( fits_get_num_cols(fptr, &t->ncols, status)
+       || fits_read_key(fptr, TLONG, "NAXIS1", &t->rowlen, NULL, status) )
+    return *status;
+  t->off = CALLOC(t->ncols + 1, long);
+  t->len = CALLOC(t->ncols + 1, long);
+  if ( !t->off || !t->len )
+    return *status = MEMORY_ALLOCATION;
+
+  for ( i = 1; i <= t->ncols; i++ )
+    {
+      snprintf(key, sizeof(key), "TFORM%d", i);
+      if ( fits_read_key(fptr, TSTRING, key, tform, NULL, status)
+	   || fits_binary_tform(tform, &typecode, &repeat, &width, status) )
+	return *status;
+      if ( typecode < 0 )
+	{
+	  fprintf(stderr, "%s: variable length column %d is not supported\n",
+		  progname, i);
+	  return *status = BAD_TFORM;
+	}
+      t->off[i] = pos;
+      if ( typecode == TBIT )
+	t->len[i] = (repeat + 7)/8;
+      else if ( typecode == TSTRING )
+	t->len[i] = repeat;
+      else
+	t->len[i] = repeat*width;
+      pos += t->len[i];
+    }
+  return pos == t->rowlen ? 0 : (*status = BAD_ROW_WIDTH);
+}
+
+static void free_layout(table_layout *t)
+{
+  free(t->off);
+  free(t->len);
+}
+
+/*
+  Look up a scalar numeric column of the current table; returns 1 if
+  there is no such column.
+*/
+static int find_col(fitsfile *fptr, const table_layout *t, char *name,
+		    col_ref *c, int *status)
+{
+  char key[FLEN_KEYWORD];
+  long repeat, width;
+
+  fits_write_errmark();
+  if ( fits_get_colnum(fptr, CASEINSEN, name, &c->colnum, status) )
+    {
+      *status = 0;
+      fits_clear_errmark();
+      return 1;
+    }
+  fits_clear_errmark();
+
+  if ( fits_get_coltype(fptr, c->colnum, &c->typecode, &repeat, &width,
+			status) )
+    return -1;
+  if ( repeat != 1 || c->typecode == TSTRING || c->typecode == TBIT
+       || c->typecode == TLOGICAL || c->typecode == TCOMPLEX
+       || c->typecode == TDBLCOMPLEX )
+    {
+      fprintf(stderr, "%s: column '%s' is not a scalar number\n",
+	      progname, name);
+      *status = BAD_TFORM;
+      return -1;
+    }
+  c->off = t->off[c->colnum];
+
+  c->scale = 1.0;
+  c->zero = 0.0;
+  fits_write_errmark();
+  snprintf(key, sizeof(key), "TSCAL%d", c->colnum);
+  if ( fits_read_key(fptr, TDOUBLE, key, &c->scale, NULL, status) )
+    *status = 0;
+  snprintf(key, sizeof(key), "TZERO%d", c->colnum);
+  if ( fits_read_key(fptr, TDOUBLE, key, &c->zero, NULL, status) )
+    *status = 0;
+  fits_clear_errmark();
+  return 0;
+}
+
+/* the big-endian value at p of a column of the given type */
+static double cell_value(int typecode, const unsigned char *p)
+{
+  unsigned long long x = 0;
+  union { unsigned int u; float f; } f4;
+  union { unsigned long long u; double d; } f8;
+  int i, n;
+
+  switch ( typecode )
+    {
+    case TBYTE:
+      return p[0];
+    case TSHORT:
+      return (short)(p[0] << 8 | p[1]);
+    case TLONG:
+      return (int)((unsigned)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3]);
+    case TFLOAT:
+      f4.u = (unsigned)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+      return f4.f;
+    default:			/* TLONGLONG, TDOUBLE */
+      n = 8;
+      for ( i = 0; i < n; i++ )
+	x = x << 8 | p[i];
+      if ( typecode == TLONGLONG )
+	return (double)(long long)x;
+      f8.u = x;
+      return f8.d;
+    }
+}
+
+/*
+  Read column c of the n rows at rows into dst, as integers. The usual
+  unscaled 16 and 32 bit columns are done without going through
+  doubles.
+*/
+static void read_ints(const col_ref *c, const unsigned char *rows,
+		      long rowlen, long n, int *dst)
+{
+  const unsigned char *p = rows + c->off;
+  int plain = c->scale == 1.0 && c->zero == 0.0;
+  long j;
+
+  if ( plain && c->typecode == TSHORT )
+    for ( j = 0; j < n; j++, p += rowlen )
+      dst[j] = (short)(p[0] << 8 | p[1]);
+  else if ( plain && c->typecode == TLONG )
+    for ( j = 0; j < n; j++, p += rowlen )
+      dst[j] = (int)((unsigned)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3]);
+  else
+    for ( j = 0; j < n; j++, p += rowlen )
+      dst[j] = (int)(c->scale*cell_value(c->typecode, p) + c->zero);
+}
+
+/*
+  Read the 'phalim' table of the filter file into the cut image. The
+  table is mapped if it can be, and otherwise read in one go.
+*/
+static int read_filter(char *filename, cut_image *ci, int *status)
+{
+  static char *names[4] = { "lab_u", "lab_v", "pha_low", "pha_high" };
+  fitsfile *fptr;
+  table_layout t;
+  evt0_map m;
+  col_ref c;
+  unsigned char *buf = 0;
+  const unsigned char *rows;
+  int *col[4] = { 0, 0, 0, 0 }, k, umax = 0, vmax = 0;
+  long nrows, j, n;
+
+  t.off = t.len = 0;
+  if ( fits_open_file(&fptr, filename, READONLY, status) )
+    return *status;
+  if ( fits_movnam_hdu(fptr, ANY_HDU, "phalim", 0, status)
+       || fits_get_num_rows(fptr, &nrows, status)
+       || get_layout(fptr, &t, status) )
+    {
+      free_layout(&t);
+      fits_close_file(fptr, status);
+      return *status;
+    }
+
+  if ( evt0_map_open(&m, fptr, filename, 0) == 0 )
+    rows = evt0_map_rows(&m, 1);
+  else if ( (buf = CALLOC(nrows*t.rowlen + 1, unsigned char)) )
+    {
+      fits_read_tblbytes(fptr, 1, 1, (LONGLONG)nrows*t.rowlen, buf, status);
+      rows = buf;
+    }
+  else
+    *status = MEMORY_ALLOCATION;
+
+  for ( k = 0; k < 4 && !*status; k++ )
+    {
+      if ( find_col(fptr, &t, names[k], &c, status) > 0 )
+	{
+	  fprintf(stderr, "%s: no '%s' column in '%s'\n",
+		  progname, names[k], filename);
+	  *status = COL_NOT_FOUND;
+	  break;
+	}
+      if ( !(col[k] = CALLOC(nrows + 1, int)) )
+	*status = MEMORY_ALLOCATION;
+      else if ( !*status )
+	read_ints(&c, rows, t.rowlen, nrows, col[k]);
+    }
+  evt0_map_close(&m);
+  free(buf);
+  free_layout(&t);
+  fits_close_file(fptr, status);
+  if ( *status )
+    goto done;
+
+  for ( j = 0; j < nrows; j++ )
+    {
+      if ( col[0][j] < 1 || col[1][j] < 1 )
+	{
+	  fprintf(stderr, "%s: bad cell (%d, %d) in '%s'\n",
+		  progname, col[0][j], col[1][j], filename);
+	  *status = NOT_POS_INT;
+	  goto done;
+	}
+      if ( col[0][j] > umax )
+	umax = col[0][j];
+      if ( col[1][j] > vmax )
+	vmax = col[1][j];
+    }
+
+  /* cells not in the table get limits of -1, as in pha_filter.pl */
+  ci->nu = umax;
+  ci->nv = vmax;
+  n = (long)umax*vmax;
+  ci->lo = CALLOC(n + 1, int);
+  ci->hi = CALLOC(n + 1, int);
+  if ( !ci->lo || !ci->hi )
+    {
+      *status = MEMORY_ALLOCATION;
+      goto done;
+    }
+  for ( j = 0; j < n; j++ )
+    ci->lo[j] = ci->hi[j] = -1;
+  ci->lo[n] = 1;
+  ci->hi[n] = 0;
+  for ( j = 0; j < nrows; j++ )
+    {
+      ci->lo[(col[0][j] - 1)*(long)vmax + col[1][j] - 1] = col[2][j];
+      ci->hi[(col[0][j] - 1)*(long)vmax + col[1][j] - 1] = col[3][j];
+    }
+
+ done:
+  for ( k = 0; k < 4; k++ )
+    free(col[k]);
+  return *status;
+}
+
+/*
+  The cell of RAW position (x, y), or the rejecting cell past the end
+  if it is off the image. The division truncates toward zero, as PDL's
+  conversion does, so -127 ... -1 still fall in the first cell.
+*/
+static inline long cut_cell(const cut_image *ci, int x, int y)
+{
+  if ( x <= -CELL || y <= -CELL || x >= CELL*ci->nu || y >= CELL*ci->nv )
+    return (long)ci->nu*ci->nv;
+  return (long)(x/CELL)*ci->nv + y/CELL;
+}
+
+static long cut_scalar(const cut_image *ci, const int *x, const int *y,
+		       const int *pha, long j, long n, long *keep, long nkeep)
+{
+  long k;
+
+  for ( ; j < n; j++ )
+    {
+      k = cut_cell(ci, x[j], y[j]);
+      if ( ci->lo[k] <= pha[j] && pha[j] <= ci->hi[k] )
+	keep[nkeep++] = j;
+    }
+  return nkeep;
+}
+
+#ifdef HAVE_X86_SIMD
+
+/*
+  cut_scalar() eight events at a time: the cells are worked out in
+  vector registers and their limits gathered with one instruction
+  each. Only the indices of the kept events leave the loop.
+*/
+__attribute__ ((target ("avx2")))
+static long cut_avx2(const cut_image *ci, const int *x, const int *y,
+		     const int *pha, long n, long *keep)
+{
+  __m256i vx, vy, vp, iu, iv, idx, lo, hi, in, ok;
+  __m256i low = _mm256_set1_epi32(-CELL), zero = _mm256_setzero_si256();
+  __m256i xmax = _mm256_set1_epi32(CELL*ci->nu);
+  __m256i ymax = _mm256_set1_epi32(CELL*ci->nv);
+  __m256i nv = _mm256_set1_epi32(ci->nv);
+  __m256i off = _mm256_set1_epi32(ci->nu*ci->nv);
+  long j, nkeep = 0;
+  unsigned mask;
+
+  for ( j = 0; j + 8 <= n; j += 8 )
+    {
+      vx = _mm256_loadu_si256((const __m256i *)(x + j));
+      vy = _mm256_loadu_si256((const __m256i *)(y + j));
+      vp = _mm256_loadu_si256((const __m256i *)(pha + j));
+
+      in = _mm256_and_si256(_mm256_and_si256(_mm256_cmpgt_epi32(vx, low),
+					     _mm256_cmpgt_epi32(xmax, vx)),
+			    _mm256_and_si256(_mm256_cmpgt_epi32(vy, low),
+					     _mm256_cmpgt_epi32(ymax, vy)));
+      iu = _mm256_srai_epi32(_mm256_max_epi32(vx, zero), 7);
+      iv = _mm256_srai_epi32(_mm256_max_epi32(vy, zero), 7);
+      idx = _mm256_add_epi32(_mm256_mullo_epi32(iu, nv), iv);
+      idx = _mm256_blendv_epi8(off, idx, in);
+
+      lo = _mm256_i32gather_epi32(ci->lo, idx, 4);
+      hi = _mm256_i32gather_epi32(ci->hi, idx, 4);
+      ok = _mm256_or_si256(_mm256_cmpgt_epi32(lo, vp),
+			   _mm256_cmpgt_epi32(vp, hi));
+      mask = ~_mm256_movemask_ps(_mm256_castsi256_ps(ok)) & 0xff;
+      while ( mask )
+	{
+	  keep[nkeep++] = j + __builtin_ctz(mask);
+	  mask &= mask - 1;
+	}
+    }
+  return cut_scalar(ci, x, y, pha, j, n, keep, nkeep);
+}
+
+#endif /* HAVE_X86_SIMD */
+
+/* the rows of a block passing the cut, as indices into it */
+static long cut_rows(const cut_image *ci, const int *x, const int *y,
+		     const int *pha, long n, long *keep)
+{
+#ifdef HAVE_X86_SIMD
+  static int avx2 = -1;
+
+  if ( avx2 < 0 )
+    {
+      __builtin_cpu_init();
+      avx2 = __builtin_cpu_supports("avx2")
+	/* the cell index must fit the 32 bit lanes */
+	&& (long)CELL*ci->nu < 0x7fffffffL && (long)CELL*ci->nv < 0x7fffffffL
+	&& (long)ci->nu*ci->nv < 0x7fffffffL;
+    }
+  if ( avx2 )
+    return cut_avx2(ci, x, y, pha, n, keep);
+#endif
+  return cut_scalar(ci, x, y, pha, 0, n, keep, 0);
+}
+
+/* copy a keyword card from in to out, if it is there, under a new name */
+static int copy_card(fitsfile *in, fitsfile *out, char *key, char *newkey,
+		     int *status)
+{
+  char card[FLEN_CARD];
+  size_t n;
+
+  fits_write_errmark();
+  if ( fits_read_card(in, key, card, status) )
+    {
+      fits_clear_errmark();
+      return *status = 0;
+    }
+  fits_clear_errmark();
+  if ( newkey )
+    {
+      n = strlen(key);
+      memmove(card + strlen(newkey), card + n, strlen(card + n) + 1);
+      memcpy(card, newkey, strlen(newkey));
+    }
+  return fits_write_record(out, card, status);
+}
+
+/*
+  Write the filtered events of the current HDU of in as a new table
+  of out. use_status and use_chip are the --status and --chip options.
+*/
+static int filter_pha(fitsfile *in, char *inname, fitsfile *out,
+		      const cut_image *ci, char *extname, long nrows_block,
+		      int use_status, int use_chip, int *status)
+{
+  char key[FLEN_KEYWORD], newkey[FLEN_KEYWORD], card[FLEN_CARD];
+  char hist[2*FLEN_VALUE + 16];
+  char **ttype, **tform, **tunit;
+  table_layout t;
+  evt0_map m;
+  col_ref cx, cy, cid, cpha;
+  long *segoff, *seglen, *keep, nseg = 0, outrowlen = 0, orowlen;
+  long nrows, row, n, nkeep, nwritten = 0, j, s;
+  int *x, *y, *pha, *id, *outcol, i, k, nout = 0, nkeys, mapped;
+  unsigned char *inbuf = 0, *outbuf, *d;
+  const unsigned char *rows, *r;
+
+  if ( get_layout(in, &t, status)
+       || fits_get_num_rows(in, &nrows, status) )
+    return *status;
+
+  ttype = CALLOC(t.ncols + 1, char *);
+  tform = CALLOC(t.ncols + 1, char *);
+  tunit = CALLOC(t.ncols + 1, char *);
+  outcol = CALLOC(t.ncols + 1, int);
+  segoff = CALLOC(t.ncols + 1, long);
+  seglen = CALLOC(t.ncols + 1, long);
+  if ( !ttype || !tform || !tunit || !outcol || !segoff || !seglen )
+    return *status = MEMORY_ALLOCATION;
+
+  /*
+    The output columns, skipping the status flags with --nostatus, and
+    the runs of bytes they take up in an input row.
+  */
+  for ( i = 1; i <= t.ncols; i++ )
+    {
+      /* a skipped column leaves its strings for the next one */
+      if ( !ttype[nout] )
+	{
+	  ttype[nout] = CALLOC(FLEN_VALUE, char);
+	  tform[nout] = CALLOC(FLEN_VALUE, char);
+	  tunit[nout] = CALLOC(FLEN_VALUE, char);
+	}
+      if ( !ttype[nout] || !tform[nout] || !tunit[nout] )
+	return *status = MEMORY_ALLOCATION;
+
+      snprintf(key, sizeof(key), "TTYPE%d", i);
+      fits_read_key(in, TSTRING, key, ttype[nout], NULL, status);
+      if ( !use_status && strstr(ttype[nout], "status") )
+	continue;
+      snprintf(key, sizeof(key), "TFORM%d", i);
+      fits_read_key(in, TSTRING, key, tform[nout], NULL, status);
+      snprintf(key, sizeof(key), "TUNIT%d", i);
+      fits_write_errmark();
+      if ( fits_read_key(in, TSTRING, key, tunit[nout], NULL, status)
+	   == KEY_NO_EXIST )
+	*status = 0;
+      fits_clear_errmark();
+      if ( *status )
+	return *status;
+
+      outcol[i] = ++nout;
+      if ( nseg && segoff[nseg-1] + seglen[nseg-1] == t.off[i] )
+	seglen[nseg-1] += t.len[i];
+      else
+	{
+	  segoff[nseg] = t.off[i];
+	  seglen[nseg++] = t.len[i];
+	}
+      outrowlen += t.len[i];
+    }
+
+  if ( fits_create_tbl(out, BINARY_TBL, 0, nout, ttype, tform, tunit,
+		       extname, status)
+       || fits_read_key(out, TLONG, "NAXIS1", &orowlen, NULL, status) )
+    return *status;
+  if ( orowlen != outrowlen )
+    return *status = BAD_ROW_WIDTH;
+
+  /* copy a bunch of keywords the hard way */
+  for ( k = 0; copy_keywords[k]; k++ )
+    copy_card(in, out, copy_keywords[k], 0, status);
+  for ( i = 1; i <= t.ncols; i++ )
+    {
+      if ( !outcol[i] )
+	continue;
+      for ( k = 0; copy_colkeys[k]; k++ )
+	{
+	  snprintf(key, sizeof(key), "%s%d", copy_colkeys[k], i);
+	  snprintf(newkey, sizeof(newkey), "%s%d", copy_colkeys[k], outcol[i]);
+	  copy_card(in, out, key, newkey, status);
+	}
+    }
+
+  /* retain old HISTORY keywords, add some of our own */
+  fits_get_hdrspace(in, &nkeys, NULL, status);
+  for ( k = 1; k <= nkeys && !*status; k++ )
+    if ( fits_read_record(in, k, card, status) == 0
+	 && !strncmp(card, "HISTORY ", 8) )
+      fits_write_record(out, card, status);
+  snprintf(hist, sizeof(hist), "TOOL :%s   %s", CREATOR, DATE);
+  fits_write_history(out, hist, status);
+  if ( *status )
+    return *status;
+
+  if ( !use_chip && (find_col(in, &t, "rawx", &cx, status)
+		     || find_col(in, &t, "rawy", &cy, status)) )
+    {
+      if ( *status )
+	return *status;
+      fprintf(stderr, "could not read RAW columns, trying CHIP\n");
+      use_chip = 1;
+    }
+  if ( use_chip && (find_col(in, &t, "chipx", &cx, status)
+		    || find_col(in, &t, "chipy", &cy, status)
+		    || find_col(in, &t, "chip_id", &cid, status)) )
+    {
+      if ( !*status )
+	fprintf(stderr, "%s: could not read CHIP columns\n", progname);
+      return *status ? *status : (*status = COL_NOT_FOUND);
+    }
+  if ( find_col(in, &t, "pha", &cpha, status) )
+    {
+      if ( !*status )
+	fprintf(stderr, "%s: could not read PHA column\n", progname);
+      return *status ? *status : (*status = COL_NOT_FOUND);
+    }
+
+  if ( nrows_block < 1 || nrows_block > nrows )
+    nrows_block = nrows > 0 ? nrows : 1;
+
+  mapped = evt0_map_open(&m, in, inname, 0) == 0;
+  if ( !mapped )
+    inbuf = CALLOC(nrows_block*t.rowlen, unsigned char);
+  outbuf = CALLOC(nrows_block*outrowlen + 1, unsigned char);
+  x = CALLOC(nrows_block, int);
+  y = CALLOC(nrows_block, int);
+  pha = CALLOC(nrows_block, int);
+  id = CALLOC(nrows_block, int);
+  keep = CALLOC(nrows_block, long);
+  if ( (!mapped && !inbuf) || !outbuf || !x || !y || !pha || !id || !keep )
+    return *status = MEMORY_ALLOCATION;
+
+  fprintf(stderr, "Filtering events...    ");
+
+  for ( row = 1; row <= nrows && !*status; row += n )
+    {
+      fprintf(stderr, "\b\b\b\b %2d%%", (int)(100.0*(row - 1)/nrows));
+
+      n = nrows - row + 1 < nrows_block ? nrows - row + 1 : nrows_block;
+      if ( mapped )
+	rows = evt0_map_rows(&m, row);
+      else
+	{
+	  fits_read_tblbytes(in, row, 1, (LONGLONG)n*t.rowlen, inbuf, status);
+	  rows = inbuf;
+	}
+
+      /* the RAW position of each event, or CHIP converted to RAW */
+      read_ints(&cx, rows, t.rowlen, n, x);
+      read_ints(&cy, rows, t.rowlen, n, y);
+      read_ints(&cpha, rows, t.rowlen, n, pha);
+      if ( use_chip )
+	{
+	  read_ints(&cid, rows, t.rowlen, n, id);
+	  for ( j = 0; j < n; j++ )
+	    if ( id[j] >= 1 && id[j] <= 3 )
+	      y[j] += chip_yoff[id[j]];
+	}
+
+      nkeep = cut_rows(ci, x, y, pha, n, keep);
+      if ( !nkeep )
+	continue;
+
+      /* pack the kept rows, without the dropped columns */
+      d = outbuf;
+      if ( nseg == 1 && outrowlen == t.rowlen )
+	for ( j = 0; j < nkeep; j++, d += outrowlen )
+	  memcpy(d, rows + keep[j]*t.rowlen, outrowlen);
+      else
+	for ( j = 0; j < nkeep; j++ )
+	  {
+	    r = rows + keep[j]*t.rowlen;
+	    for ( s = 0; s < nseg; s++ )
+	      {
+		memcpy(d, r + segoff[s], seglen[s]);
+		d += seglen[s];
+	      }
+	  }
+      fits_write_tblbytes(out, nwritten + 1, 1, (LONGLONG)nkeep*outrowlen,
+			  outbuf, status);
+      nwritten += nkeep;
+    }
+
+  if ( !*status )
+    {
+      fprintf(stderr, "\b\b\b\b100%% done - ");
+      fprintf(stderr, "kept %ld/%ld (%.1f%%) events\n", nwritten, nrows,
+	      nrows ? 100.0*nwritten/nrows : 0.0);
+      evt0_stamp_hdu(out, CREATOR, DATE, status);
+    }
+
+  if ( mapped )
+    evt0_map_close(&m);
+  free(inbuf);
+  free(outbuf);
+  free(x);
+  free(y);
+  free(pha);
+  free(id);
+  free(keep);
+  for ( i = 0; i < t.ncols; i++ )
+    {
+      free(ttype[i]);
+      free(tform[i]);
+      free(tunit[i]);
+    }
+  free(ttype);
+  free(tform);
+  free(tunit);
+  free(outcol);
+  free(segoff);
+  free(seglen);
+  free_layout(&t);
+  return *status;
+}
+
+/* give up, removing the partial output */
+static void fail(fitsfile *in, fitsfile *out, int status, const char *what)
+{
+  int s = 0;
+
+  fits_report_error(stderr, status);
+  fprintf(stderr, "%s: %s\n", progname, what);
+  if ( in )
+    fits_close_file(in, &s);
+  s = 0;
+  if ( out )
+    fits_delete_file(out, &s);
+  exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+  static struct option long_options[] = {
+    { "help", no_argument, 0, 'h' },
+    { "version", no_argument, 0, 'V' },
+    { "filter", required_argument, 0, 'f' },
+    { "nrows", required_argument, 0, 'n' },
+    { "extname", required_argument, 0, 'e' },
+    { "status", no_argument, 0, 's' },
+    { "nostatus", no_argument, 0, 'S' },
+    { "chip", no_argument, 0, 'c' },
+    { "nochip", no_argument, 0, 'C' },
+    { 0, 0, 0, 0 }
+  };
+  fitsfile *in = 0, *out = 0;
+  cut_image ci;
+  char *filter = DEFAULT_FILTER, *extname = DEFAULT_EXTNAME;
+  char *infile, *outfile, *p, msg[2*FLEN_FILENAME];
+  long nrows = DEFAULT_NROWS;
+  int use_status = 1, use_chip = 0, c, status = 0, timeref;
+  int nhdus, target, i;
+
+  progname = argv[0];
+  if ( (p = strrchr(progname, '/')) )
+    progname = p + 1;
+
+  while ((c = getopt_long_only(argc, argv, "h", long_options, NULL)) != -1)
+    switch (c)
+      {
+      case 'f':
+	filter = optarg;
+	break;
+      case 'n':
+	nrows = atol(optarg);
+	break;
+      case 'e':
+	extname = optarg;
+	break;
+      case 's':
+      case 'S':
+	use_status = c == 's';
+	break;
+      case 'c':
+      case 'C':
+	use_chip = c == 'c';
+	break;
+      case 'V':
+	printf("%s, version %s\n", progname, VERSION);
+	exit(0);
+      case 'h':
+	print_usage(0);
+	break;
+      default:
+	print_usage(1);
+      }
+
+  if ( argc - optind != 2 )
+    {
+      fprintf(stderr, "%s: invalid arguments\nTry `%s --help' for more information.\n",
+	      progname, progname);
+      exit(1);
+    }
+  infile = argv[optind];
+  outfile = argv[optind+1];
+
+  /*
+    read filter columns, convert to pha cut limit "images"
+  */
+  fprintf(stderr, "Using filter file %s\n", filter);
+  if ( read_filter(filter, &ci, &status) )
+    {
+      snprintf(msg, sizeof(msg), "error reading PHA filter file '%s'", filter);
+      fail(0, 0, status, msg);
+    }
+
+  /*
+    open input and output event list files
+  */
+  fprintf(stderr, "Opening events file '%s'...", infile);
+  if ( fits_open_file(&in, infile, READONLY, &status) )
+    {
+      snprintf(msg, sizeof(msg), "error opening input event file '%s'", infile);
+      fail(0, 0, status, msg);
+    }
+  fprintf(stderr, "done\n");
+
+  snprintf(msg, sizeof(msg), "%s%s", *outfile == '!' ? "" : "!", outfile);
+  if ( fits_create_file(&out, msg, &status) )
+    {
+      snprintf(msg, sizeof(msg), "error opening output event file '%s'", outfile);
+      fail(in, 0, status, msg);
+    }
+
+  if ( fits_get_num_hdus(in, &nhdus, &status)
+       || fits_movnam_hdu(in, ANY_HDU, extname, 0, &status) )
+    {
+      snprintf(msg, sizeof(msg), "error getting HDU number for '%s' extension in input event file '%s'",
+	       extname, infile);
+      fail(in, out, status, msg);
+    }
+  fits_get_hdu_num(in, &target);
+
+  /*
+    create some common keywords that will be overwritten in the output
+    headers
+  */
+  fits_get_system_time(DATE, &timeref, &status);
+  strncpy(CREATOR, progname, sizeof(CREATOR) - 1);
+
+  /*
+    copy all HDUs before the event list, filter the events, then copy
+    all HDUs after it
+  */
+  for ( i = 1; i <= nhdus; i++ )
+    {
+      if ( fits_movabs_hdu(in, i, NULL, &status) )
+	break;
+      if ( i == target )
+	{
+	  if ( filter_pha(in, infile, out, &ci, extname, nrows, use_status,
+			  use_chip, &status) )
+	    {
+	      snprintf(msg, sizeof(msg), "error filtering on PHA input event file '%s' to output event file '%s'",
+		       infile, outfile);
+	      fail(in, out, status, msg);
+	    }
+	}
+      else if ( fits_copy_hdu(in, out, 0, &status)
+		|| evt0_stamp_hdu(out, CREATOR, DATE, &status) )
+	break;
+    }
+  if ( status )
+    {
+      snprintf(msg, sizeof(msg), "error copying HDU number %d from input event file '%s' to output event file '%s'",
+	       i, infile, outfile);
+      fail(in, out, status, msg);
+    }
+
+  fits_close_file(in, &status);
+  fits_close_file(out, &status);
+  if ( status )
+    printerror(status);
+
+  free(ci.lo);
+  free(ci.hi);
+  return 0;
+}
@@ -0,0 +1,711 @@
+/*
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+            spec_extract
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+
+The extraction kernel of extract_linear and prextract_parabola. Reads
+the dispersion and cross-dispersion positions of the events, moves
+them to microns about zeroth order with the dispersion along X (shift
+by -c, scale by -q, shift chip 3 by -3, rotate by -a), and sorts each
+event into the data region and the two background regions:
+
+	data, linear (-L cwidth,cdist,oslope): |y| < cwidth/2 within
+	  cdist of zeroth order, opening with slope oslope beyond;
+	data, parabolic (-P dwidth,l0,l1,l2,h0,h1,h2): between
+	  l0 + l1 x + l2 x^2 - dwidth/2 and h0 + h1 x + h2 x^2 + dwidth/2;
+	background (-B bg1off,bg1width,bg2off,bg2width):
+	  bg1off - bg1width < y < bg1off and bg2off < y < bg2off + bg2width;
+
+all for |x| < xspan/2. The spectra are binned as the scripts did: the
+range is the overlap of the regions' X extents, rounded out to the
+bin size, and the images are npix square over the regions' extents
+within it.
+
+The events are read once and kept in memory; the passes over them
+(sort into regions and find their extents, find the extents within
+the spectral range, then bin) are shared out to -j threads, each
+filling histograms of its own that are added up at the end.
+
+The output (-o) is an RDB table of the spectra, bins centred on x:
+
+	x	all	data	bg_low	bg_high
+
+preceded by comment lines "# key: values" giving the extents of the
+regions (region: name count xmin xmax ymin ymax, before the spectral
+range is applied), the range (smin, smax) and the images (image: name
+xmin xmax ymin ymax). The images, of the background regions, the data
+region, and all events over the data region, are written to -i in
+that order as npix x npix native floats, X varying fastest.
+
+Build:
+	cc -O2 -pthread -o spec_extract spec_extract.c -lcfitsio -lm
+
+*/
+
+/*** include files ***/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include <getopt.h>
+#include <pthread.h>
+
+#include "fitsio.h"
+
+#include "correction.h"
+
+/* region bits of an event */
+#define IN_DATA    1
+#define IN_BG_LOW  2
+#define IN_BG_HIGH 4
+
+#define NREG 3				/* data, bg_low, bg_high */
+#define NSPEC 4				/* all, data, bg_low, bg_high */
+#define NIMG 3				/* bg, data, all */
+
+typedef struct
+{
+  int parabolic;
+  double cwidth, cdist, oslope;	/* linear */
+  double dwidth, lo[3], hi[3];	/* parabolic */
+  double bg1off, bg1width, bg2off, bg2width;
+  double xspan;
+} ext_regions;
+
+typedef struct
+{
+  long n;
+  double xmin, xmax, ymin, ymax;
+} extent;
+
+/* bins lo + i*step, i < n */
+typedef struct
+{
+  long n;
+  double lo, step;
+} axis;
+
+/* the work of one thread in one pass */
+typedef struct
+{
+  const double *x, *y;
+  unsigned char *cls;
+  long first, last;
+  const ext_regions *r;
+  int pass;
+  double smin, smax;
+  axis spec, imgx[NIMG], imgy[NIMG];
+
+  extent ext[NREG];
+  long *spectra[NSPEC];
+  long *img[NIMG];
+} ext_work;
+
+static const char *region_names[NREG] = { "data", "bg_low", "bg_high" };
+static const char *image_names[NIMG] = { "bg", "data", "all" };
+
+static char *progname;
+
+void printerror(int status)
+{
+  /*****************************************************/
+  /* Print out cfitsio error messages and exit program */
+  /*****************************************************/
+
+  if (status)
+    fprintf(stderr, "\n*** Error occurred during program execution ***\n");
+  fits_report_error(stderr, status);
+  exit( status );
+}
+
+int print_usage(void)
+{
+  fprintf(stderr, "\nUsage:\n\t%s [options] <EVENTS>\n", progname);
+  fprintf(stderr,"\n\te[events]:\tname of the events extension\n");
+  fprintf(stderr,"\tx[tg_r]:\tdispersion column\n");
+  fprintf(stderr,"\ty[tg_d]:\tcross-dispersion column\n");
+  fprintf(stderr,"\tc[0,0]:\tzeroth order, in column units\n");
+  fprintf(stderr,"\tq[150600,-150600]:\tmicrons per column unit\n");
+  fprintf(stderr,"\t3[0]:\tchip 3 offset, microns\n");
+  fprintf(stderr,"\ta[0]:\tclocking angle, radians counterclockwise\n");
+  fprintf(stderr,"\tL:\tlinear data region cwidth,cdist,oslope\n");
+  fprintf(stderr,"\tP:\tparabolic data region dwidth,l0,l1,l2,h0,h1,h2\n");
+  fprintf(stderr,"\tB:\tbackground regions bg1off,bg1width,bg2off,bg2width\n");
+  fprintf(stderr,"\ts[6.43]:\tspectrum bin size, microns\n");
+  fprintf(stderr,"\tw[421390.05]:\tspan of dispersion used, microns\n");
+  fprintf(stderr,"\tn[512]:\timage size\n");
+  fprintf(stderr,"\ti:\timage output file\n");
+  fprintf(stderr,"\to[stdout]:\tspectrum output file\n");
+  fprintf(stderr,"\tj[1]:\tthreads\n");
+  fprintf(stderr,"\tm[65536]:\trows read at a time\n");
+  fprintf(stderr,"\th or ?:\tprint usage\n");
+  return 0;
+}
+
+/* the comma-separated numbers of arg into v; returns how many */
+static int parse_list(const char *arg, double *v, int max)
+{
+  char *end;
+  int n = 0;
+
+  while ( n < max )
+    {
+      v[n] = strtod(arg, &end);
+      if ( end == arg )
+	break;
+      n++;
+      if ( *end != ',' )
+	break;
+      arg = end + 1;
+    }
+  return n;
+}
+
+static inline int classify(const ext_regions *r, double x, double y)
+{
+  double cw2, lo, hi;
+  int c = 0;
+
+  if ( !(fabs(x) < r->xspan/2) )
+    return 0;
+
+  if ( r->parabolic )
+    {
+      lo = r->lo[0] + r->lo[1]*x + r->lo[2]*x*x - r->dwidth/2;
+      hi = r->hi[0] + r->hi[1]*x + r->hi[2]*x*x + r->dwidth/2;
+      if ( y > lo && y < hi )
+	c |= IN_DATA;
+    }
+  else
+    {
+      cw2 = r->cwidth/2;
+      if ( fabs(x) < r->cdist )
+	{
+	  if ( fabs(y) < cw2 )
+	    c |= IN_DATA;
+	}
+      else if ( x <= -r->cdist )
+	{
+	  if ( y > (x + r->cdist)*r->oslope - cw2
+	       && y < (x + r->cdist)*-r->oslope + cw2 )
+	    c |= IN_DATA;
+	}
+      else if ( y < (x - r->cdist)*r->oslope + cw2
+		&& y > (x - r->cdist)*-r->oslope - cw2 )
+	c |= IN_DATA;
+    }
+
+  if ( y > r->bg1off - r->bg1width && y < r->bg1off )
+    c |= IN_BG_LOW;
+  if ( y < r->bg2off + r->bg2width && y > r->bg2off )
+    c |= IN_BG_HIGH;
+  return c;
+}
+
+static void extent_init(extent *e)
+{
+  e->n = 0;
+  e->xmin = e->ymin = DBL_MAX;
+  e->xmax = e->ymax = -DBL_MAX;
+}
+
+static inline void extent_add(extent *e, double x, double y)
+{
+  e->n++;
+  if ( x < e->xmin )
+    e->xmin = x;
+  if ( x > e->xmax )
+    e->xmax = x;
+  if ( y < e->ymin )
+    e->ymin = y;
+  if ( y > e->ymax )
+    e->ymax = y;
+}
+
+static void extent_merge(extent *e, const extent *f)
+{
+  e->n += f->n;
+  if ( f->xmin < e->xmin )
+    e->xmin = f->xmin;
+  if ( f->xmax > e->xmax )
+    e->xmax = f->xmax;
+  if ( f->ymin < e->ymin )
+    e->ymin = f->ymin;
+  if ( f->ymax > e->ymax )
+    e->ymax = f->ymax;
+}
+
+/* the bin of v, or -1, as PDL's histogram has it */
+static inline long axis_bin(const axis *a, double v)
+{
+  double b = floor((v - a->lo)/a->step);
+
+  return (b >= 0 && b < a->n) ? (long)b : -1;
+}
+
+/*
+  Perl's % of two numbers, which the scripts rounded the spectral range
+  with: the integer parts, the result taking the sign of the right.
+*/
+static double perl_mod(double a, double b)
+{
+  long long m = (long long)a, n = (long long)b, r;
+
+  if ( n == 0 )
+    return 0;
+  r = m % n;
+  if ( r && (r < 0) != (n < 0) )
+    r += n;
+  return (double)r;
+}
+
+static void *run_pass(void *arg)
+{
+  ext_work *w = arg;
+  const double *x = w->x, *y = w->y;
+  long i, b, bx, by;
+  int c, k;
+
+  for ( k = 0; k < NREG; k++ )
+    extent_init(w->ext + k);
+
+  for ( i = w->first; i < w->last; i++ )
+    {
+      switch ( w->pass )
+	{
+	case 1:		/* sort into regions */
+	  c = w->cls[i] = classify(w->r, x[i], y[i]);
+	  for ( k = 0; k < NREG; k++ )
+	    if ( c & 1 << k )
+	      extent_add(w->ext + k, x[i], y[i]);
+	  break;
+
+	case 2:		/* extents within the spectral range */
+	  if ( !(c = w->cls[i]) || x[i] < w->smin || x[i] > w->smax )
+	    continue;
+	  for ( k = 0; k < NREG; k++ )
+	    if ( c & 1 << k )
+	      extent_add(w->ext + k, x[i], y[i]);
+	  break;
+
+	case 3:		/* spectra and images */
+	  c = w->cls[i];
+
+	  /* all events over the data region */
+	  if ( x[i] > w->imgx[2].lo
+	       && x[i] < w->imgx[2].lo + w->imgx[2].n*w->imgx[2].step
+	       && y[i] > w->imgy[2].lo
+	       && y[i] < w->imgy[2].lo + w->imgy[2].n*w->imgy[2].step
+	       && (bx = axis_bin(w->imgx + 2, x[i])) >= 0
+	       && (by = axis_bin(w->imgy + 2, y[i])) >= 0 )
+	    w->img[2][by*w->imgx[2].n + bx]++;
+
+	  if ( !c || x[i] < w->smin || x[i] > w->smax )
+	    continue;
+	  if ( (b = axis_bin(&w->spec, x[i])) >= 0 )
+	    {
+	      w->spectra[0][b]++;
+	      for ( k = 0; k < NREG; k++ )
+		if ( c & 1 << k )
+		  w->spectra[k+1][b]++;
+	    }
+	  if ( c & IN_DATA && (bx = axis_bin(w->imgx + 1, x[i])) >= 0
+	       && (by = axis_bin(w->imgy + 1, y[i])) >= 0 )
+	    w->img[1][by*w->imgx[1].n + bx]++;
+	  if ( (bx = axis_bin(w->imgx, x[i])) >= 0
+	       && (by = axis_bin(w->imgy, y[i])) >= 0 )
+	    w->img[0][by*w->imgx[0].n + bx] +=
+	      !!(c & IN_BG_LOW) + !!(c & IN_BG_HIGH);
+	  break;
+	}
+    }
+  return 0;
+}
+
+/* run pass on the events split among nt threads, summing the results */
+static int run_threads(ext_work *w, int nt, int pass, extent *ext)
+{
+  pthread_t *tid;
+  int t, k;
+
+  for ( t = 0; t < nt; t++ )
+    w[t].pass = pass;
+  if ( nt == 1 )
+    run_pass(w);
+  else
+    {
+      if ( !(tid = CALLOC(nt, pthread_t)) )
+	return -1;
+      for ( t = 0; t < nt; t++ )
+	if ( pthread_create(tid + t, 0, run_pass, w + t) )
+	  {
+	    fprintf(stderr, "%s: could not start a thread\n", progname);
+	    exit(1);
+	  }
+      for ( t = 0; t < nt; t++ )
+	pthread_join(tid[t], 0);
+      free(tid);
+    }
+
+  for ( k = 0; k < NREG; k++ )
+    {
+      extent_init(ext + k);
+      for ( t = 0; t < nt; t++ )
+	extent_merge(ext + k, w[t].ext + k);
+    }
+  return 0;
+}
+
+/*
+  Read the event positions and move them to microns about zeroth
+  order, dispersion along X.
+*/
+static long read_events(fitsfile *fptr, const char *xcol, const char *ycol,
+			const double *cen, const double *quantum,
+			double chip3off, double angle, long chunk,
+			double **x, double **y, int *status)
+{
+  double ca = cos(angle), sa = sin(angle), xx, yy;
+  int *chip = 0;
+  long nrows, row, n, j;
+  int xc, yc, cc = 0, anynul;
+
+  if ( fits_get_num_rows(fptr, &nrows, status)
+       || fits_get_colnum(fptr, CASEINSEN, (char *)xcol, &xc, status)
+       || fits_get_colnum(fptr, CASEINSEN, (char *)ycol, &yc, status)
+       || (chip3off != 0
+	   && fits_get_colnum(fptr, CASEINSEN, "chip_id", &cc, status)) )
+    return -1;
+  if ( chunk < 1 )
+    chunk = 1;
+  *x = CALLOC(nrows + 1, double);
+  *y = CALLOC(nrows + 1, double);
+  if ( chip3off != 0 )
+    chip = CALLOC(chunk, int);
+  if ( !*x || !*y || (chip3off != 0 && !chip) )
+    {
+      *status = MEMORY_ALLOCATION;
+      return -1;
+    }
+
+  fprintf(stderr, "Reading events...    ");
+  for ( row = 1; row <= nrows; row += n )
+    {
+      fprintf(stderr, "\b\b\b\b %2d%%", (int)(100.0*(row - 1)/nrows));
+      n = nrows - row + 1 < chunk ? nrows - row + 1 : chunk;
+      if ( fits_read_col(fptr, TDOUBLE, xc, row, 1, n, NULL, *x + row - 1,
+			 &anynul, status)
+	   || fits_read_col(fptr, TDOUBLE, yc, row, 1, n, NULL, *y + row - 1,
+			    &anynul, status)
+	   || (chip && fits_read_col(fptr, TINT, cc, row, 1, n, NULL, chip,
+				     &anynul, status)) )
+	return -1;
+      for ( j = 0; j < n; j++ )
+	{
+	  xx = ((*x)[row-1+j] - cen[0])*quantum[0];
+	  yy = ((*y)[row-1+j] - cen[1])*quantum[1];
+	  if ( chip && chip[j] == 3 )
+	    yy += chip3off;
+	  (*x)[row-1+j] = xx*ca + yy*sa;
+	  (*y)[row-1+j] = yy*ca - xx*sa;
+	}
+    }
+  fprintf(stderr, "\b\b\b\b100%% done\n");
+  free(chip);
+  return nrows;
+}
+
+int main(int argc, char *argv[])
+{
+  fitsfile *fptr;
+  ext_regions reg;
+  ext_work *w;
+  extent ext[NREG], fext[NREG], none[NREG], u;
+  axis spec, imgx[NIMG], imgy[NIMG];
+  long *spectra[NSPEC], *img[NIMG];
+  float *fimg;
+  FILE *fp;
+  char *extname = "events", *xcol = "tg_r", *ycol = "tg_d", *p;
+  char *imgfile = 0, *outfile = 0;
+  double cen[2] = { 0, 0 }, quantum[2] = { 150600, -150600 }, v[7];
+  double chip3off = 0, angle = 0, binsize = 6.43, smin, smax, *x, *y;
+  long nrows, chunk = 65536, npix = 512, i, b, per;
+  int nt = 1, have_data = 0, have_bg = 0, c, t, k, status = 0;
+
+  progname = argv[0];
+  if ( (p = strrchr(progname, '/')) )
+    progname = p + 1;
+
+  memset(&reg, 0, sizeof(reg));
+  reg.xspan = 65535*6.43;
+
+  while ((c = getopt(argc, argv, "e:x:y:c:q:3:a:L:P:B:s:w:n:i:o:j:m:h?"))
+	 != -1)
+    {
+      switch (c)
+	{
+	case 'e':
+	  extname = optarg;
+	  break;
+	case 'x':
+	  xcol = optarg;
+	  break;
+	case 'y':
+	  ycol = optarg;
+	  break;
+	case 'c':
+	  if ( parse_list(optarg, cen, 2) != 2 )
+	    goto usage;
+	  break;
+	case 'q':
+	  if ( parse_list(optarg, quantum, 2) != 2 )
+	    goto usage;
+	  break;
+	case '3':
+	  chip3off = atof(optarg);
+	  break;
+	case 'a':
+	  angle = atof(optarg);
+	  break;
+	case 'L':
+	  if ( parse_list(optarg, v, 3) != 3 )
+	    goto usage;
+	  reg.parabolic = 0;
+	  reg.cwidth = v[0];
+	  reg.cdist = v[1];
+	  reg.oslope = v[2];
+	  have_data = 1;
+	  break;
+	case 'P':
+	  if ( parse_list(optarg, v, 7) != 7 )
+	    goto usage;
+	  reg.parabolic = 1;
+	  reg.dwidth = v[0];
+	  memcpy(reg.lo, v + 1, 3*sizeof(double));
+	  memcpy(reg.hi, v + 4, 3*sizeof(double));
+	  have_data = 1;
+	  break;
+	case 'B':
+	  if ( parse_list(optarg, v, 4) != 4 )
+	    goto usage;
+	  reg.bg1off = v[0];
+	  reg.bg1width = v[1];
+	  reg.bg2off = v[2];
+	  reg.bg2width = v[3];
+	  have_bg = 1;
+	  break;
+	case 's':
+	  binsize = atof(optarg);
+	  break;
+	case 'w':
+	  reg.xspan = atof(optarg);
+	  break;
+	case 'n':
+	  npix = atol(optarg);
+	  break;
+	case 'i':
+	  imgfile = optarg;
+	  break;
+	case 'o':
+	  outfile = optarg;
+	  break;
+	case 'j':
+	  nt = atoi(optarg);
+	  break;
+	case 'm':
+	  chunk = atol(optarg);
+	  break;
+	case 'h':
+	case '?':
+	default:
+	usage:
+	  print_usage();
+	  exit(1);
+	}
+    }
+  if ( argc - optind != 1 || !have_data || !have_bg || !(binsize > 0)
+       || npix < 1 )
+    {
+      print_usage();
+      exit(1);
+    }
+
+  if ( fits_open_file(&fptr, argv[optind], READONLY, &status)
+       || fits_movnam_hdu(fptr, BINARY_TBL, extname, 0, &status)
+       || (nrows = read_events(fptr, xcol, ycol, cen, quantum, chip3off,
+			       angle, chunk, &x, &y, &status)) < 0 )
+    printerror(status);
+  fits_close_file(fptr, &status);
+  if ( nrows == 0 )
+    {
+      fprintf(stderr, "%s: no events in %s\n", progname, argv[optind]);
+      exit(1);
+    }
+
+  if ( nt < 1 )
+    nt = 1;
+  if ( nt > nrows )
+    nt = nrows;
+  w = CALLOC(nt, ext_work);
+  if ( !w || !(w->cls = CALLOC(nrows, unsigned char)) )
+    {
+      fprintf(stderr, "%s: out of memory\n", progname);
+      exit(1);
+    }
+  per = (nrows + nt - 1)/nt;
+  for ( t = 0; t < nt; t++ )
+    {
+      w[t].x = x;
+      w[t].y = y;
+      w[t].cls = w->cls;
+      w[t].r = &reg;
+      w[t].first = t*per;
+      w[t].last = (t + 1)*per < nrows ? (t + 1)*per : nrows;
+    }
+
+  /* the regions, and from their extents the spectral range */
+  run_threads(w, nt, 1, ext);
+  for ( k = 0; k < NREG; k++ )
+    if ( ext[k].n == 0 )
+      {
+	fprintf(stderr, "%s: no events in the %s region\n", progname,
+		region_names[k]);
+	exit(1);
+      }
+  smin = ext[0].xmin;
+  smax = ext[0].xmax;
+  for ( k = 1; k < NREG; k++ )
+    {
+      if ( ext[k].xmin > smin )
+	smin = ext[k].xmin;
+      if ( ext[k].xmax < smax )
+	smax = ext[k].xmax;
+    }
+  if ( smin >= 0 )
+    smin -= perl_mod(smin, binsize);
+  else
+    smin -= binsize*(1 - ((long long)(smin/binsize) - smin/binsize));
+  smax += binsize - perl_mod(smax - smin, binsize);
+
+  for ( t = 0; t < nt; t++ )
+    {
+      w[t].smin = smin;
+      w[t].smax = smax;
+    }
+  run_threads(w, nt, 2, fext);
+  if ( fext[0].n == 0 )
+    {
+      fprintf(stderr, "%s: no data region events in the spectral range\n",
+	      progname);
+      exit(1);
+    }
+
+  /* the spectra, as hist($x, smin - binsize/2, smax + binsize/2, binsize) */
+  spec.lo = smin - binsize/2;
+  spec.step = binsize;
+  spec.n = (long)((smax - smin + binsize)/binsize + 0.5);
+
+  /* the images: the background regions, the data region, all over it */
+  extent_init(&u);
+  for ( k = 0; k < NREG; k++ )
+    extent_merge(&u, fext + k);
+  imgx[0].lo = u.xmin;
+  imgx[0].step = (u.xmax + binsize - u.xmin)/npix;
+  imgy[0].lo = u.ymin;
+  imgy[0].step = (u.ymax + binsize - u.ymin)/npix;
+  imgx[1].lo = fext[0].xmin;
+  imgx[1].step = (fext[0].xmax + binsize - fext[0].xmin)/npix;
+  imgy[1].lo = fext[0].ymin;
+  imgy[1].step = (fext[0].ymax + binsize - fext[0].ymin)/npix;
+  imgx[2] = imgx[1];
+  imgy[2] = imgy[1];
+  for ( k = 0; k < NIMG; k++ )
+    imgx[k].n = imgy[k].n = npix;
+
+  for ( t = 0; t < nt; t++ )
+    {
+      w[t].spec = spec;
+      memcpy(w[t].imgx, imgx, sizeof(imgx));
+      memcpy(w[t].imgy, imgy, sizeof(imgy));
+      for ( k = 0; k < NSPEC; k++ )
+	if ( !(w[t].spectra[k] = CALLOC(spec.n + 1, long)) )
+	  exit(1);
+      for ( k = 0; k < NIMG; k++ )
+	if ( !(w[t].img[k] = CALLOC(npix*npix, long)) )
+	  exit(1);
+    }
+  run_threads(w, nt, 3, none);
+
+  /* add up the threads' histograms into the first's */
+  for ( k = 0; k < NSPEC; k++ )
+    {
+      spectra[k] = w->spectra[k];
+      for ( t = 1; t < nt; t++ )
+	for ( b = 0; b < spec.n; b++ )
+	  spectra[k][b] += w[t].spectra[k][b];
+    }
+  for ( k = 0; k < NIMG; k++ )
+    {
+      img[k] = w->img[k];
+      for ( t = 1; t < nt; t++ )
+	for ( i = 0; i < npix*npix; i++ )
+	  img[k][i] += w[t].img[k][i];
+    }
+
+  if ( !outfile || !strcmp(outfile, "-") )
+    fp = stdout;
+  else if ( !(fp = fopen(outfile, "w")) )
+    {
+      perror(outfile);
+      exit(1);
+    }
+  fprintf(fp, "# %s: %s\n", progname, argv[optind]);
+  fprintf(fp, "# nevents: %ld\n", nrows);
+  for ( k = 0; k < NREG; k++ )
+    fprintf(fp, "# region: %s %ld %.10g %.10g %.10g %.10g\n", region_names[k],
+	    ext[k].n, ext[k].xmin, ext[k].xmax, ext[k].ymin, ext[k].ymax);
+  fprintf(fp, "# smin: %.10g\n", smin);
+  fprintf(fp, "# smax: %.10g\n", smax);
+  for ( k = 0; k < NIMG; k++ )
+    fprintf(fp, "# image: %s %.10g %.10g %.10g %.10g\n", image_names[k],
+	    imgx[k].lo, imgx[k].lo + npix*imgx[k].step,
+	    imgy[k].lo, imgy[k].lo + npix*imgy[k].step);
+  fprintf(fp, "x\tall\tdata\tbg_low\tbg_high\n");
+  fprintf(fp, "N\tN\tN\tN\tN\n");
+  for ( b = 0; b < spec.n; b++ )
+    fprintf(fp, "%.10g\t%ld\t%ld\t%ld\t%ld\n", smin + b*binsize,
+	    spectra[0][b], spectra[1][b], spectra[2][b], spectra[3][b]);
+  if ( fp != stdout && fclose(fp) )
+    {
+      perror(outfile);
+      exit(1);
+    }
+
+  if ( imgfile )
+    {
+      if ( !(fimg = CALLOC(npix*npix, float)) || !(fp = fopen(imgfile, "wb")) )
+	{
+	  perror(imgfile);
+	  exit(1);
+	}
+      for ( k = 0; k < NIMG; k++ )
+	{
+	  for ( i = 0; i < npix*npix; i++ )
+	    fimg[i] = img[k][i];
+	  if ( fwrite(fimg, sizeof(float), npix*npix, fp)
+	       != (size_t)(npix*npix) )
+	    {
+	      perror(imgfile);
+	      exit(1);
+	    }
+	}
+      if ( fclose(fp) )
+	{
+	  perror(imgfile);
+	  exit(1);
+	}
+      free(fimg);
+    }
+  return 0;
+}
@@ -0,0 +1,130 @@
+/*
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+            time_index
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+
+Writes the sidecar time index of an EVENTS table (see evt_tindex.c),
+file.tidx next to the events file. gti_split and lcurve_bin then read
+only the rows that can fall in their GTIs, for as long as the table's
+DATASUM matches the index.
+
+Build:
+	cc -O2 -o time_index time_index.c evt_tindex.c -lcfitsio -lm
+
+*/
+
+/*** include files ***/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+
+#include "fitsio.h"
+
+#include "evt_tindex.h"
+
+static char *progname;
+
+void printerror(int status)
+{
+  /*****************************************************/
+  /* Print out cfitsio error messages and exit program */
+  /*****************************************************/
+
+  if (status)
+    fprintf(stderr, "\n*** Error occurred during program execution ***\n");
+  fits_report_error(stderr, status);
+  exit( status );
+}
+
+int print_usage(void)
+{
+  fprintf(stderr, "\nUsage:\n\t%s [options] <EVENTS>\n", progname);
+  fprintf(stderr,"\n\te[events]:\tname of the events extension\n");
+  fprintf(stderr,"\tn[4096]:\trows per index block\n");
+  fprintf(stderr,"\to[EVENTS.tidx]:\tindex file\n");
+  fprintf(stderr,"\tv[0]:\tverbosity of diagnostic output\n");
+  fprintf(stderr,"\th or ?:\tprint usage\n");
+  return 0;
+}
+
+int main(int argc, char *argv[])
+{
+  fitsfile *fptr;
+  evt_tindex ix;
+  char *extname = "events", *outfile = 0, *p;
+  char name[FLEN_FILENAME + 8];
+  long step = 4096, i, unsorted;
+  int c, verb = 0, status = 0;
+
+  progname = argv[0];
+  if ( (p = strrchr(progname, '/')) )
+    progname = p + 1;
+
+  while ((c = getopt(argc, argv, "e:n:o:v:h?")) != -1)
+    {
+      switch (c)
+	{
+	case 'e':
+	  extname = optarg;
+	  break;
+	case 'n':
+	  step = atol(optarg);
+	  break;
+	case 'o':
+	  outfile = optarg;
+	  break;
+	case 'v':
+	  verb = atoi(optarg);
+	  break;
+	case 'h':
+	case '?':
+	default:
+	  print_usage();
+	  exit(1);
+	}
+    }
+  if ( argc - optind != 1 )
+    {
+      print_usage();
+      exit(1);
+    }
+  if ( !outfile )
+    {
+      if ( evt_tindex_name(argv[optind], name, sizeof(name)) )
+	{
+	  fprintf(stderr, "%s: '%s' is not a plain file; give -o\n",
+		  progname, argv[optind]);
+	  exit(1);
+	}
+      outfile = name;
+    }
+
+  if ( fits_open_file(&fptr, argv[optind], READONLY, &status)
+       || fits_movnam_hdu(fptr, BINARY_TBL, extname, 0, &status) )
+    printerror(status);
+  if ( evt_tindex_build(&ix, fptr, step, &status) )
+    {
+      if ( status == KEY_NO_EXIST )
+	fprintf(stderr, "%s: %s has no DATASUM to tie an index to\n",
+		progname, extname);
+      printerror(status);
+    }
+  fits_close_file(fptr, &status);
+
+  if ( evt_tindex_write(&ix, outfile) )
+    {
+      perror(outfile);
+      exit(1);
+    }
+  if ( verb )
+    {
+      for ( i = 1, unsorted = 0; i < ix.nblocks; i++ )
+	unsorted += ix.blk[i].tmin < ix.blk[i-1].tmax;
+      fprintf(stderr, "%s: %s: %lld rows in %ld blocks of %lld,"
+	      " %ld out of time order\n", progname, outfile, ix.nrows,
+	      ix.nblocks, ix.step, unsorted);
+    }
+  evt_tindex_free(&ix);
+  return 0;
+}